@@ -0,0 +1,137 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+#include "svrtk/OutputWriter.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Persistent cache of slice-to-volume coefficients.
+     *
+     * The coefficients are stored in one binary file per key, which is a hash of
+     * everything they depend on (slice geometry and masks, transformations, PSF,
+     * volume grid and mask). The file consists of a header, the slice dimensions
+     * and overlap flags, the offsets of the coefficients of each slice voxel and
+     * the POINT3D records themselves, so it can be memory-mapped as a whole.
+     * The directory is kept within a size limit by removing the least recently
+     * used files.
+     */
+    class CoefficientCache {
+    protected:
+        /// Cache directory (disabled if empty)
+        string _directory;
+        /// Size limit of the cache directory in bytes (0 - unlimited)
+        size_t _max_bytes;
+        /// Hash of the inputs added since the last reset
+        uint64_t _key;
+
+        /// Serialise the coefficients into the contents of a cache file (false if it exceeds the size limit)
+        bool Serialise(const Array<SLICECOEFFS>& volcoeffs, const Array<bool>& slice_inside, Array<char>& contents) const;
+
+        /// Store the contents of a cache file and evict old files beyond the size limit
+        static bool Store(const Array<char>& contents, const string& path, const string& directory, size_t max_bytes);
+
+        /// Remove the least recently used cache files until the directory fits the size limit
+        static void Evict(const string& directory, size_t max_bytes, const string& keep);
+
+    public:
+        /// CoefficientCache constructor
+        CoefficientCache() : _max_bytes(0) {
+            Reset();
+        }
+
+        /// Start a new key
+        void Reset();
+
+        /// Add raw bytes to the key
+        void Add(const void *data, size_t bytes);
+
+        /// Add image geometry (dimensions and image to world matrix) to the key
+        void Add(const ImageAttributes& attr);
+
+        /// Add a matrix to the key
+        void Add(const Matrix& matrix);
+
+        /// Add a multi-level FFD (global matrix, lattices and control point values) to the key
+        void Add(const MultiLevelFreeFormTransformation& mffd);
+
+        /// Add the voxels of an image to the key
+        void Add(const RealImage& image);
+
+        /**
+         * @brief Read the coefficients of the current key.
+         * @param volcoeffs Output coefficients of each slice.
+         * @param slice_inside Output overlap of each slice with the mask.
+         * @param slices Attributes of the slices the coefficients have to match.
+         * @return Whether a matching cache file was found.
+         */
+        bool Read(Array<SLICECOEFFS>& volcoeffs, Array<bool>& slice_inside, const Array<RealImage>& slices) const;
+
+        /**
+         * @brief Write the coefficients under the current key.
+         * The file contents are serialised on the calling thread; with a writer, the file
+         * is stored and old files are evicted by its background threads.
+         * @param volcoeffs Coefficients of each slice.
+         * @param slice_inside Overlap of each slice with the mask.
+         * @param writer Background writer (nullptr - write synchronously).
+         * @return Whether the file was written (queued with a writer); false if it exceeds the size limit or writing failed.
+         */
+        bool Write(const Array<SLICECOEFFS>& volcoeffs, const Array<bool>& slice_inside, OutputWriter *writer = nullptr) const;
+
+        /// Path of the cache file of the current key
+        string Path() const;
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /**
+         * @brief Set the cache directory.
+         * @param directory Cache directory (empty - disabled).
+         * @param max_size Size limit of the directory in MB (0 - unlimited).
+         */
+        inline void SetDirectory(const string& directory, double max_size = 0) {
+            _directory = directory;
+            _max_bytes = max(0.0, max_size) * 1024 * 1024;
+        }
+
+        /// Whether the cache is enabled
+        inline bool Enabled() const {
+            return !_directory.empty();
+        }
+
+        /// Hash of the inputs added since the last reset
+        inline uint64_t Key() const {
+            return _key;
+        }
+
+        /// Add a value to the key
+        template<typename T>
+        inline void Add(const T& value) {
+            Add(&value, sizeof(T));
+        }
+    };
+
+} // namespace svrtk
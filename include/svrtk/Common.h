@@ -48,6 +48,7 @@
 
 // C++ Standard
 #include <algorithm>
+#include <numeric>
 #include <pthread.h>
 #include <queue>
 #include <set>
@@ -72,7 +73,8 @@ namespace svrtk {
         short x;
         short y;
         short z;
-        double value;
+        // single precision as the coefficients are accumulated in RealPixel images
+        float value;
     };
 
     enum RECON_TYPE { _3D, _1D, _interpolate };
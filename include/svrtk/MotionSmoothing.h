@@ -0,0 +1,115 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Temporal smoothing engine for rigid slice transformations.
+     *
+     * Tracks of the 6 rigid parameters (one column per transformation, in
+     * temporal order) are smoothed by weighted Gaussian kernel regression within
+     * independent segments (e.g. slice locations or packages). Kernels are built
+     * once per segment and applied as banded convolutions of the weighted
+     * parameters and of the weights, so a regression pass is linear in the
+     * number of transformations.
+     *
+     * The target registration error (TRE) of two transformations over a fixed
+     * point set is evaluated in closed form from the mean and covariance of the
+     * points, i.e. in constant time per transformation.
+     */
+    class MotionSmoothing {
+    public:
+        /// Mean and covariance of a point set (world coordinates)
+        struct PointMoments {
+            size_t n = 0;
+            double mean[3] = {};
+            double cov[3][3] = {};
+        };
+
+    protected:
+        /// Range of transformations smoothed together with its kernel
+        struct Segment {
+            size_t begin, end;
+            int half_width;
+            Array<double> kernel;
+        };
+
+        /// Number of transformations
+        size_t _n;
+        /// Smoothing segments
+        Array<Segment> _segments;
+        /// Running kernel-weighted sums (6 per transformation)
+        Array<double> _num, _den;
+
+    public:
+        /**
+         * @brief MotionSmoothing constructor.
+         * @param n Number of transformations.
+         */
+        MotionSmoothing(size_t n);
+
+        /**
+         * @brief Add a range of transformations smoothed independently of the others.
+         * Transformations not covered by any segment get no estimate (0/0).
+         * @param begin First transformation of the segment.
+         * @param end One past the last transformation of the segment.
+         * @param sigma Kernel width in samples (kernel is exp(-(j/sigma)^2)).
+         * @param half_width Kernel support in samples (default: 3 * sigma).
+         */
+        void AddSegment(size_t begin, size_t end, double sigma, int half_width = -1);
+
+        /// Reset the running sums of the kernel regression
+        void Reset();
+
+        /**
+         * @brief Kernel regression pass.
+         * The kernel-weighted sums are added to those of the previous passes
+         * (since the last Reset()), so the estimate averages all reweighting iterations.
+         * @param parameters Rigid parameters (6 x number of transformations).
+         * @param weights Weights of the parameters (6 x number of transformations).
+         * @param kr Output regressed parameters (6 x number of transformations).
+         */
+        void Regress(const Matrix& parameters, const Matrix& weights, Matrix& kr);
+
+        /**
+         * @brief Compute the moments of the world coordinates of the image voxels above -1.
+         * @param image Input image (the first frame is used).
+         * @param step Sampling step in voxels.
+         * @return Point moments.
+         */
+        static PointMoments Moments(const RealImage& image, int step = 1);
+
+        /**
+         * @brief Root mean square distance between the points mapped by two affine matrices.
+         * @param a First 4x4 matrix.
+         * @param b Second 4x4 matrix.
+         * @param moments Moments of the point set.
+         * @return RMS target registration error or -1 for an empty point set.
+         */
+        static double TRE(const Matrix& a, const Matrix& b, const PointMoments& moments);
+    };
+
+} // namespace svrtk
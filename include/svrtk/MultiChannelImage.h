@@ -0,0 +1,115 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Channel-packed multi-channel image.
+     *
+     * The channels of a voxel are stored contiguously, so kernels visiting a
+     * voxel once per coefficient can update all channels in one pass.
+     */
+    class MultiChannelImage {
+    protected:
+        /// Spatial attributes
+        ImageAttributes _attr;
+        /// Number of channels
+        int _channels;
+        /// Channel-packed voxel values
+        Array<RealPixel> _data;
+
+    public:
+        /// MultiChannelImage constructor
+        MultiChannelImage() : _channels(0) {}
+
+        /// MultiChannelImage constructor
+        MultiChannelImage(const ImageAttributes& attr, int channels, RealPixel value = 0) {
+            Initialize(attr, channels, value);
+        }
+
+        /**
+         * @brief Allocate the image.
+         * @param attr Spatial attributes.
+         * @param channels Number of channels.
+         * @param value Initial value of all channels.
+         */
+        void Initialize(const ImageAttributes& attr, int channels, RealPixel value = 0);
+
+        /// Pack separate channel images of the same size
+        void Pack(const Array<RealImage>& images);
+
+        /// Unpack into separate channel images
+        void Unpack(Array<RealImage>& images) const;
+
+        /// Add another image of the same size
+        MultiChannelImage& operator+=(const MultiChannelImage& image);
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Spatial attributes
+        inline const ImageAttributes& Attributes() const {
+            return _attr;
+        }
+
+        /// Number of channels
+        inline int Channels() const {
+            return _channels;
+        }
+
+        /// Number of spatial voxels
+        inline size_t NumberOfVoxels() const {
+            return _channels > 0 ? _data.size() / _channels : 0;
+        }
+
+        /// Set all channels of all voxels to zero
+        inline void Clear() {
+            fill(_data.begin(), _data.end(), 0);
+        }
+
+        /// Channels of a voxel given by its linear index
+        inline RealPixel *Voxel(size_t v) {
+            return _data.data() + v * _channels;
+        }
+
+        /// Channels of a voxel given by its linear index
+        inline const RealPixel *Voxel(size_t v) const {
+            return _data.data() + v * _channels;
+        }
+
+        /// Channels of a voxel
+        inline RealPixel *operator()(int i, int j, int k) {
+            return Voxel(i + size_t(_attr._x) * (j + size_t(_attr._y) * k));
+        }
+
+        /// Channels of a voxel
+        inline const RealPixel *operator()(int i, int j, int k) const {
+            return Voxel(i + size_t(_attr._x) * (j + size_t(_attr._y) * k));
+        }
+    };
+
+} // namespace svrtk
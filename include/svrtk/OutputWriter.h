@@ -0,0 +1,113 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+// C++ Standard
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Asynchronous writer of output images and transformations.
+     *
+     * Write requests take a snapshot of the data and are queued; background
+     * threads perform compression and file I/O. The queue is bounded, so the
+     * caller blocks only when the writer falls behind.
+     */
+    class OutputWriter {
+    protected:
+        /// Pending write jobs
+        deque<function<void()>> _jobs;
+        /// Maximum number of pending jobs
+        size_t _capacity;
+        /// Number of jobs being written at the moment
+        size_t _active;
+        /// Whether the writer is shutting down
+        bool _stop;
+
+        /// Background threads
+        Array<thread> _threads;
+        mutex _mutex;
+        condition_variable _job_added;
+        condition_variable _job_done;
+
+        /// Errors raised by finished jobs
+        Array<string> _errors;
+
+        /// Body of the background threads
+        void Run();
+
+    public:
+        /**
+         * @brief OutputWriter constructor.
+         * @param capacity Maximum number of queued snapshots.
+         * @param threads Number of background threads.
+         */
+        OutputWriter(size_t capacity = 64, int threads = 1);
+
+        /// OutputWriter destructor (writes all pending outputs and reports errors not collected by Flush)
+        ~OutputWriter();
+
+        OutputWriter(const OutputWriter&) = delete;
+        OutputWriter& operator=(const OutputWriter&) = delete;
+
+        /// Queue a job that owns the data it writes (blocks while the queue is full)
+        void Push(function<void()> job);
+
+        /// Queue a snapshot of the image to be written to the given file
+        void Write(const RealImage& image, const string& filename);
+
+        /// Queue a snapshot of the transformation to be written to the given file
+        void Write(const RigidTransformation& transformation, const string& filename);
+
+        /**
+         * @brief Queue per-slice images to be packed into a single multi-volume file.
+         * @param images Slice images.
+         * @param filename Output image (slices are stored as frames).
+         */
+        void WritePacked(const Array<RealImage>& images, const string& filename);
+
+        /// Wait until all queued outputs have been written (throws if any of them failed)
+        void Flush();
+
+        /**
+         * @brief Pack images into frames of a single image (padded with -1 to the largest extent).
+         * @param images Input images.
+         * @param packed Output multi-volume image.
+         */
+        static void PackImages(const Array<RealImage>& images, RealImage& packed);
+
+        /**
+         * @brief Write images packed into a single multi-volume file (synchronously).
+         * The geometry of each image is written to filename + ".txt".
+         * @param images Input images.
+         * @param filename Output image.
+         */
+        static void SavePacked(const Array<RealImage>& images, const string& filename);
+    };
+
+} // namespace svrtk
@@ -112,168 +112,78 @@ namespace svrtk::Parallel {
 
     //-------------------------------------------------------------------
 
-    class QualityReport {
+    /// Residual statistics of all slices against their simulated slices in one pass per slice
+    class SliceResidualStatistics {
         Reconstruction *reconstructor;
 
     public:
-        double out_global_ncc;
-        double out_global_nrmse;
+        SliceResidualStatistics(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
 
-        QualityReport(Reconstruction *reconstructor) : reconstructor(reconstructor) {
-            out_global_ncc = 0;
-            out_global_nrmse = 0;
-        }
-
-        QualityReport(QualityReport& x, split) : QualityReport(x.reconstructor) {}
-
-        void operator()(const blocked_range<size_t>& r) {
+        void operator()(const blocked_range<size_t>& r) const {
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
-                const double out_ncc = ComputeNCC(reconstructor->_slices[inputIndex], reconstructor->_simulated_slices[inputIndex], 0.1);
-
-                if (out_ncc > 0)
-                    out_global_ncc += out_ncc;
+                SliceResidualStats& stats = reconstructor->_slice_residuals[inputIndex];
+                stats = SliceResidualStats();
 
-                double s_diff = 0;
-                double s_t = 0;
-                int s_n = 0;
-                double point_ns = 0;
-                double point_nt = 0;
-
-                for (int x = 0; x < reconstructor->_slices[inputIndex].GetX(); x++) {
-                    for (int y = 0; y < reconstructor->_slices[inputIndex].GetY(); y++) {
-                        for (int z = 0; z < reconstructor->_slices[inputIndex].GetZ(); z++) {
-                            double test_val = reconstructor->_simulated_slices[inputIndex](x, y, z);
-                            if (reconstructor->_no_masking_background)
-                                test_val = reconstructor->_simulated_slices[inputIndex](x, y, z) * reconstructor->_slice_masks[inputIndex](x, y, z);
+                const RealPixel *ps = reconstructor->_slices[inputIndex].Data();
+                const RealPixel *pc = reconstructor->_corrected_slices[inputIndex].Data();
+                const RealPixel *psim = reconstructor->_simulated_slices[inputIndex].Data();
+                const RealPixel *pm = reconstructor->_no_masking_background ? reconstructor->_slice_masks[inputIndex].Data() : nullptr;
+                const double scale = reconstructor->_scale[inputIndex];
+                const int n = reconstructor->_slices[inputIndex].NumberOfVoxels();
+
+                //NCC moments (as ComputeNCC with threshold 0.1) and NRMSE
+                double s1 = 0, s2 = 0, s11 = 0, s22 = 0, s12 = 0;
+                double s_t = 0, s_diff = 0;
+                int ncc_n = 0, s_n = 0;
+
+                #pragma omp simd reduction(+: s1, s2, s11, s22, s12, s_t, s_diff, ncc_n, s_n)
+                for (int i = 0; i < n; i++) {
+                    if (ps[i] > 0.1 && psim[i] > 0.1) {
+                        s1 += ps[i];
+                        s2 += psim[i];
+                        s11 += ps[i] * ps[i];
+                        s22 += psim[i] * psim[i];
+                        s12 += ps[i] * psim[i];
+                        ncc_n++;
+                    }
 
-                            if (reconstructor->_slices[inputIndex](x, y, z) > 0 && test_val > 0) {
-                                point_nt = reconstructor->_slices[inputIndex](x, y, z) * exp(-(reconstructor->_bias[inputIndex])(x, y, 0)) * reconstructor->_scale[inputIndex];
-                                point_ns = reconstructor->_simulated_slices[inputIndex](x, y, z);
+                    const double test_val = pm ? psim[i] * pm[i] : psim[i];
+                    if (ps[i] > 0 && test_val > 0) {
+                        const double point_nt = pc[i] * scale;
 
-                                s_t += point_nt;
-                                s_diff += (point_nt - point_ns) * (point_nt - point_ns);
-                                s_n++;
-                            }
-                        }
+                        s_t += point_nt;
+                        s_diff += (point_nt - psim[i]) * (point_nt - psim[i]);
+                        s_n++;
                     }
                 }
 
-                if (s_n > 0 && s_t > 0) {
-                    const double out_nrmse = sqrt(s_diff / s_n) / (s_t / s_n);
-                    out_global_nrmse += out_nrmse;
+                stats.ncc = -1;
+                if (ncc_n >= 5) {
+                    const double v1 = s11 - s1 * s1 / ncc_n;
+                    const double v2 = s22 - s2 * s2 / ncc_n;
+                    stats.ncc = v1 * v2 > 0 ? (s12 - s1 * s2 / ncc_n) / sqrt(v1 * v2) : 0;
                 }
 
-                if (!isfinite(out_global_nrmse))
-                    out_global_nrmse = 0;
-
-            } //end of loop for a slice inputIndex
-        }
-
-        void join(const QualityReport& y) {
-            out_global_ncc += y.out_global_ncc;
-            out_global_nrmse += y.out_global_nrmse;
-        }
-
-        void operator()() {
-            parallel_reduce(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
-        }
-    };
-
-    //-------------------------------------------------------------------
-
-    // class for global 3D stack registration
-    class StackRegistrations {
-        const Reconstruction *reconstructor;
-        const Array<RealImage>& stacks;
-        Array<RigidTransformation>& stack_transformations;
-        int templateNumber;
-        const RealImage& target;
-        const RigidTransformation& offset;
-
-    public:
-        StackRegistrations(
-            const Reconstruction *reconstructor,
-            const Array<RealImage>& stacks,
-            Array<RigidTransformation>& stack_transformations,
-            int templateNumber,
-            const RealImage& target,
-            const RigidTransformation& offset) :
-            reconstructor(reconstructor),
-            stacks(stacks),
-            stack_transformations(stack_transformations),
-            templateNumber(templateNumber),
-            target(target),
-            offset(offset) {}
-
-        void operator()(const blocked_range<size_t>& r) const {
-            RealImage r_source, r_target;
-            GenericLinearInterpolateImageFunction<RealImage> interpolator;
-            ResamplingWithPadding<RealPixel> resampling(1.2, 1.2, 1.2, 0);
-            resampling.Interpolator(&interpolator);
-
-            ParameterList params;
-            Insert(params, "Transformation model", "Rigid");
-            if (reconstructor->_nmi_bins > 0)
-                Insert(params, "No. of bins", reconstructor->_nmi_bins);
-
-            if (reconstructor->_masked_stacks)
-                Insert(params, "Background value", 0);
-            else
-                Insert(params, "Background value for image 1", 0);
-
-            // Insert(params, "Background value", 0);
-            // Insert(params, "Image (dis-)similarity measure", "NCC");
-            // Insert(params, "Image interpolation mode", "Linear");
-            // string type = "box";
-            // string units = "mm";
-            // double width = 0;
-            // Insert(params, string("Local window size [") + type + string("]"), ToString(width) + units);
-
-            Transformation *dofout;
-            GenericRegistrationFilter registration;
-            registration.Parameter(params);
-            registration.Output(&dofout);
-
-            for (size_t i = r.begin(); i != r.end(); i++) {
-
-                r_source.Initialize(stacks[i].Attributes());
-                resampling.Input(&stacks[i]);
-                resampling.Output(&r_source);
-                resampling.Run();
-
-                r_target.Initialize(target.Attributes());
-                resampling.Input(&target);
-                resampling.Output(&r_target);
-                resampling.Run();
-
-                const Matrix& mo = offset.GetMatrix();
-                stack_transformations[i].PutMatrix(stack_transformations[i].GetMatrix() * mo);
-
-                registration.Input(&r_target, &r_source);
-                registration.InitialGuess(&stack_transformations[i]);
-                registration.GuessParameter();
-                registration.Run();
-
-                unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-                stack_transformations[i] = *rigidTransf;
-
-                stack_transformations[i].PutMatrix(stack_transformations[i].GetMatrix() * mo.Inverse());
-
-                //save volumetric registrations
-                if (reconstructor->_debug) {
-                    stack_transformations[i].Write((boost::format("global-transformation%1%.dof") % i).str().c_str());
-                    stacks[i].Write((boost::format("global-stack%1%.nii.gz") % i).str().c_str());
+                if (s_n > 0 && s_t > 0) {
+                    const double nrmse = sqrt(s_diff / s_n) / (s_t / s_n);
+                    if (isfinite(nrmse))
+                        stats.nrmse = nrmse;
                 }
+
+                stats.structural_excluded = reconstructor->_structural_slice_weight[inputIndex] < 1;
+                stats.excluded = reconstructor->_slice_weight[inputIndex] < 0.5 || stats.structural_excluded;
             }
         }
 
         void operator()() const {
-            parallel_for(blocked_range<size_t>(0, stacks.size()), *this);
+            parallel_for(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
         }
     };
 
     //-------------------------------------------------------------------
 
+    //-------------------------------------------------------------------
+
     // class for simulation of slice masks
     class SimulateMasks {
         Reconstruction *reconstructor;
@@ -355,15 +265,10 @@ namespace svrtk::Parallel {
                 memset(sim_inside.Data(), 0, sizeof(RealPixel) * sim_inside.NumberOfVoxels());
                 reconstructor->_slice_inside[inputIndex] = false;
 
-                if (reconstructor->_multiple_channels_flag) {
-                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                        for ( int i = 0; i < reconstructor->_simulated_slices[inputIndex].GetX(); i++ ) {
-                            for ( int j = 0; j < reconstructor->_simulated_slices[inputIndex].GetY(); j++ ) {
-                                reconstructor->_mc_simulated_slices[inputIndex][nc]->PutAsDouble(i, j, 0, 0);
-                            }
-                        }
-                    }
-                }
+                //all channels are updated per coefficient from the channel-packed volume
+                const int nc = reconstructor->_multiple_channels_flag && reconstructor->_number_of_channels > 0 ? reconstructor->_number_of_channels : 0;
+                if (nc > 0)
+                    reconstructor->_mc_simulated_slices[inputIndex].Clear();
 
                 for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
                     for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++) {
@@ -372,14 +277,16 @@ namespace svrtk::Parallel {
                                 test_val = reconstructor->_not_masked_slices[inputIndex](i, j, 0);
                             if (test_val > -0.01) {
                                 double weight = 0;
+                                RealPixel *mc_sim = nc > 0 ? reconstructor->_mc_simulated_slices[inputIndex](i, j, 0) : nullptr;
                                 for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
                                     const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
                                     sim_slice(i, j, 0) += p.value * reconstructor->_reconstructed(p.x, p.y, p.z);
                                     weight += p.value;
 
-                                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                        double tmp_val = reconstructor->_mc_simulated_slices[inputIndex][nc]->GetAsDouble(i, j, 0) + p.value * reconstructor->_mc_reconstructed[nc](p.x, p.y, p.z);
-                                        reconstructor->_mc_simulated_slices[inputIndex][nc]->PutAsDouble(i, j, 0, tmp_val);
+                                    if (nc > 0) {
+                                        const RealPixel *mc_value = reconstructor->_mc_reconstructed_packed(p.x, p.y, p.z);
+                                        for (int n = 0; n < nc; n++)
+                                            mc_sim[n] += p.value * mc_value[n];
                                     }
 
                                     if (reconstructor->_no_masking_background || reconstructor->_mask(p.x, p.y, p.z) > 0.1) {
@@ -391,10 +298,8 @@ namespace svrtk::Parallel {
                                     sim_slice(i, j, 0) /= weight;
                                     sim_weight(i, j, 0) = weight;
 
-                                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                        double tmp_val = reconstructor->_mc_simulated_slices[inputIndex][nc]->GetAsDouble(i, j, 0) / weight;
-                                        reconstructor->_mc_simulated_slices[inputIndex][nc]->PutAsDouble(i, j, 0, tmp_val);
-                                    }
+                                    for (int n = 0; n < nc; n++)
+                                        mc_sim[n] /= weight;
 
                                 }
                             }
@@ -464,6 +369,13 @@ namespace svrtk::Parallel {
         SimulateSlicesCardiacVelocity4D(ReconstructionCardiacVelocity4D *reconstructor) : reconstructor(reconstructor) {}
 
         void operator() (const blocked_range<size_t> &r) const {
+            const PackedVelocityField& velocity = reconstructor->_packed_velocity;
+            const int phases = velocity.Phases();
+            const int components = velocity.Components();
+            const int nx = reconstructor->_reconstructed4D.GetX();
+            const int ny = reconstructor->_reconstructed4D.GetY();
+            Array<double> temporal_weight(phases), signal_factor(components), sim_velocity(components);
+
             for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
                 // calculate simulated slice
                 reconstructor->_simulated_slices[inputIndex].Initialize(reconstructor->_slices[inputIndex].Attributes());
@@ -471,48 +383,61 @@ namespace svrtk::Parallel {
                 reconstructor->_simulated_inside[inputIndex].Initialize(reconstructor->_slices[inputIndex].Attributes());
                 reconstructor->_slice_inside[inputIndex] = false;
 
-                memset(reconstructor->_simulated_velocities[inputIndex][0].Data(), 0, sizeof(RealPixel) * reconstructor->_simulated_velocities[inputIndex][0].NumberOfVoxels());
-                memset(reconstructor->_simulated_velocities[inputIndex][1].Data(), 0, sizeof(RealPixel) * reconstructor->_simulated_velocities[inputIndex][1].NumberOfVoxels());
-                memset(reconstructor->_simulated_velocities[inputIndex][2].Data(), 0, sizeof(RealPixel) * reconstructor->_simulated_velocities[inputIndex][2].NumberOfVoxels());
+                Array<RealImage>& simulated_velocities = reconstructor->_simulated_velocities[inputIndex];
+                for (int velocityIndex = 0; velocityIndex < components; velocityIndex++)
+                    memset(simulated_velocities[velocityIndex].Data(), 0, sizeof(RealPixel) * simulated_velocities[velocityIndex].NumberOfVoxels());
+
+                // Temporal weights of the current slice
+                if (phases == 1)
+                    reconstructor->_slice_temporal_weight[0][inputIndex] = 1;
+                for (int outputIndex = 0; outputIndex < phases; outputIndex++)
+                    temporal_weight[outputIndex] = reconstructor->_slice_temporal_weight[outputIndex][inputIndex];
 
-                // Gradient magnitude for the current slice
+                // Phase signal of every velocity component: gradient magnitude and direction for the current slice
                 const int gradientIndex = reconstructor->_stack_index[inputIndex];
                 const double gval = reconstructor->_g_values[gradientIndex];
+                for (int velocityIndex = 0; velocityIndex < components; velocityIndex++)
+                    signal_factor[velocityIndex] = gval * reconstructor->_slice_g_directions[inputIndex][velocityIndex];
 
                 for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
                     for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
                         if (reconstructor->_slices[inputIndex](i, j, 0) > -10) {
-                            double weight = 0;
+                            double weight = 0, sim_signal = 0;
+                            fill(sim_velocity.begin(), sim_velocity.end(), 0);
+
                             for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
                                 const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                for (int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++) {
-                                    if (reconstructor->_reconstructed4D.GetT() == 1)
-                                        reconstructor->_slice_temporal_weight[outputIndex][inputIndex] = 1;
-
-                                    // Simulation of phase signal from velocity volumes
-                                    double sim_signal = 0;
-
-                                    for (size_t velocityIndex = 0; velocityIndex < reconstructor->_reconstructed5DVelocity.size(); velocityIndex++) {
-                                        sim_signal += reconstructor->_reconstructed5DVelocity[velocityIndex](p.x, p.y, p.z, outputIndex) * gval * reconstructor->_slice_g_directions[inputIndex][velocityIndex];
-                                        reconstructor->_simulated_velocities[inputIndex][velocityIndex](i, j, 0) += reconstructor->_reconstructed5DVelocity[velocityIndex](p.x, p.y, p.z, outputIndex) * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
+                                const RealPixel *pv = velocity.Voxel(p.x + (size_t)nx * (p.y + (size_t)ny * p.z));
+
+                                // Simulation of phase signal and velocities from all components at once
+                                for (int outputIndex = 0; outputIndex < phases; outputIndex++, pv += components) {
+                                    const double w = temporal_weight[outputIndex] * p.value;
+                                    double signal = 0;
+                                    for (int velocityIndex = 0; velocityIndex < components; velocityIndex++) {
+                                        signal += pv[velocityIndex] * signal_factor[velocityIndex];
+                                        sim_velocity[velocityIndex] += pv[velocityIndex] * w;
                                     }
-
-                                    reconstructor->_simulated_slices[inputIndex](i, j, 0) += sim_signal * reconstructor->gamma * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
-                                    weight += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value;
+                                    sim_signal += signal * w;
+                                    weight += w;
                                 }
+
                                 if (reconstructor->_mask(p.x, p.y, p.z) == 1) {
                                     reconstructor->_simulated_inside[inputIndex](i, j, 0) = 1;
                                     reconstructor->_slice_inside[inputIndex] = true;
                                 }
                             }
 
+                            sim_signal *= reconstructor->gamma;
                             if (weight > 0) {
-                                reconstructor->_simulated_slices[inputIndex](i, j, 0) /= weight;
+                                sim_signal /= weight;
                                 reconstructor->_simulated_weights[inputIndex](i, j, 0) = weight;
-
-                                for (size_t velocityIndex = 0; velocityIndex < reconstructor->_reconstructed5DVelocity.size(); velocityIndex++)
-                                    reconstructor->_simulated_velocities[inputIndex][velocityIndex](i, j, 0) /= weight;
+                                for (int velocityIndex = 0; velocityIndex < components; velocityIndex++)
+                                    sim_velocity[velocityIndex] /= weight;
                             }
+
+                            reconstructor->_simulated_slices[inputIndex](i, j, 0) = sim_signal;
+                            for (int velocityIndex = 0; velocityIndex < components; velocityIndex++)
+                                simulated_velocities[velocityIndex](i, j, 0) = sim_velocity[velocityIndex];
                         }
             }
         }
@@ -532,82 +457,82 @@ namespace svrtk::Parallel {
     public:
         SliceToVolumeRegistration(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
 
-        void operator()(const blocked_range<size_t>& r) const {
+        void operator()(size_t inputIndex) const {
             GreyPixel smin, smax, tmin, tmax;
-            GreyImage target;
+            GreyImage target = reconstructor->_grey_slices[inputIndex];
+            target.GetMinMax(&smin, &smax);
+
+            if (smax > 1 && (smax - smin) > 1) {
+                ParameterList params;
+                Insert(params, "Transformation model", "Rigid");
+                reconstructor->_grey_reconstructed.GetMinMax(&tmin, &tmax);
+
+                if (smin < 1)
+                    Insert(params, "Background value for image 1", -1);
+
+                if (tmin < 0)
+                    Insert(params, "Background value for image 2", -1);
+                else if (tmin < 1)
+                    Insert(params, "Background value for image 2", 0);
+
+                if (!reconstructor->_ncc_reg) {
+                    Insert(params, "Image (dis-)similarity measure", "NMI");
+                    if (reconstructor->_nmi_bins > 0)
+                        Insert(params, "No. of bins", reconstructor->_nmi_bins);
+                } else {
+                    Insert(params, "Image (dis-)similarity measure", "NCC");
+                    const string type = "sigma";
+                    const string units = "mm";
+                    constexpr double width = 0;
+                    Insert(params, string("Local window size [") + type + string("]"), ToString(width) + units);
+                }
 
-            for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
-                target = reconstructor->_grey_slices[inputIndex];
-                target.GetMinMax(&smin, &smax);
-
-                if (smax > 1 && (smax - smin) > 1) {
-                    ParameterList params;
-                    Insert(params, "Transformation model", "Rigid");
-                    reconstructor->_grey_reconstructed.GetMinMax(&tmin, &tmax);
-
-                    if (smin < 1)
-                        Insert(params, "Background value for image 1", -1);
-
-                    if (tmin < 0)
-                        Insert(params, "Background value for image 2", -1);
-                    else if (tmin < 1)
-                        Insert(params, "Background value for image 2", 0);
-
-                    if (!reconstructor->_ncc_reg) {
-                        Insert(params, "Image (dis-)similarity measure", "NMI");
-                        if (reconstructor->_nmi_bins > 0)
-                            Insert(params, "No. of bins", reconstructor->_nmi_bins);
-                    } else {
-                        Insert(params, "Image (dis-)similarity measure", "NCC");
-                        const string type = "sigma";
-                        const string units = "mm";
-                        constexpr double width = 0;
-                        Insert(params, string("Local window size [") + type + string("]"), ToString(width) + units);
-                    }
+                // stable slices are only refined
+                if (reconstructor->_svr_scheduler.GetMode(inputIndex) == SVRScheduler::Reduced)
+                    Insert(params, "No. of resolution levels", 1);
 
-                    GenericRegistrationFilter registration;
-                    registration.Parameter(params);
-
-                    //put origin to zero
-                    RigidTransformation offset;
-                    ResetOrigin(target, offset);
-                    const Matrix& mo = offset.GetMatrix();
-                    auto& transformation = reconstructor->_transformations[inputIndex];
-                    transformation.PutMatrix(transformation.GetMatrix() * mo);
+                GenericRegistrationFilter registration;
+                registration.Parameter(params);
 
-                    // run registration
-                    registration.Input(&target, &reconstructor->_grey_reconstructed);
-                    Transformation *dofout;
-                    registration.Output(&dofout);
-                    registration.InitialGuess(&transformation);
-                    registration.GuessParameter();
-                    registration.Run();
+                //put origin to zero
+                RigidTransformation offset;
+                ResetOrigin(target, offset);
+                const Matrix& mo = offset.GetMatrix();
+                auto& transformation = reconstructor->_transformations[inputIndex];
+                transformation.PutMatrix(transformation.GetMatrix() * mo);
+
+                // run registration
+                registration.Input(&target, &reconstructor->_grey_reconstructed);
+                Transformation *dofout;
+                registration.Output(&dofout);
+                registration.InitialGuess(&transformation);
+                registration.GuessParameter();
+                registration.Run();
 
-                    // output transformation
-                    unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-                    transformation = *rigidTransf;
+                // output transformation
+                unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
+                transformation = *rigidTransf;
 
-                    //undo the offset
-                    transformation.PutMatrix(transformation.GetMatrix() * mo.Inverse());
+                //undo the offset
+                transformation.PutMatrix(transformation.GetMatrix() * mo.Inverse());
 
-                    // save log outputs
-                    if (reconstructor->_reg_log) {
-                        const double tx = transformation.GetTranslationX();
-                        const double ty = transformation.GetTranslationY();
-                        const double tz = transformation.GetTranslationZ();
+                // save log outputs
+                if (reconstructor->_reg_log) {
+                    const double tx = transformation.GetTranslationX();
+                    const double ty = transformation.GetTranslationY();
+                    const double tz = transformation.GetTranslationZ();
 
-                        const double rx = transformation.GetRotationX();
-                        const double ry = transformation.GetRotationY();
-                        const double rz = transformation.GetRotationZ();
+                    const double rx = transformation.GetRotationX();
+                    const double ry = transformation.GetRotationY();
+                    const double rz = transformation.GetRotationZ();
 
-                        cout << boost::format("%1% %1% %1% %1% %1% %1% %1%") % inputIndex % tx % ty % tz % rx % ry % rz << endl;
-                    }
+                    cout << boost::format("%1% %1% %1% %1% %1% %1% %1%") % inputIndex % tx % ty % tz % rx % ry % rz << endl;
                 }
             }
         }
 
         void operator()() const {
-            parallel_for(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
+            reconstructor->_svr_scheduler.Dispatch(*this);
         }
     };
 
@@ -619,9 +544,11 @@ namespace svrtk::Parallel {
     public:
         SliceToVolumeRegistrationCardiac4D(ReconstructionCardiac4D *reconstructor) : reconstructor(reconstructor) {}
 
-        void operator()(const blocked_range<size_t>& r) const {
-            const ImageAttributes& attr = reconstructor->_reconstructed4D.Attributes();
-            GreyImage source, target;
+        void operator()(size_t inputIndex) const {
+            if (reconstructor->_slice_excluded[inputIndex])
+                return;
+
+            GreyImage target;
 
             ParameterList params;
             Insert(params, "Transformation model", "Rigid");
@@ -644,53 +571,48 @@ namespace svrtk::Parallel {
             registration.Parameter(params);
             registration.Output(&dofout);
 
-            for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
-                if (reconstructor->_slice_excluded[inputIndex])
-                    continue;
+            // ResamplingWithPadding<RealPixel> resampling(attr._dx, attr._dx, attr._dx, -1);
+            // GenericLinearInterpolateImageFunction<RealImage> interpolator;
+            // // TARGET
+            // // get current slice
+            // RealImage t(reconstructor->_slices[inputIndex].Attributes());
+            // // resample to spatial resolution of reconstructed volume
+            // resampling.Input(&reconstructor->_slices[inputIndex]);
+            // resampling.Output(&t);
+            // resampling.Interpolator(&interpolator);
+            // resampling.Run();
+            // target = t;
+
+            // get pixel value min and max
+            GreyPixel smin, smax;
+            target = reconstructor->_slices[inputIndex];
+            target.GetMinMax(&smin, &smax);
+
+            // SOURCE
+            if (smax > 0 && (smax - smin) > 1) {
+                // put origin to zero
+                RigidTransformation offset;
+                ResetOrigin(target, offset);
+                const Matrix& mo = offset.GetMatrix();
+                auto& transformation = reconstructor->_transformations[inputIndex];
+                transformation.PutMatrix(transformation.GetMatrix() * mo);
 
-                // ResamplingWithPadding<RealPixel> resampling(attr._dx, attr._dx, attr._dx, -1);
-                // GenericLinearInterpolateImageFunction<RealImage> interpolator;
-                // // TARGET
-                // // get current slice
-                // RealImage t(reconstructor->_slices[inputIndex].Attributes());
-                // // resample to spatial resolution of reconstructed volume
-                // resampling.Input(&reconstructor->_slices[inputIndex]);
-                // resampling.Output(&t);
-                // resampling.Interpolator(&interpolator);
-                // resampling.Run();
-                // target = t;
-
-                // get pixel value min and max
-                GreyPixel smin, smax;
-                target = reconstructor->_slices[inputIndex];
-                target.GetMinMax(&smin, &smax);
-
-                // SOURCE
-                if (smax > 0 && (smax - smin) > 1) {
-                    // put origin to zero
-                    RigidTransformation offset;
-                    ResetOrigin(target, offset);
-                    const Matrix& mo = offset.GetMatrix();
-                    auto& transformation = reconstructor->_transformations[inputIndex];
-                    transformation.PutMatrix(transformation.GetMatrix() * mo);
-
-                    // TODO: extract the nearest cardiac phase from reconstructed 4D to use as source
-                    source = reconstructor->_reconstructed4D.GetRegion(0, 0, 0, reconstructor->_slice_svr_card_index[inputIndex], attr._x, attr._y, attr._z, reconstructor->_slice_svr_card_index[inputIndex] + 1);
-                    registration.Input(&target, &source);
-                    registration.InitialGuess(&transformation);
-                    registration.GuessParameter();
-                    registration.Run();
-                    unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-                    transformation = *rigidTransf;
+                // nearest cardiac phase of the reconstructed 4D volume is used as source
+                const GreyImage& source = reconstructor->_svr_phase_volumes[reconstructor->_slice_svr_card_index[inputIndex]];
+                registration.Input(&target, &source);
+                registration.InitialGuess(&transformation);
+                registration.GuessParameter();
+                registration.Run();
+                unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
+                transformation = *rigidTransf;
 
-                    //undo the offset
-                    transformation.PutMatrix(transformation.GetMatrix() * mo.Inverse());
-                }
+                //undo the offset
+                transformation.PutMatrix(transformation.GetMatrix() * mo.Inverse());
             }
         }
 
         void operator()() const {
-            parallel_for(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
+            reconstructor->_svr_scheduler.Dispatch(*this);
         }
     };
 
@@ -703,9 +625,7 @@ namespace svrtk::Parallel {
     public:
         SliceToVolumeRegistrationFFD(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
 
-        void operator()(const blocked_range<size_t>& r) const {
-
-
+        void operator()(size_t inputIndex) const {
             // define registration model
             ParameterList params_init;
             
@@ -730,60 +650,45 @@ namespace svrtk::Parallel {
                 Insert(params_init, "Control point spacing in Z", cp_spacing);
             }
 
-            RealPixel smin, smax;
-            reconstructor->_reconstructed.GetMinMax(&smin, &smax);
-
-            for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
-
-                GenericRegistrationFilter registration;
-
-                RealPixel tmin, tmax;
-                const RealImage& target = reconstructor->_slices[inputIndex];
-                target.GetMinMax(&smin, &smax);
-
-                if (smax > 1 && (smax - smin) > 1) {
+            GenericRegistrationFilter registration;
 
-                    if (reconstructor->_ffd_global_only) {
+            RealPixel smin, smax;
+            const RealImage& target = reconstructor->_slices[inputIndex];
+            target.GetMinMax(&smin, &smax);
 
-                        MultiLevelFreeFormTransformation *mffd_init;
-                        int current_stack=reconstructor->_stack_index[inputIndex];
-                        Transformation *tt = Transformation::New((boost::format("ms-%1%.dof") % current_stack).str().c_str());
-                        mffd_init = dynamic_cast<MultiLevelFreeFormTransformation*> (tt);
-                        reconstructor->_mffd_transformations[inputIndex] = mffd_init;
+            if (smax > 1 && (smax - smin) > 1) {
 
-                    } else {
+                if (reconstructor->_ffd_global_only) {
 
-                        ParameterList params = params_init;
-                        // run registration
-                        registration.Parameter(params);
-                        registration.Input(&target, &reconstructor->_reconstructed);
+                    // the slice shares the transformation of its stack
+                    reconstructor->_mffd_transformations.ShareStack(inputIndex, reconstructor->_stack_index[inputIndex]);
 
-                        if (reconstructor->_current_iteration == 0) {
-                            MultiLevelFreeFormTransformation *mffd_init;
-                            int current_stack=reconstructor->_stack_index[inputIndex];
-                            Transformation *tt = Transformation::New((boost::format("ms-%1%.dof") % current_stack).str().c_str());
-                            mffd_init = dynamic_cast<MultiLevelFreeFormTransformation*> (tt);
-                            registration.InitialGuess(mffd_init);
+                } else {
 
-                        } else {
-                            registration.InitialGuess(reconstructor->_mffd_transformations[inputIndex]);
-                        }
+                    ParameterList params = params_init;
+                    // run registration
+                    registration.Parameter(params);
+                    registration.Input(&target, &reconstructor->_reconstructed);
 
-                        Transformation *dofout;
-                        registration.Output(&dofout);
-                        registration.GuessParameter();
-                        registration.Run();
+                    if (reconstructor->_current_iteration == 0)
+                        registration.InitialGuess(reconstructor->_mffd_transformations.Stack(reconstructor->_stack_index[inputIndex]));
+                    else
+                        registration.InitialGuess(reconstructor->_mffd_transformations[inputIndex]);
 
-                        MultiLevelFreeFormTransformation *mffd_dofout = dynamic_cast<MultiLevelFreeFormTransformation*> (dofout);
-                        reconstructor->_mffd_transformations[inputIndex] = mffd_dofout;
-                    }
+                    Transformation *dofout;
+                    registration.Output(&dofout);
+                    registration.GuessParameter();
+                    registration.Run();
 
+                    // replaces (and releases) the previous slice transformation
+                    reconstructor->_mffd_transformations.SetSlice(inputIndex, dofout);
                 }
+
             }
         }
 
         void operator()() const {
-            parallel_for(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
+            reconstructor->_svr_scheduler.Dispatch(*this);
         }
     };
 
@@ -981,6 +886,51 @@ namespace svrtk::Parallel {
                 //calculate centre of tPSF in image coordinates
                 const int centre = (dim - 1) / 2;
 
+                //composite map of slice voxels to volume voxels and PSF offsets (not applicable to FFD)
+                SliceGeometry geometry;
+                Array<double> psf_offsets;
+                if (!reconstructor->_ffd) {
+                    geometry = reconstructor->_slice_geometry.Get(inputIndex, global_slice.Attributes(), reconstructor->_transformations[inputIndex], global_reconstructed.Attributes());
+                    geometry.PSFOffsets(PSF, dx, dy, dz, psf_offsets);
+                }
+
+                //FFD: PSF offsets in slice image coordinates and the cached map of the slice
+                //(exact evaluation if disabled or the map is not accurate enough)
+                unique_ptr<SliceDisplacementField> ffd_field;
+                const MultiLevelFreeFormTransformation *mffd = nullptr;
+                if (reconstructor->_ffd) {
+                    mffd = reconstructor->_mffd_transformations[inputIndex];
+                    psf_offsets.resize(3 * xDim * yDim * zDim);
+                    for (int ii = 0; ii < xDim; ii++)
+                        for (int jj = 0; jj < yDim; jj++)
+                            for (int kk = 0; kk < zDim; kk++) {
+                                //PSF image coordinates to PSF world coordinates centred around the centrepoint of the PSF
+                                double x = ii, y = jj, z = kk;
+                                PSF.ImageToWorld(x, y, z);
+                                //slice image coordinates (slices can be oriented in any direction)
+                                double *po = &psf_offsets[3 * ((ii * yDim + jj) * zDim + kk)];
+                                po[0] = (x - cx) / dx;
+                                po[1] = (y - cy) / dy;
+                                po[2] = (z - cz) / dz;
+                            }
+
+                    reconstructor->_ffd_field_error[inputIndex] = -1;
+                    if (reconstructor->_ffd_field_tolerance > 0) {
+                        ffd_field.reset(new SliceDisplacementField);
+                        const bool accurate = ffd_field->Build(global_slice, *mffd, global_reconstructed, psf_offsets, reconstructor->_ffd_field_tolerance);
+                        reconstructor->_ffd_field_error[inputIndex] = ffd_field->Error();
+                        if (!accurate)
+                            ffd_field.reset();
+                    }
+                }
+
+                //vectorised trilinear splatting with optional pruning (not applicable to FFD)
+                unique_ptr<TrilinearSplat> splat;
+                if (reconstructor->_trilinear_splat && !reconstructor->_ffd)
+                    splat.reset(new TrilinearSplat(global_reconstructed.Attributes(), reconstructor->_mask, reconstructor->_no_masking_background));
+                const double prune_threshold = splat ? reconstructor->_coeff_prune_threshold : 0;
+                CoeffPruningStats pruning;
+
                 //for each voxel in current slice calculate matrix coefficients
                 bool excluded_slice = false;
                 for (size_t ff = 0; ff < reconstructor->_force_excluded.size(); ff++) {
@@ -1001,14 +951,14 @@ namespace svrtk::Parallel {
                             double x = i;
                             double y = j;
                             double z = 0;
-                            global_slice.ImageToWorld(x, y, z);
-
-                            if (!reconstructor->_ffd)
-                                reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                            else
-                                reconstructor->_mffd_transformations[inputIndex]->Transform(-1, 1, x, y, z);
-
-                            global_reconstructed.WorldToImage(x, y, z);
+                            if (!reconstructor->_ffd) {
+                                geometry.Transform(x, y, z);
+                            } else if (ffd_field) {
+                                ffd_field->Map(x, y, z);
+                            } else {
+                                SliceDisplacementField::Exact(global_slice, *mffd, global_reconstructed, x, y, z);
+                            }
+                            const double centre_x = x, centre_y = y, centre_z = z;
                             int tx = round(x);
                             int ty = round(y);
                             int tz = round(z);
@@ -1020,47 +970,50 @@ namespace svrtk::Parallel {
                             for (int ii = 0; ii < xDim; ii++)
                                 for (int jj = 0; jj < yDim; jj++)
                                     for (int kk = 0; kk < zDim; kk++) {
-                                        //Calculate the position of the POINT3D of PSF centred over current slice voxel
-                                        //This is a bit complicated because slices can be oriented in any direction
-
-                                        //PSF image coordinates
-                                        x = ii;
-                                        y = jj;
-                                        z = kk;
-                                        //change to PSF world coordinates - now real sizes in mm
-                                        PSF.ImageToWorld(x, y, z);
-                                        //centre around the centrepoint of the PSF
-                                        x -= cx;
-                                        y -= cy;
-                                        z -= cz;
-
-                                        //Need to convert (x,y,z) to slice image coordinates because slices can have
-                                        //transformations included in them (they are nifti) and those are not reflected in
-                                        //PSF. In slice image coordinates we are sure that z is through-plane
-
-                                        //adjust according to voxel size
-                                        x /= dx;
-                                        y /= dy;
-                                        z /= dz;
-                                        //centre over current voxel
-                                        x += i;
-                                        y += j;
-
-                                        //convert from slice image coordinates to world coordinates
-                                        global_slice.ImageToWorld(x, y, z);
-
-                                        //Transform to space of reconstructed volume
-                                        if (!reconstructor->_ffd)
-                                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                        else
-                                            reconstructor->_mffd_transformations[inputIndex]->Transform(-1, 1, x, y, z);
-
-                                        //Change to image coordinates
-                                        global_reconstructed.WorldToImage(x, y, z);
+                                        if (!reconstructor->_ffd) {
+                                            //position of the POINT3D of PSF centred over current slice voxel in volume image coordinates
+                                            const double *po = &psf_offsets[3 * ((ii * yDim + jj) * zDim + kk)];
+                                            x = centre_x + po[0];
+                                            y = centre_y + po[1];
+                                            z = centre_z + po[2];
+                                        } else {
+                                            //position of the POINT3D of PSF centred over current slice voxel in slice image coordinates
+                                            const double *po = &psf_offsets[3 * ((ii * yDim + jj) * zDim + kk)];
+                                            x = i + po[0];
+                                            y = j + po[1];
+                                            z = po[2];
+
+                                            //transform to image coordinates of the reconstructed volume
+                                            if (ffd_field)
+                                                ffd_field->Map(x, y, z);
+                                            else
+                                                SliceDisplacementField::Exact(global_slice, *mffd, global_reconstructed, x, y, z);
+                                        }
 
                                         //determine coefficients of volume voxels for position x,y,z
                                         //using linear interpolation
 
+                                        if (splat) {
+                                            int nx, ny, nz;
+                                            float weights[8];
+                                            bool inside;
+                                            const float wsum = splat->Weights(x, y, z, nx, ny, nz, weights, inside);
+                                            slice_inside = slice_inside || inside;
+                                            if (wsum <= 0 || !inside)
+                                                continue;
+
+                                            const float psf = PSF(ii, jj, kk) / wsum;
+                                            for (int q = 0; q < 8; q++) {
+                                                //image coordinates of the neighbour in tPSF
+                                                const int aa = nx + (q >> 2) - tx + centre;
+                                                const int bb = ny + ((q >> 1) & 1) - ty + centre;
+                                                const int cc = nz + (q & 1) - tz + centre;
+                                                if (weights[q] > 0 && aa >= 0 && aa < dim && bb >= 0 && bb < dim && cc >= 0 && cc < dim)
+                                                    tPSF(aa, bb, cc) += psf * weights[q];
+                                            }
+                                            continue;
+                                        }
+
                                         //Find the 8 closest volume voxels
 
                                         //lowest corner of the cube
@@ -1131,11 +1084,32 @@ namespace svrtk::Parallel {
                                             p.value = tPSF(ii, jj, kk);
                                             slicecoeffs[i][j].push_back(p);
                                         }
+
+                            //prune small coefficients and measure the change of the simulated intensity
+                            if (prune_threshold > 0) {
+                                VOXELCOEFFS& coeffs = slicecoeffs[i][j];
+                                double weight = 0, full = 0;
+                                for (const POINT3D& p : coeffs) {
+                                    weight += p.value;
+                                    full += p.value * reconstructor->_reconstructed(p.x, p.y, p.z);
+                                }
+                                pruning.total += coeffs.size();
+                                pruning.pruned += TrilinearSplat::Prune(coeffs, prune_threshold);
+
+                                if (weight > 0) {
+                                    double pruned = 0;
+                                    for (const POINT3D& p : coeffs)
+                                        pruned += p.value * reconstructor->_reconstructed(p.x, p.y, p.z);
+                                    pruning.error += pow((pruned - full) / weight, 2);
+                                    pruning.norm += pow(full / weight, 2);
+                                }
+                            }
                         } //end of loop for slice voxels
                         }
 
                 reconstructor->_volcoeffs[inputIndex] = slicecoeffs; //move(slicecoeffs);
                 reconstructor->_slice_inside[inputIndex] = slice_inside;
+                reconstructor->_coeff_pruning[inputIndex] = pruning;
 
             }  //end of loop through the slices
         }
@@ -1273,6 +1247,12 @@ namespace svrtk::Parallel {
                 //calculate centre of tPSF in image coordinates
                 int centre = (dim - 1) / 2;
 
+                //composite map of slice voxels to volume voxels and PSF offsets
+                const RigidTransformation& transformation = reconstructor->_withMB ? reconstructor->_transformationsRwithMB[inputIndex] : reconstructor->_transformations[inputIndex];
+                const SliceGeometry geometry(slice.Attributes(), transformation.GetMatrix(), reconstructor->_reconstructed.Attributes());
+                Array<double> psf_offsets;
+                geometry.PSFOffsets(PSF, dx, dy, dz, psf_offsets);
+
                 //for each voxel in current slice calculate matrix coefficients
                 for (int i = 0; i < slice.GetX(); i++)
                     for (int j = 0; j < slice.GetY(); j++)
@@ -1281,14 +1261,8 @@ namespace svrtk::Parallel {
                             double x = i;
                             double y = j;
                             double z = 0;
-                            slice.ImageToWorld(x, y, z);
-
-                            if (reconstructor->_withMB)
-                                reconstructor->_transformationsRwithMB[inputIndex].Transform(x, y, z);
-                            else
-                                reconstructor->_transformations[inputIndex].Transform(x, y, z);
-
-                            reconstructor->_reconstructed.WorldToImage(x, y, z);
+                            geometry.Transform(x, y, z);
+                            const double centre_x = x, centre_y = y, centre_z = z;
                             int tx = round(x);
                             int ty = round(y);
                             int tz = round(z);
@@ -1300,49 +1274,11 @@ namespace svrtk::Parallel {
                             for (int ii = 0; ii < xDim; ii++)
                                 for (int jj = 0; jj < yDim; jj++)
                                     for (int kk = 0; kk < zDim; kk++) {
-                                        //Calculate the position of the POINT3D of
-                                        //PSF centred over current slice voxel
-                                        //This is a bit complicated because slices
-                                        //can be oriented in any direction
-
-                                        //PSF image coordinates
-                                        x = ii;
-                                        y = jj;
-                                        z = kk;
-                                        //change to PSF world coordinates - now real sizes in mm
-                                        PSF.ImageToWorld(x, y, z);
-                                        //centre around the centrepoint of the PSF
-                                        x -= cx;
-                                        y -= cy;
-                                        z -= cz;
-
-                                        //Need to convert (x,y,z) to slice image
-                                        //coordinates because slices can have
-                                        //transformations included in them (they are
-                                        //nifti) and those are not reflected in
-                                        //PSF. In slice image coordinates we are
-                                        //sure that z is through-plane
-
-                                        //adjust according to voxel size
-                                        x /= dx;
-                                        y /= dy;
-                                        z /= dz;
-                                        //center over current voxel
-                                        x += i;
-                                        y += j;
-
-                                        //convert from slice image coordinates to world coordinates
-                                        slice.ImageToWorld(x, y, z);
-
-                                        //x+=(vx-cx); y+=(vy-cy); z+=(vz-cz);
-                                        //Transform to space of reconstructed volume
-                                        if (reconstructor->_withMB)
-                                            reconstructor->_transformationsRwithMB[inputIndex].Transform(x, y, z);
-                                        else
-                                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
-
-                                        //Change to image coordinates
-                                        reconstructor->_reconstructed.WorldToImage(x, y, z);
+                                        //position of the POINT3D of PSF centred over current slice voxel in volume image coordinates
+                                        const double *po = &psf_offsets[3 * ((ii * yDim + jj) * zDim + kk)];
+                                        x = centre_x + po[0];
+                                        y = centre_y + po[1];
+                                        z = centre_z + po[2];
 
                                         //determine coefficients of volume voxels for position x,y,z
                                         //using linear interpolation
@@ -1574,6 +1510,11 @@ namespace svrtk::Parallel {
                 //calculate centre of tPSF in image coordinates
                 int centre = (dim - 1) / 2;
 
+                //composite map of slice voxels to volume voxels and PSF offsets
+                const SliceGeometry& geometry = reconstructor->_slice_geometry.Get(inputIndex, slice.Attributes(), reconstructor->_transformations[inputIndex], reconstructor->_reconstructed4D.Attributes());
+                Array<double> psf_offsets;
+                geometry.PSFOffsets(PSF, dx, dy, dz, psf_offsets);
+
                 //for each voxel in current slice calculate matrix coefficients
                 for (int i = 0; i < slice.GetX(); i++)
                     for (int j = 0; j < slice.GetY(); j++)
@@ -1582,9 +1523,8 @@ namespace svrtk::Parallel {
                             double x = i;
                             double y = j;
                             double z = 0;
-                            slice.ImageToWorld(x, y, z);
-                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                            reconstructor->_reconstructed4D.WorldToImage(x, y, z);
+                            geometry.Transform(x, y, z);
+                            const double centre_x = x, centre_y = y, centre_z = z;
                             int tx = round(x);
                             int ty = round(y);
                             int tz = round(z);
@@ -1596,45 +1536,11 @@ namespace svrtk::Parallel {
                             for (int ii = 0; ii < xDim; ii++)
                                 for (int jj = 0; jj < yDim; jj++)
                                     for (int kk = 0; kk < zDim; kk++) {
-                                        //Calculate the position of the POINT3D of
-                                        //PSF centred over current slice voxel
-                                        //This is a bit complicated because slices
-                                        //can be oriented in any direction
-
-                                        //PSF image coordinates
-                                        x = ii;
-                                        y = jj;
-                                        z = kk;
-                                        //change to PSF world coordinates - now real sizes in mm
-                                        PSF.ImageToWorld(x, y, z);
-                                        //centre around the centrepoint of the PSF
-                                        x -= cx;
-                                        y -= cy;
-                                        z -= cz;
-
-                                        //Need to convert (x,y,z) to slice image
-                                        //coordinates because slices can have
-                                        //transformations included in them (they are
-                                        //nifti)  and those are not reflected in
-                                        //PSF. In slice image coordinates we are
-                                        //sure that z is through-plane
-
-                                        //adjust according to voxel size
-                                        x /= dx;
-                                        y /= dy;
-                                        z /= dz;
-                                        //center over current voxel
-                                        x += i;
-                                        y += j;
-
-                                        //convert from slice image coordinates to world coordinates
-                                        slice.ImageToWorld(x, y, z);
-
-                                        //x+=(vx-cx); y+=(vy-cy); z+=(vz-cz);
-                                        //Transform to space of reconstructed volume
-                                        reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                        //Change to image coordinates
-                                        reconstructor->_reconstructed4D.WorldToImage(x, y, z);
+                                        //position of the POINT3D of PSF centred over current slice voxel in volume image coordinates
+                                        const double *po = &psf_offsets[3 * ((ii * yDim + jj) * zDim + kk)];
+                                        x = centre_x + po[0];
+                                        y = centre_y + po[1];
+                                        z = centre_z + po[2];
 
                                         //determine coefficients of volume voxels for position x,y,z
                                         //using linear interpolation
@@ -2048,60 +1954,63 @@ namespace svrtk::Parallel {
             slice_potential(slice_potential) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            RealImage slice;
+            // constants of the inlier Gaussian and the outlier uniform likelihoods
+            const double mix = reconstructor->_mix;
+            const double g_norm = reconstructor->_step / sqrt(6.28 * reconstructor->_sigma);
+            const double g_exp = -1 / (2 * reconstructor->_sigma);
+            const double m = reconstructor->M(reconstructor->_m) * (1 - mix);
+
+            Array<RealPixel> inside;
 
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
                 // read the current slice
-
-                if (reconstructor->_no_masking_background)
-                    slice = reconstructor->_not_masked_slices[inputIndex];
-                else
-                    slice = reconstructor->_slices[inputIndex];
+                const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
 
                 //read current weight image
                 RealImage& weight = reconstructor->_weights[inputIndex];
                 memset(weight.Data(), 0, sizeof(RealPixel) * weight.NumberOfVoxels());
 
+                // slice voxels that contribute to at least one volumetric voxel
+                const SLICECOEFFS& slicecoeffs = reconstructor->_volcoeffs[inputIndex];
+                const int nx = slice.GetX();
+                ClearAndResize(inside, slice.NumberOfVoxels(), 0);
+                for (size_t i = 0; i < slicecoeffs.size(); i++)
+                    for (size_t j = 0; j < slicecoeffs[i].size(); j++)
+                        inside[j * nx + i] = slicecoeffs[i][j].empty() ? 0 : 1;
+
+                const RealPixel *ps = slice.Data();
+                const RealPixel *pc = reconstructor->_corrected_slices[inputIndex].Data();
+                const RealPixel *psim = reconstructor->_simulated_slices[inputIndex].Data();
+                const RealPixel *psw = reconstructor->_simulated_weights[inputIndex].Data();
+                const RealPixel *pin = inside.data();
+                RealPixel *pw = weight.Data();
+                const double scale = reconstructor->_scale[inputIndex];
+                const int n = slice.NumberOfVoxels();
+
+                double potential = 0;
                 double num = 0;
                 //Calculate error, voxel weights, and slice potential
-                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
-                        if (slice(i, j, 0) > -0.01) {
-                            //bias correct and scale the slice
-                            slice(i, j, 0) *= exp(-reconstructor->_bias[inputIndex](i, j, 0)) * reconstructor->_scale[inputIndex];
-
-                            //number of volumetric voxels to which
-                            // current slice voxel contributes
-                            const size_t n = reconstructor->_volcoeffs[inputIndex][i][j].size();
-
-                            // if n == 0, slice voxel has no overlap with volumetric ROI, do not process it
-
-                            if (n > 0 && reconstructor->_simulated_weights[inputIndex](i, j, 0) > 0) {
-                                slice(i, j, 0) -= reconstructor->_simulated_slices[inputIndex](i, j, 0);
-
-                                //calculate norm and voxel-wise weights
-
-                                //Gaussian distribution for inliers (likelihood)
-                                const double g = reconstructor->G(slice(i, j, 0), reconstructor->_sigma);
-                                //Uniform distribution for outliers (likelihood)
-                                const double m = reconstructor->M(reconstructor->_m);
-
-                                //voxel_wise posterior
-                                const double w = g * reconstructor->_mix / (g * reconstructor->_mix + m * (1 - reconstructor->_mix));
-                                weight.PutAsDouble(i, j, 0, w);
-
-                                //calculate slice potentials
-                                if (reconstructor->_simulated_weights[inputIndex](i, j, 0) > 0.99) {
-                                    slice_potential[inputIndex] += (1 - w) * (1 - w);
-                                    num++;
-                                }
-                            } else
-                                weight.PutAsDouble(i, j, 0, 0);
-                        }
+                #pragma omp simd reduction(+: potential, num)
+                for (int i = 0; i < n; i++) {
+                    // if the slice voxel has no overlap with volumetric ROI, do not process it
+                    const bool valid = ps[i] > -0.01 && pin[i] > 0 && psw[i] > 0;
+                    //error of the bias-corrected and scaled slice
+                    const double e = pc[i] * scale - psim[i];
+                    //Gaussian distribution for inliers (likelihood)
+                    const double g = g_norm * exp(g_exp * e * e) * mix;
+                    //voxel_wise posterior
+                    const double w = valid ? g / (g + m) : 0;
+                    pw[i] = w;
+
+                    //calculate slice potentials
+                    const bool full = valid && psw[i] > 0.99;
+                    potential += full ? (1 - w) * (1 - w) : 0;
+                    num += full ? 1 : 0;
+                }
 
                 //evaluate slice potential
                 if (num > 0)
-                    slice_potential[inputIndex] = sqrt(slice_potential[inputIndex] / num);
+                    slice_potential[inputIndex] = sqrt((slice_potential[inputIndex] + potential) / num);
                 else
                     slice_potential[inputIndex] = -1; // slice has no unpadded voxels
             }
@@ -2194,23 +2103,25 @@ namespace svrtk::Parallel {
 
         void operator()(const blocked_range<size_t>& r) const {
             for (size_t inputIndex = r.begin(); inputIndex != r.end(); inputIndex++) {
-                //alias the current bias image
-                const RealImage& b = reconstructor->_bias[inputIndex];
+                //alias the current slice, its bias-corrected version, weights and simulation
+                const RealPixel *ps = reconstructor->_slices[inputIndex].Data();
+                const RealPixel *pc = reconstructor->_corrected_slices[inputIndex].Data();
+                const RealPixel *pw = reconstructor->_weights[inputIndex].Data();
+                const RealPixel *psim = reconstructor->_simulated_slices[inputIndex].Data();
+                const RealPixel *psw = reconstructor->_simulated_weights[inputIndex].Data();
+                const int n = reconstructor->_slices[inputIndex].NumberOfVoxels();
 
                 //initialise calculation of scale
                 double scalenum = 0;
                 double scaleden = 0;
 
-                for (int i = 0; i < reconstructor->_slices[inputIndex].GetX(); i++)
-                    for (int j = 0; j < reconstructor->_slices[inputIndex].GetY(); j++)
-                        if (reconstructor->_slices[inputIndex](i, j, 0) > -0.01) {
-                            if (reconstructor->_simulated_weights[inputIndex](i, j, 0) > 0.99) {
-                                //scale - intensity matching
-                                const double eb = exp(-b(i, j, 0));
-                                scalenum += reconstructor->_weights[inputIndex](i, j, 0) * reconstructor->_slices[inputIndex](i, j, 0) * eb * reconstructor->_simulated_slices[inputIndex](i, j, 0);
-                                scaleden += reconstructor->_weights[inputIndex](i, j, 0) * reconstructor->_slices[inputIndex](i, j, 0) * eb * reconstructor->_slices[inputIndex](i, j, 0) * eb;
-                            }
-                        }
+                //scale - intensity matching
+                #pragma omp simd reduction(+: scalenum, scaleden)
+                for (int i = 0; i < n; i++) {
+                    const double wc = ps[i] > -0.01 && psw[i] > 0.99 ? pw[i] * pc[i] : 0;
+                    scalenum += wc * psim[i];
+                    scaleden += wc * pc[i];
+                }
 
                 //calculate scale for this slice
                 reconstructor->_scale[inputIndex] = scaleden > 0 ? scalenum / scaleden : 1;
@@ -2232,41 +2143,49 @@ namespace svrtk::Parallel {
         Bias(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) const {
-            RealImage slice, wb, wresidual;
+            RealImage wb, wresidual;
             GaussianBlurring<RealPixel> gb(reconstructor->_sigma_bias);
 
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
-                // read the current slice
-                slice = reconstructor->_slices[inputIndex];
+                // alias the current slice and its bias-corrected version
+                const RealImage& slice = reconstructor->_slices[inputIndex];
+                const RealPixel *ps = slice.Data();
+                const RealPixel *pc = reconstructor->_corrected_slices[inputIndex].Data();
+                const RealPixel *psim = reconstructor->_simulated_slices[inputIndex].Data();
+                const RealPixel *psw = reconstructor->_simulated_weights[inputIndex].Data();
+                const double scale = reconstructor->_scale[inputIndex];
+                const int n = slice.NumberOfVoxels();
 
                 //alias the current bias image
                 RealImage& b = reconstructor->_bias[inputIndex];
+                RealPixel *pb = b.Data();
 
                 //prepare weight image for bias field
                 wb = reconstructor->_weights[inputIndex];
-
                 wresidual.Initialize(slice.Attributes());
-
-                for (int i = 0; i < slice.GetX(); i++)
-                    for (int j = 0; j < slice.GetY(); j++)
-                        if (slice(i, j, 0) > -0.01) {
-                            if (reconstructor->_simulated_weights[inputIndex](i, j, 0) > 0.99) {
-                                //bias-correct and scale current slice
-                                const double eb = exp(-b(i, j, 0));
-                                slice(i, j, 0) *= eb * reconstructor->_scale[inputIndex];
-
-                                //calculate weight image
-                                wb(i, j, 0) *= slice(i, j, 0);
-
-                                //calculate weighted residual image make sure it is far from zero to avoid numerical instability
-                                if ((reconstructor->_simulated_slices[inputIndex](i, j, 0) > 1) && (slice(i, j, 0) > 1))
-                                    wresidual(i, j, 0) = log(slice(i, j, 0) / reconstructor->_simulated_slices[inputIndex](i, j, 0)) * wb(i, j, 0);
-                            } else {
-                                //do not take into account this voxel when calculating bias field
-                                wresidual(i, j, 0) = 0;
-                                wb(i, j, 0) = 0;
-                            }
+                RealPixel *pwb = wb.Data();
+                RealPixel *pwr = wresidual.Data();
+
+                #pragma omp simd
+                for (int i = 0; i < n; i++) {
+                    if (ps[i] > -0.01) {
+                        if (psw[i] > 0.99) {
+                            //bias-corrected and scaled current slice
+                            const double sc = pc[i] * scale;
+
+                            //calculate weight image
+                            pwb[i] *= sc;
+
+                            //calculate weighted residual image make sure it is far from zero to avoid numerical instability
+                            if (psim[i] > 1 && sc > 1)
+                                pwr[i] = log(sc / psim[i]) * pwb[i];
+                        } else {
+                            //do not take into account this voxel when calculating bias field
+                            pwr[i] = 0;
+                            pwb[i] = 0;
                         }
+                    }
+                }
 
                 //calculate bias field for this slice
                 //smooth weighted residual
@@ -2282,23 +2201,27 @@ namespace svrtk::Parallel {
                 //update bias field
                 double sum = 0;
                 double num = 0;
-                for (int i = 0; i < slice.GetX(); i++)
-                    for (int j = 0; j < slice.GetY(); j++)
-                        if (slice(i, j, 0) > -0.01) {
-                            if (wb(i, j, 0) > 0)
-                                b(i, j, 0) += wresidual(i, j, 0) / wb(i, j, 0);
-                            sum += b(i, j, 0);
-                            num++;
-                        }
+                #pragma omp simd reduction(+: sum, num)
+                for (int i = 0; i < n; i++) {
+                    if (ps[i] > -0.01) {
+                        if (pwb[i] > 0)
+                            pb[i] += pwr[i] / pwb[i];
+                        sum += pb[i];
+                        num++;
+                    }
+                }
 
                 //normalize bias field to have zero mean
                 if (!reconstructor->_global_bias_correction && num > 0) {
                     const double mean = sum / num;
-                    for (int i = 0; i < slice.GetX(); i++)
-                        for (int j = 0; j < slice.GetY(); j++)
-                            if (slice(i, j, 0) > -0.01)
-                                b(i, j, 0) -= mean;
+                    #pragma omp simd
+                    for (int i = 0; i < n; i++)
+                        if (ps[i] > -0.01)
+                            pb[i] -= mean;
                 }
+
+                //the bias-corrected slice has to be recomputed
+                reconstructor->_corrected_slices_dirty[inputIndex] = 1;
             }
         }
 
@@ -2316,7 +2239,7 @@ namespace svrtk::Parallel {
     public:
         RealImage confidence_map;
         RealImage addon;
-        Array<RealImage> mc_addons;
+        MultiChannelImage mc_addon;
 
         Superresolution(Reconstruction *reconstructor) : reconstructor(reconstructor) {
             //Clear addon
@@ -2325,18 +2248,18 @@ namespace svrtk::Parallel {
             //Clear confidence map
             confidence_map.Initialize(reconstructor->_reconstructed.Attributes());
 
-            if (reconstructor->_multiple_channels_flag) {
-                mc_addons.clear();
-                for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                    mc_addons.push_back(addon);
-                }
-            }
+            //one channel-packed addon for all channels
+            if (reconstructor->_multiple_channels_flag && reconstructor->_number_of_channels > 0)
+                mc_addon.Initialize(reconstructor->_reconstructed.Attributes(), reconstructor->_number_of_channels);
 
         }
 
         Superresolution(Superresolution& x, split) : Superresolution(x.reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) {
+            const int nx = addon.GetX(), ny = addon.GetY();
+            const int nc = mc_addon.Channels();
+
             //Update reconstructed volume using current slice
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
                 //Distribute error to the volume
@@ -2353,13 +2276,15 @@ namespace svrtk::Parallel {
                             if (reconstructor->_simulated_slices[inputIndex](i, j, 0) < 0.01) {
                                 reconstructor->_slice_dif[inputIndex](i, j, 0) = 0;
 
-                                if (reconstructor->_multiple_channels_flag) {
-                                    for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                        reconstructor->_mc_slice_dif[inputIndex][nc]->PutAsDouble(i, j, 0, 0);
-                                    }
+                                if (nc > 0) {
+                                    RealPixel *mc_dif = reconstructor->_mc_slice_dif[inputIndex](i, j, 0);
+                                    for (int n = 0; n < nc; n++)
+                                        mc_dif[n] = 0;
                                 }
                             }
 
+                            const RealPixel *mc_dif = nc > 0 ? reconstructor->_mc_slice_dif[inputIndex](i, j, 0) : nullptr;
+
 
                             #pragma omp simd
                             for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
@@ -2369,22 +2294,18 @@ namespace svrtk::Parallel {
                                 if (reconstructor->_structural)
                                     ssim_weight = reconstructor->_slice_ssim_maps[inputIndex](i, j, 0);
 
-                                bool include_flag = true;
-                                if (reconstructor->_ffd) {
-                                    double jac = reconstructor->_mffd_transformations[inputIndex]->Jacobian(p.x, p.y, p.z, 0, 0);
-                                    if ((100*jac) < reconstructor->_global_JAC_threshold)
-                                        include_flag = false;
-                                }
+                                const bool include_flag = !reconstructor->JacobianExcluded(inputIndex, p.x + nx * (p.y + ny * p.z));
 
                                 if (include_flag) {
                                     addon(p.x, p.y, p.z) += ssim_weight * multiplier * p.value * reconstructor->_slice_weight[inputIndex] * reconstructor->_slice_dif[inputIndex](i, j, 0);
 
                                     confidence_map(p.x, p.y, p.z) += ssim_weight * multiplier * p.value * reconstructor->_slice_weight[inputIndex];
 
-                                    if (reconstructor->_multiple_channels_flag) {
-                                        for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                                            mc_addons[nc](p.x, p.y, p.z) += ssim_weight * multiplier * p.value * reconstructor->_slice_weight[inputIndex] * reconstructor->_mc_slice_dif[inputIndex][nc]->GetAsDouble(i, j, 0);
-                                        }
+                                    if (nc > 0) {
+                                        const double weight = ssim_weight * multiplier * p.value * reconstructor->_slice_weight[inputIndex];
+                                        RealPixel *mc_value = mc_addon(p.x, p.y, p.z);
+                                        for (int n = 0; n < nc; n++)
+                                            mc_value[n] += weight * mc_dif[n];
                                     }
 
                                 }
@@ -2399,11 +2320,8 @@ namespace svrtk::Parallel {
             addon += y.addon;
             confidence_map += y.confidence_map;
 
-            if (reconstructor->_multiple_channels_flag) {
-                for (int nc=0; nc<reconstructor->_number_of_channels; nc++) {
-                    mc_addons[nc] += y.mc_addons[nc];
-                }
-            }
+            if (mc_addon.Channels() > 0)
+                mc_addon += y.mc_addon;
 
         }
 
@@ -2414,6 +2332,86 @@ namespace svrtk::Parallel {
 
     //-------------------------------------------------------------------
 
+    /// Superresolution update gathered per volume voxel through the transposed coefficients
+    class SuperresolutionGather {
+        Reconstruction *reconstructor;
+
+    public:
+        RealImage confidence_map;
+        RealImage addon;
+        MultiChannelImage mc_addon;
+
+        SuperresolutionGather(Reconstruction *reconstructor) : reconstructor(reconstructor) {
+            addon.Initialize(reconstructor->_reconstructed.Attributes());
+            confidence_map.Initialize(reconstructor->_reconstructed.Attributes());
+            if (reconstructor->_multiple_channels_flag && reconstructor->_number_of_channels > 0)
+                mc_addon.Initialize(reconstructor->_reconstructed.Attributes(), reconstructor->_number_of_channels);
+        }
+
+        void operator()() {
+            const int nc = mc_addon.Channels();
+
+            //differences of slice voxels without simulated signal are discarded (as in Superresolution)
+            #pragma omp parallel for
+            for (size_t inputIndex = 0; inputIndex < reconstructor->_slices.size(); inputIndex++) {
+                const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
+                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                        if (slice(i, j, 0) > -0.01 && reconstructor->_simulated_slices[inputIndex](i, j, 0) < 0.01) {
+                            reconstructor->_slice_dif[inputIndex](i, j, 0) = 0;
+                            if (nc > 0)
+                                fill_n(reconstructor->_mc_slice_dif[inputIndex](i, j, 0), nc, 0);
+                        }
+            }
+
+            const TransposedCoefficients& coeffs = reconstructor->_transposed_coeffs;
+            const size_t nx = addon.GetX(), ny = addon.GetY();
+            RealPixel *pa = addon.Data();
+            RealPixel *pc = confidence_map.Data();
+
+            //every volume voxel sums its own contributions - no reduction is needed
+            #pragma omp parallel
+            {
+                Array<double> mc_sum(nc);
+
+                #pragma omp for schedule(guided)
+                for (size_t v = 0; v < coeffs.NumberOfVoxels(); v++) {
+                    double sum = 0, confidence = 0;
+                    fill(mc_sum.begin(), mc_sum.end(), 0);
+
+                    for (auto c = coeffs.Begin(v); c != coeffs.End(v); c++) {
+                        const int inputIndex = c->slice, i = c->i, j = c->j;
+                        const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                        if (!(slice(i, j, 0) > -0.01))
+                            continue;
+
+                        if (reconstructor->JacobianExcluded(inputIndex, v))
+                            continue;
+
+                        const auto multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_weights[inputIndex](i, j, 0);
+                        const double ssim_weight = reconstructor->_structural ? reconstructor->_slice_ssim_maps[inputIndex](i, j, 0) : 1;
+                        const double weight = ssim_weight * multiplier * c->value * reconstructor->_slice_weight[inputIndex];
+
+                        sum += weight * reconstructor->_slice_dif[inputIndex](i, j, 0);
+                        confidence += weight;
+                        if (nc > 0) {
+                            const RealPixel *mc_dif = reconstructor->_mc_slice_dif[inputIndex](i, j, 0);
+                            for (int n = 0; n < nc; n++)
+                                mc_sum[n] += weight * mc_dif[n];
+                        }
+                    }
+
+                    pa[v] = sum;
+                    pc[v] = confidence;
+                    if (nc > 0)
+                        copy(mc_sum.begin(), mc_sum.end(), mc_addon.Voxel(v));
+                }
+            }
+        }
+    };
+
+    //-------------------------------------------------------------------
+
     class SuperresolutionCardiac4D {
         ReconstructionCardiac4D *reconstructor;
 
@@ -2482,20 +2480,31 @@ namespace svrtk::Parallel {
     /// Gradient descend step of velocity estimation
     class SuperresolutionCardiacVelocity4D {
         ReconstructionCardiacVelocity4D *reconstructor;
+        /// Addons of all velocity components packed per voxel and phase
+        PackedVelocityField packed_addons;
+        /// Confidence (the same for all velocity components)
+        PackedVelocityField packed_confidence;
 
     public:
         Array<RealImage> confidence_maps;
-        Array<RealImage> addons_p;
-        Array<RealImage> addons_n;
         Array<RealImage> addons;
 
         SuperresolutionCardiacVelocity4D(ReconstructionCardiacVelocity4D *reconstructor) : reconstructor(reconstructor) {
-            addons = confidence_maps = Array<RealImage>(reconstructor->_reconstructed5DVelocity.size(), RealImage(reconstructor->_reconstructed4D.Attributes()));
+            const RealImage& rec = reconstructor->_reconstructed4D;
+            const size_t voxels = (size_t)rec.GetX() * rec.GetY() * rec.GetZ();
+            packed_addons.Initialize(voxels, rec.GetT(), reconstructor->_v_directions.size());
+            packed_confidence.Initialize(voxels, rec.GetT(), 1);
         }
 
         SuperresolutionCardiacVelocity4D(SuperresolutionCardiacVelocity4D& x, split) : SuperresolutionCardiacVelocity4D(x.reconstructor) {}
 
         void operator()(const blocked_range<size_t>& r) {
+            const int phases = packed_addons.Phases();
+            const int components = packed_addons.Components();
+            const int nx = reconstructor->_reconstructed4D.GetX();
+            const int ny = reconstructor->_reconstructed4D.GetY();
+            Array<double> temporal_weight(phases), v_component(components);
+
             for (size_t inputIndex = r.begin(); inputIndex < r.end(); inputIndex++) {
                 if (reconstructor->_volcoeffs[inputIndex].empty())
                     continue;
@@ -2520,43 +2529,57 @@ namespace svrtk::Parallel {
                 const int gradientIndex = reconstructor->_stack_index[inputIndex];
                 const double gval = reconstructor->_g_values[gradientIndex];
 
-                // Update reconstructed velocity volumes using current slice
-                for (size_t velocityIndex = 0; velocityIndex < reconstructor->_v_directions.size(); velocityIndex++) {
-                    // Compute current velocity component factor
-                    const double v_component = reconstructor->_slice_g_directions[inputIndex][velocityIndex] / (3 * reconstructor->gamma * gval);
+                // Compute current velocity component factors
+                for (int velocityIndex = 0; velocityIndex < components; velocityIndex++)
+                    v_component[velocityIndex] = reconstructor->_slice_g_directions[inputIndex][velocityIndex] / (3 * reconstructor->gamma * gval);
 
-                    // Distribute error to the volume
-                    for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
-                        for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
-                            if (slice(i, j, 0) > -10) {
-                                if (sim(i, j, 0) < -10)
-                                    slice(i, j, 0) = 0;
+                for (int outputIndex = 0; outputIndex < phases; outputIndex++)
+                    temporal_weight[outputIndex] = reconstructor->_slice_temporal_weight[outputIndex][inputIndex];
 
-                                for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
-                                    const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
-                                    if (p.value > 0.0) {
-                                        for (int outputIndex = 0; outputIndex < reconstructor->_reconstructed4D.GetT(); outputIndex++) {
-                                            const auto multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_slice_weight[inputIndex];
-                                            addons[velocityIndex](p.x, p.y, p.z, outputIndex) += v_component * reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * slice(i, j, 0) * w(i, j, 0) * multiplier;
-                                            confidence_maps[velocityIndex](p.x, p.y, p.z, outputIndex) += reconstructor->_slice_temporal_weight[outputIndex][inputIndex] * p.value * w(i, j, 0) * multiplier;
-                                        }
+                const double multiplier = reconstructor->_robust_slices_only ? 1 : reconstructor->_slice_weight[inputIndex];
+
+                // Distribute error of all velocity components to the volume at once
+                for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
+                    for (size_t j = 0; j < reconstructor->_volcoeffs[inputIndex][i].size(); j++)
+                        if (slice(i, j, 0) > -10) {
+                            if (sim(i, j, 0) < -10)
+                                slice(i, j, 0) = 0;
+
+                            const double confidence = w(i, j, 0) * multiplier;
+                            const double error = slice(i, j, 0) * confidence;
+
+                            for (size_t k = 0; k < reconstructor->_volcoeffs[inputIndex][i][j].size(); k++) {
+                                const POINT3D& p = reconstructor->_volcoeffs[inputIndex][i][j][k];
+                                if (p.value > 0.0) {
+                                    const size_t index = p.x + (size_t)nx * (p.y + (size_t)ny * p.z);
+                                    RealPixel *pa = packed_addons.Voxel(index);
+                                    RealPixel *pc = packed_confidence.Voxel(index);
+                                    for (int outputIndex = 0; outputIndex < phases; outputIndex++, pa += components) {
+                                        const double tw = temporal_weight[outputIndex] * p.value;
+                                        for (int velocityIndex = 0; velocityIndex < components; velocityIndex++)
+                                            pa[velocityIndex] += v_component[velocityIndex] * tw * error;
+                                        pc[outputIndex] += tw * confidence;
                                     }
                                 }
                             }
-                } // end of loop for velocity directions
+                        }
             } //end of loop for a slice inputIndex
         }
 
         void join(const SuperresolutionCardiacVelocity4D& y) {
-            for (size_t i = 0; i < addons.size(); i++) {
-                addons[i] += y.addons[i];
-                confidence_maps[i] += y.confidence_maps[i];
-            }
+            packed_addons += y.packed_addons;
+            packed_confidence += y.packed_confidence;
         }
 
         // execute
         void operator() () {
             parallel_reduce(blocked_range<size_t>(0, reconstructor->_slices.size()), *this);
+
+            const ImageAttributes& attr = reconstructor->_reconstructed4D.Attributes();
+            packed_addons.Unpack(addons, attr);
+            Array<RealImage> confidence;
+            packed_confidence.Unpack(confidence, attr);
+            confidence_maps = Array<RealImage>(packed_addons.Components(), confidence[0]);
         }
     };
 
@@ -2896,7 +2919,7 @@ namespace svrtk::Parallel {
                             }
 
                             val -= sum * original(x, y, z);
-                            val = original(x, y, z) + reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
+                            val = original(x, y, z) + reconstructor->_alpha * reconstructor->_lambda * reconstructor->_level_regularisation / (reconstructor->_delta * reconstructor->_delta) * val;
                             reconstructor->_reconstructed(x, y, z) = val;
                         }
             }
@@ -2964,7 +2987,7 @@ namespace svrtk::Parallel {
                             }
                         }
                         val -= sum * original[nc](x, y, z);
-                        val = original[nc](x, y, z) + reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
+                        val = original[nc](x, y, z) + reconstructor->_alpha * reconstructor->_lambda * reconstructor->_level_regularisation / (reconstructor->_delta * reconstructor->_delta) * val;
                         reconstructor->_mc_reconstructed[nc](x, y, z) = val;
                     }
                 }
@@ -3124,11 +3147,16 @@ namespace svrtk::Parallel {
                 //read current scale factor
                 const double scale = reconstructor->_scale[inputIndex];
 
-                const RealPixel *pi = slice.Data();
-                RealPixel *pb = b.Data();
-                for (int i = 0; i < slice.NumberOfVoxels(); i++)
-                    if (pi[i] > -1 && scale > 0)
-                        pb[i] -= log(scale);
+                if (scale > 0) {
+                    const double log_scale = log(scale);
+                    const RealPixel *pi = slice.Data();
+                    RealPixel *pb = b.Data();
+                    const int n = slice.NumberOfVoxels();
+                    #pragma omp simd
+                    for (int i = 0; i < n; i++)
+                        if (pi[i] > -1)
+                            pb[i] -= log_scale;
+                }
 
                 //Distribute slice intensities to the volume
                 for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
@@ -3155,6 +3183,169 @@ namespace svrtk::Parallel {
 
     //-------------------------------------------------------------------
 
+    /// Bias normalisation gathered per volume voxel through the transposed coefficients
+    class NormaliseBiasGather {
+        Reconstruction *reconstructor;
+
+    public:
+        RealImage bias;
+
+        NormaliseBiasGather(Reconstruction *reconstructor) : reconstructor(reconstructor) {
+            bias.Initialize(reconstructor->_reconstructed.Attributes());
+        }
+
+        void operator()() {
+            Array<double> log_scale(reconstructor->_slices.size());
+            for (size_t inputIndex = 0; inputIndex < log_scale.size(); inputIndex++)
+                log_scale[inputIndex] = reconstructor->_scale[inputIndex] > 0 ? log(reconstructor->_scale[inputIndex]) : 0;
+
+            const TransposedCoefficients& coeffs = reconstructor->_transposed_coeffs;
+            RealPixel *pb = bias.Data();
+
+            #pragma omp parallel for schedule(guided)
+            for (size_t v = 0; v < coeffs.NumberOfVoxels(); v++) {
+                double sum = 0;
+                for (auto c = coeffs.Begin(v); c != coeffs.End(v); c++) {
+                    const int inputIndex = c->slice, i = c->i, j = c->j;
+                    const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                    if (!(slice(i, j, 0) > -0.01))
+                        continue;
+
+                    //bias of the slice voxel corrected by the scale factor
+                    RealPixel b = reconstructor->_bias[inputIndex](i, j, 0);
+                    b -= log_scale[inputIndex];
+                    sum += c->value * b;
+                }
+                pb[v] = sum;
+            }
+        }
+    };
+
+    //-------------------------------------------------------------------
+
+    /// Gaussian reconstruction gathered per volume voxel through the transposed coefficients
+    class GaussianReconstructionGather {
+        Reconstruction *reconstructor;
+
+    public:
+        /// Number of slice voxels overlapping the volume (slices with coefficients only)
+        Array<int> voxel_num;
+
+        GaussianReconstructionGather(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
+
+        void operator()() {
+            const size_t nslices = reconstructor->_slices.size();
+            const int nc = reconstructor->_multiple_channels_flag && reconstructor->_number_of_channels > 0 ? reconstructor->_number_of_channels : 0;
+
+            //slice voxels contributing to the volume
+            Array<Array<char>> include(nslices);
+            Array<int> slice_vox_num(nslices, 0);
+            #pragma omp parallel for schedule(dynamic)
+            for (size_t inputIndex = 0; inputIndex < nslices; inputIndex++) {
+                const RealImage& slice = reconstructor->_no_masking_background ? reconstructor->_not_masked_slices[inputIndex] : reconstructor->_slices[inputIndex];
+                const SLICECOEFFS& slicecoeffs = reconstructor->_volcoeffs[inputIndex];
+                include[inputIndex].assign(slice.GetX() * slice.GetY(), 0);
+                for (size_t i = 0; i < slicecoeffs.size(); i++)
+                    for (size_t j = 0; j < slicecoeffs[i].size(); j++)
+                        if (slice(i, j, 0) > -0.01 && reconstructor->JacobianIncluded(inputIndex, i, j)) {
+                            include[inputIndex][i * slice.GetY() + j] = 1;
+                            if (!slicecoeffs[i][j].empty())
+                                slice_vox_num[inputIndex]++;
+                        }
+            }
+
+            voxel_num.clear();
+            for (size_t inputIndex = 0; inputIndex < nslices; inputIndex++)
+                if (!reconstructor->_volcoeffs[inputIndex].empty())
+                    voxel_num.push_back(slice_vox_num[inputIndex]);
+
+            const TransposedCoefficients& coeffs = reconstructor->_transposed_coeffs;
+            RealPixel *pr = reconstructor->_reconstructed.Data();
+
+            //contributions are summed in the order of the serial scatter
+            #pragma omp parallel
+            {
+                Array<RealPixel> mc_sum(nc);
+
+                #pragma omp for schedule(guided)
+                for (size_t v = 0; v < coeffs.NumberOfVoxels(); v++) {
+                    RealPixel sum = 0;
+                    fill(mc_sum.begin(), mc_sum.end(), 0);
+
+                    for (auto c = coeffs.Begin(v); c != coeffs.End(v); c++) {
+                        const int inputIndex = c->slice, i = c->i, j = c->j;
+                        if (!include[inputIndex][i * reconstructor->_slices[inputIndex].GetY() + j])
+                            continue;
+
+                        //biascorrected and scaled slice value
+                        const double scale = reconstructor->_scale[inputIndex];
+                        sum += c->value * (reconstructor->_corrected_slices[inputIndex](i, j, 0) * scale);
+
+                        if (nc > 0) {
+                            const double eb = exp(-reconstructor->_bias[inputIndex](i, j, 0)) * scale;
+                            const RealPixel *mc_value = reconstructor->_mc_slices[inputIndex](i, j, 0);
+                            for (int n = 0; n < nc; n++) {
+                                RealPixel value = mc_value[n];
+                                value *= eb;
+                                mc_sum[n] += c->value * value;
+                            }
+                        }
+                    }
+
+                    pr[v] = sum;
+                    for (int n = 0; n < nc; n++)
+                        reconstructor->_mc_reconstructed[n].Data()[v] = mc_sum[n];
+                }
+            }
+        }
+    };
+
+    //-------------------------------------------------------------------
+
+    /// Volume weights gathered per volume voxel through the transposed coefficients
+    class VolumeWeightsGather {
+        Reconstruction *reconstructor;
+
+    public:
+        VolumeWeightsGather(Reconstruction *reconstructor) : reconstructor(reconstructor) {}
+
+        void operator()() {
+            const size_t nslices = reconstructor->_slices.size();
+
+            //slice voxels contributing to the volume weights
+            Array<Array<char>> include(nslices);
+            #pragma omp parallel for schedule(dynamic)
+            for (size_t inputIndex = 0; inputIndex < nslices; inputIndex++) {
+                bool excluded = reconstructor->_structural_slice_weight[inputIndex] < 0.5;
+                for (size_t fe = 0; fe < reconstructor->_force_excluded.size(); fe++)
+                    if (inputIndex == reconstructor->_force_excluded[fe])
+                        excluded = true;
+
+                const RealImage& slice = reconstructor->_slices[inputIndex];
+                include[inputIndex].assign(slice.GetX() * slice.GetY(), excluded ? 0 : 1);
+                if (!excluded && reconstructor->_ffd)
+                    for (int i = 0; i < slice.GetX(); i++)
+                        for (int j = 0; j < slice.GetY(); j++)
+                            if (!reconstructor->_volcoeffs[inputIndex][i][j].empty())
+                                include[inputIndex][i * slice.GetY() + j] = reconstructor->JacobianIncluded(inputIndex, i, j);
+            }
+
+            const TransposedCoefficients& coeffs = reconstructor->_transposed_coeffs;
+            RealPixel *pw = reconstructor->_volume_weights.Data();
+
+            #pragma omp parallel for schedule(guided)
+            for (size_t v = 0; v < coeffs.NumberOfVoxels(); v++) {
+                RealPixel sum = 0;
+                for (auto c = coeffs.Begin(v); c != coeffs.End(v); c++)
+                    if (include[c->slice][c->i * reconstructor->_slices[c->slice].GetY() + c->j])
+                        sum += c->value;
+                pw[v] = sum;
+            }
+        }
+    };
+
+    //-------------------------------------------------------------------
+
     class NormaliseBiasCardiac4D {
         ReconstructionCardiac4D *reconstructor;
 
@@ -3189,11 +3380,16 @@ namespace svrtk::Parallel {
                 //read current scale factor
                 const double scale = reconstructor->_scale[inputIndex];
 
-                const RealPixel *pi = slice.Data();
-                RealPixel *pb = b.Data();
-                for (int i = 0; i < slice.NumberOfVoxels(); i++)
-                    if (pi[i] > -1 && scale > 0)
-                        pb[i] -= log(scale);
+                if (scale > 0) {
+                    const double log_scale = log(scale);
+                    const RealPixel *pi = slice.Data();
+                    RealPixel *pb = b.Data();
+                    const int n = slice.NumberOfVoxels();
+                    #pragma omp simd
+                    for (int i = 0; i < n; i++)
+                        if (pi[i] > -1)
+                            pb[i] -= log_scale;
+                }
 
                 //Distribute slice intensities to the volume
                 for (size_t i = 0; i < reconstructor->_volcoeffs[inputIndex].size(); i++)
@@ -3286,7 +3482,7 @@ namespace svrtk::Parallel {
                             //bias correct and scale the voxel
                             slice(i, j, 0) *= exp(-reconstructor->_bias[inputIndex](i, j, 0)) * reconstructor->_scale[inputIndex];
 
-                reconstructor->_corrected_slices[inputIndex] = move(slice);
+                reconstructor->_corrected_scaled_slices[inputIndex] = move(slice);
             } //end of loop for a slice inputIndex
         }
 
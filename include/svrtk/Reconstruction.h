@@ -21,6 +21,17 @@
 
 // SVRTK
 #include "svrtk/Common.h"
+#include "svrtk/SliceStore.h"
+#include "svrtk/OutputWriter.h"
+#include "svrtk/SliceGeometry.h"
+#include "svrtk/StackRegistration.h"
+#include "svrtk/TransposedCoefficients.h"
+#include "svrtk/TrilinearSplat.h"
+#include "svrtk/TransformationStore.h"
+#include "svrtk/SliceDisplacementField.h"
+#include "svrtk/MultiChannelImage.h"
+#include "svrtk/SVRScheduler.h"
+#include "svrtk/CoefficientCache.h"
 
 using namespace std;
 using namespace mirtk;
@@ -31,20 +42,23 @@ namespace svrtk {
     // Forward declarations
     namespace Parallel {
         class GlobalSimilarityStats;
-        class QualityReport;
-        class StackRegistrations;
+        class SliceResidualStatistics;
         class SliceToVolumeRegistration;
         class SliceToVolumeRegistrationFFD;
         class RemoteSliceToVolumeRegistration;
         class CoeffInit;
         class CoeffInitSF;
         class Superresolution;
+        class SuperresolutionGather;
         class SStep;
         class MStep;
         class EStep;
         class Bias;
         class Scale;
         class NormaliseBias;
+        class NormaliseBiasGather;
+        class GaussianReconstructionGather;
+        class VolumeWeightsGather;
         class SimulateSlices;
         class SimulateMasks;
         class Average;
@@ -54,6 +68,18 @@ namespace svrtk {
         class AdaptiveRegularization2MC;
     }
 
+    /// Residual statistics of a slice against its simulated slice
+    struct SliceResidualStats {
+        /// NCC between the slice and the simulated slice (-1 - too few voxels)
+        double ncc = 0;
+        /// RMS difference of the corrected slice relative to its mean intensity
+        double nrmse = 0;
+        /// Whether the slice is excluded by its slice weight or structurally
+        bool excluded = false;
+        /// Whether the slice is excluded structurally
+        bool structural_excluded = false;
+    };
+
     /**
      * @brief Reconstruction class used reconstruction.
      */
@@ -66,6 +92,28 @@ namespace svrtk {
         Array<SLICECOEFFS> _volcoeffs;
         Array<SLICECOEFFS> _volcoeffsSF;
 
+        /// Volume-to-slice index of _volcoeffs for the stages updating the volume by gathering
+        TransposedCoefficients _transposed_coeffs;
+        /// Stages using the transposed coefficients (combination of CoeffStage flags)
+        int _gather_stages;
+        /// Memory budget of the transposed coefficients in MB (0 - unlimited)
+        double _gather_memory;
+
+        /// Whether coefficients are generated by the vectorised trilinear kernel
+        bool _trilinear_splat;
+        /// Relative weight below which coefficients are pruned (0 - no pruning)
+        double _coeff_prune_threshold;
+        /// Pruning statistics of each slice from the last CoeffInit
+        Array<CoeffPruningStats> _coeff_pruning;
+
+        /// Largest interpolation error of the cached FFD slice maps in volume voxels (0 - exact evaluation)
+        double _ffd_field_tolerance;
+        /// Measured error of the cached FFD map of each slice from the last CoeffInit (-1 - not cached)
+        Array<double> _ffd_field_error;
+
+        /// Persistent cache of the coefficients (disabled unless a directory is set)
+        CoefficientCache _coeff_cache;
+
         /// flags
         int _slicePerDyn;
         bool _ffd;
@@ -84,11 +132,23 @@ namespace svrtk {
         int _local_SSIM_window_size;
         double _local_SSIM_threshold;
         double _global_JAC_threshold;
+        /// Slice pixels whose FFD Jacobian passes the threshold (i * Y + j; cached in CoeffInit)
+        Array<Array<char>> _jac_pixel_include;
+        /// Sorted volume voxels excluded from the superresolution of each slice by the FFD Jacobian
+        Array<Array<int>> _jac_excluded_voxels;
         
         Array<int> _n_packages;
 
         ImageAttributes _attr_reconstructed;
 
+        /// Grid and mask of the template (finest level of the resolution schedule)
+        ImageAttributes _attr_template;
+        RealImage _mask_template;
+        /// Resolution of the current level of the resolution schedule
+        double _level_resolution;
+        /// Scaling of the regularisation step for the current level
+        double _level_regularisation;
+
         Array<Matrix> _offset_matrices;
         bool _saved_slices;
         Array<int> _zero_slices;
@@ -110,11 +170,23 @@ namespace svrtk {
         Array<ImageAttributes> _slice_attributes;
         Array<RealImage> _slice_dif;
         
+        /// Slices before masking (views of the SVR targets where these match)
         Array<RealImage> _not_masked_slices;
 
-        Array<GreyImage> _grey_slices;
+        /// Unmasked slices registered in SVR (views of the input stacks unless blurred)
+        Array<RealImage> _grey_slices;
         GreyImage _grey_reconstructed;
 
+        /// Contiguous (optionally memory-mapped) storage of the per-slice images
+        SliceStore _slice_store;
+        bool _use_slice_store;
+        string _slice_store_file;
+
+        /// Asynchronous output writer (outputs are written synchronously if not set)
+        unique_ptr<OutputWriter> _output_writer;
+        /// Pack per-slice outputs into single multi-volume files
+        bool _pack_slice_outputs;
+
         Array<int> _structural_slice_weight;
         Array<int> _package_index;
         Array<int> _slice_pos;
@@ -123,9 +195,12 @@ namespace svrtk {
         Array<RigidTransformation> _transformations;
         Array<RigidTransformation> _previous_transformations;
         Array<RigidTransformation> _transformationsRwithMB;
-        Array<MultiLevelFreeFormTransformation*> _mffd_transformations;
+        TransformationStore _mffd_transformations;
         Array<MultiLevelFreeFormTransformation*> _global_mffd_transformations;
 
+        /// Cached composite slice-to-volume voxel maps of the rigid transformations
+        SliceGeometryCache _slice_geometry;
+
         /// Indicator whether slice has an overlap with volumetric mask
         Array<bool> _slice_inside;
         Array<bool> _slice_insideSF;
@@ -156,11 +231,14 @@ namespace svrtk {
         
         bool _combined_rigid_ffd;
         
-        Array<Array<RealImage*>> _mc_slices;
-        Array<Array<RealImage*>> _mc_simulated_slices;
-        Array<Array<RealImage*>> _mc_slice_dif;
+        /// Channel-packed slices, simulated slices and slice differences of the additional channels
+        Array<MultiChannelImage> _mc_slices;
+        Array<MultiChannelImage> _mc_simulated_slices;
+        Array<MultiChannelImage> _mc_slice_dif;
 
         Array<RealImage> _mc_reconstructed;
+        /// Channel-packed copy of _mc_reconstructed read by the slice kernels
+        MultiChannelImage _mc_reconstructed_packed;
         
         Array<double> _max_intensity_mc;
         Array<double> _min_intensity_mc;
@@ -202,6 +280,28 @@ namespace svrtk {
         /// Slice-dependent scales
         Array<double> _scale;
 
+        /// Bias-corrected slices (slice * exp(-bias)), the scale is applied by the kernels
+        Array<RealImage> _corrected_slices;
+        /// Whether the bias field of a slice changed since its corrected slice was computed
+        Array<int> _corrected_slices_dirty;
+
+        /// Residual statistics of each slice, valid until the slices, weights or simulation change
+        Array<SliceResidualStats> _slice_residuals;
+        bool _slice_residuals_valid;
+
+        /// Convergence tolerances: mean and max TRE of the slice transformations (mm)
+        /// and relative RMS change of the volume between SR iterations (0 - disabled)
+        double _convergence_tre;
+        double _convergence_max_tre;
+        double _convergence_volume;
+        /// TRE of each slice transformation in the last registration (mm, -1 - not registered)
+        Array<double> _slice_tre;
+        /// Volume of the previous SR iteration
+        RealImage _convergence_reference;
+
+        /// Order, skipping and timing of the slice registrations
+        SVRScheduler _svr_scheduler;
+
         /// Quality factor - higher means slower and better
         double _quality_factor;
         /// Intensity min and max
@@ -300,6 +400,13 @@ namespace svrtk {
          */
         double CreateTemplate(const RealImage& stack, double resolution = 0);
 
+        /**
+         * @brief Resample the reconstructed volume and the mask to the given level of the resolution schedule.
+         * The grid covers the same field of view as the template; the finest level is the template grid itself.
+         * @param resolution Isotropic resolution of the level (template resolution if <= 0).
+         */
+        void SetResolutionLevel(double resolution);
+
         /**
          * @brief Create anisotropic template.
          * @param stack Stack to be set as template.
@@ -346,6 +453,8 @@ namespace svrtk {
 
         /**
          * @brief Create slices from the stacks and slice-dependent transformations from stack transformations.
+         * The SVR targets and probability maps of the slices refer to the stacks without copying,
+         * so the stacks and probability maps have to outlive the reconstruction unmodified.
          * @param stacks
          * @param stack_transformations
          * @param thickness
@@ -424,6 +533,8 @@ namespace svrtk {
 
         /// Calculate transformation matrix between slices and voxels
         void CoeffInit();
+        /// Hash the inputs of the coefficients into the key of the coefficient cache
+        void CoeffCacheKey();
         /// Calculate transformation matrix between slices and voxels
         void CoeffInitSF(int begin, int end);
 
@@ -441,6 +552,22 @@ namespace svrtk {
         /// Initalise parameters of EM robust statistics
         void InitializeRobustStatistics();
 
+        /// Move the per-slice images into the contiguous slice store
+        void BindSliceStore();
+
+        /// Recompute the bias-corrected slices whose bias fields have changed
+        void UpdateCorrectedSlices();
+
+        /// Mark all bias-corrected slices as outdated
+        inline void InvalidateCorrectedSlices() {
+            ClearAndResize(_corrected_slices_dirty, _slices.size(), 1);
+        }
+
+        /// Mark the slice residual statistics as outdated
+        inline void InvalidateSliceResiduals() {
+            _slice_residuals_valid = false;
+        }
+
         /// Perform EStep for calculation of voxel-wise and slice-wise posteriors (weights)
         void EStep();
 
@@ -474,6 +601,25 @@ namespace svrtk {
         /// Run slice to volume registration
         void SliceToVolumeRegistration();
 
+        /**
+         * @brief Whether the slice transformations have converged in the last registration.
+         * The TRE between the transformations before and after the registration is
+         * evaluated over the mask (rigid registration only).
+         * @return Whether the mean and max TRE are within the tolerances.
+         */
+        bool RegistrationConverged();
+
+        /// Evaluate the TRE of each slice transformation in the last registration over the mask
+        void UpdateSliceTRE();
+
+        /**
+         * @brief Whether the volume has converged since the previous call.
+         * The relative RMS change over the mask is compared with the tolerance and
+         * the current volume becomes the reference of the next call.
+         * @return Whether the change is within the tolerance.
+         */
+        bool ReconstructionConverged();
+
         /**
          * @brief Run remote slice to volume registration.
          * @param iter
@@ -498,6 +644,17 @@ namespace svrtk {
         /// Mask the volume
         inline void MaskVolume() { MaskImage(_reconstructed, _mask, -1); }
 
+        /// Save image (queued to the asynchronous writer if enabled)
+        void SaveImage(const RealImage& image, const string& filename);
+
+        /**
+         * @brief Save per-slice images, either one file per slice or packed into a single file.
+         * @param images Slice images.
+         * @param name Output name without extension (a slice index is appended unless packed).
+         * @param index Optional labels used in the per-slice file names instead of the slice index.
+         */
+        void SaveSliceImages(const Array<RealImage>& images, const string& name, const Array<int>& index = Array<int>());
+
         /// Save slices
         void SaveSlices();
         /// Save slices with timing info
@@ -533,6 +690,13 @@ namespace svrtk {
          */
         void ReconQualityReport(double& out_ncc, double& out_nrmse, double& average_weight, double& ratio_excluded);
 
+        /**
+         * @brief Residual statistics of all slices against the simulated slices.
+         * Computed in one parallel pass and reused until the slices, weights or simulation change.
+         * @return Statistics of each slice.
+         */
+        const Array<SliceResidualStats>& SliceResiduals();
+
         /**
          * @brief Evaluation based on the number of excluded slices.
          * @param iter
@@ -552,7 +716,7 @@ namespace svrtk {
         /**
          * @brief Simulate stacks from the reconstructed volume to compare how simulation
          * from the reconstructed volume matches the original stacks.
-         * @param stacks
+         * @param stacks Output stacks, copies of the input stacks (the slices refer to the input stacks).
          */
         void SimulateStacks(Array<RealImage>& stacks);
 
@@ -609,21 +773,49 @@ namespace svrtk {
          */
         void Transform2Reconstructed(const int inputIndex, int& i, int& j, int& k, const int mode);
 
+        /// Jacobian of the slice transformation at a slice pixel (1 for rigid reconstructions)
+        double SliceJacobian(size_t inputIndex, int i, int j) const;
+
+        /// Cache the Jacobian-based include masks of all slices for the current coefficients (FFD only)
+        void JacobianMasks();
+
+        /// Whether the Jacobian of a slice pixel passes the threshold (always for rigid reconstructions)
+        inline bool JacobianIncluded(size_t inputIndex, int i, int j) const {
+            return !_ffd || _jac_pixel_include[inputIndex][i * _slices[inputIndex].GetY() + j];
+        }
+
+        /// Whether a volume voxel is excluded from the superresolution of a slice by the Jacobian
+        inline bool JacobianExcluded(size_t inputIndex, int voxel) const {
+            if (!_ffd)
+                return false;
+            const Array<int>& excluded = _jac_excluded_voxels[inputIndex];
+            return !excluded.empty() && binary_search(excluded.begin(), excluded.end(), voxel);
+        }
+
+        /// Whether a stage updates the volume by gathering through the transposed coefficients
+        inline bool Gather(int stage) const {
+            return (_gather_stages & stage) && !_transposed_coeffs.Empty()
+                && _transposed_coeffs.NumberOfVoxels() == (size_t)_reconstructed.NumberOfSpatialPoints();
+        }
+
         friend class Parallel::GlobalSimilarityStats;
-        friend class Parallel::QualityReport;
-        friend class Parallel::StackRegistrations;
+        friend class Parallel::SliceResidualStatistics;
         friend class Parallel::SliceToVolumeRegistration;
         friend class Parallel::SliceToVolumeRegistrationFFD;
         friend class Parallel::RemoteSliceToVolumeRegistration;
         friend class Parallel::CoeffInit;
         friend class Parallel::CoeffInitSF;
         friend class Parallel::Superresolution;
+        friend class Parallel::SuperresolutionGather;
         friend class Parallel::MStep;
         friend class Parallel::EStep;
         friend class Parallel::SStep;
         friend class Parallel::Bias;
         friend class Parallel::Scale;
         friend class Parallel::NormaliseBias;
+        friend class Parallel::NormaliseBiasGather;
+        friend class Parallel::GaussianReconstructionGather;
+        friend class Parallel::VolumeWeightsGather;
         friend class Parallel::SimulateSlices;
         friend class Parallel::SimulateMasks;
         friend class Parallel::Average;
@@ -686,6 +878,11 @@ namespace svrtk {
             _current_iteration = current_iteration;
         }
         
+        /// Return resolution of the current level of the resolution schedule
+        inline double GetLevelResolution() {
+            return _level_resolution;
+        }
+
         /// Return mask
         inline const RealImage& GetMask() {
             return _mask;
@@ -812,6 +1009,106 @@ namespace svrtk {
             _no_masking_background = true;
         }
 
+        /// Keep per-slice images in a contiguous slice store (memory-mapped if a scratch file is given)
+        inline void UseSliceStore(const string& scratch_file = "") {
+            _use_slice_store = true;
+            _slice_store_file = scratch_file;
+        }
+
+        /// Write outputs asynchronously through a bounded queue of the given size
+        inline void UseAsyncOutput(size_t queue_size = 64, int threads = 1) {
+            _output_writer.reset(new OutputWriter(queue_size, threads));
+        }
+
+        /// Pack per-slice outputs (slices, weights, bias fields, simulated slices) into single files
+        inline void PackSliceOutputs(bool flag = true) {
+            _pack_slice_outputs = flag;
+        }
+
+        /// Stages that can update the volume by gathering instead of scattering
+        enum CoeffStage {
+            StageSuperresolution = 1,
+            StageNormaliseBias = 2,
+            StageGaussianReconstruction = 4,
+            StageAll = 7
+        };
+
+        /**
+         * @brief Select the stages updating the volume by gathering through the transposed coefficients.
+         * The index is built in CoeffInit; above the memory budget all stages scatter.
+         * @param stages Combination of CoeffStage flags (0 - scatter only).
+         * @param memory Memory budget of the index in MB (0 - unlimited).
+         */
+        inline void SetGatherStages(int stages, double memory = 0) {
+            _gather_stages = stages;
+            _gather_memory = memory;
+        }
+
+        /**
+         * @brief Set the tolerances of the early stopping of the iterations.
+         * @param tre Mean TRE of the slice transformations between registrations in mm (0 - disabled).
+         * @param max_tre Max TRE of the slice transformations between registrations in mm (0 - not checked).
+         * @param volume Relative RMS change of the volume between SR iterations (0 - disabled).
+         */
+        inline void SetConvergenceTolerances(double tre, double max_tre, double volume) {
+            _convergence_tre = tre;
+            _convergence_max_tre = max_tre;
+            _convergence_volume = volume;
+        }
+
+        /// Forget the volume of the previous SR iteration
+        inline void ResetReconstructionConvergence() {
+            _convergence_reference.Clear();
+        }
+
+        /**
+         * @brief Skip the registration of stable slices (rigid SVR only).
+         * @param tre_tolerance TRE below which a slice transformation is considered unchanged in mm (0 - disabled).
+         * @param revisit Number of iterations after which a skipped slice is registered again.
+         */
+        inline void SetAdaptiveSVR(double tre_tolerance, int revisit) {
+            _svr_scheduler.SetTolerances(tre_tolerance, revisit);
+        }
+
+        /// Adaptive schedule of the slice registrations
+        inline const SVRScheduler& GetSVRScheduler() const {
+            return _svr_scheduler;
+        }
+
+        /**
+         * @brief Generate coefficients with the vectorised trilinear kernel (rigid slice transformations).
+         * @param prune_threshold Coefficients of a slice voxel below this fraction of the largest one are
+         * pruned and the rest renormalised (0 - no pruning).
+         */
+        inline void UseTrilinearSplat(double prune_threshold = 0) {
+            _trilinear_splat = true;
+            _coeff_prune_threshold = prune_threshold;
+        }
+
+        /**
+         * @brief Map FFD slice PSF samples through cached displacement fields.
+         * @param tolerance Largest interpolation error at the map cell centres in volume voxels;
+         * slices above it are evaluated exactly (0 - always exact, the default).
+         */
+        inline void SetFFDFieldTolerance(double tolerance) {
+            _ffd_field_tolerance = tolerance;
+        }
+
+        /**
+         * @brief Load the coefficients from and save them to a cache directory.
+         * @param directory Cache directory (empty - disabled).
+         * @param max_size Size limit of the directory in MB, least recently used files are removed beyond it (0 - unlimited).
+         */
+        inline void SetCoefficientCache(const string& directory, double max_size = 0) {
+            _coeff_cache.SetDirectory(directory, max_size);
+        }
+
+        /// Wait until all queued outputs have been written (throws if any of them failed)
+        inline void FlushOutput() {
+            if (_output_writer)
+                _output_writer->Flush();
+        }
+
         /// Set sigma flag
         inline void SetSigma(double sigma) {
             _sigma_bias = sigma;
@@ -964,6 +1261,7 @@ namespace svrtk {
         /// Set slices
         inline void SetSlices(const Array<RealImage>& slices) {
             _slices = slices;
+            InvalidateCorrectedSlices();
         }
 
         /// Mask stacks with respect to the reconstruction mask and given transformations
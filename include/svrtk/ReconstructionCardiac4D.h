@@ -51,7 +51,8 @@ namespace svrtk {
 
         // Images
         Array<RealImage> _error;
-        Array<RealImage> _corrected_slices;
+        /// Bias-corrected and scaled slices (output only, unlike the unscaled Reconstruction::_corrected_slices)
+        Array<RealImage> _corrected_scaled_slices;
 
         // Reconstructed 4D Cardiac Cine Images
         RealImage _reconstructed4D;
@@ -85,6 +86,9 @@ namespace svrtk {
         // Slice SVR Target Cardiac Phase
         Array<int> _slice_svr_card_index;
 
+        // Reconstructed volume of each cardiac phase used as SVR source (rebuilt every registration pass)
+        Array<GreyImage> _svr_phase_volumes;
+
         // Displacement
         Array<double> _slice_displacement;
         Array<double> _slice_tx;
@@ -214,6 +218,8 @@ namespace svrtk {
 
         /// Calculate target cardiac phase in reconstructed volume for slice-to-volume registration.
         void CalculateSliceToVolumeTargetCardiacPhase();
+        /// Extract the reconstructed volume of each cardiac phase
+        void UpdateSliceToVolumePhaseCache();
         /// Slice-to-volume registration
         void SliceToVolumeRegistrationCardiac4D();
         /**
@@ -416,7 +422,7 @@ namespace svrtk {
 
         /// Initialise corrected slices
         inline void InitCorrectedSlices() {
-            _corrected_slices = _slices;
+            _corrected_scaled_slices = _slices;
         }
 
         /// Initialise error
@@ -482,12 +488,12 @@ namespace svrtk {
 
         /// Save corrected slices
         inline void SaveCorrectedSlices() {
-            Save(_corrected_slices, "Saving corrected images", "correctedimage");
+            Save(_corrected_scaled_slices, "Saving corrected images", "correctedimage");
         }
 
         /// Save corrected slices
         inline void SaveCorrectedSlices(const Array<RealImage>& stacks, int iter = -1, int rec_iter = -1) {
-            Save(_corrected_slices, stacks, iter, rec_iter, "Saving error images as stacks", "correctedstack");
+            Save(_corrected_scaled_slices, stacks, iter, rec_iter, "Saving error images as stacks", "correctedstack");
         }
 
         /// Save error
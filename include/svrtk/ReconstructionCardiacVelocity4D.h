@@ -33,6 +33,67 @@ namespace svrtk {
         class SuperresolutionCardiacVelocity4D;
     }
 
+    /**
+     * @brief Velocity components packed contiguously per voxel and cardiac phase.
+     *
+     * Value of component v at voxel n and phase t is stored at (n * phases + t) * components + v,
+     * so all phases and components of a PSF point are read from one contiguous block.
+     */
+    class PackedVelocityField {
+    protected:
+        size_t _voxels;
+        int _phases;
+        int _components;
+        Array<RealPixel> _data;
+
+    public:
+        PackedVelocityField() : _voxels(0), _phases(0), _components(0) {}
+
+        /// Pack velocity volumes (one 4D image per component)
+        void Pack(const Array<RealImage>& velocities);
+
+        /// Unpack into velocity volumes with the given attributes
+        void Unpack(Array<RealImage>& velocities, const ImageAttributes& attr) const;
+
+        /// Initialise with zeros
+        inline void Initialize(size_t voxels, int phases, int components) {
+            _voxels = voxels;
+            _phases = phases;
+            _components = components;
+            _data.assign(voxels * phases * components, 0);
+        }
+
+        /// Add another field of the same size
+        inline PackedVelocityField& operator+=(const PackedVelocityField& field) {
+            RealPixel *pd = _data.data();
+            const RealPixel *pf = field._data.data();
+            #pragma omp simd
+            for (size_t i = 0; i < _data.size(); i++)
+                pd[i] += pf[i];
+            return *this;
+        }
+
+        /// Return the values of all phases and components of the voxel
+        inline RealPixel *Voxel(size_t index) {
+            return _data.data() + index * _phases * _components;
+        }
+
+        /// Return the values of all phases and components of the voxel
+        inline const RealPixel *Voxel(size_t index) const {
+            return _data.data() + index * _phases * _components;
+        }
+
+        /// Return number of cardiac phases
+        inline int Phases() const {
+            return _phases;
+        }
+
+        /// Return number of velocity components
+        inline int Components() const {
+            return _components;
+        }
+    };
+
     class ReconstructionCardiacVelocity4D: public ReconstructionCardiac4D {
     protected:
         // Arrays of gradient moment values
@@ -44,6 +105,8 @@ namespace svrtk {
 
         // Reconstructed 4D cardiac cine velocity images (for X, Y and Z components)
         Array<RealImage> _reconstructed5DVelocity;
+        // Reconstructed velocities packed for the slice simulation
+        PackedVelocityField _packed_velocity;
         Array<RealImage> _confidence_maps_velocity;
 
         double _min_phase;
@@ -20,6 +20,10 @@
 
 // SVRTK
 #include "svrtk/Common.h"
+#include "svrtk/StencilRegulariser.h"
+#include "svrtk/SliceGeometry.h"
+#include "svrtk/StackRegistration.h"
+#include "svrtk/SliceStore.h"
 
 using namespace mirtk;
 
@@ -35,15 +39,13 @@ namespace svrtk {
         Array<SLICECOEFFS> _volcoeffs;
         Array<SLICECOEFFS> _volcoeffsSF;
 
-
-        Array<RealImage> _original_slices;
-
         Array<RealImage> _slices;
         Array<RealImage> _simulated_slices;
         Array<RealImage> _simulated_weights;
         Array<RealImage> _simulated_inside;
 
         Array<RigidTransformation> _transformations;
+        SliceGeometryCache _slice_geometry;
 
         Array<bool> _slice_inside;
 
@@ -164,7 +166,41 @@ namespace svrtk {
 
         Array<int> _slice_order;
 
-
+        /// Memory cap of the out-of-core mode in MB (0 - slice coefficients are kept in memory)
+        double _memory_cap;
+        /// Scratch file the per-slice images are paged to in the out-of-core mode
+        string _scratch_file;
+        /// Per-slice images of the out-of-core mode
+        SliceStore _slice_store;
+
+        /**
+         * @brief Run a kernel over slice batches whose coefficients are in memory.
+         * In the out-of-core mode the coefficients of each batch are generated before
+         * and released after the kernel, with batches sized to fit the memory cap.
+         * Otherwise the kernel runs once over all slices with the resident coefficients.
+         * @param kernel Kernel called with the slice range [begin, end).
+         */
+        void ForEachCoeffBatch(const function<void(size_t, size_t)>& kernel);
+
+        /// Memory taken by the coefficients of the given slice range in bytes
+        size_t CoeffBytes(size_t begin, size_t end) const;
+
+        /**
+         * @brief Number of SH coefficients updated together by each thread within the memory cap.
+         * The resident SH state (the coefficients, the copy kept for the adaptive
+         * regularisation and the confidence frame) is counted against the cap first.
+         * @param keep_original Whether a copy of the coefficients is kept for the adaptive regularisation.
+         */
+        int SHBlockSize(bool keep_original) const;
+
+        /// Move the per-slice images into the slice store backed by the scratch file
+        void BindSliceStore();
+
+        /// Throw if the coefficients of all slices are not resident (out-of-core mode)
+        inline void RequireResidentCoeffs(const char *name) const {
+            if (_memory_cap > 0)
+                throw runtime_error(string(name) + ": not available in the out-of-core mode");
+        }
 
     public:
 
@@ -284,6 +320,9 @@ namespace svrtk {
 
         void AdaptiveRegularization(int iter, RealImage& original);
 
+        /// Adaptive regularisation of all volumes of the image (e.g. SH coefficients), each with its own original
+        void AdaptiveRegularization(RealImage& reconstructed, const RealImage& original);
+
         void L22Regularization(int iter, RealImage& original);
 
         void LaplacianRegularization(int iter, int t, RealImage& original);
@@ -411,6 +450,15 @@ namespace svrtk {
         void SimulateStacksDTI(Array<RealImage>& stacks, bool simulate_excluded=false);
         void SimulateStacksDTIIntensityMatching(Array<RealImage>& stacks, bool simulate_excluded=false);
         void SuperresolutionDTI(int iter, bool tv = false, double sh_alpha = 5);
+
+        /**
+         * @brief Laplace-Beltrami damping of the SH coefficients (coefficients above order 4 are fully weighted).
+         * @param sh_coeffs SH coefficients to be damped.
+         * @param lambdaLB Damping weight.
+         * @param regul Output damping subtracted from the coefficients (nullptr - applied in place
+         * without a 4D image, as in the out-of-core mode).
+         */
+        static void LaplaceBeltramiDamping(RealImage& sh_coeffs, double lambdaLB, RealImage *regul = nullptr);
         double LaplacianSmoothnessDTI();
         void SaveSHcoeffs(int iteration);
         void SimulateSignal();
@@ -440,6 +488,17 @@ namespace svrtk {
 
         double ConsistencyDTI();
 
+        /**
+         * @brief Out-of-core mode of the SH reconstruction (CoeffInit, SimulateSlicesDTI,
+         * SuperresolutionDTI, NormaliseBias and EStep). Slice coefficients are regenerated
+         * in batches and SH updates are split into coefficient blocks, keeping both within
+         * the memory cap. Resident coefficients are released when the mode is enabled and
+         * regenerated when it is disabled again.
+         * @param memory_cap Memory cap in MB (0 - disabled).
+         * @param scratch_file Memory-mapped file the per-slice images are paged to ("" - keep in memory).
+         */
+        void SetOutOfCore(double memory_cap, const string& scratch_file = "");
+
 
 
 
@@ -447,7 +506,6 @@ namespace svrtk {
 
 
 
-        friend class ParallelStackRegistrations_DWI;
         friend class ParallelSliceToVolumeRegistration_DWI;
         friend class ParallelCoeffInit_DWI;
         friend class ParallelSuperresolution_DWI;
@@ -459,11 +517,6 @@ namespace svrtk {
         friend class ParallelSimulateSlices_DWI;
         friend class ParallelAverage_DWI;
         friend class ParallelSliceAverage_DWI;
-        friend class ParallelAdaptiveRegularization1_DWI;
-        friend class ParallelAdaptiveRegularization2_DWI;
-        friend class ParallelL22Regularization_DWI;
-        friend class ParallelLaplacianRegularization1_DWI;
-        friend class ParallelLaplacianRegularization2_DWI;
 
 
         friend class ParallelSimulateSlicesDTI;
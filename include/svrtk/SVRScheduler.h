@@ -0,0 +1,210 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Adaptive schedule of slice-to-volume registrations.
+     *
+     * A slice is stable in an iteration if its transformation changed by less than
+     * the TRE tolerance in its last registration, its slice weight is high and its
+     * residual is not above the median. A slice stable once is registered at the
+     * finest level only, a slice stable for longer is skipped and revisited at the
+     * finest level after the given number of iterations.
+     *
+     * The registered slices are dispatched one at a time in the order of their
+     * estimated cost, largest first, so that the threads finishing early pick up
+     * the remaining short registrations. The cost of a slice is its registration
+     * time in the previous iteration or, if unknown, its foreground pixel count.
+     */
+    class SVRScheduler {
+    public:
+        /// Registration of a slice in an iteration
+        enum Mode { Skip = 0, Reduced = 1, Full = 2 };
+
+    protected:
+        /// TRE below which a slice transformation is considered unchanged (mm, 0 - disabled)
+        double _tre_tolerance;
+        /// Slice weight above which a slice is considered an inlier
+        double _weight_threshold;
+        /// Number of iterations after which a skipped slice is registered again
+        int _revisit;
+
+        /// Number of consecutive iterations each slice was stable
+        Array<int> _stable;
+        /// Number of iterations since each slice was last registered
+        Array<int> _since;
+        /// Registration of each slice in the current iteration
+        Array<Mode> _modes;
+        /// Registered slices in the order of priority
+        Array<size_t> _order;
+
+        /// Estimated registration cost of each slice
+        Array<double> _cost;
+        /// Time of the last registration of each slice (s, -1 - unknown)
+        Array<double> _time;
+        /// Thread of the last registration of each slice
+        Array<thread::id> _thread;
+        /// Wall time of the last dispatch (s)
+        double _wall_time;
+
+        /// Statistics of the current iteration and of all iterations
+        size_t _skipped, _reduced;
+        size_t _total_registrations, _total_skipped, _total_reduced;
+
+    public:
+        /// SVRScheduler constructor
+        SVRScheduler() : _tre_tolerance(0), _weight_threshold(0.8), _revisit(3),
+            _wall_time(0), _skipped(0), _reduced(0), _total_registrations(0), _total_skipped(0), _total_reduced(0) {}
+
+        /**
+         * @brief Estimate the registration cost of each slice.
+         * The time of the previous registration is used if known, otherwise the foreground
+         * pixel count scaled by the mean time per pixel of the slices registered before.
+         * @param foreground Foreground pixel count of each slice (0 - nothing to register).
+         */
+        void EstimateCosts(const Array<double>& foreground);
+
+        /**
+         * @brief Plan the registrations of an iteration.
+         * @param tre TRE of each slice transformation in its last registration (mm, -1 - unknown).
+         * @param slice_weight Slice weights.
+         * @param residual Residual of each slice (e.g. NRMSE, empty - not checked).
+         * @param zero_slices Whether each slice has enough foreground to be registered.
+         */
+        void Plan(const Array<double>& tre, const Array<double>& slice_weight, const Array<double>& residual, const Array<int>& zero_slices);
+
+        /// Register all slices at all levels
+        void PlanAll(size_t slices);
+
+        /// Write the load balance of the last dispatch
+        void ReportLoadBalance(ostream& out) const;
+
+        /// Forget the history of all slices
+        void Reset();
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /**
+         * @brief Set the stability criteria.
+         * @param tre_tolerance TRE below which a slice transformation is considered unchanged in mm (0 - disabled).
+         * @param revisit Number of iterations after which a skipped slice is registered again.
+         * @param weight_threshold Slice weight above which a slice is considered an inlier.
+         */
+        inline void SetTolerances(double tre_tolerance, int revisit, double weight_threshold = 0.8) {
+            _tre_tolerance = tre_tolerance;
+            _revisit = max(1, revisit);
+            _weight_threshold = weight_threshold;
+        }
+
+        /**
+         * @brief Run the planned registrations in parallel, largest first.
+         * @param body Registration of a slice given by its index.
+         */
+        template <typename Body>
+        void Dispatch(const Body& body) {
+            _time.resize(_modes.size(), -1);
+            _thread.resize(_modes.size());
+
+            // Each task takes the next slice in the order, whichever range it was given
+            atomic<size_t> next(0);
+            const auto start = chrono::steady_clock::now();
+            parallel_for(blocked_range<size_t>(0, _order.size(), 1), [&](const blocked_range<size_t>& r) {
+                for (size_t n = r.begin(); n != r.end(); n++) {
+                    const size_t slice = _order[next++];
+                    const auto slice_start = chrono::steady_clock::now();
+                    body(slice);
+                    _time[slice] = chrono::duration<double>(chrono::steady_clock::now() - slice_start).count();
+                    _thread[slice] = this_thread::get_id();
+                }
+            });
+            _wall_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+
+        /// Foreground pixel count of each slice
+        template <typename ImageType>
+        static Array<double> Foreground(const Array<ImageType>& slices) {
+            Array<double> foreground(slices.size());
+            #pragma omp parallel for
+            for (size_t i = 0; i < slices.size(); i++) {
+                const auto *p = slices[i].Data();
+                int count = 0;
+                for (int n = 0; n < slices[i].NumberOfVoxels(); n++)
+                    if (p[n] > 0)
+                        count++;
+                foreground[i] = count;
+            }
+            return foreground;
+        }
+
+        /// Whether slices can be skipped
+        inline bool Enabled() const {
+            return _tre_tolerance > 0;
+        }
+
+        /// Registered slices in the order of priority
+        inline const Array<size_t>& Order() const {
+            return _order;
+        }
+
+        /// Registration of a slice in the current iteration
+        inline Mode GetMode(size_t slice) const {
+            return slice < _modes.size() ? _modes[slice] : Full;
+        }
+
+        /// Number of slices skipped in the current iteration
+        inline size_t NumberOfSkipped() const {
+            return _skipped;
+        }
+
+        /// Number of slices registered at the finest level only in the current iteration
+        inline size_t NumberOfReduced() const {
+            return _reduced;
+        }
+
+        /// Number of planned slice registrations in all iterations
+        inline size_t TotalRegistrations() const {
+            return _total_registrations;
+        }
+
+        /// Number of skipped slice registrations in all iterations
+        inline size_t TotalSkipped() const {
+            return _total_skipped;
+        }
+
+        /// Number of slice registrations at the finest level only in all iterations
+        inline size_t TotalReduced() const {
+            return _total_reduced;
+        }
+    };
+
+} // namespace svrtk
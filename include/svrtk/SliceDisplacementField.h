@@ -0,0 +1,106 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Cached FFD slice-to-volume map on a lattice around a slice.
+     *
+     * The map from slice image coordinates to volume image coordinates through
+     * a multi-level FFD is evaluated once on a lattice with the in-plane slice
+     * pixel spacing, covering the slice and the extent of the PSF, and then
+     * trilinearly interpolated. Interpolation reproduces the affine parts of the
+     * map exactly, so only the curvature of the FFD displacement is
+     * approximated. The error is measured against exact evaluation at lattice
+     * cell centres, where trilinear interpolation is least accurate.
+     */
+    class SliceDisplacementField {
+    protected:
+        /// Origin of the lattice in slice image coordinates
+        double _x0, _y0, _z0;
+        /// Through-plane spacing of the lattice in slice voxels
+        double _sz;
+        /// Lattice dimensions
+        int _nx, _ny, _nz;
+        /// Volume image coordinates of the lattice nodes
+        Array<double> _map;
+        /// Largest interpolation error at the lattice cell centres in volume voxels
+        double _error;
+
+    public:
+        /// SliceDisplacementField constructor
+        SliceDisplacementField() : _x0(0), _y0(0), _z0(0), _sz(1), _nx(0), _ny(0), _nz(0), _error(0) {}
+
+        /**
+         * @brief Evaluate the map of a slice on the lattice.
+         * @param slice Slice the map is defined for.
+         * @param mffd FFD transformation of the slice.
+         * @param volume Volume the map points to.
+         * @param offsets PSF sample offsets (x, y, z triplets) in slice image coordinates.
+         * @param tolerance Largest acceptable interpolation error in volume voxels.
+         * @return Whether the error measured at the centre of every lattice cell is within the tolerance.
+         * The error is checked at the cell centres only, so it is an estimate rather than a strict bound.
+         */
+        bool Build(const RealImage& slice, const MultiLevelFreeFormTransformation& mffd, const RealImage& volume,
+            const Array<double>& offsets, double tolerance);
+
+        /// Exact map of a point from slice to volume image coordinates
+        static void Exact(const RealImage& slice, const MultiLevelFreeFormTransformation& mffd, const RealImage& volume,
+            double& x, double& y, double& z);
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Largest interpolation error at the lattice cell centres in volume voxels
+        inline double Error() const {
+            return _error;
+        }
+
+        /// Interpolated map of a point from slice to volume image coordinates
+        inline void Map(double& x, double& y, double& z) const {
+            const double fx = x - _x0, fy = y - _y0, fz = (z - _z0) / _sz;
+            const int ix = max(0, min(_nx - 2, (int)floor(fx)));
+            const int iy = max(0, min(_ny - 2, (int)floor(fy)));
+            const int iz = max(0, min(_nz - 2, (int)floor(fz)));
+            const double wx[2] = {1 - (fx - ix), fx - ix};
+            const double wy[2] = {1 - (fy - iy), fy - iy};
+            const double wz[2] = {1 - (fz - iz), fz - iz};
+
+            x = y = z = 0;
+            for (int c = 0; c < 2; c++)
+                for (int b = 0; b < 2; b++)
+                    for (int a = 0; a < 2; a++) {
+                        const double w = wx[a] * wy[b] * wz[c];
+                        const double *p = &_map[3 * ((ix + a) + _nx * ((iy + b) + _ny * (iz + c)))];
+                        x += w * p[0];
+                        y += w * p[1];
+                        z += w * p[2];
+                    }
+        }
+    };
+
+} // namespace svrtk
@@ -0,0 +1,145 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Composite affine map from slice voxel to volume voxel coordinates.
+     *
+     * Combines the slice image-to-world matrix, the rigid slice transformation and the
+     * volume world-to-image matrix, so mapping a pixel costs a single 3x4 multiplication.
+     */
+    class SliceGeometry {
+    protected:
+        /// Composite matrix (slice voxel -> volume voxel)
+        double _m[3][4];
+
+    public:
+        /// Identity map
+        SliceGeometry();
+
+        /**
+         * @brief SliceGeometry constructor.
+         * @param slice Attributes of the slice.
+         * @param transformation Matrix of the slice transformation (slice world -> volume world).
+         * @param volume Attributes of the volume.
+         */
+        SliceGeometry(const ImageAttributes& slice, const Matrix& transformation, const ImageAttributes& volume);
+
+        /**
+         * @brief Compute offsets of the PSF points from the mapped centre of a slice voxel.
+         * PSF point (ii, jj, kk) centred over slice voxel (i, j) lies at Transform(i, j, 0) plus
+         * offsets[3 * ((ii * PSF.GetY() + jj) * PSF.GetZ() + kk) + {0, 1, 2}] in volume voxel coordinates.
+         * @param PSF Discretised PSF (world coordinates in mm, centred at the centre of the image).
+         * @param dx Slice voxel size in x.
+         * @param dy Slice voxel size in y.
+         * @param dz Slice voxel size in z.
+         * @param offsets Output offsets.
+         */
+        void PSFOffsets(const RealImage& PSF, double dx, double dy, double dz, Array<double>& offsets) const;
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Map slice voxel coordinates to volume voxel coordinates
+        inline void Transform(double& x, double& y, double& z) const {
+            const double xx = _m[0][0] * x + _m[0][1] * y + _m[0][2] * z + _m[0][3];
+            const double yy = _m[1][0] * x + _m[1][1] * y + _m[1][2] * z + _m[1][3];
+            const double zz = _m[2][0] * x + _m[2][1] * y + _m[2][2] * z + _m[2][3];
+            x = xx;
+            y = yy;
+            z = zz;
+        }
+
+        /// Map a displacement in slice voxel units to volume voxel units
+        inline void TransformVector(double& x, double& y, double& z) const {
+            const double xx = _m[0][0] * x + _m[0][1] * y + _m[0][2] * z;
+            const double yy = _m[1][0] * x + _m[1][1] * y + _m[1][2] * z;
+            const double zz = _m[2][0] * x + _m[2][1] * y + _m[2][2] * z;
+            x = xx;
+            y = yy;
+            z = zz;
+        }
+
+        /// Map the voxels (0 .. n-1, j, k) of a slice row by stepping along the first column
+        inline void TransformRow(double j, double k, int n, double *x, double *y, double *z) const {
+            const double x0 = _m[0][1] * j + _m[0][2] * k + _m[0][3];
+            const double y0 = _m[1][1] * j + _m[1][2] * k + _m[1][3];
+            const double z0 = _m[2][1] * j + _m[2][2] * k + _m[2][3];
+            const double sx = _m[0][0], sy = _m[1][0], sz = _m[2][0];
+            #pragma omp simd
+            for (int i = 0; i < n; i++) {
+                x[i] = x0 + i * sx;
+                y[i] = y0 + i * sy;
+                z[i] = z0 + i * sz;
+            }
+        }
+    };
+
+    //-------------------------------------------------------------------
+
+    /**
+     * @brief Per-slice cache of slice geometries.
+     *
+     * The geometry of a slice is rebuilt only when its transformation or the slice or
+     * volume grid changes. Different slices can be accessed concurrently.
+     */
+    class SliceGeometryCache {
+    protected:
+        struct Entry {
+            bool valid = false;
+            double transformation[12];
+            ImageAttributes slice;
+            ImageAttributes volume;
+            SliceGeometry geometry;
+        };
+
+        Array<Entry> _entries;
+
+    public:
+        /// Set the number of slices (not thread-safe; entries of the remaining slices are kept)
+        inline void Resize(size_t n) {
+            _entries.resize(n);
+        }
+
+        /// Invalidate all entries
+        inline void Clear() {
+            _entries.clear();
+        }
+
+        /**
+         * @brief Get the geometry of a slice, rebuilding it if needed.
+         * @param index Slice index (has to be smaller than the size of the cache).
+         * @param slice Attributes of the slice.
+         * @param transformation Slice transformation.
+         * @param volume Attributes of the volume.
+         * @return Slice geometry.
+         */
+        const SliceGeometry& Get(size_t index, const ImageAttributes& slice, const RigidTransformation& transformation, const ImageAttributes& volume);
+    };
+
+} // namespace svrtk
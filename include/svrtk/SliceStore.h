@@ -0,0 +1,147 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Contiguous storage of per-slice images.
+     *
+     * Every field (slices, weights, bias fields, ...) is kept in a single slab
+     * covering all slices, optionally backed by a memory-mapped scratch file.
+     * Slice geometry is stored once per stack; only the slice origins are kept
+     * per slice. Images bound to the store are lightweight views into the slab.
+     */
+    class SliceStore {
+    protected:
+        /// Shared slice attributes of each stack (origin of the first slice)
+        Array<ImageAttributes> _stack_attributes;
+        /// Stack index of each slice
+        Array<int> _stack_index;
+        /// Origin of each slice
+        Array<Point> _origins;
+        /// Offset of each slice within a field (in voxels)
+        Array<size_t> _offsets;
+        /// Number of voxels of each field
+        size_t _field_size;
+
+        /// Field names
+        Array<string> _fields;
+        /// Slab holding all fields
+        RealPixel *_data;
+        /// Size of the slab in bytes
+        size_t _bytes;
+        /// Whether the slab is memory-mapped
+        bool _mapped;
+
+        /// Release the slab
+        void Release();
+
+    public:
+        /// SliceStore constructor
+        SliceStore() : _field_size(0), _data(nullptr), _bytes(0), _mapped(false) {}
+        /// SliceStore destructor
+        ~SliceStore() { Release(); }
+
+        SliceStore(const SliceStore&) = delete;
+        SliceStore& operator=(const SliceStore&) = delete;
+        SliceStore(SliceStore&& store) noexcept;
+        SliceStore& operator=(SliceStore&& store) noexcept;
+
+        /**
+         * @brief Set up slice geometry and allocate the slab.
+         * @param slice_attributes Attributes of all slices.
+         * @param stack_index Stack index of each slice.
+         * @param fields Names of the fields to be stored.
+         * @param scratch_file Backing file for the slab (heap memory if empty).
+         */
+        void Initialize(const Array<ImageAttributes>& slice_attributes, const Array<int>& stack_index,
+            const Array<string>& fields, const string& scratch_file = "");
+
+        /**
+         * @brief Copy the image into the store and turn it into a view of the slab.
+         * @param image Slice image (its geometry has to match the stored slice).
+         * @param field Field index.
+         * @param index Slice index.
+         */
+        void Bind(RealImage& image, int field, size_t index);
+
+        /**
+         * @brief Bind a whole array of slice images to the given field.
+         * @param images Slice images (ignored unless there is one per slice).
+         * @param name Field name.
+         */
+        void Bind(Array<RealImage>& images, const string& name);
+
+        /// Return attributes of the given slice
+        ImageAttributes Attributes(size_t index) const;
+
+        /// Return index of the given field
+        int Field(const string& name) const;
+
+        /**
+         * @brief Wrap the given field and slice without copying.
+         * @param view Output image referring to the slab.
+         * @param field Field index.
+         * @param index Slice index.
+         */
+        void View(RealImage& view, int field, size_t index) const;
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Return pointer to the data of the given field and slice
+        inline RealPixel *Data(int field, size_t index) const {
+            return _data + field * _field_size + _offsets[index];
+        }
+
+        /// Return number of voxels of the given slice
+        inline size_t NumberOfVoxels(size_t index) const {
+            return _offsets[index + 1] - _offsets[index];
+        }
+
+        /// Return number of slices
+        inline size_t NumberOfSlices() const {
+            return _stack_index.size();
+        }
+
+        /// Return number of stored bytes
+        inline size_t Bytes() const {
+            return _bytes;
+        }
+
+        /// Whether the slab is backed by a memory-mapped file
+        inline bool IsMapped() const {
+            return _mapped;
+        }
+
+        /// Whether the store holds any slices
+        inline bool IsEmpty() const {
+            return _data == nullptr;
+        }
+    };
+
+} // namespace svrtk
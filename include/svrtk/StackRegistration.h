@@ -0,0 +1,117 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Registration of stacks to a shared template.
+     *
+     * The template is prepared once (origin reset for the rigid model and
+     * resampling to the registration resolution) and kept read-only, so all
+     * stacks are registered concurrently against the same image. Rigid
+     * transformations map the template to the stacks (template is the target);
+     * FFD transformations map the stacks to the template (template is the source).
+     */
+    class StackRegistration {
+    public:
+        /// Transformation model
+        enum Model { Rigid, FFD };
+
+    protected:
+        /// Transformation model
+        Model _model;
+        /// Registration parameters
+        ParameterList _params;
+        /// Prepared template shared by all registrations
+        RealImage _template;
+        /// Origin of the template (rigid model)
+        RigidTransformation _offset;
+        /// Isotropic resolution of the registered images
+        double _resolution;
+        /// Padding value of the resampling
+        double _padding;
+        /// Sigma of the Gaussian blurring of the stacks before resampling (0 - no blurring)
+        double _blurring;
+
+        /**
+         * @brief Resample an image to the registration resolution.
+         * @param image Input image.
+         * @param blurring Sigma of the Gaussian blurring applied before resampling.
+         * @return Resampled image.
+         */
+        RealImage Resample(const RealImage& image, double blurring) const;
+
+    public:
+        /**
+         * @brief StackRegistration constructor.
+         * @param model Transformation model.
+         * @param params Parameters of GenericRegistrationFilter (the transformation model is set automatically).
+         * @param resolution Isotropic resolution of the registered images.
+         * @param padding Padding value of the resampling.
+         * @param blurring Sigma of the Gaussian blurring of the stacks before resampling.
+         */
+        StackRegistration(Model model, const ParameterList& params, double resolution, double padding = 0, double blurring = 0);
+
+        /**
+         * @brief Prepare the template shared by all registrations.
+         * @param image Template (already masked).
+         */
+        void Template(const RealImage& image);
+
+        /**
+         * @brief Register a single stack to the template (thread-safe).
+         * @param stack Stack to be registered.
+         * @param guess Initial guess of the transformation (nullptr - none).
+         * @return Transformation of the model (owned by the caller).
+         */
+        Transformation *Register(const RealImage& stack, const Transformation *guess = nullptr) const;
+
+        /**
+         * @brief Register stacks rigidly and concurrently.
+         * @param stacks Stacks to be registered.
+         * @param transformations Initial guesses on input, template-to-stack transformations on output.
+         * @param skip Index of a stack that is not registered (e.g. the template stack; -1 - none).
+         */
+        void Run(const Array<RealImage>& stacks, Array<RigidTransformation>& transformations, int skip = -1) const;
+
+        /**
+         * @brief Register stacks with FFD concurrently.
+         * @param stacks Stacks to be registered.
+         * @param transformations Output stack-to-template transformations.
+         */
+        void Run(const Array<RealImage>& stacks, Array<unique_ptr<MultiLevelFreeFormTransformation>>& transformations) const;
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Get the prepared template
+        inline const RealImage& GetTemplate() const {
+            return _template;
+        }
+    };
+
+} // namespace svrtk
@@ -0,0 +1,151 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Deterministic 26-neighbourhood stencil regularisers (adaptive, Laplacian, L22).
+     *
+     * The work is partitioned over blocks of z-slices of every volume (e.g. every
+     * SH coefficient), so each output voxel is written by exactly one thread and
+     * neighbours are accumulated in a fixed order. Results are therefore bitwise
+     * identical for any number of threads. Neighbour offsets are precomputed and
+     * the mask tests are replaced by one bitset per voxel.
+     *
+     * Neighbour k < 13 is voxel + directions[k], neighbour k >= 13 is voxel - directions[k - 13].
+     * Input and output images may have several frames (regularised independently);
+     * masks have a single frame with the same spatial grid.
+     */
+    class StencilRegulariser {
+    protected:
+        /// Spatial grid size
+        int _nx, _ny, _nz;
+        /// Number of voxels of one volume
+        size_t _n;
+        /// Neighbour directions (13 positive and 13 negative)
+        int _neighbours[26][3];
+        /// Linear offsets of the neighbours
+        ptrdiff_t _offsets[26];
+        /// Number of z-slices processed by one task
+        int _block_size;
+
+        /**
+         * @brief Compute neighbour bitsets.
+         * Bit k of a voxel is set if its neighbour k at the given step lies within the grid
+         * and, if a mask is given, within the mask.
+         * @param mask Neighbour mask (may be nullptr).
+         * @param step Distance of the neighbour in multiples of the direction.
+         * @param bits Output bitset per voxel.
+         */
+        void NeighbourBits(const RealImage *mask, int step, Array<uint32_t>& bits) const;
+
+        /// Check that the image lies on the regulariser's grid
+        void CheckGrid(const RealImage& image, const char *name) const;
+
+        /// Run the kernel over all blocks of z-slices of all volumes
+        template<typename Kernel>
+        void ForEachBlock(int volumes, Kernel kernel) const;
+
+    public:
+        /**
+         * @brief StencilRegulariser constructor.
+         * @param attr Attributes of the regularised volumes.
+         * @param directions The 13 neighbourhood directions.
+         * @param block_size Number of z-slices per task.
+         */
+        StencilRegulariser(const ImageAttributes& attr, const int directions[13][3], int block_size = 4);
+
+        /**
+         * @brief Edge-preserving (adaptive) regularisation step.
+         * @param original Volume(s) used for the edge-stopping weights.
+         * @param reconstructed Volume(s) to be regularised (updated inside the mask).
+         * @param mask Reconstruction mask.
+         * @param factor Weight of each direction.
+         * @param delta Edge-stopping parameter.
+         * @param coef Update step (alpha * lambda / delta^2).
+         */
+        void Adaptive(const RealImage& original, RealImage& reconstructed, const RealImage& mask,
+            const Array<double>& factor, double delta, double coef) const;
+
+        /**
+         * @brief Compute the Laplacian inside the internal mask.
+         * @param original Input volume(s).
+         * @param laplacian Output Laplacian (zero outside the internal mask).
+         * @param mask Reconstruction mask.
+         * @param mask_internal Mask eroded by the neighbourhood.
+         * @param factor Weight of each direction.
+         */
+        void Laplacian(const RealImage& original, RealImage& laplacian, const RealImage& mask,
+            const RealImage& mask_internal, const Array<double>& factor) const;
+
+        /**
+         * @brief Laplacian regularisation step (bi-Laplacian update from a precomputed Laplacian).
+         * @param laplacian Laplacian of the volume(s).
+         * @param reconstructed Volume(s) to be regularised (updated inside the mask).
+         * @param mask Reconstruction mask.
+         * @param mask_internal Mask eroded by the neighbourhood.
+         * @param factor Weight of each direction.
+         * @param coef Update step (alpha * lambda / delta^2).
+         */
+        void LaplacianUpdate(const RealImage& laplacian, RealImage& reconstructed, const RealImage& mask,
+            const RealImage& mask_internal, const Array<double>& factor, double coef) const;
+
+        /**
+         * @brief L22 regularisation step.
+         * @param reconstructed Volume(s) to be regularised (updated where the confidence is positive).
+         * @param confidence Confidence map.
+         * @param factor Weight of each direction.
+         * @param coef Update step (alpha * lambda / delta^2).
+         */
+        void L22(RealImage& reconstructed, const RealImage& confidence, const Array<double>& factor, double coef) const;
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Return linear offset of the given neighbour
+        inline ptrdiff_t Offset(int k) const {
+            return _offsets[k];
+        }
+    };
+
+    //-------------------------------------------------------------------
+
+    template<typename Kernel>
+    void StencilRegulariser::ForEachBlock(int volumes, Kernel kernel) const {
+        const int blocks_per_volume = (_nz + _block_size - 1) / _block_size;
+        const int blocks = volumes * blocks_per_volume;
+
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < blocks; b++) {
+            const int volume = b / blocks_per_volume;
+            const int z_begin = (b % blocks_per_volume) * _block_size;
+            const int z_end = min(z_begin + _block_size, _nz);
+            kernel(volume, (size_t)z_begin * _nx * _ny, (size_t)z_end * _nx * _ny);
+        }
+    }
+
+} // namespace svrtk
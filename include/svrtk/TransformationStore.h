@@ -0,0 +1,127 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief In-memory store of the stack and slice FFD transformations.
+     *
+     * Transformations are reference counted: a slice shares the transformation
+     * of its stack (or the identity) until it is registered, and is given its
+     * own copy only when it has to be modified in place. A transformation is
+     * released as soon as no stack or slice refers to it anymore.
+     */
+    class TransformationStore {
+    public:
+        typedef shared_ptr<MultiLevelFreeFormTransformation> Pointer;
+
+    protected:
+        /// Transformations of the stacks
+        Array<Pointer> _stacks;
+        /// Transformations of the slices
+        Array<Pointer> _slices;
+        /// Identity transformation shared by unregistered slices
+        Pointer _identity;
+
+    public:
+        /// TransformationStore constructor
+        TransformationStore() : _identity(make_shared<MultiLevelFreeFormTransformation>()) {}
+
+        /**
+         * @brief Set the transformation of a stack.
+         * @param stack Stack index.
+         * @param transformation Transformation, the store takes ownership of it.
+         */
+        void SetStack(size_t stack, unique_ptr<MultiLevelFreeFormTransformation> transformation);
+
+        /**
+         * @brief Set the transformation of a slice.
+         * @param slice Slice index.
+         * @param transformation Transformation, the store takes ownership of it.
+         * It has to be a multi-level FFD.
+         */
+        void SetSlice(size_t slice, Transformation *transformation);
+
+        /**
+         * @brief Let a slice share the transformation of its stack.
+         * @param slice Slice index.
+         * @param stack Stack index.
+         */
+        void ShareStack(size_t slice, size_t stack);
+
+        /**
+         * @brief Transformation of a slice that may be modified in place.
+         * The transformation is copied first if it is shared.
+         * @param slice Slice index.
+         * @return Transformation owned by the slice only.
+         */
+        MultiLevelFreeFormTransformation *Mutable(size_t slice);
+
+        /**
+         * @brief Write the stack transformations for debugging.
+         * @param prefix Filename prefix, the stack index and ".dof" are appended.
+         */
+        void WriteStacks(const string& prefix) const;
+
+        /// Release all slice transformations and reserve memory for the given number of slices
+        void ClearSlices(size_t reserve_size = 0);
+
+        /// Release all transformations
+        void Clear();
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Add a slice with the identity transformation
+        inline void AddSlice() {
+            _slices.push_back(_identity);
+        }
+
+        /// Number of slices
+        inline size_t size() const {
+            return _slices.size();
+        }
+
+        /// Number of stacks
+        inline size_t NumberOfStacks() const {
+            return _stacks.size();
+        }
+
+        /// Transformation of a stack (shared, use as initial guess only)
+        inline const MultiLevelFreeFormTransformation *Stack(size_t stack) const {
+            if (stack >= _stacks.size() || !_stacks[stack])
+                throw runtime_error("TransformationStore: no transformation for stack " + to_string(stack));
+            return _stacks[stack].get();
+        }
+
+        /// Transformation of a slice (possibly shared, use Mutable() to modify it)
+        inline MultiLevelFreeFormTransformation *operator[](size_t slice) const {
+            return _slices[slice].get();
+        }
+    };
+
+} // namespace svrtk
@@ -0,0 +1,98 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /**
+     * @brief Volume-to-slice index of the slice-volume coefficients.
+     *
+     * Transpose of the slice-to-volume coefficients (_volcoeffs) in compressed
+     * row form: for each volume voxel, the contributing slice pixels with their
+     * weights, ordered by slice and pixel. Volume-side updates can then be
+     * computed as independent per-voxel gathers, summing in the same order as
+     * a serial scatter over slices.
+     */
+    class TransposedCoefficients {
+    public:
+        /// Contribution of a slice pixel to a volume voxel
+        struct Contribution {
+            int slice;
+            short i;
+            short j;
+            float value;
+        };
+
+    protected:
+        /// Start of the contributions of each voxel (number of voxels + 1)
+        Array<size_t> _offsets;
+        /// Contributions of all voxels
+        Array<Contribution> _contributions;
+
+    public:
+        /**
+         * @brief Memory needed for the index of the given coefficients.
+         * @param volcoeffs Slice-volume coefficients.
+         * @param voxels Number of volume voxels.
+         * @return Size in bytes.
+         */
+        static size_t Bytes(const Array<SLICECOEFFS>& volcoeffs, size_t voxels);
+
+        /**
+         * @brief Build the index from the slice-volume coefficients.
+         * @param volcoeffs Slice-volume coefficients.
+         * @param attr Attributes of the volume the coefficients refer to.
+         */
+        void Build(const Array<SLICECOEFFS>& volcoeffs, const ImageAttributes& attr);
+
+        /// Release the index
+        void Clear();
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /// Whether the index has been built
+        inline bool Empty() const {
+            return _offsets.empty();
+        }
+
+        /// Number of voxels of the indexed volume
+        inline size_t NumberOfVoxels() const {
+            return _offsets.empty() ? 0 : _offsets.size() - 1;
+        }
+
+        /// First contribution of a voxel
+        inline const Contribution *Begin(size_t voxel) const {
+            return _contributions.data() + _offsets[voxel];
+        }
+
+        /// One past the last contribution of a voxel
+        inline const Contribution *End(size_t voxel) const {
+            return _contributions.data() + _offsets[voxel + 1];
+        }
+    };
+
+} // namespace svrtk
@@ -0,0 +1,129 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// SVRTK
+#include "svrtk/Common.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /// Statistics of the coefficient pruning of a slice
+    struct CoeffPruningStats {
+        /// Number of coefficients before pruning
+        size_t total = 0;
+        /// Number of pruned coefficients
+        size_t pruned = 0;
+        /// Sum of squared differences of the simulated intensities
+        double error = 0;
+        /// Sum of squared simulated intensities without pruning
+        double norm = 0;
+
+        inline CoeffPruningStats& operator+=(const CoeffPruningStats& stats) {
+            total += stats.total;
+            pruned += stats.pruned;
+            error += stats.error;
+            norm += stats.norm;
+            return *this;
+        }
+    };
+
+    /**
+     * @brief Trilinear splatting of PSF samples into the reconstructed volume.
+     *
+     * The weights of the 8 neighbours of a sample are computed in single
+     * precision without branches: neighbours outside the volume get a zero
+     * weight and their (clamped) mask lookups are masked out.
+     */
+    class TrilinearSplat {
+    protected:
+        /// Volume dimensions
+        int _x, _y, _z;
+        /// Mask of the volume
+        const RealPixel *_mask;
+        /// Whether all voxels count as inside the mask
+        bool _no_masking;
+
+    public:
+        /**
+         * @brief TrilinearSplat constructor.
+         * @param attr Attributes of the reconstructed volume.
+         * @param mask Mask of the reconstructed volume.
+         * @param no_masking Whether all voxels count as inside the mask.
+         */
+        TrilinearSplat(const ImageAttributes& attr, const RealImage& mask, bool no_masking);
+
+        /**
+         * @brief Prune small coefficients of a slice voxel.
+         * Coefficients below the threshold relative to the largest one are removed
+         * and the remaining ones are rescaled to keep the total weight.
+         * @param coeffs Coefficients of the slice voxel.
+         * @param threshold Relative weight threshold.
+         * @return Number of pruned coefficients.
+         */
+        static size_t Prune(VOXELCOEFFS& coeffs, double threshold);
+
+        ////////////////////////////////////////////////////////////////////////////////
+        // Inline/template definitions
+        ////////////////////////////////////////////////////////////////////////////////
+
+        /**
+         * @brief Weights of the 8 neighbours of a sample.
+         * Neighbour q is (nx + (q >> 2), ny + ((q >> 1) & 1), nz + (q & 1)).
+         * @param x, y, z Sample position in volume image coordinates.
+         * @param nx, ny, nz Output lowest corner of the neighbourhood.
+         * @param weights Output weights (zero outside the volume).
+         * @param inside Output whether a neighbour within the volume is inside the mask.
+         * @return Sum of the weights.
+         */
+        inline float Weights(double x, double y, double z, int& nx, int& ny, int& nz, float weights[8], bool& inside) const {
+            nx = (int)floor(x);
+            ny = (int)floor(y);
+            nz = (int)floor(z);
+            const float fx = float(x - nx), fy = float(y - ny), fz = float(z - nz);
+
+            const int bx[2] = {nx >= 0 && nx < _x, nx + 1 >= 0 && nx + 1 < _x};
+            const int by[2] = {ny >= 0 && ny < _y, ny + 1 >= 0 && ny + 1 < _y};
+            const int bz[2] = {nz >= 0 && nz < _z, nz + 1 >= 0 && nz + 1 < _z};
+            const float wx[2] = {(1 - fx) * bx[0], fx * bx[1]};
+            const float wy[2] = {(1 - fy) * by[0], fy * by[1]};
+            const float wz[2] = {(1 - fz) * bz[0], fz * bz[1]};
+            const int ix[2] = {max(0, min(_x - 1, nx)), max(0, min(_x - 1, nx + 1))};
+            const int iy[2] = {max(0, min(_y - 1, ny)), max(0, min(_y - 1, ny + 1))};
+            const int iz[2] = {max(0, min(_z - 1, nz)), max(0, min(_z - 1, nz + 1))};
+
+            float sum = 0;
+            int in = 0;
+            #pragma omp simd reduction(+:sum) reduction(|:in)
+            for (int q = 0; q < 8; q++) {
+                const int a = q >> 2, b = (q >> 1) & 1, c = q & 1;
+                weights[q] = wx[a] * wy[b] * wz[c];
+                sum += weights[q];
+                const int masked = _no_masking || _mask[ix[a] + _x * (iy[b] + _y * iz[c])] == 1;
+                in |= bx[a] & by[b] & bz[c] & masked;
+            }
+
+            inside = in;
+            return sum;
+        }
+    };
+
+} // namespace svrtk
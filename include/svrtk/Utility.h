@@ -20,6 +20,7 @@
 
 // SVRTK
 #include "svrtk/Common.h"
+#include "svrtk/SliceGeometry.h"
 
 using namespace std;
 using namespace mirtk;
@@ -84,8 +85,22 @@ namespace svrtk::Utility {
     double ComputeNCC(const RealImage& slice_1, const RealImage& slice_2, const double threshold = 0.01, double *count = nullptr);
 
 
+    /**
+     * @brief Replace NaN and negative intensities with zeros (all frames).
+     * @param stack
+     */
     void RemoveNanNegative(RealImage& stack);
 
+    /**
+     * @brief Read images concurrently, keeping the order of the file names.
+     * Each image is decoded directly into a RealImage and handed to the preprocessing
+     * callback as soon as it is ready, while the remaining files are still being read.
+     * @param file_names Input file names.
+     * @param images Output images.
+     * @param Preprocess Optional per-image preprocessing (index, image), run on the reading thread.
+     */
+    void ReadImages(const Array<string>& file_names, Array<RealImage>& images, function<void(size_t, RealImage&)> Preprocess = nullptr);
+
 
     double LocalSSIM(const RealImage slice, const RealImage sim_slice );
 
@@ -184,6 +199,32 @@ namespace svrtk::Utility {
      */
     void MaskSlices(Array<RealImage>& slices, const RealImage& mask, function<void(size_t, double&, double&, double&)> Transform);
 
+    /**
+     * @brief Mask slices based on the reconstruction mask, mapping whole rows of slice voxels at once.
+     * @param slices
+     * @param mask
+     * @param Geometry Returns the slice-to-mask voxel map of a slice.
+     */
+    void MaskSlices(Array<RealImage>& slices, const RealImage& mask, function<SliceGeometry(size_t)> Geometry);
+
+    /**
+     * @brief Wrap a slice of a stack without copying.
+     * The view refers to the voxels of the stack, which has to outlive it and must not be modified through it.
+     * @param view Output image referring to the stack.
+     * @param stack Input stack.
+     * @param z Slice index.
+     * @param t Frame index.
+     * @param thickness Slice thickness (z voxel size of the view).
+     */
+    void StackSliceView(RealImage& view, const RealImage& stack, int z, int t, double thickness);
+
+    /**
+     * @brief Wrap an image without copying.
+     * @param view Output image referring to the voxels of the image.
+     * @param image Input image, which has to outlive the view.
+     */
+    void ImageView(RealImage& view, const RealImage& image);
+
     /**
      * @brief Get slice order parameters.
      * @param stacks
@@ -0,0 +1,318 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/CoefficientCache.h"
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    /// Header of a cache file
+    struct CoefficientCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t point_size;
+        uint64_t key;
+        uint64_t slices;
+        uint64_t voxels;
+        uint64_t points;
+    };
+
+    static const char CoefficientCacheMagic[8] = {'S', 'V', 'R', 'T', 'K', 'C', 'O', 'E'};
+    static constexpr uint32_t CoefficientCacheVersion = 1;
+
+    // Offsets of the sections of a cache file
+    static void CacheLayout(uint64_t slices, uint64_t voxels, size_t& dims, size_t& inside, size_t& offsets, size_t& points) {
+        dims = sizeof(CoefficientCacheHeader);
+        inside = dims + 2 * sizeof(uint32_t) * slices;
+        offsets = inside + (slices + 7) / 8 * 8;
+        points = offsets + sizeof(uint64_t) * (voxels + 1);
+    }
+
+    //-------------------------------------------------------------------
+
+    void CoefficientCache::Reset() {
+        // FNV-1a offset basis
+        _key = 14695981039346656037ULL;
+    }
+
+    //-------------------------------------------------------------------
+
+    void CoefficientCache::Add(const void *data, size_t bytes) {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        for (size_t n = 0; n < bytes; n++) {
+            _key ^= p[n];
+            _key *= 1099511628211ULL;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void CoefficientCache::Add(const ImageAttributes& attr) {
+        Add(attr._x);
+        Add(attr._y);
+        Add(attr._z);
+        Add(attr.GetImageToWorldMatrix());
+    }
+
+    //-------------------------------------------------------------------
+
+    void CoefficientCache::Add(const Matrix& matrix) {
+        for (int i = 0; i < matrix.Rows(); i++)
+            for (int j = 0; j < matrix.Cols(); j++)
+                Add(matrix(i, j));
+    }
+
+    //-------------------------------------------------------------------
+
+    void CoefficientCache::Add(const MultiLevelFreeFormTransformation& mffd) {
+        Add(mffd.GetGlobalTransformation()->GetMatrix());
+        Add(mffd.NumberOfLevels());
+        for (int l = 0; l < mffd.NumberOfLevels(); l++) {
+            const FreeFormTransformation *ffd = mffd.GetLocalTransformation(l);
+            Add(ffd->Attributes());
+            for (int dof = 0; dof < ffd->NumberOfDOFs(); dof++)
+                Add(ffd->Get(dof));
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void CoefficientCache::Add(const RealImage& image) {
+        Add(image.Attributes());
+        Add(image.Data(), sizeof(RealPixel) * image.NumberOfVoxels());
+    }
+
+    //-------------------------------------------------------------------
+
+    string CoefficientCache::Path() const {
+        ostringstream path;
+        path << _directory << "/coeffs-" << hex << setw(16) << setfill('0') << _key << ".bin";
+        return path.str();
+    }
+
+    //-------------------------------------------------------------------
+
+    bool CoefficientCache::Read(Array<SLICECOEFFS>& volcoeffs, Array<bool>& slice_inside, const Array<RealImage>& slices) const {
+        const string path = Path();
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CoefficientCacheHeader)) {
+            close(fd);
+            return false;
+        }
+        const size_t bytes = st.st_size;
+        void *ptr = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+            return false;
+        const char *data = static_cast<const char *>(ptr);
+
+        // The file has to match the key and the slice dimensions
+        const CoefficientCacheHeader& header = *reinterpret_cast<const CoefficientCacheHeader *>(data);
+        bool valid = memcmp(header.magic, CoefficientCacheMagic, sizeof(header.magic)) == 0
+            && header.version == CoefficientCacheVersion && header.point_size == sizeof(POINT3D)
+            && header.key == _key && header.slices == slices.size();
+
+        size_t dims_offset = 0, inside_offset = 0, offsets_offset = 0, points_offset = 0;
+        Array<size_t> slice_voxels(slices.size() + 1, 0);
+        if (valid) {
+            CacheLayout(header.slices, header.voxels, dims_offset, inside_offset, offsets_offset, points_offset);
+            valid = bytes == points_offset + sizeof(POINT3D) * header.points;
+        }
+        if (valid) {
+            const uint32_t *dims = reinterpret_cast<const uint32_t *>(data + dims_offset);
+            for (size_t s = 0; s < slices.size() && valid; s++) {
+                valid = (int)dims[2 * s] == slices[s].GetX() && (int)dims[2 * s + 1] == slices[s].GetY();
+                slice_voxels[s + 1] = slice_voxels[s] + size_t(dims[2 * s]) * dims[2 * s + 1];
+            }
+            valid = valid && slice_voxels.back() == header.voxels;
+        }
+        if (valid) {
+            const uint64_t *offsets = reinterpret_cast<const uint64_t *>(data + offsets_offset);
+            valid = offsets[header.voxels] == header.points;
+            for (size_t v = 0; v < header.voxels && valid; v++)
+                valid = offsets[v] <= offsets[v + 1];
+        }
+
+        if (valid) {
+            const uint8_t *inside = reinterpret_cast<const uint8_t *>(data + inside_offset);
+            const uint64_t *offsets = reinterpret_cast<const uint64_t *>(data + offsets_offset);
+            const POINT3D *points = reinterpret_cast<const POINT3D *>(data + points_offset);
+
+            volcoeffs.resize(slices.size());
+            slice_inside.resize(slices.size());
+            #pragma omp parallel for schedule(dynamic)
+            for (size_t s = 0; s < slices.size(); s++) {
+                const int nx = slices[s].GetX(), ny = slices[s].GetY();
+                SLICECOEFFS slicecoeffs(nx, Array<VOXELCOEFFS>(ny));
+                for (int i = 0; i < nx; i++)
+                    for (int j = 0; j < ny; j++) {
+                        const size_t v = slice_voxels[s] + size_t(i) * ny + j;
+                        slicecoeffs[i][j].assign(points + offsets[v], points + offsets[v + 1]);
+                    }
+                volcoeffs[s] = move(slicecoeffs);
+                slice_inside[s] = inside[s] != 0;
+            }
+        }
+
+        munmap(ptr, bytes);
+
+        // A hit makes the file the most recently used one
+        if (valid)
+            utimes(path.c_str(), nullptr);
+
+        return valid;
+    }
+
+    //-------------------------------------------------------------------
+
+    bool CoefficientCache::Serialise(const Array<SLICECOEFFS>& volcoeffs, const Array<bool>& slice_inside, Array<char>& contents) const {
+        CoefficientCacheHeader header;
+        memcpy(header.magic, CoefficientCacheMagic, sizeof(header.magic));
+        header.version = CoefficientCacheVersion;
+        header.point_size = sizeof(POINT3D);
+        header.key = _key;
+        header.slices = volcoeffs.size();
+        header.voxels = 0;
+        header.points = 0;
+        for (const SLICECOEFFS& slicecoeffs : volcoeffs)
+            for (const auto& column : slicecoeffs) {
+                header.voxels += column.size();
+                for (const VOXELCOEFFS& coeffs : column)
+                    header.points += coeffs.size();
+            }
+
+        size_t dims_offset, inside_offset, offsets_offset, points_offset;
+        CacheLayout(header.slices, header.voxels, dims_offset, inside_offset, offsets_offset, points_offset);
+
+        // A file beyond the size limit would evict everything else and be removed itself next time
+        const size_t bytes = points_offset + sizeof(POINT3D) * header.points;
+        if (_max_bytes > 0 && bytes > _max_bytes)
+            return false;
+        contents.assign(bytes, 0);
+        memcpy(contents.data(), &header, sizeof(header));
+
+        uint32_t *dims = reinterpret_cast<uint32_t *>(contents.data() + dims_offset);
+        uint8_t *inside = reinterpret_cast<uint8_t *>(contents.data() + inside_offset);
+        uint64_t *offsets = reinterpret_cast<uint64_t *>(contents.data() + offsets_offset);
+        POINT3D *points = reinterpret_cast<POINT3D *>(contents.data() + points_offset);
+
+        size_t v = 0;
+        offsets[0] = 0;
+        for (size_t s = 0; s < volcoeffs.size(); s++) {
+            const uint32_t nx = volcoeffs[s].size(), ny = nx > 0 ? volcoeffs[s][0].size() : 0;
+            dims[2 * s] = nx;
+            dims[2 * s + 1] = ny;
+            inside[s] = s < slice_inside.size() && slice_inside[s];
+            for (uint32_t i = 0; i < nx; i++)
+                for (uint32_t j = 0; j < ny; j++, v++) {
+                    const VOXELCOEFFS& coeffs = volcoeffs[s][i][j];
+                    copy(coeffs.begin(), coeffs.end(), points + offsets[v]);
+                    offsets[v + 1] = offsets[v] + coeffs.size();
+                }
+        }
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+
+    bool CoefficientCache::Store(const Array<char>& contents, const string& path, const string& directory, size_t max_bytes) {
+        // Written under a temporary name and renamed, so concurrent runs never read a partial file
+        const string tmp_path = path + "." + to_string(getpid()) + ".tmp";
+        ofstream file(tmp_path, ios::binary);
+        file.write(contents.data(), contents.size());
+        file.close();
+
+        if (!file || rename(tmp_path.c_str(), path.c_str()) != 0) {
+            unlink(tmp_path.c_str());
+            cerr << "CoefficientCache: cannot write " << path << endl;
+            return false;
+        }
+
+        if (max_bytes > 0)
+            Evict(directory, max_bytes, path);
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+
+    void CoefficientCache::Evict(const string& directory, size_t max_bytes, const string& keep) {
+        struct CacheFile {
+            string path;
+            size_t bytes;
+            time_t used;
+        };
+        Array<CacheFile> files;
+        size_t total = 0;
+
+        DIR *dir = opendir(directory.c_str());
+        if (dir == nullptr)
+            return;
+        while (const dirent *entry = readdir(dir)) {
+            const string name = entry->d_name;
+            if (name.compare(0, 7, "coeffs-") != 0 || name.size() < 4 || name.compare(name.size() - 4, 4, ".bin") != 0)
+                continue;
+            const string path = directory + "/" + name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0)
+                continue;
+            files.push_back({path, size_t(st.st_size), st.st_mtime});
+            total += st.st_size;
+        }
+        closedir(dir);
+
+        // Least recently used first
+        sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.used < b.used; });
+        for (const CacheFile& file : files) {
+            if (total <= max_bytes)
+                break;
+            if (file.path == keep || unlink(file.path.c_str()) != 0)
+                continue;
+            total -= file.bytes;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    bool CoefficientCache::Write(const Array<SLICECOEFFS>& volcoeffs, const Array<bool>& slice_inside, OutputWriter *writer) const {
+        auto contents = make_shared<Array<char>>();
+        if (!Serialise(volcoeffs, slice_inside, *contents))
+            return false;
+
+        if (writer == nullptr)
+            return Store(*contents, Path(), _directory, _max_bytes);
+
+        const string path = Path(), directory = _directory;
+        const size_t max_bytes = _max_bytes;
+        writer->Push([contents, path, directory, max_bytes] { Store(*contents, path, directory, max_bytes); });
+        return true;
+    }
+
+} // namespace svrtk
@@ -0,0 +1,163 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/MotionSmoothing.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    MotionSmoothing::MotionSmoothing(size_t n) : _n(n) {
+        Reset();
+    }
+
+    //-------------------------------------------------------------------
+
+    void MotionSmoothing::AddSegment(size_t begin, size_t end, double sigma, int half_width) {
+        if (begin > end || end > _n)
+            throw runtime_error("MotionSmoothing: segment is out of range");
+
+        Segment segment;
+        segment.begin = begin;
+        segment.end = end;
+        segment.half_width = half_width >= 0 ? half_width : max(int(3 * sigma), 0);
+        for (int j = -segment.half_width; j <= segment.half_width; j++)
+            segment.kernel.push_back(exp(-(j / sigma) * (j / sigma)));
+        _segments.push_back(move(segment));
+    }
+
+    //-------------------------------------------------------------------
+
+    void MotionSmoothing::Reset() {
+        _num.assign(6 * _n, 0);
+        _den.assign(6 * _n, 0);
+    }
+
+    //-------------------------------------------------------------------
+
+    void MotionSmoothing::Regress(const Matrix& parameters, const Matrix& weights, Matrix& kr) {
+        if (parameters.Rows() != 6 || parameters.Cols() != (int)_n || weights.Rows() != 6 || weights.Cols() != (int)_n)
+            throw runtime_error("MotionSmoothing: parameters and weights have to be 6 x number of transformations");
+
+        // Weights and weighted parameters packed per transformation
+        Array<double> w(6 * _n), wp(6 * _n);
+        for (size_t i = 0; i < _n; i++) {
+            for (int par = 0; par < 6; par++) {
+                w[6 * i + par] = weights(par, i);
+                wp[6 * i + par] = parameters(par, i) * weights(par, i);
+            }
+        }
+
+        for (const auto& segment : _segments) {
+            const ptrdiff_t begin = segment.begin, end = segment.end;
+            const int h = segment.half_width;
+
+            #pragma omp parallel for
+            for (ptrdiff_t i = begin; i < end; i++) {
+                const ptrdiff_t jb = max(i - h, begin);
+                const ptrdiff_t je = min(i + h + 1, end);
+                double num[6] = {}, den[6] = {};
+                for (ptrdiff_t j = jb; j < je; j++) {
+                    const double k = segment.kernel[j - i + h];
+                    for (int par = 0; par < 6; par++) {
+                        num[par] += k * wp[6 * j + par];
+                        den[par] += k * w[6 * j + par];
+                    }
+                }
+                for (int par = 0; par < 6; par++) {
+                    _num[6 * i + par] += num[par];
+                    _den[6 * i + par] += den[par];
+                }
+            }
+        }
+
+        kr.Initialize(6, _n);
+        for (size_t i = 0; i < _n; i++)
+            for (int par = 0; par < 6; par++)
+                kr(par, i) = _num[6 * i + par] / _den[6 * i + par];
+    }
+
+    //-------------------------------------------------------------------
+
+    MotionSmoothing::PointMoments MotionSmoothing::Moments(const RealImage& image, int step) {
+        step = max(step, 1);
+        Array<double> points;
+        for (int k = 0; k < image.GetZ(); k += step)
+            for (int j = 0; j < image.GetY(); j += step)
+                for (int i = 0; i < image.GetX(); i += step)
+                    if (image(i, j, k, 0) > -1) {
+                        double x = i, y = j, z = k;
+                        image.ImageToWorld(x, y, z);
+                        points.push_back(x);
+                        points.push_back(y);
+                        points.push_back(z);
+                    }
+
+        PointMoments moments;
+        moments.n = points.size() / 3;
+        if (moments.n == 0)
+            return moments;
+
+        // Two passes, so the covariance doesn't suffer from cancellation far from the origin
+        for (size_t p = 0; p < moments.n; p++)
+            for (int a = 0; a < 3; a++)
+                moments.mean[a] += points[3 * p + a];
+        for (int a = 0; a < 3; a++)
+            moments.mean[a] /= moments.n;
+
+        for (size_t p = 0; p < moments.n; p++)
+            for (int a = 0; a < 3; a++)
+                for (int b = 0; b < 3; b++)
+                    moments.cov[a][b] += (points[3 * p + a] - moments.mean[a]) * (points[3 * p + b] - moments.mean[b]);
+        for (int a = 0; a < 3; a++)
+            for (int b = 0; b < 3; b++)
+                moments.cov[a][b] /= moments.n;
+
+        return moments;
+    }
+
+    //-------------------------------------------------------------------
+
+    double MotionSmoothing::TRE(const Matrix& a, const Matrix& b, const PointMoments& moments) {
+        if (moments.n == 0)
+            return -1;
+
+        // mean |D p|^2 = |D mean|^2 + trace(L cov L^T) with D = a - b and L its linear part
+        double sum = 0;
+        for (int r = 0; r < 3; r++) {
+            double d[4];
+            for (int c = 0; c < 4; c++)
+                d[c] = a(r, c) - b(r, c);
+
+            double dm = d[3];
+            for (int c = 0; c < 3; c++)
+                dm += d[c] * moments.mean[c];
+
+            double dc = 0;
+            for (int c = 0; c < 3; c++)
+                for (int e = 0; e < 3; e++)
+                    dc += d[c] * moments.cov[c][e] * d[e];
+
+            sum += dm * dm + dc;
+        }
+
+        return sqrt(max(sum, 0.0));
+    }
+
+} // namespace svrtk
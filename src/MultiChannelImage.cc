@@ -0,0 +1,85 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/MultiChannelImage.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    void MultiChannelImage::Initialize(const ImageAttributes& attr, int channels, RealPixel value) {
+        _attr = attr;
+        _attr._t = 1;
+        _channels = channels;
+        _data.assign(_attr.NumberOfSpatialPoints() * _channels, value);
+    }
+
+    //-------------------------------------------------------------------
+
+    void MultiChannelImage::Pack(const Array<RealImage>& images) {
+        if (images.empty()) {
+            Initialize(ImageAttributes(), 0);
+            return;
+        }
+
+        const size_t voxels = images[0].NumberOfSpatialVoxels();
+        for (size_t c = 1; c < images.size(); c++)
+            if ((size_t)images[c].NumberOfSpatialVoxels() != voxels)
+                throw runtime_error("MultiChannelImage: channel images differ in size");
+
+        if (_channels != (int)images.size() || NumberOfVoxels() != voxels)
+            Initialize(images[0].Attributes(), images.size());
+        else
+            _attr = images[0].Attributes();
+
+        #pragma omp parallel for
+        for (size_t v = 0; v < voxels; v++)
+            for (int c = 0; c < _channels; c++)
+                _data[v * _channels + c] = images[c].Data()[v];
+    }
+
+    //-------------------------------------------------------------------
+
+    void MultiChannelImage::Unpack(Array<RealImage>& images) const {
+        const size_t voxels = NumberOfVoxels();
+        images.resize(_channels);
+        for (int c = 0; c < _channels; c++)
+            if (images[c].NumberOfVoxels() != (int)voxels)
+                images[c].Initialize(_attr);
+
+        #pragma omp parallel for
+        for (size_t v = 0; v < voxels; v++)
+            for (int c = 0; c < _channels; c++)
+                images[c].Data()[v] = _data[v * _channels + c];
+    }
+
+    //-------------------------------------------------------------------
+
+    MultiChannelImage& MultiChannelImage::operator+=(const MultiChannelImage& image) {
+        if (image._data.size() != _data.size())
+            throw runtime_error("MultiChannelImage: images differ in size");
+
+        #pragma omp simd
+        for (size_t n = 0; n < _data.size(); n++)
+            _data[n] += image._data[n];
+
+        return *this;
+    }
+
+} // namespace svrtk
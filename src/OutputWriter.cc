@@ -0,0 +1,182 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/OutputWriter.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    OutputWriter::OutputWriter(size_t capacity, int threads) : _capacity(max<size_t>(capacity, 1)), _active(0), _stop(false) {
+        for (int i = 0; i < max(threads, 1); i++)
+            _threads.emplace_back(&OutputWriter::Run, this);
+    }
+
+    //-------------------------------------------------------------------
+
+    OutputWriter::~OutputWriter() {
+        {
+            unique_lock<mutex> lock(_mutex);
+            _stop = true;
+        }
+        _job_added.notify_all();
+        for (auto& t : _threads)
+            t.join();
+
+        for (const auto& error : _errors)
+            cerr << "OutputWriter: " << error << endl;
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::Push(function<void()> job) {
+        unique_lock<mutex> lock(_mutex);
+        _job_done.wait(lock, [this] { return _jobs.size() < _capacity; });
+        _jobs.push_back(move(job));
+        lock.unlock();
+        _job_added.notify_one();
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::Run() {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(_mutex);
+                _job_added.wait(lock, [this] { return _stop || !_jobs.empty(); });
+                // Pending jobs are still written when stopping
+                if (_jobs.empty())
+                    return;
+                job = move(_jobs.front());
+                _jobs.pop_front();
+                _active++;
+            }
+            _job_done.notify_all();
+
+            string error;
+            try {
+                job();
+            } catch (const exception& e) {
+                error = e.what();
+            }
+
+            {
+                unique_lock<mutex> lock(_mutex);
+                if (!error.empty())
+                    _errors.push_back(move(error));
+                _active--;
+            }
+            _job_done.notify_all();
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::Write(const RealImage& image, const string& filename) {
+        // The snapshot is taken on the calling thread, the image can be modified right after
+        auto snapshot = make_shared<RealImage>(image);
+        Push([snapshot, filename] { snapshot->Write(filename.c_str()); });
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::Write(const RigidTransformation& transformation, const string& filename) {
+        auto snapshot = make_shared<RigidTransformation>(transformation);
+        Push([snapshot, filename] { snapshot->Write(filename.c_str()); });
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::WritePacked(const Array<RealImage>& images, const string& filename) {
+        auto snapshot = make_shared<Array<RealImage>>(images);
+        Push([snapshot, filename] { SavePacked(*snapshot, filename); });
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::Flush() {
+        unique_lock<mutex> lock(_mutex);
+        _job_done.wait(lock, [this] { return _jobs.empty() && _active == 0; });
+
+        if (_errors.empty())
+            return;
+        string message = "OutputWriter: " + to_string(_errors.size()) + " output(s) could not be written";
+        for (const auto& error : _errors)
+            message += "\n  " + error;
+        _errors.clear();
+        throw runtime_error(message);
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::PackImages(const Array<RealImage>& images, RealImage& packed) {
+        if (images.empty()) {
+            packed = RealImage();
+            return;
+        }
+
+        ImageAttributes attr = images[0].Attributes();
+        for (const auto& image : images) {
+            attr._x = max(attr._x, image.GetX());
+            attr._y = max(attr._y, image.GetY());
+            attr._z = max(attr._z, image.GetZ());
+        }
+        attr._t = images.size();
+        attr._dt = 1;
+        packed.Initialize(attr);
+        packed = -1;
+
+        #pragma omp parallel for
+        for (size_t n = 0; n < images.size(); n++) {
+            const RealImage& image = images[n];
+            for (int k = 0; k < image.GetZ(); k++)
+                for (int j = 0; j < image.GetY(); j++)
+                    memcpy(&packed(0, j, k, n), &image(0, j, k), sizeof(RealPixel) * image.GetX());
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void OutputWriter::SavePacked(const Array<RealImage>& images, const string& filename) {
+        if (images.empty())
+            return;
+        RealImage packed;
+        PackImages(images, packed);
+        packed.Write(filename.c_str());
+
+        // Geometry of the individual images is needed to unpack them
+        ofstream info(filename + ".txt");
+        info << "index x y z dx dy dz xorigin yorigin zorigin xaxis yaxis zaxis" << endl;
+        for (size_t i = 0; i < images.size(); i++) {
+            const ImageAttributes& attr = images[i].Attributes();
+            info << i << " " << attr._x << " " << attr._y << " " << attr._z << " "
+                << attr._dx << " " << attr._dy << " " << attr._dz << " "
+                << attr._xorigin << " " << attr._yorigin << " " << attr._zorigin;
+            for (int j = 0; j < 3; j++)
+                info << " " << attr._xaxis[j];
+            for (int j = 0; j < 3; j++)
+                info << " " << attr._yaxis[j];
+            for (int j = 0; j < 3; j++)
+                info << " " << attr._zaxis[j];
+            info << endl;
+        }
+    }
+
+} // namespace svrtk
@@ -21,6 +21,7 @@
 #include "svrtk/Reconstruction.h"
 #include "svrtk/Profiling.h"
 #include "svrtk/Parallel.h"
+#include "svrtk/MotionSmoothing.h"
 
 namespace svrtk {
 
@@ -74,6 +75,19 @@ namespace svrtk {
         _ffd_global_ncc = false;
         _no_masking_background = false;
         _combined_rigid_ffd = false;
+        _use_slice_store = false;
+        _pack_slice_outputs = false;
+        _gather_stages = 0;
+        _gather_memory = 0;
+        _trilinear_splat = false;
+        _coeff_prune_threshold = 0;
+        _ffd_field_tolerance = 0;
+        _slice_residuals_valid = false;
+        _convergence_tre = 0;
+        _convergence_max_tre = 0;
+        _convergence_volume = 0;
+        _level_resolution = 0;
+        _level_regularisation = 1;
 
     }
 
@@ -156,6 +170,11 @@ namespace svrtk {
         _grey_reconstructed = _reconstructed;
         _attr_reconstructed = _reconstructed.Attributes();
 
+        //the template defines the finest level of the resolution schedule
+        _attr_template = _attr_reconstructed;
+        _level_resolution = d;
+        _level_regularisation = 1;
+
         if (_debug)
             _reconstructed.Write("template.nii.gz");
 
@@ -171,6 +190,79 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
+    // Resample the reconstructed volume and the mask to a level of the resolution schedule
+    void Reconstruction::SetResolutionLevel(double resolution) {
+        if (!_template_created)
+            throw runtime_error("Please create the template before setting the resolution level.");
+
+        const double template_resolution = _attr_template._dx;
+        if (resolution <= 0)
+            resolution = template_resolution;
+        if (fabs(resolution - _level_resolution) < 1e-6)
+            return;
+
+        SVRTK_START_TIMING();
+
+        //grid of the level covers the same field of view as the template
+        ImageAttributes attr = _attr_template;
+        if (fabs(resolution - template_resolution) > 1e-6) {
+            attr._x = max(1, (int)round(_attr_template._x * _attr_template._dx / resolution));
+            attr._y = max(1, (int)round(_attr_template._y * _attr_template._dy / resolution));
+            attr._z = max(1, (int)round(_attr_template._z * _attr_template._dz / resolution));
+            attr._dx = attr._dy = attr._dz = resolution;
+        }
+
+        const auto resample = [&](RealImage input, RealImage& output, InterpolationMode interpolation) {
+            RealImage resampled(attr);
+            RigidTransformation transformation;
+            ImageTransformation imagetransformation;
+            unique_ptr<InterpolateImageFunction> interpolator(InterpolateImageFunction::New(interpolation));
+
+            imagetransformation.Input(&input);
+            imagetransformation.Transformation(&transformation);
+            imagetransformation.Output(&resampled);
+            imagetransformation.TargetPaddingValue(-1);
+            imagetransformation.SourcePaddingValue(0);
+            imagetransformation.Interpolator(interpolator.get());
+            imagetransformation.Run();
+
+            output = move(resampled);
+        };
+
+        //upsample (or downsample) the current reconstruction to the new grid
+        resample(_reconstructed, _reconstructed, Interpolation_Linear);
+        for (size_t n = 0; n < _mc_reconstructed.size(); n++)
+            resample(_mc_reconstructed[n], _mc_reconstructed[n], Interpolation_Linear);
+
+        //the mask is always resampled from the template grid to avoid accumulating errors
+        if (_have_mask) {
+            if (!_mask_template.IsEmpty())
+                resample(_mask_template, _mask, Interpolation_NN);
+            else
+                resample(_mask, _mask, Interpolation_NN);
+            _evaluation_mask = _mask;
+        }
+
+        _grey_reconstructed = _reconstructed;
+        _attr_reconstructed = _reconstructed.Attributes();
+
+        //volume weights and confidence map refer to the previous grid until the next CoeffInit/Superresolution
+        _confidence_map.Initialize(_attr_reconstructed);
+        _volume_weights.Initialize(_attr_reconstructed);
+
+        //a coarser grid covers a larger distance per neighbour, so each regularisation step is damped
+        _level_resolution = resolution;
+        _level_regularisation = pow(template_resolution / resolution, 2);
+
+        cout << "Reconstructed volume voxel size (level) : " << resolution << " mm" << endl;
+        if (_verbose)
+            _verbose_log << "Resolution level : " << resolution << " mm ; regularisation scaling : " << _level_regularisation << endl;
+
+        SVRTK_END_TIMING("SetResolutionLevel");
+    }
+
+    //-------------------------------------------------------------------
+
     // Create anisotropic template
     double Reconstruction::CreateTemplateAniso(const RealImage& stack) {
         ImageAttributes attr = stack.Attributes();
@@ -264,6 +356,10 @@ namespace svrtk {
         _have_mask = true;
         _evaluation_mask = _mask;
 
+        //remember the mask on the template grid for the resolution schedule
+        if (_mask.Attributes() == _attr_template)
+            _mask_template = _mask;
+
         // compute mask volume
         double vol = 0;
         RealPixel *pm = _evaluation_mask.Data();
@@ -285,17 +381,21 @@ namespace svrtk {
 
     // generate reconstruction quality report / metrics
     void Reconstruction::ReconQualityReport(double& out_ncc, double& out_nrmse, double& average_weight, double& ratio_excluded) {
-        Parallel::QualityReport parallelQualityReport(this);
-        parallelQualityReport();
+        const Array<SliceResidualStats>& residuals = SliceResiduals();
 
-        size_t count_excluded_str = 0;
-        for (size_t i = 0; i < _slices.size(); i++)
-            if (_structural_slice_weight[i] < 1)
-                count_excluded_str++;
+        double global_ncc = 0, global_nrmse = 0;
+        size_t count_excluded_str = 0, count_excluded = 0;
+        for (const SliceResidualStats& stats : residuals) {
+            if (stats.ncc > 0)
+                global_ncc += stats.ncc;
+            global_nrmse += stats.nrmse;
+            count_excluded_str += stats.structural_excluded;
+            count_excluded += stats.excluded;
+        }
 
         average_weight = _average_volume_weight;
-        out_ncc = parallelQualityReport.out_global_ncc / (_slices.size()-count_excluded_str);
-        out_nrmse = parallelQualityReport.out_global_nrmse / (_slices.size()-count_excluded_str);
+        out_ncc = global_ncc / (_slices.size()-count_excluded_str);
+        out_nrmse = global_nrmse / (_slices.size()-count_excluded_str);
 
         if (!isfinite(out_nrmse))
             out_nrmse = 0;
@@ -303,16 +403,29 @@ namespace svrtk {
         if (!isfinite(out_ncc))
             out_ncc = 0;
 
-        size_t count_excluded = 0;
-        for (size_t i = 0; i < _slices.size(); i++)
-            if (_slice_weight[i] < 0.5 || _structural_slice_weight[i] < 1)
-                count_excluded++;
-
         ratio_excluded = (double)count_excluded / _slices.size();
     }
 
     //-------------------------------------------------------------------
 
+    const Array<SliceResidualStats>& Reconstruction::SliceResiduals() {
+        UpdateCorrectedSlices();
+
+        if (_slice_residuals_valid && _slice_residuals.size() == _slices.size())
+            return _slice_residuals;
+
+        SVRTK_START_TIMING();
+        _slice_residuals.resize(_slices.size());
+        Parallel::SliceResidualStatistics statistics(this);
+        statistics();
+        _slice_residuals_valid = true;
+        SVRTK_END_TIMING("SliceResiduals");
+
+        return _slice_residuals;
+    }
+
+    //-------------------------------------------------------------------
+
     // run global stack registration to the template
     void Reconstruction::StackRegistrations(const Array<RealImage>& stacks, Array<RigidTransformation>& stack_transformations, int templateNumber, RealImage* input_template) {
 
@@ -339,12 +452,27 @@ namespace svrtk {
             stacks[0].Write("stack0.nii.gz");
         }
 
-        RigidTransformation offset;
-        ResetOrigin(target, offset);
+        ParameterList params;
+        if (_nmi_bins > 0)
+            Insert(params, "No. of bins", _nmi_bins);
+
+        if (_masked_stacks)
+            Insert(params, "Background value", 0);
+        else
+            Insert(params, "Background value for image 1", 0);
 
-        //register all stacks to the target
-        Parallel::StackRegistrations p_reg(this, stacks, stack_transformations, templateNumber, target, offset);
-        p_reg();
+        //register all stacks to the target prepared once
+        StackRegistration registration(StackRegistration::Rigid, params, 1.2);
+        registration.Template(target);
+        registration.Run(stacks, stack_transformations);
+
+        //save volumetric registrations
+        if (_debug) {
+            for (size_t i = 0; i < stacks.size(); i++) {
+                stack_transformations[i].Write((boost::format("global-transformation%1%.dof") % i).str().c_str());
+                stacks[i].Write((boost::format("global-stack%1%.nii.gz") % i).str().c_str());
+            }
+        }
 
         for (int i=0; i<stack_transformations.size(); i++) {
             double tx, ty, tz, rx, ry, rz;
@@ -456,6 +584,9 @@ namespace svrtk {
     // run simulation of slices from the reconstruction volume
     void Reconstruction::SimulateSlices() {
         SVRTK_START_TIMING();
+        InvalidateSliceResiduals();
+        if (_multiple_channels_flag && _number_of_channels > 0)
+            _mc_reconstructed_packed.Pack(_mc_reconstructed);
         Parallel::SimulateSlices p_sim(this);
         p_sim();
         SVRTK_END_TIMING("SimulateSlices");
@@ -909,6 +1040,7 @@ namespace svrtk {
         ClearAndReserve(_package_index, reserve_size);
         ClearAndReserve(_slice_attributes, reserve_size);
         ClearAndReserve(_grey_slices, reserve_size);
+        _not_masked_slices.clear();
         ClearAndReserve(_slice_dif, reserve_size);
         ClearAndReserve(_simulated_slices, reserve_size);
         ClearAndReserve(_structural_slice_weight, reserve_size);
@@ -918,7 +1050,7 @@ namespace svrtk {
         ClearAndReserve(_stack_index, reserve_size);
         ClearAndReserve(_transformations, reserve_size);
         if (_ffd)
-            ClearAndReserve(_mffd_transformations, reserve_size);
+            _mffd_transformations.ClearSlices(reserve_size);
         if (!probability_maps.empty())
             ClearAndReserve(_probability_maps, reserve_size);
 
@@ -951,15 +1083,16 @@ namespace svrtk {
 //                if (excluded)
 //                    continue;
 
-                //create slice by selecting the appropriate region of the stack
-                RealImage slice = stacks[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
-                //set correct voxel size in the stack. Z size is equal to slice thickness.
-                slice.PutPixelSize(attr._dx, attr._dy, thickness[i]);
-                //remember the slice
+                //view the slice in the stack. Z size is equal to slice thickness.
+                RealImage view;
+                StackSliceView(view, stacks[i], j, 0, thickness[i]);
                 RealPixel tmin, tmax;
-                slice.GetMinMax(&tmin, &tmax);
+                view.GetMinMax(&tmin, &tmax);
                 _zero_slices.push_back(tmax > 1 && (tmax - tmin) > 1 ? 1 : -1);
 
+                //remember the slice (copied as it is masked later)
+                RealImage slice(view);
+
                 // if 2D gaussian filtering is required
                 if (_blurring) {
                     GaussianBlurring<RealPixel> gbt(0.6 * slice.GetXSize());
@@ -972,7 +1105,12 @@ namespace svrtk {
                 _package_index.push_back(current_package);
                 _slice_attributes.push_back(slice.Attributes());
 
-                _grey_slices.push_back(slice);
+                // the SVR target refers to the stack unless blurred
+                _grey_slices.emplace_back();
+                if (_blurring)
+                    _grey_slices.back() = slice;
+                else
+                    StackSliceView(_grey_slices.back(), stacks[i], j, 0, thickness[i]);
                 memset(slice.Data(), 0, sizeof(RealPixel) * slice.NumberOfVoxels());
                 _slice_dif.push_back(slice);
                 _simulated_slices.push_back(slice);
@@ -989,15 +1127,12 @@ namespace svrtk {
                 _transformations.push_back(stack_transformations[i]);
 
                 // if non-rigid FFD registartion option was selected
-                if (_ffd) {
-                    MultiLevelFreeFormTransformation* mffd = new MultiLevelFreeFormTransformation();
-                    _mffd_transformations.push_back(mffd);
-                }
+                if (_ffd)
+                    _mffd_transformations.AddSlice();
 
                 if (!probability_maps.empty()) {
-                    RealImage proba = probability_maps[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
-                    proba.PutPixelSize(attr._dx, attr._dy, thickness[i]);
-                    _probability_maps.push_back(move(proba));
+                    _probability_maps.emplace_back();
+                    StackSliceView(_probability_maps.back(), probability_maps[i], j, 0, thickness[i]);
                 }
 
                 average_thickness += thickness[i];
@@ -1029,6 +1164,7 @@ namespace svrtk {
         ClearAndReserve(_package_index, reserve_size);
         ClearAndReserve(_slice_attributes, reserve_size);
         ClearAndReserve(_grey_slices, reserve_size);
+        _not_masked_slices.clear();
         ClearAndReserve(_slice_dif, reserve_size);
         ClearAndReserve(_simulated_slices, reserve_size);
         ClearAndReserve(_structural_slice_weight, reserve_size);
@@ -1038,9 +1174,12 @@ namespace svrtk {
         ClearAndReserve(_stack_index, reserve_size);
         ClearAndReserve(_transformations, reserve_size);
         if (_ffd)
-            ClearAndReserve(_mffd_transformations, reserve_size);
+            _mffd_transformations.ClearSlices(reserve_size);
         if (!probability_maps.empty())
             ClearAndReserve(_probability_maps, reserve_size);
+        ClearAndReserve(_mc_slices, reserve_size);
+        ClearAndReserve(_mc_simulated_slices, reserve_size);
+        ClearAndReserve(_mc_slice_dif, reserve_size);
 
         //for each stack
         for (size_t i = 0; i < stacks.size(); i++) {
@@ -1071,17 +1210,16 @@ namespace svrtk {
     //                if (excluded)
     //                    continue;
 
-                //create slice by selecting the appropriate region of the stack
-                RealImage slice = stacks[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
-
-
-                //set correct voxel size in the stack. Z size is equal to slice thickness.
-                slice.PutPixelSize(attr._dx, attr._dy, thickness[i]);
-                //remember the slice
+                //view the slice in the stack. Z size is equal to slice thickness.
+                RealImage view;
+                StackSliceView(view, stacks[i], j, 0, thickness[i]);
                 RealPixel tmin, tmax;
-                slice.GetMinMax(&tmin, &tmax);
+                view.GetMinMax(&tmin, &tmax);
                 _zero_slices.push_back(tmax > 1 && (tmax - tmin) > 1 ? 1 : -1);
 
+                //remember the slice (copied as it is masked later)
+                RealImage slice(view);
+
                 // if 2D gaussian filtering is required
                 if (_blurring) {
                     GaussianBlurring<RealPixel> gbt(0.6 * slice.GetXSize());
@@ -1094,7 +1232,12 @@ namespace svrtk {
                 _package_index.push_back(current_package);
                 _slice_attributes.push_back(slice.Attributes());
 
-                _grey_slices.push_back(slice);
+                // the SVR target refers to the stack unless blurred
+                _grey_slices.emplace_back();
+                if (_blurring)
+                    _grey_slices.back() = slice;
+                else
+                    StackSliceView(_grey_slices.back(), stacks[i], j, 0, thickness[i]);
                 memset(slice.Data(), 0, sizeof(RealPixel) * slice.NumberOfVoxels());
                 _slice_dif.push_back(slice);
                 _simulated_slices.push_back(slice);
@@ -1110,35 +1253,24 @@ namespace svrtk {
                 //initialize slice transformation with the stack transformation
                 _transformations.push_back(stack_transformations[i]);
 
-                Array<RealImage*> tmp_mc_slices;
-                Array<RealImage*> tmp_mc_simulated_slices;
-                Array<RealImage*> tmp_mc_diff_slices;
-                for (int n=0; n<_number_of_channels; n++) {
-                    RealImage slice_mc = mc_stacks[n][i].GetRegion(0, 0, j, stacks[i].GetX(), stacks[i].GetY(), j + 1);
-                    slice_mc.PutPixelSize(attr._dx, attr._dy, thickness[i]);
-                    RealImage *p_mc_slice = new RealImage(slice_mc);
-                    slice_mc = 1;
-                    RealImage *p_mc_sim_slice = new RealImage(slice_mc);
-                    slice_mc = 1;
-                    RealImage *p_mc_diff_slice = new RealImage(slice_mc);
-                    tmp_mc_slices.push_back(p_mc_slice);
-                    tmp_mc_simulated_slices.push_back(p_mc_sim_slice);
-                    tmp_mc_diff_slices.push_back(p_mc_diff_slice);
-                }
-                _mc_slices.push_back(tmp_mc_slices);
-                _mc_simulated_slices.push_back(tmp_mc_simulated_slices);
-                _mc_slice_dif.push_back(tmp_mc_diff_slices);
+                // channels are packed straight from the stacks
+                Array<RealImage> mc_slices(_number_of_channels);
+                for (int n=0; n<_number_of_channels; n++)
+                    StackSliceView(mc_slices[n], mc_stacks[n][i], j, 0, thickness[i]);
+                MultiChannelImage mc_slice;
+                mc_slice.Pack(mc_slices);
+                const ImageAttributes mc_attr = mc_slice.Attributes();
+                _mc_slices.push_back(move(mc_slice));
+                _mc_simulated_slices.emplace_back(mc_attr, _number_of_channels, 1);
+                _mc_slice_dif.emplace_back(mc_attr, _number_of_channels, 1);
 
                 // if non-rigid FFD registration option was selected
-                if (_ffd) {
-                    MultiLevelFreeFormTransformation* mffd = new MultiLevelFreeFormTransformation();
-                    _mffd_transformations.push_back(mffd);
-                }
+                if (_ffd)
+                    _mffd_transformations.AddSlice();
 
                 if (!probability_maps.empty()) {
-                    RealImage proba = probability_maps[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
-                    proba.PutPixelSize(attr._dx, attr._dy, thickness[i]);
-                    _probability_maps.push_back(move(proba));
+                    _probability_maps.emplace_back();
+                    StackSliceView(_probability_maps.back(), probability_maps[i], j, 0, thickness[i]);
                 }
 
                 average_thickness += thickness[i];
@@ -1164,6 +1296,8 @@ namespace svrtk {
             _bias[i].Initialize(_slices[i].Attributes());
             _weights[i].Initialize(_slices[i].Attributes());
         }
+
+        InvalidateCorrectedSlices();
     }
 
     //-------------------------------------------------------------------
@@ -1225,15 +1359,29 @@ namespace svrtk {
             return;
         }
 
-        if (_no_masking_background)
-            _not_masked_slices.insert(_not_masked_slices.end(), _slices.begin(), _slices.end());
+        // Unmodified slices refer to their SVR targets instead of being copied
+        if (_no_masking_background) {
+            ClearAndResize(_not_masked_slices, _slices.size());
+            #pragma omp parallel for
+            for (size_t i = 0; i < _slices.size(); i++) {
+                if (i < _grey_slices.size() && _grey_slices[i].NumberOfVoxels() == _slices[i].NumberOfVoxels()
+                    && memcmp(_grey_slices[i].Data(), _slices[i].Data(), sizeof(RealPixel) * _slices[i].NumberOfVoxels()) == 0)
+                    ImageView(_not_masked_slices[i], _grey_slices[i]);
+                else
+                    _not_masked_slices[i] = _slices[i];
+            }
+        }
 
-        Utility::MaskSlices(_slices, _mask, [&](size_t index, double& x, double& y, double& z) {
-            if (!_ffd)
-                _transformations[index].Transform(x, y, z);
-            else
+        if (!_ffd) {
+            _slice_geometry.Resize(_slices.size());
+            Utility::MaskSlices(_slices, _mask, [&](size_t index) {
+                return _slice_geometry.Get(index, _slices[index].Attributes(), _transformations[index], _mask.Attributes());
+            });
+        } else {
+            Utility::MaskSlices(_slices, _mask, [&](size_t index, double& x, double& y, double& z) {
                 _mffd_transformations[index]->Transform(-1, 1, x, y, z);
-        });
+            });
+        }
     }
 
     //-------------------------------------------------------------------
@@ -1266,6 +1414,70 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
+    // Jacobian of the slice transformation at a slice pixel
+    double Reconstruction::SliceJacobian(size_t inputIndex, int i, int j) const {
+        if (!_ffd)
+            return 1;
+
+        double x = i, y = j, z = 0;
+        _slices[inputIndex].ImageToWorld(x, y, z);
+        return _mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
+    }
+
+    //-------------------------------------------------------------------
+
+    // Jacobian-based include masks of the slice pixels and of the volume voxels of their coefficients
+    void Reconstruction::JacobianMasks() {
+        SVRTK_START_TIMING();
+
+        ClearAndResize(_jac_pixel_include, _slices.size());
+        ClearAndResize(_jac_excluded_voxels, _slices.size());
+        if (!_ffd)
+            return;
+
+        const int nx = _reconstructed.GetX(), ny = _reconstructed.GetY();
+        size_t excluded_pixels = 0, excluded_voxels = 0;
+
+        #pragma omp parallel for schedule(dynamic) reduction(+: excluded_pixels, excluded_voxels)
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+            const RealImage& slice = _slices[inputIndex];
+            Array<char>& include = _jac_pixel_include[inputIndex];
+            include.resize(slice.GetX() * slice.GetY());
+            for (int i = 0; i < slice.GetX(); i++)
+                for (int j = 0; j < slice.GetY(); j++) {
+                    include[i * slice.GetY() + j] = (100 * SliceJacobian(inputIndex, i, j)) > _global_JAC_threshold;
+                    excluded_pixels += !include[i * slice.GetY() + j];
+                }
+
+            // The superresolution evaluates the Jacobian at the coefficient voxel indices,
+            // once for every voxel touched by the slice
+            Array<int> voxels;
+            for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
+                for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+                    for (const POINT3D& p : _volcoeffs[inputIndex][i][j])
+                        voxels.push_back(p.x + nx * (p.y + ny * p.z));
+            sort(voxels.begin(), voxels.end());
+            voxels.erase(unique(voxels.begin(), voxels.end()), voxels.end());
+
+            Array<int>& excluded = _jac_excluded_voxels[inputIndex];
+            for (const int v : voxels) {
+                const double jac = _mffd_transformations[inputIndex]->Jacobian(v % nx, (v / nx) % ny, v / (nx * ny), 0, 0);
+                if ((100 * jac) < _global_JAC_threshold)
+                    excluded.push_back(v);
+            }
+            excluded.shrink_to_fit();
+            excluded_voxels += excluded.size();
+        }
+
+        if (_verbose)
+            _verbose_log << "Jacobian masks: " << excluded_pixels << " slice pixels and " << excluded_voxels
+                << " slice-voxel pairs excluded (threshold " << _global_JAC_threshold << "%)" << endl;
+
+        SVRTK_END_TIMING("JacobianMasks");
+    }
+
+    //-------------------------------------------------------------------
+
     // initialise slice transformations with stack transformations
     void Reconstruction::InitialiseWithStackTransformations(const Array<RigidTransformation>& stack_transformations) {
         #pragma omp parallel for
@@ -1307,10 +1519,8 @@ namespace svrtk {
         double mean_ncc = 0;
         int number_of_excluded = 0;
 
-        if (_debug)
-            cout << " - excluded : ";
-
-        // #pragma omp parallel for private(output, target, slice_mask) firstprivate(imagetransformation) reduction(+: mean_ncc)
+        // slices are resampled and compared independently
+        #pragma omp parallel for schedule(dynamic) reduction(+: mean_ncc)
         for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
             // transfrom reconstructed volume to the slice space
 
@@ -1346,24 +1556,29 @@ namespace svrtk {
                 output_ncc = 1;
             reg_ncc[inputIndex] = output_ncc;
             mean_ncc += output_ncc;
+        }
 
-            double current_global_NCC_threshold = _global_NCC_threshold;
-            if (_current_iteration == 0)
-                current_global_NCC_threshold = _global_NCC_threshold * 0.75;
+        double current_global_NCC_threshold = _global_NCC_threshold;
+        if (_current_iteration == 0)
+            current_global_NCC_threshold = _global_NCC_threshold * 0.75;
 
-            // set slice weight
-            if (output_ncc > current_global_NCC_threshold) {
+        if (_debug)
+            cout << " - excluded : ";
+
+        // set slice weights
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+            if (reg_ncc[inputIndex] > current_global_NCC_threshold) {
                 _structural_slice_weight[inputIndex] = 1;
-//                cout << inputIndex << "(in:" << output_ncc << ") ";
             } else {
                 _structural_slice_weight[inputIndex] = -1;
                 number_of_excluded++;
                 if (_debug)
-                    cout << inputIndex << "(" << output_ncc << "), ";
+                    cout << inputIndex << "(" << reg_ncc[inputIndex] << "), ";
             }
         }
         cout << endl;
         mean_ncc /= _slices.size();
+        InvalidateSliceResiduals();
 
         if (_debug)
             cout << " - mean registration ncc: " << mean_ncc << " | " << number_of_excluded << " / " << _slices.size() << endl;
@@ -1457,19 +1672,124 @@ namespace svrtk {
         _grey_reconstructed = _reconstructed;
 
         if (!_ffd) {
+            _svr_scheduler.EstimateCosts(SVRScheduler::Foreground(_grey_slices));
+            if (_svr_scheduler.Enabled()) {
+                // Outcome of the previous registration
+                UpdateSliceTRE();
+                Array<double> residual;
+                if (_simulated_slices.size() == _slices.size()) {
+                    const Array<SliceResidualStats>& stats = SliceResiduals();
+                    residual.resize(stats.size());
+                    for (size_t inputIndex = 0; inputIndex < stats.size(); inputIndex++)
+                        residual[inputIndex] = stats[inputIndex].nrmse;
+                }
+                _svr_scheduler.Plan(_slice_tre, _slice_weight, residual, _zero_slices);
+
+                if (_verbose)
+                    _verbose_log << "Adaptive SVR: " << _svr_scheduler.Order().size() << " slices registered (" << _svr_scheduler.NumberOfReduced()
+                        << " at the finest level only), " << _svr_scheduler.NumberOfSkipped() << " stable slices skipped" << endl;
+            } else {
+                _svr_scheduler.PlanAll(_slices.size());
+            }
+
+            _previous_transformations = _transformations;
             Parallel::SliceToVolumeRegistration p_reg(this);
             p_reg();
         } else {
 //            _reconstructed.Write("ffd.nii.gz");
+            _svr_scheduler.EstimateCosts(SVRScheduler::Foreground(_slices));
+            _svr_scheduler.PlanAll(_slices.size());
             Parallel::SliceToVolumeRegistrationFFD p_reg(this);
             p_reg();
         }
 
+        if (_verbose)
+            _svr_scheduler.ReportLoadBalance(_verbose_log);
+
         SVRTK_END_TIMING("SliceToVolumeRegistration");
     }
 
     //-------------------------------------------------------------------
 
+    void Reconstruction::UpdateSliceTRE() {
+        ClearAndResize(_slice_tre, _transformations.size(), -1.0);
+        if (_ffd || _previous_transformations.size() != _transformations.size())
+            return;
+
+        // TRE over the voxels of the mask
+        RealImage points = _mask;
+        RealPixel *pp = points.Data();
+        for (int i = 0; i < points.NumberOfVoxels(); i++)
+            if (pp[i] <= 0)
+                pp[i] = -1;
+        const MotionSmoothing::PointMoments moments = MotionSmoothing::Moments(points, 2);
+
+        for (size_t inputIndex = 0; inputIndex < _transformations.size(); inputIndex++) {
+            // Skipped slices were not registered
+            if (_zero_slices[inputIndex] <= 0 || _svr_scheduler.GetMode(inputIndex) == SVRScheduler::Skip)
+                continue;
+            _slice_tre[inputIndex] = MotionSmoothing::TRE(_previous_transformations[inputIndex].GetMatrix(), _transformations[inputIndex].GetMatrix(), moments);
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    bool Reconstruction::RegistrationConverged() {
+        UpdateSliceTRE();
+
+        double mean_tre = 0, max_tre = 0;
+        size_t count = 0;
+        for (size_t inputIndex = 0; inputIndex < _slice_tre.size(); inputIndex++) {
+            const double tre = _slice_tre[inputIndex];
+            if (tre < 0)
+                continue;
+            mean_tre += tre;
+            max_tre = max(max_tre, tre);
+            count++;
+        }
+        if (count == 0)
+            return false;
+        mean_tre /= count;
+
+        const bool converged = _convergence_tre > 0 && mean_tre <= _convergence_tre && (_convergence_max_tre <= 0 || max_tre <= _convergence_max_tre);
+
+        if (_verbose)
+            _verbose_log << "Slice transformation change: mean TRE " << mean_tre << " mm, max TRE " << max_tre << " mm" << (converged ? " (converged)" : "") << endl;
+
+        return converged;
+    }
+
+    //-------------------------------------------------------------------
+
+    bool Reconstruction::ReconstructionConverged() {
+        bool converged = false;
+
+        if (_convergence_reference.NumberOfVoxels() == _reconstructed.NumberOfVoxels()) {
+            const RealPixel *pr = _reconstructed.Data();
+            const RealPixel *pp = _convergence_reference.Data();
+            const RealPixel *pm = _mask.Data();
+            double diff = 0, norm = 0;
+            #pragma omp parallel for reduction(+: diff, norm)
+            for (int i = 0; i < _reconstructed.NumberOfVoxels(); i++) {
+                if (pm[i] > 0) {
+                    diff += (pr[i] - pp[i]) * (pr[i] - pp[i]);
+                    norm += pp[i] * pp[i];
+                }
+            }
+            const double change = norm > 0 ? sqrt(diff / norm) : 0;
+            converged = _convergence_volume > 0 && norm > 0 && change <= _convergence_volume;
+
+            if (_verbose)
+                _verbose_log << "Volume change: " << change << (converged ? " (converged)" : "") << endl;
+        }
+
+        _convergence_reference = _reconstructed;
+
+        return converged;
+    }
+
+    //-------------------------------------------------------------------
+
     // run remote SVR
     void Reconstruction::RemoteSliceToVolumeRegistration(int iter, const string& str_mirtk_path, const string& str_current_exchange_file_path) {
         SVRTK_START_TIMING();
@@ -1489,6 +1809,8 @@ namespace svrtk {
         int svr_range_stop = svr_range_start + stride;
 
         if (!_ffd) {
+            _previous_transformations = _transformations;
+
             // rigid SVR
             if (iter < 3) {
                 _offset_matrices.clear();
@@ -1578,7 +1900,7 @@ namespace svrtk {
             #pragma omp parallel for
             for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
                 const string str_dofout = str_current_exchange_file_path + "/transformation-" + to_string(inputIndex) + ".dof";
-                _mffd_transformations[inputIndex]->Read(str_dofout.c_str());
+                _mffd_transformations.Mutable(inputIndex)->Read(str_dofout.c_str());
             }
         }
 
@@ -1675,7 +1997,7 @@ namespace svrtk {
 
             _slice_attributes.push_back(slice.Attributes());
 
-            _grey_slices.push_back(GreyImage(slice));
+            _grey_slices.push_back(slice);
 
             memset(slice.Data(), 0, sizeof(RealPixel) * slice.NumberOfVoxels());
             _slice_dif.push_back(slice);
@@ -1690,9 +2012,8 @@ namespace svrtk {
 
             _stack_index.push_back(0);
 
-            if (_ffd) {
-                MultiLevelFreeFormTransformation* mffd = new MultiLevelFreeFormTransformation();
-                _mffd_transformations.push_back(mffd);}
+            if (_ffd)
+                _mffd_transformations.AddSlice();
 
         }
     }
@@ -1729,6 +2050,57 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
+    // key of the coefficient cache
+    void Reconstruction::CoeffCacheKey() {
+        //changes of the coefficient computation invalidate earlier cache files
+        const uint32_t version = 1;
+        _coeff_cache.Reset();
+        _coeff_cache.Add(version);
+
+        //PSF and volume grid
+        _coeff_cache.Add(_recon_type);
+        _coeff_cache.Add(_no_sr);
+        _coeff_cache.Add(_quality_factor);
+        _coeff_cache.Add(_grey_reconstructed.Attributes());
+        _coeff_cache.Add(_no_masking_background);
+        if (!_no_masking_background)
+            _coeff_cache.Add(_mask);
+
+        //coefficient kernel
+        const bool splat = _trilinear_splat && !_ffd;
+        _coeff_cache.Add(splat);
+        if (splat)
+            _coeff_cache.Add(_coeff_prune_threshold);
+        _coeff_cache.Add(_ffd);
+        if (_ffd)
+            _coeff_cache.Add(_ffd_field_tolerance);
+
+        //slice geometry, transformations and the pixels coefficients are computed for
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+            const RealImage& slice = _slices[inputIndex];
+            _coeff_cache.Add(slice.Attributes());
+            if (_ffd)
+                _coeff_cache.Add(*_mffd_transformations[inputIndex]);
+            else
+                _coeff_cache.Add(_transformations[inputIndex].GetMatrix());
+
+            const bool active = _structural_slice_weight[inputIndex] > 0
+                && find(_force_excluded.begin(), _force_excluded.end(), (int)inputIndex) == _force_excluded.end();
+            _coeff_cache.Add(active);
+            if (!active)
+                continue;
+
+            const RealImage& test = _no_masking_background ? _not_masked_slices[inputIndex] : slice;
+            Array<uint8_t> pattern(slice.NumberOfVoxels());
+            for (int i = 0; i < slice.GetX(); i++)
+                for (int j = 0; j < slice.GetY(); j++)
+                    pattern[i * slice.GetY() + j] = test(i, j, 0) > -0.01;
+            _coeff_cache.Add(pattern.data(), pattern.size());
+        }
+    }
+
+    //-------------------------------------------------------------------
+
     // run calculation of transformation matrices
     void Reconstruction::CoeffInit() {
         SVRTK_START_TIMING();
@@ -1740,48 +2112,113 @@ namespace svrtk {
         ClearAndResize(_slice_inside, _slices.size());
         _attr_reconstructed = _reconstructed.Attributes();
 
-        Parallel::CoeffInit coeffinit(this);
-        coeffinit();
+        //geometries of slices whose transformation didn't change are reused
+        _slice_geometry.Resize(_slices.size());
+
+        //the PSF is discretised relative to the current level of the resolution schedule
+        if (_verbose && _level_resolution > 0 && _level_resolution != _attr_template._dx)
+            _verbose_log << "CoeffInit at level resolution " << _level_resolution << " mm" << endl;
+
+        ClearAndResize(_coeff_pruning, _slices.size());
+        if (_ffd)
+            ClearAndResize(_ffd_field_error, _slices.size());
+
+        //coefficients of an identical earlier run are loaded from the cache
+        bool cached = false, saved = false;
+        if (_coeff_cache.Enabled()) {
+            CoeffCacheKey();
+            cached = _coeff_cache.Read(_volcoeffs, _slice_inside, _slices);
+        }
+
+        if (!cached) {
+            Parallel::CoeffInit coeffinit(this);
+            coeffinit();
+            //the file is stored by the background writer if there is one
+            if (_coeff_cache.Enabled())
+                saved = _coeff_cache.Write(_volcoeffs, _slice_inside, _output_writer.get());
+        }
+
+        if (_verbose && _coeff_cache.Enabled())
+            _verbose_log << "Coefficients " << (cached ? "loaded from " : !saved ? "not saved to " : _output_writer ? "queued for " : "saved to ")
+                << _coeff_cache.Path() << endl;
+
+        if (_verbose && !cached && _ffd && _ffd_field_tolerance > 0) {
+            double largest = 0;
+            size_t exact = 0;
+            for (size_t inputIndex = 0; inputIndex < _ffd_field_error.size(); inputIndex++) {
+                largest = max(largest, _ffd_field_error[inputIndex]);
+                exact += _ffd_field_error[inputIndex] > _ffd_field_tolerance;
+            }
+            _verbose_log << "Cached FFD slice maps: largest error " << largest << " voxels, " << exact
+                << " slices evaluated exactly (tolerance " << _ffd_field_tolerance << ")" << endl;
+        }
+
+        //Jacobian-based include masks used by the FFD-aware kernels
+        JacobianMasks();
+
+        if (_verbose && !cached && _trilinear_splat && _coeff_prune_threshold > 0) {
+            CoeffPruningStats pruning;
+            for (const auto& stats : _coeff_pruning)
+                pruning += stats;
+            _verbose_log << "Coefficient pruning (threshold " << _coeff_prune_threshold << "): " << pruning.pruned << " of "
+                << pruning.total << " coefficients (" << 100. * pruning.pruned / max(size_t(1), pruning.total)
+                << "%), simulated intensity NRMSE " << (pruning.norm > 0 ? sqrt(pruning.error / pruning.norm) : 0) << endl;
+        }
+
+        //transposed coefficients for the stages updating the volume by gathering
+        _transposed_coeffs.Clear();
+        if (_gather_stages != 0) {
+            const size_t bytes = TransposedCoefficients::Bytes(_volcoeffs, _reconstructed.NumberOfSpatialPoints());
+            if (_gather_memory <= 0 || bytes <= _gather_memory * 1024 * 1024) {
+                _transposed_coeffs.Build(_volcoeffs, _reconstructed.Attributes());
+                if (_verbose)
+                    _verbose_log << "Transposed coefficients: " << bytes / (1024. * 1024.) << " MB" << endl;
+            } else if (_verbose) {
+                _verbose_log << "Transposed coefficients (" << bytes / (1024. * 1024.) << " MB) exceed the memory budget of "
+                    << _gather_memory << " MB - all stages scatter" << endl;
+            }
+        }
 
         //prepare image for volume weights, will be needed for Gaussian Reconstruction
         _volume_weights.Initialize(_reconstructed.Attributes());
 
-        // Do not parallelise: It would cause data inconsistencies
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-            bool excluded = false;
+        if (!_transposed_coeffs.Empty()) {
+            Parallel::VolumeWeightsGather volumeweights(this);
+            volumeweights();
+        } else {
+            // Do not parallelise: It would cause data inconsistencies
+            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+                bool excluded = false;
 
-            for (size_t fe = 0; fe < _force_excluded.size(); fe++) {
-                if (inputIndex == _force_excluded[fe]) {
-                    excluded = true;
-                    break;
+                for (size_t fe = 0; fe < _force_excluded.size(); fe++) {
+                    if (inputIndex == _force_excluded[fe]) {
+                        excluded = true;
+                        break;
+                    }
                 }
-            }
 
-            if (_structural_slice_weight[inputIndex] < 0.5)
-                excluded = true;
+                if (_structural_slice_weight[inputIndex] < 0.5)
+                    excluded = true;
 
-            if (!excluded) {
+                if (!excluded) {
 
-                // Do not parallelise: It would cause data inconsistencies
-                for (int i = 0; i < _slices[inputIndex].GetX(); i++)
-                    for (int j = 0; j < _slices[inputIndex].GetY(); j++)
-                        for (size_t k = 0; k < _volcoeffs[inputIndex][i][j].size(); k++) {
-                            const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
+                    // Do not parallelise: It would cause data inconsistencies
+                    for (int i = 0; i < _slices[inputIndex].GetX(); i++)
+                        for (int j = 0; j < _slices[inputIndex].GetY(); j++) {
+                            if (_volcoeffs[inputIndex][i][j].empty())
+                                continue;
 
-                            if (_ffd) {
-                                double x = i, y = j, z = 0;
-                                _slices[inputIndex].ImageToWorld(x, y, z);
-                                double jac = _mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
-                                if ((100*jac) > _global_JAC_threshold) {
-                                    _volume_weights(p.x, p.y, p.z) += p.value;
-                                }
-                            } else {
+                            if (!JacobianIncluded(inputIndex, i, j))
+                                continue;
+
+                            for (size_t k = 0; k < _volcoeffs[inputIndex][i][j].size(); k++) {
+                                const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
                                 _volume_weights(p.x, p.y, p.z) += p.value;
                             }
-
                         }
-            }
+                }
 
+            }
         }
 
         if (_ffd) {
@@ -1823,10 +2260,11 @@ namespace svrtk {
     void Reconstruction::GaussianReconstruction() {
         SVRTK_START_TIMING();
 
-        RealImage slice;
         Array<int> voxel_num;
         voxel_num.reserve(_slices.size());
 
+        UpdateCorrectedSlices();
+
         //clear _reconstructed image
         memset(_reconstructed.Data(), 0, sizeof(RealPixel) * _reconstructed.NumberOfVoxels());
 
@@ -1836,79 +2274,79 @@ namespace svrtk {
             }
         }
 
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-            if (_volcoeffs[inputIndex].empty())
-                continue;
-
-            int slice_vox_num = 0;
-            //copy the current slice
-            slice = _no_masking_background ? _not_masked_slices[inputIndex] : _slices[inputIndex];
+        if (Gather(StageGaussianReconstruction)) {
+            Parallel::GaussianReconstructionGather gaussian(this);
+            gaussian();
+            voxel_num = move(gaussian.voxel_num);
+        } else {
+            for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+                if (_volcoeffs[inputIndex].empty())
+                    continue;
 
-            //alias the current bias image
-            const RealImage& b = _bias[inputIndex];
-            //read current scale factor
-            const double scale = _scale[inputIndex];
+                int slice_vox_num = 0;
+                //alias the current slice
+                const RealImage& slice = _no_masking_background ? _not_masked_slices[inputIndex] : _slices[inputIndex];
 
-            Array<RealImage> mc_slices;
-            if (_multiple_channels_flag && (_number_of_channels > 0)) {
-                for (int n=0; n<_number_of_channels; n++) {
-                    mc_slices.push_back(*_mc_slices[inputIndex][n]);
-                }
-            }
+                //alias the current bias-corrected slice
+                const RealImage& corrected = _corrected_slices[inputIndex];
+                //alias the current bias image
+                const RealImage& b = _bias[inputIndex];
+                //read current scale factor
+                const double scale = _scale[inputIndex];
 
-            //Distribute slice intensities to the volume
-            for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
-                for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
-                    if (slice(i, j, 0) > -0.01) {
+                //bias-corrected copy of the channels
+                MultiChannelImage mc_slice;
+                if (_multiple_channels_flag && (_number_of_channels > 0))
+                    mc_slice = _mc_slices[inputIndex];
 
-                        double jac = 1;
-                        if (_ffd) {
-                            double x = i, y = j, z = 0;
-                            _slices[inputIndex].ImageToWorld(x, y, z);
-                            jac = _mffd_transformations[inputIndex]->Jacobian(x, y, z, 0, 0);
-                        } else {
-                            jac = 1;
-                        }
+                //Distribute slice intensities to the volume
+                for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++)
+                    for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+                        if (slice(i, j, 0) > -0.01) {
 
-                        if ((100*jac) > _global_JAC_threshold) {
-                            //biascorrect and scale the slice
-                            slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
+                            if (JacobianIncluded(inputIndex, i, j)) {
+                                //biascorrected and scaled slice value
+                                const double value = corrected(i, j, 0) * scale;
 
-                            if (_multiple_channels_flag && (_number_of_channels > 0)) {
-                                for (int n=0; n<_number_of_channels; n++) {
-                                    mc_slices[n](i, j, 0) *= exp(-b(i, j, 0)) * scale;
+                                RealPixel *mc_value = nullptr;
+                                if (_multiple_channels_flag && (_number_of_channels > 0)) {
+                                    const double eb = exp(-b(i, j, 0)) * scale;
+                                    mc_value = mc_slice(i, j, 0);
+                                    for (int n=0; n<_number_of_channels; n++) {
+                                        mc_value[n] *= eb;
+                                    }
                                 }
-                            }
 
-                            //number of volume voxels with non-zero coefficients
-                            //for current slice voxel
-                            const size_t n = _volcoeffs[inputIndex][i][j].size();
+                                //number of volume voxels with non-zero coefficients
+                                //for current slice voxel
+                                const size_t n = _volcoeffs[inputIndex][i][j].size();
 
-                            //if given voxel is not present in reconstructed volume at all, pad it
+                                //if given voxel is not present in reconstructed volume at all, pad it
 
-                            //calculate num of vox in a slice that have overlap with roi
-                            if (n > 0)
-                                slice_vox_num++;
+                                //calculate num of vox in a slice that have overlap with roi
+                                if (n > 0)
+                                    slice_vox_num++;
 
-                            //add contribution of current slice voxel to all voxel volumes
-                            //to which it contributes
-                            for (size_t k = 0; k < n; k++) {
+                                //add contribution of current slice voxel to all voxel volumes
+                                //to which it contributes
+                                for (size_t k = 0; k < n; k++) {
 
-                                const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
+                                    const POINT3D& p = _volcoeffs[inputIndex][i][j][k];
 
-                                _reconstructed(p.x, p.y, p.z) += p.value * slice(i, j, 0);
+                                    _reconstructed(p.x, p.y, p.z) += p.value * value;
 
-                                if (_multiple_channels_flag && (_number_of_channels > 0)) {
-                                    for (int n=0; n<_number_of_channels; n++) {
-                                        _mc_reconstructed[n](p.x, p.y, p.z) += p.value * mc_slices[n](i, j, 0);
+                                    if (mc_value) {
+                                        for (int n=0; n<_number_of_channels; n++) {
+                                            _mc_reconstructed[n](p.x, p.y, p.z) += p.value * mc_value[n];
+                                        }
                                     }
-                                }
 
+                                }
                             }
                         }
-                    }
-            voxel_num.push_back(slice_vox_num);
-            //end of loop for a slice inputIndex
+                voxel_num.push_back(slice_vox_num);
+                //end of loop for a slice inputIndex
+            }
         }
 
         //normalize the volume by proportion of contributing slice voxels
@@ -2144,15 +2582,16 @@ namespace svrtk {
                 _min_intensity_mc.push_back(voxel_limits<RealPixel>::max());
             }
 
-            for (int n=0; n<_number_of_channels; n++) {
-                for (int i = 0; i < _slices.size(); i++) {
-                    for (int y=0; y<_slices[i].GetY(); y++) {
-                        for (int x=0; x<_slices[i].GetX(); x++) {
-                            if (_slices[i](x,y,0) > 0) {
-                                if (_mc_slices[i][n]->GetAsDouble(x,y,0) > _max_intensity_mc[n])
-                                    _max_intensity_mc[n] = _mc_slices[i][n]->GetAsDouble(x,y,0);
-                                if (_mc_slices[i][n]->GetAsDouble(x,y,0) < _min_intensity_mc[n])
-                                    _min_intensity_mc[n] = _mc_slices[i][n]->GetAsDouble(x,y,0);
+            for (int i = 0; i < _slices.size(); i++) {
+                for (int y=0; y<_slices[i].GetY(); y++) {
+                    for (int x=0; x<_slices[i].GetX(); x++) {
+                        if (_slices[i](x,y,0) > 0) {
+                            const RealPixel *value = _mc_slices[i](x, y, 0);
+                            for (int n=0; n<_number_of_channels; n++) {
+                                if (value[n] > _max_intensity_mc[n])
+                                    _max_intensity_mc[n] = value[n];
+                                if (value[n] < _min_intensity_mc[n])
+                                    _min_intensity_mc[n] = value[n];
                             }
                         }
                     }
@@ -2160,7 +2599,56 @@ namespace svrtk {
             }
         }
 
+        InvalidateCorrectedSlices();
+
+        if (_use_slice_store)
+            BindSliceStore();
+    }
+
+    //-------------------------------------------------------------------
+
+    // move the per-slice images into one contiguous slab per field
+    void Reconstruction::BindSliceStore() {
+        SVRTK_START_TIMING();
+
+        // _not_masked_slices is left out: it is mostly views of _grey_slices, which binding would copy again
+        const Array<pair<string, Array<RealImage>*>> candidates = {
+            {"slices", &_slices},
+            {"simulated_slices", &_simulated_slices},
+            {"simulated_weights", &_simulated_weights},
+            {"simulated_inside", &_simulated_inside},
+            {"slice_masks", &_slice_masks},
+            {"weights", &_weights},
+            {"bias", &_bias},
+            {"slice_dif", &_slice_dif}
+        };
+
+        Array<string> fields;
+        for (const auto& candidate : candidates)
+            if (candidate.second->size() == _slices.size())
+                fields.push_back(candidate.first);
+
+        Array<ImageAttributes> slice_attributes;
+        Array<int> stack_index;
+        ClearAndReserve(slice_attributes, _slices.size());
+        ClearAndReserve(stack_index, _slices.size());
+        for (size_t i = 0; i < _slices.size(); i++) {
+            slice_attributes.push_back(_slices[i].Attributes());
+            stack_index.push_back(i < _stack_index.size() ? _stack_index[i] : 0);
+        }
+
+        // The new slab is filled before the previous one is released, as the images may still refer to it
+        SliceStore store;
+        store.Initialize(slice_attributes, stack_index, fields, _slice_store_file);
+        for (const auto& candidate : candidates)
+            store.Bind(*candidate.second, candidate.first);
+        _slice_store = move(store);
 
+        if (_verbose)
+            _verbose_log << "Slice store : " << fields.size() << " fields, " << _slice_store.Bytes() / (1024 * 1024) << " MB"
+                << (_slice_store.IsMapped() ? " (memory-mapped)" : "") << endl;
+
+        SVRTK_END_TIMING("BindSliceStore");
     }
 
     //-------------------------------------------------------------------
@@ -2169,6 +2657,8 @@ namespace svrtk {
     void Reconstruction::InitializeEMValues() {
         SVRTK_START_TIMING();
 
+        InvalidateSliceResiduals();
+
         if (_no_masking_background) {
             #pragma omp parallel for
             for (size_t i = 0; i < _slices.size(); i++) {
@@ -2212,13 +2702,55 @@ namespace svrtk {
             if (_force_excluded[i] > 0 && _force_excluded[i] < _slices.size())
                 _slice_weight[_force_excluded[i]] = 0;
 
+        InvalidateCorrectedSlices();
+
         SVRTK_END_TIMING("InitializeEMValues");
     }
 
     //-------------------------------------------------------------------
 
+    // recompute bias-corrected slices for the slices with updated bias fields
+    void Reconstruction::UpdateCorrectedSlices() {
+        if (_corrected_slices.size() != _slices.size()) {
+            ClearAndResize(_corrected_slices, _slices.size());
+            InvalidateCorrectedSlices();
+        }
+
+        bool updated = false;
+        #pragma omp parallel for reduction(||: updated)
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+            const RealImage& slice = _no_masking_background ? _not_masked_slices[inputIndex] : _slices[inputIndex];
+            RealImage& corrected = _corrected_slices[inputIndex];
+
+            if (!_corrected_slices_dirty[inputIndex] && corrected.NumberOfVoxels() == slice.NumberOfVoxels())
+                continue;
+            updated = true;
+
+            if (corrected.NumberOfVoxels() != slice.NumberOfVoxels())
+                corrected.Initialize(slice.Attributes());
+
+            const RealPixel *ps = slice.Data();
+            const RealPixel *pb = _bias[inputIndex].Data();
+            RealPixel *pc = corrected.Data();
+            const int n = slice.NumberOfVoxels();
+
+            // padding is kept as is, so the corrected slice can be masked the same way
+            #pragma omp simd
+            for (int i = 0; i < n; i++)
+                pc[i] = ps[i] > -0.01 ? ps[i] * exp(-pb[i]) : ps[i];
+
+            _corrected_slices_dirty[inputIndex] = 0;
+        }
+
+        if (updated)
+            InvalidateSliceResiduals();
+    }
+
+    //-------------------------------------------------------------------
+
     // initialise parameters of EM robust statistics
     void Reconstruction::InitializeRobustStatistics() {
+        InvalidateSliceResiduals();
         Array<int> sigma_numbers(_slices.size());
         Array<double> sigma_values(_slices.size());
         RealImage slice;
@@ -2277,8 +2809,11 @@ namespace svrtk {
 
     // run EStep for calculation of voxel-wise and slice-wise posteriors (weights)
     void Reconstruction::EStep() {
+        InvalidateSliceResiduals();
         Array<double> slice_potential(_slices.size());
 
+        UpdateCorrectedSlices();
+
         Parallel::EStep parallelEStep(this, slice_potential);
         parallelEStep();
 
@@ -2441,8 +2976,11 @@ namespace svrtk {
     void Reconstruction::Scale() {
         SVRTK_START_TIMING();
 
+        UpdateCorrectedSlices();
+
         Parallel::Scale parallelScale(this);
         parallelScale();
+        InvalidateSliceResiduals();
 
         if (_verbose) {
             _verbose_log << setprecision(3);
@@ -2460,6 +2998,7 @@ namespace svrtk {
     // run slice bias correction
     void Reconstruction::Bias() {
         SVRTK_START_TIMING();
+        UpdateCorrectedSlices();
         Parallel::Bias parallelBias(this);
         parallelBias();
         SVRTK_END_TIMING("Bias");
@@ -2469,44 +3008,38 @@ namespace svrtk {
 
     // compute difference between simulated and original slices
     void Reconstruction::SliceDifference() {
+        UpdateCorrectedSlices();
+
         #pragma omp parallel for
         for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-            Array<double> mc_ds;
             const RealImage& slice = _no_masking_background ? _not_masked_slices[inputIndex] : _slices[inputIndex];
-            _slice_dif[inputIndex] = slice;
-
-            for (int i = 0; i < _slices[inputIndex].GetX(); i++) {
-                for (int j = 0; j < _slices[inputIndex].GetY(); j++) {
-                    if (_multiple_channels_flag) {
-                        ClearAndReserve(mc_ds, _number_of_channels);
-                        for (int n=0; n<_number_of_channels; n++) {
-                            mc_ds.push_back(_mc_slices[inputIndex][n]->GetAsDouble(i, j, 0));
-                        }
-                    }
-
-                    if (slice(i, j, 0) > -0.01) {
-                        _slice_dif[inputIndex](i, j, 0) *= exp(-(_bias[inputIndex])(i, j, 0)) * _scale[inputIndex];
-                        _slice_dif[inputIndex](i, j, 0) -= _simulated_slices[inputIndex](i, j, 0);
-
-                        if (_multiple_channels_flag) {
-                            for (int n=0; n<_number_of_channels; n++) {
-                                mc_ds[n] = mc_ds[n] * exp(-(_bias[inputIndex])(i, j, 0)) * _scale[inputIndex];
-                                mc_ds[n] = mc_ds[n] - _mc_simulated_slices[inputIndex][n]->GetAsDouble(i, j, 0);
-                            }
-                        }
-                    } else {
-                        _slice_dif[inputIndex](i, j, 0) = 0;
+            const int n = slice.NumberOfVoxels();
+            if (_slice_dif[inputIndex].NumberOfVoxels() != n)
+                _slice_dif[inputIndex].Initialize(slice.Attributes());
+
+            const RealPixel *ps = slice.Data();
+            const RealPixel *pc = _corrected_slices[inputIndex].Data();
+            const RealPixel *psim = _simulated_slices[inputIndex].Data();
+            RealPixel *pd = _slice_dif[inputIndex].Data();
+            const double scale = _scale[inputIndex];
 
-                        if (_multiple_channels_flag) {
-                            for (int n=0; n<_number_of_channels; n++) {
-                                mc_ds[n] = 0;
-                            }
-                        }
-                    }
+            #pragma omp simd
+            for (int i = 0; i < n; i++)
+                pd[i] = ps[i] > -0.01 ? pc[i] * scale - psim[i] : 0;
 
-                    if (_multiple_channels_flag) {
-                        for (int n=0; n<_number_of_channels; n++) {
-                            _mc_slice_dif[inputIndex][n]->PutAsDouble(i, j, 0, mc_ds[n]);
+            if (_multiple_channels_flag) {
+                for (int i = 0; i < slice.GetX(); i++) {
+                    for (int j = 0; j < slice.GetY(); j++) {
+                        const RealPixel *mc_s = _mc_slices[inputIndex](i, j, 0);
+                        const RealPixel *mc_sim = _mc_simulated_slices[inputIndex](i, j, 0);
+                        RealPixel *mc_d = _mc_slice_dif[inputIndex](i, j, 0);
+                        if (slice(i, j, 0) > -0.01) {
+                            const double eb = exp(-_bias[inputIndex](i, j, 0)) * scale;
+                            for (int c = 0; c < _number_of_channels; c++)
+                                mc_d[c] = mc_s[c] * eb - mc_sim[c];
+                        } else {
+                            for (int c = 0; c < _number_of_channels; c++)
+                                mc_d[c] = 0;
                         }
                     }
                 }
@@ -2525,18 +3058,28 @@ namespace svrtk {
 
         SliceDifference();
 
-        Parallel::Superresolution parallelSuperresolution(this);
-        parallelSuperresolution();
-
-        RealImage& addon = parallelSuperresolution.addon;
-        _confidence_map = move(parallelSuperresolution.confidence_map);
-        //_confidence4mask = _confidence_map;
-
+        RealImage addon;
+        MultiChannelImage mc_addon;
         Array<RealImage> mc_addons;
         Array<RealImage> mc_originals;
 
+        if (Gather(StageSuperresolution)) {
+            Parallel::SuperresolutionGather parallelSuperresolution(this);
+            parallelSuperresolution();
+            addon = move(parallelSuperresolution.addon);
+            _confidence_map = move(parallelSuperresolution.confidence_map);
+            mc_addon = move(parallelSuperresolution.mc_addon);
+        } else {
+            Parallel::Superresolution parallelSuperresolution(this);
+            parallelSuperresolution();
+            addon = move(parallelSuperresolution.addon);
+            _confidence_map = move(parallelSuperresolution.confidence_map);
+            mc_addon = move(parallelSuperresolution.mc_addon);
+        }
+        //_confidence4mask = _confidence_map;
+
         if (_multiple_channels_flag) {
-            mc_addons = move(parallelSuperresolution.mc_addons);
+            mc_addon.Unpack(mc_addons);
             mc_originals = _mc_reconstructed;
         }
 
@@ -2544,8 +3087,8 @@ namespace svrtk {
 
 
         if (_debug) {
-            _confidence_map.Write((boost::format("confidence-map%1%.nii.gz") % iter).str().c_str());
-            addon.Write((boost::format("addon%1%.nii.gz") % iter).str().c_str());
+            SaveImage(_confidence_map, (boost::format("confidence-map%1%.nii.gz") % iter).str());
+            SaveImage(addon, (boost::format("addon%1%.nii.gz") % iter).str());
         }
 
         if (!_adaptive) {
@@ -2604,8 +3147,8 @@ namespace svrtk {
 
         /*
         if (_debug) {
-            _reconstructed.Write((boost::format("recon%1%.nii.gz") % iter).str().c_str());
-            _mask.Write((boost::format("_mask%1%.nii.gz") % iter).str().c_str());
+            SaveImage(_reconstructed, (boost::format("recon%1%.nii.gz") % iter).str());
+            SaveImage(_mask, (boost::format("_mask%1%.nii.gz") % iter).str());
         }
         */
 
@@ -2628,7 +3171,7 @@ namespace svrtk {
         //cout<<"max int"<<_max_intensity;
         /*
         if (_debug) {
-            _reconstructed.Write((boost::format("recon_tr%1%.nii.gz") % iter).str().c_str());
+            SaveImage(_reconstructed, (boost::format("recon_tr%1%.nii.gz") % iter).str());
         }
         */
         //Smooth the reconstructed image with regularisation
@@ -2641,7 +3184,7 @@ namespace svrtk {
         /*
 
         if (_debug) {
-            _reconstructed.Write((boost::format("recon_reg%1%.nii.gz") % iter).str().c_str());
+            SaveImage(_reconstructed, (boost::format("recon_reg%1%.nii.gz") % iter).str());
         }
         */
         //Remove the bias in the reconstructed volume compared to previous iteration
@@ -2649,7 +3192,7 @@ namespace svrtk {
             BiasCorrectVolume(original);
 
         if (_debug) {
-            _reconstructed.Write((boost::format("recon_reg_bias%1%.nii.gz") % iter).str().c_str());
+            SaveImage(_reconstructed, (boost::format("recon_reg_bias%1%.nii.gz") % iter).str());
         }
 
         SVRTK_END_TIMING("Superresolution");
@@ -2705,7 +3248,7 @@ namespace svrtk {
         Parallel::AdaptiveRegularization2 parallelAdaptiveRegularization2(this, b, original2);
         parallelAdaptiveRegularization2();
 
-        if (_alpha * _lambda / (_delta * _delta) > 0.068)
+        if (_alpha * _lambda * _level_regularisation / (_delta * _delta) > 0.068)
             cerr << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068." << endl;
     }
 
@@ -2837,9 +3380,16 @@ namespace svrtk {
     void Reconstruction::NormaliseBias(int iter) {
         SVRTK_START_TIMING();
 
-        Parallel::NormaliseBias parallelNormaliseBias(this);
-        parallelNormaliseBias();
-        RealImage& bias = parallelNormaliseBias.bias;
+        RealImage bias;
+        if (Gather(StageNormaliseBias)) {
+            Parallel::NormaliseBiasGather parallelNormaliseBias(this);
+            parallelNormaliseBias();
+            bias = move(parallelNormaliseBias.bias);
+        } else {
+            Parallel::NormaliseBias parallelNormaliseBias(this);
+            parallelNormaliseBias();
+            bias = move(parallelNormaliseBias.bias);
+        }
 
         // normalize the volume by proportion of contributing slice voxels for each volume voxel
         bias /= _volume_weights;
@@ -2858,7 +3408,7 @@ namespace svrtk {
         bias /= m;
 
         if (_debug)
-            bias.Write((boost::format("averagebias%1%.nii.gz") % iter).str().c_str());
+            SaveImage(bias, (boost::format("averagebias%1%.nii.gz") % iter).str());
 
         RealPixel *pi = _reconstructed.Data();
         const RealPixel *pb = bias.Data();
@@ -2895,42 +3445,72 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
-    void Reconstruction::SaveBiasFields() {
+    void Reconstruction::SaveImage(const RealImage& image, const string& filename) {
+        if (_output_writer)
+            _output_writer->Write(image, filename);
+        else
+            image.Write(filename.c_str());
+    }
+
+    //-------------------------------------------------------------------
+
+    void Reconstruction::SaveSliceImages(const Array<RealImage>& images, const string& name, const Array<int>& index) {
+        if (_pack_slice_outputs) {
+            const string filename = name + "-packed.nii.gz";
+            if (_output_writer)
+                _output_writer->WritePacked(images, filename);
+            else
+                OutputWriter::SavePacked(images, filename);
+            return;
+        }
+
+        auto filename = [&](size_t inputIndex) {
+            const int label = index.empty() ? inputIndex : index[inputIndex];
+            return (boost::format("%1%%2%.nii.gz") % name % label).str();
+        };
+
+        // The background writer only takes the snapshots here, otherwise the slices are written in parallel
+        if (_output_writer) {
+            for (size_t inputIndex = 0; inputIndex < images.size(); inputIndex++)
+                _output_writer->Write(images[inputIndex], filename(inputIndex));
+            return;
+        }
+
         #pragma omp parallel for
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
-            _bias[inputIndex].Write((boost::format("bias%1%.nii.gz") % inputIndex).str().c_str());
+        for (size_t inputIndex = 0; inputIndex < images.size(); inputIndex++)
+            images[inputIndex].Write(filename(inputIndex).c_str());
+    }
+
+    //-------------------------------------------------------------------
+
+    void Reconstruction::SaveBiasFields() {
+        SaveSliceImages(_bias, "bias");
     }
 
     //-------------------------------------------------------------------
 
     void Reconstruction::SaveConfidenceMap() {
-        _confidence_map.Write("confidence-map.nii.gz");
+        SaveImage(_confidence_map, "confidence-map.nii.gz");
     }
 
     //-------------------------------------------------------------------
 
     void Reconstruction::SaveSlices() {
-        #pragma omp parallel for
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
-            _slices[inputIndex].Write((boost::format("slice%1%.nii.gz") % inputIndex).str().c_str());
+        SaveSliceImages(_slices, "slice");
     }
 
     //-------------------------------------------------------------------
 
     void Reconstruction::SaveSlicesWithTiming() {
         cout << "Saving slices with timing: ";
-        #pragma omp parallel for
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
-            _slices[inputIndex].Write((boost::format("sliceTime%1%.nii.gz") % _slice_timing[inputIndex]).str().c_str());
+        SaveSliceImages(_slices, "sliceTime", _slice_timing);
     }
 
     //-------------------------------------------------------------------
 
     void Reconstruction::SaveSimulatedSlices() {
         cout << "Saving simulated slices ... ";
-        #pragma omp parallel for
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
-            _simulated_slices[inputIndex].Write((boost::format("simslice%1%.nii.gz") % inputIndex).str().c_str());
+        SaveSliceImages(_simulated_slices, "simslice");
         cout << "done." << endl;
     }
 
@@ -2938,9 +3518,7 @@ namespace svrtk {
     //-------------------------------------------------------------------
 
     void Reconstruction::SaveWeights() {
-        #pragma omp parallel for
-        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
-            _weights[inputIndex].Write((boost::format("weights%1%.nii.gz") % inputIndex).str().c_str());
+        SaveSliceImages(_weights, "weights");
     }
 
     //-------------------------------------------------------------------
@@ -2979,9 +3557,15 @@ namespace svrtk {
     //-------------------------------------------------------------------
 
     void Reconstruction::SaveTransformations() {
+        // Transformations are never packed, ReadTransformations has to be able to load them
         #pragma omp parallel for
-        for (size_t i = 0; i < _transformations.size(); i++)
-            _transformations[i].Write((boost::format("transformation%1%.dof") % i).str().c_str());
+        for (size_t i = 0; i < _transformations.size(); i++) {
+            const string filename = (boost::format("transformation%1%.dof") % i).str();
+            if (_output_writer)
+                _output_writer->Write(_transformations[i], filename);
+            else
+                _transformations[i].Write(filename.c_str());
+        }
     }
 
     //-------------------------------------------------------------------
@@ -3033,6 +3617,47 @@ namespace svrtk {
 
     //-------------------------------------------------------------------
 
+    // rigid registration of a single package (the target origin is reset during registration)
+    template<typename ImageType>
+    static RigidTransformation RegisterPackage(const ParameterList& params, ImageType target, const ImageType& source, RigidTransformation guess) {
+        RigidTransformation offset;
+        ResetOrigin(target, offset);
+        const Matrix& mo = offset.GetMatrix();
+        guess.PutMatrix(guess.GetMatrix() * mo);
+
+        // Every task owns its registration filter
+        GenericRegistrationFilter registration;
+        registration.Parameter(params);
+        registration.Input(&target, &source);
+        Transformation *dofout = nullptr;
+        registration.Output(&dofout);
+        registration.InitialGuess(&guess);
+        registration.GuessParameter();
+        registration.Run();
+
+        unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
+        RigidTransformation result = *rigidTransf;
+
+        //undo the offset
+        result.PutMatrix(result.GetMatrix() * mo.Inverse());
+        return result;
+    }
+
+    //-------------------------------------------------------------------
+
+    // copy rigid parameters of the package transformation to a slice transformation
+    static void CopyPackageTransformation(const RigidTransformation& package, RigidTransformation& slice) {
+        slice.PutTranslationX(package.GetTranslationX());
+        slice.PutTranslationY(package.GetTranslationY());
+        slice.PutTranslationZ(package.GetTranslationZ());
+        slice.PutRotationX(package.GetRotationX());
+        slice.PutRotationY(package.GetRotationY());
+        slice.PutRotationZ(package.GetRotationZ());
+        slice.UpdateMatrix();
+    }
+
+    //-------------------------------------------------------------------
+
     // updated package-to-volume registration
     void Reconstruction::newPackageToVolume(const Array<RealImage>& stacks, const Array<int>& pack_num, const Array<int>& multiband_vector, const Array<int>& order, const int step, const int rewinder, const int iter, const int steps) {
         // copying transformations from previous iterations
@@ -3048,17 +3673,23 @@ namespace svrtk {
         // Insert(params, "Background value for image 1", -1);
         // Insert(params, "Background value for image 2", -1);
 
-        GenericRegistrationFilter rigidregistration;
-        rigidregistration.Parameter(params);
-
         int wrapper = stacks.size() / steps;
         if (stacks.size() % steps > 0)
             wrapper++;
 
-        GreyImage t;
+        // Source is shared read-only by all package registrations
+        const GreyImage source = _reconstructed;
+
+        // Package registration task
+        struct PackageTask {
+            int stack, package, package_index, first_slice;
+            int start_iteration, end_iteration;
+            RigidTransformation transformation;
+        };
+
         Array<RealImage> sstacks, packages;
-        Array<int> spack_num, smultiband_vector, sorder, z_slice_order, t_slice_order, t_internal_slice_order;
-        Array<RigidTransformation> internal_transformations;
+        Array<int> spack_num, smultiband_vector, sorder, z_slice_order, t_slice_order;
+        Array<PackageTask> tasks;
 
         for (int w = 0; w < wrapper; w++) {
             const int doffset = w * steps;
@@ -3074,60 +3705,15 @@ namespace svrtk {
 
             SplitPackageswithMB(sstacks, spack_num, packages, smultiband_vector, sorder, step, rewinder, z_slice_order, t_slice_order);
 
-            // other variables
-            int counter1 = 0, counter2 = 0, counter3 = 0;
-
+            // collect the registration tasks (initial guesses are taken before any transformation is updated)
+            int counter1 = 0, counter2 = 0;
             for (size_t i = 0; i < sstacks.size(); i++) {
                 const RealImage& firstPackage = packages[counter1];
                 const int& multiband = smultiband_vector[i];
                 int extra = (firstPackage.GetZ() / multiband) % spack_num[i];
                 int startIterations = 0, endIterations = 0;
 
-                // slice loop
-                for (int sl = 0; sl < firstPackage.GetZ(); sl++) {
-                    t_internal_slice_order.push_back(t_slice_order[counter3 + sl]);
-                    internal_transformations.push_back(_transformations[counter2 + sl]);
-                }
-
-                // package look
                 for (int j = 0; j < spack_num[i]; j++) {
-                    // performing registration
-                    const RealImage& target = packages[counter1];
-                    const GreyImage& s = _reconstructed;
-                    t = target;
-
-                    if (_debug) {
-                        t.Write((boost::format("target%1%-%2%-%3%.nii.gz") % iter % (i + doffset) % j).str().c_str());
-                        s.Write((boost::format("source%1%-%2%-%3%.nii.gz") % iter % (i + doffset) % j).str().c_str());
-                    }
-
-                    //check whether package is empty (all zeros)
-                    RealPixel tmin, tmax;
-                    target.GetMinMax(&tmin, &tmax);
-
-                    if (tmax > 0) {
-                        RigidTransformation offset;
-                        ResetOrigin(t, offset);
-                        const Matrix& mo = offset.GetMatrix();
-                        internal_transformations[j].PutMatrix(internal_transformations[j].GetMatrix() * mo);
-
-                        rigidregistration.Input(&t, &s);
-                        Transformation *dofout = nullptr;
-                        rigidregistration.Output(&dofout);
-                        rigidregistration.InitialGuess(&internal_transformations[j]);
-                        rigidregistration.GuessParameter();
-                        rigidregistration.Run();
-
-                        unique_ptr<RigidTransformation> rigid_dofout(dynamic_cast<RigidTransformation*>(dofout));
-                        internal_transformations[j] = *rigid_dofout;
-
-                        internal_transformations[j].PutMatrix(internal_transformations[j].GetMatrix() * mo.Inverse());
-                    }
-
-                    if (_debug)
-                        internal_transformations[j].Write((boost::format("transformation%1%-%2%-%3%.dof") % iter % (i + doffset) % j).str().c_str());
-
-                    // saving transformations
                     int iterations = (firstPackage.GetZ() / multiband) / spack_num[i];
                     if (extra > 0) {
                         iterations++;
@@ -3135,30 +3721,54 @@ namespace svrtk {
                     }
                     endIterations += iterations;
 
-                    for (int k = startIterations; k < endIterations; k++) {
-                        for (size_t l = 0; l < t_internal_slice_order.size(); l++) {
-                            if (k == t_internal_slice_order[l]) {
-                                _transformations[counter2 + l].PutTranslationX(internal_transformations[j].GetTranslationX());
-                                _transformations[counter2 + l].PutTranslationY(internal_transformations[j].GetTranslationY());
-                                _transformations[counter2 + l].PutTranslationZ(internal_transformations[j].GetTranslationZ());
-                                _transformations[counter2 + l].PutRotationX(internal_transformations[j].GetRotationX());
-                                _transformations[counter2 + l].PutRotationY(internal_transformations[j].GetRotationY());
-                                _transformations[counter2 + l].PutRotationZ(internal_transformations[j].GetRotationZ());
-                                _transformations[counter2 + l].UpdateMatrix();
-                            }
-                        }
-                    }
+                    tasks.push_back({(int)i, j, counter1, counter2, startIterations, endIterations, _transformations[counter2 + j]});
+
                     startIterations = endIterations;
                     counter1++;
                 }
-                // resetting variables for next dynamic
-                startIterations = 0;
-                endIterations = 0;
                 counter2 += firstPackage.GetZ();
-                counter3 += firstPackage.GetZ();
+            }
 
-                t_internal_slice_order.clear();
-                internal_transformations.clear();
+            // performing registrations
+            Array<string> errors(tasks.size());
+            #pragma omp parallel for schedule(dynamic)
+            for (size_t n = 0; n < tasks.size(); n++) {
+                PackageTask& task = tasks[n];
+                const RealImage& target = packages[task.package_index];
+
+                try {
+                    const GreyImage t = target;
+
+                    if (_debug) {
+                        t.Write((boost::format("target%1%-%2%-%3%.nii.gz") % iter % (task.stack + doffset) % task.package).str().c_str());
+                        source.Write((boost::format("source%1%-%2%-%3%.nii.gz") % iter % (task.stack + doffset) % task.package).str().c_str());
+                    }
+
+                    //check whether package is empty (all zeros)
+                    RealPixel tmin, tmax;
+                    target.GetMinMax(&tmin, &tmax);
+
+                    if (tmax > 0)
+                        task.transformation = RegisterPackage(params, t, source, task.transformation);
+
+                    if (_debug)
+                        task.transformation.Write((boost::format("transformation%1%-%2%-%3%.dof") % iter % (task.stack + doffset) % task.package).str().c_str());
+                } catch (const exception& e) {
+                    errors[n] = e.what();
+                }
+            }
+            for (const auto& error : errors)
+                if (!error.empty())
+                    throw runtime_error("Reconstruction::newPackageToVolume: " + error);
+
+            // saving transformations in task order
+            for (const auto& task : tasks) {
+                const int counter3 = task.first_slice;
+                const int nslices = packages[task.package_index - task.package].GetZ();
+                for (int k = task.start_iteration; k < task.end_iteration; k++)
+                    for (int l = 0; l < nslices; l++)
+                        if (k == t_slice_order[counter3 + l])
+                            CopyPackageTransformation(task.transformation, _transformations[task.first_slice + l]);
             }
 
             //save overall slice order
@@ -3188,6 +3798,7 @@ namespace svrtk {
             smultiband_vector.clear();
             sorder.clear();
             packages.clear();
+            tasks.clear();
         }
     }
 
@@ -3215,80 +3826,79 @@ namespace svrtk {
         if (_nmi_bins > 0)
             Insert(params, "No. of bins", _nmi_bins);
 
-        GenericRegistrationFilter rigidregistration;
-        RealImage mask, target;
-        Array<RealImage> packages;
+        // split all stacks into packages
+        Array<Array<RealImage>> stack_packages(stacks.size());
+        #pragma omp parallel for
+        for (size_t i = 0; i < stacks.size(); i++)
+            SplitImage(stacks[i], pack_num[i], stack_packages[i]);
 
-        #pragma omp parallel for private(mask, target, packages, rigidregistration)
-        for (size_t i = 0; i < stacks.size(); i++) {
-            SplitImage(stacks[i], pack_num[i], packages);
-            for (size_t j = 0; j < packages.size(); j++) {
+        // one task per package, packages of all stacks are registered concurrently
+        Array<pair<int, int>> tasks;
+        for (size_t i = 0; i < stacks.size(); i++)
+            for (size_t j = 0; j < stack_packages[i].size(); j++)
+                tasks.push_back({(int)i, (int)j});
+
+        Array<RigidTransformation> package_transformations(tasks.size());
+        Array<Array<int>> package_slices(tasks.size());
+        Array<string> errors(tasks.size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t n = 0; n < tasks.size(); n++) {
+            const int i = tasks[n].first, j = tasks[n].second;
+            const RealImage& package = stack_packages[i][j];
+
+            try {
                 if (_debug)
-                    packages[j].Write((boost::format("package-%1%-%2%.nii.gz") % i % j).str().c_str());
+                    package.Write((boost::format("package-%1%-%2%.nii.gz") % i % j).str().c_str());
 
                 //packages are not masked at present
-                mask = _mask;
+                RealImage mask = _mask;
                 const RigidTransformation& mask_transform = stack_transformations[i]; //s[i];
-                TransformMask(packages[j], mask, mask_transform);
+                TransformMask(package, mask, mask_transform);
 
-                target = packages[j] * mask;
-                const RealImage& source = _reconstructed;
+                const RealImage target = package * mask;
 
                 //find existing transformation
                 double x = 0, y = 0, z = 0;
-                packages[j].ImageToWorld(x, y, z);
+                package.ImageToWorld(x, y, z);
                 stacks[i].WorldToImage(x, y, z);
 
                 const int firstSliceIndex = round(z) + firstSlice_array[i];
                 // cout<<"First slice index for package "<<j<<" of stack "<<i<<" is "<<firstSliceIndex<<endl;
 
-                //put origin in target to zero
-                RigidTransformation offset;
-                ResetOrigin(target, offset);
-                const Matrix& mo = offset.GetMatrix();
-                _transformations[firstSliceIndex].PutMatrix(_transformations[firstSliceIndex].GetMatrix() * mo);
+                // slices of the package, the first one holds the package transformation
+                package_slices[n].push_back(firstSliceIndex);
+                for (int k = 0; k < package.GetZ(); k++) {
+                    x = 0; y = 0; z = k;
+                    package.ImageToWorld(x, y, z);
+                    stacks[i].WorldToImage(x, y, z);
+                    const int sliceIndex = round(z) + firstSlice_array[i];
 
-                rigidregistration.Parameter(params);
-                rigidregistration.Input(&target, &source);
-                Transformation *dofout;
-                rigidregistration.Output(&dofout);
-                rigidregistration.InitialGuess(&_transformations[firstSliceIndex]);
-                rigidregistration.GuessParameter();
-                rigidregistration.Run();
+                    if (sliceIndex >= _transformations.size())
+                        throw runtime_error("sliceIndex out of range.\n" + to_string(sliceIndex) + " " + to_string(_transformations.size()));
 
-                unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-                _transformations[firstSliceIndex] = *rigidTransf;
+                    if (sliceIndex != firstSliceIndex)
+                        package_slices[n].push_back(sliceIndex);
+                }
 
-                //undo the offset
-                _transformations[firstSliceIndex].PutMatrix(_transformations[firstSliceIndex].GetMatrix() * mo.Inverse());
+                package_transformations[n] = RegisterPackage(params, target, _reconstructed, _transformations[firstSliceIndex]);
 
                 if (_debug)
-                    _transformations[firstSliceIndex].Write((boost::format("transformation-%1%-%2%.dof") % i % j).str().c_str());
+                    package_transformations[n].Write((boost::format("transformation-%1%-%2%.dof") % i % j).str().c_str());
+            } catch (const exception& e) {
+                errors[n] = e.what();
+            }
+        }
 
-                //set the transformation to all slices of the package
-                // cout<<"Slices of the package "<<j<<" of the stack "<<i<<" are: ";
-                for (int k = 0; k < packages[j].GetZ(); k++) {
-                    x = 0; y = 0; z = k;
-                    packages[j].ImageToWorld(x, y, z);
-                    stacks[i].WorldToImage(x, y, z);
-                    int sliceIndex = round(z) + firstSlice_array[i];
-                    // cout<<sliceIndex<<" "<<endl;
+        for (const auto& error : errors)
+            if (!error.empty())
+                throw runtime_error("Reconstruction::PackageToVolume: " + error);
 
-                    if (sliceIndex >= _transformations.size())
-                        throw runtime_error("Reconstruction::PackageToVolume: sliceIndex out of range.\n" + to_string(sliceIndex) + " " + to_string(_transformations.size()));
-
-                    if (sliceIndex != firstSliceIndex) {
-                        _transformations[sliceIndex].PutTranslationX(_transformations[firstSliceIndex].GetTranslationX());
-                        _transformations[sliceIndex].PutTranslationY(_transformations[firstSliceIndex].GetTranslationY());
-                        _transformations[sliceIndex].PutTranslationZ(_transformations[firstSliceIndex].GetTranslationZ());
-                        _transformations[sliceIndex].PutRotationX(_transformations[firstSliceIndex].GetRotationX());
-                        _transformations[sliceIndex].PutRotationY(_transformations[firstSliceIndex].GetRotationY());
-                        _transformations[sliceIndex].PutRotationZ(_transformations[firstSliceIndex].GetRotationZ());
-                        _transformations[sliceIndex].UpdateMatrix();
-                    }
-                }
-            }
-            // cout<<"End of stack "<<i<<endl<<endl;
+        //set the transformation to all slices of the package (in task order)
+        for (size_t n = 0; n < tasks.size(); n++) {
+            _transformations[package_slices[n][0]] = package_transformations[n];
+            for (size_t k = 1; k < package_slices[n].size(); k++)
+                CopyPackageTransformation(package_transformations[n], _transformations[package_slices[n][k]]);
         }
 
         SVRTK_END_TIMING("PackageToVolume");
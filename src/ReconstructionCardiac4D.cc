@@ -18,6 +18,7 @@
 
 // SVRTK
 #include "svrtk/ReconstructionCardiac4D.h"
+#include "svrtk/MotionSmoothing.h"
 #include "svrtk/Profiling.h"
 #include "svrtk/Parallel.h"
 
@@ -235,20 +236,19 @@ namespace svrtk {
             for (int j = 0; j < attr._z; j++, loc_index++) {
                 //attr._t is number of frames in the stack
                 for (int k = 0; k < attr._t; k++) {
-                    //create slice by selecting the appropriate region of the stack
-                    RealImage slice = stacks[i].GetRegion(0, 0, j, k, attr._x, attr._y, j + 1, k + 1);
-                    //set correct voxel size in the stack. Z size is equal to slice thickness.
-                    slice.PutPixelSize(attr._dx, attr._dy, thickness[i], attr._dt);
+                    //remember the slice as a view of the stack (never written to). Z size is equal to slice thickness.
+                    _slices.emplace_back();
+                    RealImage& slice = _slices.back();
+                    StackSliceView(slice, stacks[i], j, k, thickness[i]);
                     //set slice acquisition time
                     const double sliceAcqTime = attr._torigin + k * attr._dt;
                     _slice_time.push_back(sliceAcqTime);
                     //set slice temporal resolution
                     _slice_dt.push_back(attr._dt);
-                    //remember the slice
-                    _slices.push_back(slice);
-                    _simulated_slices.push_back(slice);
-                    _simulated_weights.push_back(slice);
-                    _simulated_inside.push_back(move(slice));
+                    //simulated images are written to, so they get their own storage
+                    _simulated_slices.emplace_back(slice.Attributes());
+                    _simulated_weights.emplace_back(slice.Attributes());
+                    _simulated_inside.emplace_back(slice.Attributes());
                     _zero_slices.push_back(1);
                     //remember stack indices for this slice
                     _stack_index.push_back(i);
@@ -260,9 +260,8 @@ namespace svrtk {
                     //initialise slice exclusion flags
                     _slice_excluded.push_back(0);
                     if (!probability_maps.empty()) {
-                        RealImage proba = probability_maps[i].GetRegion(0, 0, j, k, attr._x, attr._y, j + 1, k + 1);
-                        proba.PutPixelSize(attr._dx, attr._dy, thickness[i], attr._dt);
-                        _probability_maps.push_back(move(proba));
+                        _probability_maps.emplace_back();
+                        StackSliceView(_probability_maps.back(), probability_maps[i], j, k, thickness[i]);
                     }
                     //initialise cardiac phase to use for 2D-3D registration
                     _slice_svr_card_index.push_back(0);
@@ -344,6 +343,9 @@ namespace svrtk {
         //resize indicator of slice having and overlap with volumetric mask
         ClearAndResize(_slice_inside, _slices.size());
 
+        //geometries of slices whose transformation didn't change are reused
+        _slice_geometry.Resize(_slices.size());
+
         if (_verbose)
             _verbose_log << "Initialising matrix coefficients... ";
         Parallel::CoeffInitCardiac4D coeffinit(this);
@@ -637,6 +639,19 @@ namespace svrtk {
         //   cout << "\b\b." << endl;
     }
 
+    // -----------------------------------------------------------------------------
+    // Cache of Cardiac Phase Volumes for Slice-to-Volume Registration
+    // -----------------------------------------------------------------------------
+    void ReconstructionCardiac4D::UpdateSliceToVolumePhaseCache() {
+        const ImageAttributes& attr = _reconstructed4D.Attributes();
+
+        // One converted volume per phase, shared read-only by all registrations
+        ClearAndResize(_svr_phase_volumes, attr._t);
+        #pragma omp parallel for
+        for (int t = 0; t < attr._t; t++)
+            _svr_phase_volumes[t] = _reconstructed4D.GetRegion(0, 0, 0, t, attr._x, attr._y, attr._z, t + 1);
+    }
+
     // -----------------------------------------------------------------------------
     // Slice-to-Volume Registration
     // -----------------------------------------------------------------------------
@@ -646,9 +661,22 @@ namespace svrtk {
         if (_verbose)
             _verbose_log << "SliceToVolumeRegistrationCardiac4D" << endl;
 
+        UpdateSliceToVolumePhaseCache();
+
+        // Excluded slices are not registered
+        Array<double> foreground = SVRScheduler::Foreground(_slices);
+        for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++)
+            if (_slice_excluded[inputIndex])
+                foreground[inputIndex] = 0;
+        _svr_scheduler.EstimateCosts(foreground);
+        _svr_scheduler.PlanAll(_slices.size());
+
         Parallel::SliceToVolumeRegistrationCardiac4D registration(this);
         registration();
 
+        if (_verbose)
+            _svr_scheduler.ReportLoadBalance(_verbose_log);
+
         SVRTK_END_TIMING("SliceToVolumeRegistrationCardiac4D");
     }
 
@@ -657,15 +685,16 @@ namespace svrtk {
     // -----------------------------------------------------------------------------
     void ReconstructionCardiac4D::RemoteSliceToVolumeRegistrationCardiac4D(int iter, const string& str_mirtk_path, const string& str_current_exchange_file_path) {
         const ImageAttributes& attr_recon = _reconstructed4D.Attributes();
-        RealImage source, target;
+        RealImage target;
 
         if (_verbose)
             _verbose_log << "RemoteSliceToVolumeRegistrationCardiac4D" << endl;
 
+        // The external registration reads the phase volumes at full precision (the grey cache is for the local functor only)
         #pragma omp parallel for
         for (int t = 0; t < _reconstructed4D.GetT(); t++) {
-            string str_source = str_current_exchange_file_path + "/current-source-" + to_string(t) + ".nii.gz";
-            source = _reconstructed4D.GetRegion(0, 0, 0, t, attr_recon._x, attr_recon._y, attr_recon._z, t + 1);
+            const string str_source = str_current_exchange_file_path + "/current-source-" + to_string(t) + ".nii.gz";
+            const RealImage source = _reconstructed4D.GetRegion(0, 0, 0, t, attr_recon._x, attr_recon._y, attr_recon._z, t + 1);
             source.Write(str_source.c_str());
         }
 
@@ -981,11 +1010,6 @@ namespace svrtk {
             }
         }
 
-        //initialise
-        Matrix den(6, _transformations.size());
-        Matrix num(6, _transformations.size());
-        Matrix kr(6, _transformations.size());
-
         int nloc = 0;
         for (size_t i = 0; i < _transformations.size(); i++)
             nloc = max(nloc, _loc_index[i] + 1);
@@ -993,6 +1017,13 @@ namespace svrtk {
             cout << "\tnumber of slice-locations = " << nloc << endl;
         const int dim = _transformations.size() / nloc; // assuming equal number of dynamic images for every slice-location
 
+        //gaussian kernel for every slice-location
+        MotionSmoothing smoothing(_transformations.size());
+        for (int loc = 0; loc < nloc; loc++) {
+            const double dt = _slice_dt[loc * dim];
+            smoothing.AddSegment(loc * dim, (loc + 1) * dim, sigma_seconds / dt, 3 * ceil(sigma_seconds / dt));
+        }
+
         //step size for sampling volume in error calculation in kernel regression
         constexpr double nstep = 15;
         int step = ceil(_reconstructed4D.GetX() / nstep);
@@ -1001,45 +1032,34 @@ namespace svrtk {
         if (step > ceil(_reconstructed4D.GetZ() / nstep))
             step = ceil(_reconstructed4D.GetZ() / nstep);
 
+        //the sampled points are the same for all slices and iterations
+        const MotionSmoothing::PointMoments moments = MotionSmoothing::Moments(_reconstructed4D, step);
+
+        //original transformations in the original coordinate system
+        Array<Matrix> orig_matrices(_transformations.size());
+        for (size_t i = 0; i < _transformations.size(); i++)
+            orig_matrices[i] = mo * _transformations[i].GetMatrix() * imo;
+
         //kernel regression
-        Array<double> kernel, error, tmp;
-        error.reserve(_transformations.size());
+        Matrix kr(6, _transformations.size());
+        Array<double> error(_transformations.size()), tmp;
         tmp.reserve(_transformations.size());
         for (int iter = 0; iter < niter; iter++) {
-            for (int loc = 0; loc < nloc; loc++) {
-                //gaussian kernel for current slice-location
-                const double sigma = ceil(sigma_seconds / _slice_dt[loc * dim]);
-                for (int j = -3 * sigma; j <= 3 * sigma; j++)
-                    kernel.push_back(exp(-(j * _slice_dt[loc * dim] / sigma_seconds) * (j * _slice_dt[loc * dim] / sigma_seconds)));
-
-                //kernel-weighted summation
-                #pragma omp parallel for collapse(2)
-                for (int par = 0; par < 6; par++) {
-                    for (int i = loc * dim; i < (loc + 1) * dim; i++) {
-                        if (!_slice_excluded[i]) {
-                            for (int j = -3 * sigma; j <= 3 * sigma; j++)
-                                if (((i + j) >= loc * dim) && ((i + j) < (loc + 1) * dim)) {
-                                    num(par, i) += parameters(par, i + j) * kernel[j + 3 * sigma] * weights(par, i + j);
-                                    den(par, i) += kernel[j + 3 * sigma] * weights(par, i + j);
-                                }
-                        } else {
-                            num(par, i) = parameters(par, i);
-                            den(par, i) = 1;
-                        }
-                    }
-                }
-
-                kernel.clear();
-            }
+            smoothing.Regress(parameters, weights, kr);
 
-            //kernel-weighted normalisation
-            #pragma omp parallel for collapse(2)
-            for (int par = 0; par < 6; par++)
-                for (size_t i = 0; i < _transformations.size(); i++)
-                    kr(par, i) = num(par, i) / den(par, i);
+            //excluded slices keep their parameters
+            for (size_t i = 0; i < _transformations.size(); i++)
+                if (_slice_excluded[i])
+                    for (int par = 0; par < 6; par++)
+                        kr(par, i) = parameters(par, i);
 
             //recalculate weights using target registration error with original transformations as targets
+            #pragma omp parallel for
             for (size_t i = 0; i < _transformations.size(); i++) {
+                error[i] = -1;
+                if (_slice_excluded[i])
+                    continue;
+
                 RigidTransformation processed;
                 processed.PutTranslationX(kr(0, i));
                 processed.PutTranslationY(kr(1, i));
@@ -1048,44 +1068,20 @@ namespace svrtk {
                 processed.PutRotationY(kr(4, i));
                 processed.PutRotationZ(kr(5, i));
 
-                RigidTransformation orig = _transformations[i];
-
                 //need to convert the transformations back to the original coordinate system
-                orig.PutMatrix(mo * orig.GetMatrix() * imo);
-                processed.PutMatrix(mo * processed.GetMatrix() * imo);
-
-                int n = 0;
-                double e = 0;
-
-                if (!_slice_excluded[i]) {
-                    #pragma omp parallel for collapse(3) reduction(+: n, e)
-                    for (int ii = 0; ii < _reconstructed4D.GetX(); ii += step)
-                        for (int jj = 0; jj < _reconstructed4D.GetY(); jj += step)
-                            for (int kk = 0; kk < _reconstructed4D.GetZ(); kk += step)
-                                if (_reconstructed4D(ii, jj, kk, 0) > -1) {
-                                    double x = ii, y = jj, z = kk;
-                                    _reconstructed4D.ImageToWorld(x, y, z);
-                                    double xx = x, yy = y, zz = z;
-                                    orig.Transform(x, y, z);
-                                    processed.Transform(xx, yy, zz);
-                                    x -= xx;
-                                    y -= yy;
-                                    z -= zz;
-                                    e += sqrt(x * x + y * y + z * z);
-                                    n++;
-                                }
-                }
-
-                if (n > 0) {
-                    e /= n;
-                    error.push_back(e);
-                    tmp.push_back(e);
-                } else
-                    error.push_back(-1);
+                error[i] = MotionSmoothing::TRE(orig_matrices[i], mo * processed.GetMatrix() * imo, moments);
             }
 
-            sort(tmp.begin(), tmp.end());
-            const double median = tmp[round(tmp.size() * 0.5) - 1];
+            tmp.clear();
+            for (size_t i = 0; i < _transformations.size(); i++)
+                if (error[i] >= 0)
+                    tmp.push_back(error[i]);
+            double median = 0;
+            if (!tmp.empty()) {
+                const size_t median_index = max(round(tmp.size() * 0.5) - 1, 0.0);
+                nth_element(tmp.begin(), tmp.begin() + median_index, tmp.end());
+                median = tmp[median_index];
+            }
 
             if (_debug && iter == 0)
                 cout << "\titeration:median_error(mm)...";
@@ -1106,9 +1102,6 @@ namespace svrtk {
                 for (int par = 0; par < 6; par++)
                     weights(par, i) = value;
             }
-
-            error.clear();
-            tmp.clear();
         }
 
         if (_debug)
@@ -46,6 +46,52 @@ namespace svrtk {
         }
     }
 
+    // -----------------------------------------------------------------------------
+    // Packed velocity field
+    // -----------------------------------------------------------------------------
+    void PackedVelocityField::Pack(const Array<RealImage>& velocities) {
+        if (velocities.empty()) {
+            Initialize(0, 0, 0);
+            return;
+        }
+
+        const RealImage& first = velocities[0];
+        const size_t voxels = (size_t)first.GetX() * first.GetY() * first.GetZ();
+        const int phases = first.GetT();
+        const int components = velocities.size();
+        Initialize(voxels, phases, components);
+
+        Array<const RealPixel *> pin(components);
+        for (int v = 0; v < components; v++)
+            pin[v] = velocities[v].Data();
+
+        #pragma omp parallel for
+        for (size_t n = 0; n < voxels; n++) {
+            RealPixel *pv = Voxel(n);
+            for (int t = 0; t < phases; t++)
+                for (int v = 0; v < components; v++)
+                    pv[t * components + v] = pin[v][n + t * voxels];
+        }
+    }
+
+    void PackedVelocityField::Unpack(Array<RealImage>& velocities, const ImageAttributes& attr) const {
+        velocities.resize(_components);
+        for (int v = 0; v < _components; v++)
+            velocities[v].Initialize(attr);
+
+        Array<RealPixel *> pout(_components);
+        for (int v = 0; v < _components; v++)
+            pout[v] = velocities[v].Data();
+
+        #pragma omp parallel for
+        for (size_t n = 0; n < _voxels; n++) {
+            const RealPixel *pv = Voxel(n);
+            for (int t = 0; t < _phases; t++)
+                for (int v = 0; v < _components; v++)
+                    pout[v][n + t * _voxels] = pv[t * _components + v];
+        }
+    }
+
     // -----------------------------------------------------------------------------
     // Check reconstruction quality
     // -----------------------------------------------------------------------------
@@ -75,6 +121,8 @@ namespace svrtk {
         if (_debug)
             cout << "Simulating slices ... ";
 
+        _packed_velocity.Pack(_reconstructed5DVelocity);
+
         Parallel::SimulateSlicesCardiacVelocity4D parallelSimulateSlices(this);
         parallelSimulateSlices();
 
@@ -382,10 +430,10 @@ namespace svrtk {
             return;
         }
 
-        //mask slices
+        //mask slices (copied first, as they are views of the input stacks)
         #pragma omp parallel for
         for (size_t inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-            RealImage& slice = _slices[inputIndex];
+            RealImage slice(_slices[inputIndex]);
             for (int i = 0; i < slice.GetX(); i++)
                 for (int j = 0; j < slice.GetY(); j++) {
                     //image coordinates of a slice voxel
@@ -408,6 +456,9 @@ namespace svrtk {
                     } else
                         slice(i, j, 0) = -15;
                 }
+            //release the view before storing the masked copy
+            _slices[inputIndex] = RealImage();
+            _slices[inputIndex] = slice;
         }
 
         cout << "done." << endl;
@@ -457,6 +508,8 @@ namespace svrtk {
 
         if (_debug)
             cout << " - min : " << _min_intensity << " | max : " << _max_intensity << endl;
+
+        InvalidateCorrectedSlices();
     }
 
     // -----------------------------------------------------------------------------
@@ -487,6 +540,8 @@ namespace svrtk {
         for (size_t i = 0; i < _force_excluded.size(); i++)
             _slice_weight[_force_excluded[i]] = 0;
 
+        InvalidateCorrectedSlices();
+
         SVRTK_END_TIMING("InitializeEMValues");
     }
 
@@ -17,6 +17,7 @@
  */
 
 #include "svrtk/ReconstructionDWI.h"
+#include "svrtk/MotionSmoothing.h"
 
 using namespace std;
 using namespace mirtk;
@@ -48,6 +49,7 @@ namespace svrtk {
         _recon_type = _3D;
         _regul_steps = 1;
         _intensity_matching_GD = false;
+        _memory_cap = 0;
 
         int directions[13][3] = {
             { 1, 0, -1 },
@@ -565,125 +567,6 @@ namespace svrtk {
 
 
 
-    class ParallelStackRegistrations_DWI {
-        ReconstructionDWI *reconstructor;
-        Array<RealImage>& stacks;
-        Array<RigidTransformation>& stack_transformations;
-        int templateNumber;
-        GreyImage& target;
-        RigidTransformation& offset;
-
-    public:
-        ParallelStackRegistrations_DWI( ReconstructionDWI *_reconstructor,
-                                   Array<RealImage>& _stacks,
-                                   Array<RigidTransformation>& _stack_transformations,
-                                   int _templateNumber,
-                                   GreyImage& _target,
-                                   RigidTransformation& _offset ) :
-        reconstructor(_reconstructor),
-        stacks(_stacks),
-        stack_transformations(_stack_transformations),
-        target(_target),
-        offset(_offset) {
-            templateNumber = _templateNumber;
-        }
-
-        void operator() (const blocked_range<size_t> &r) const {
-            for ( size_t i = r.begin(); i != r.end(); ++i ) {
-
-                if (i == templateNumber)
-                    continue;
-
-                RealImage r_source = stacks[i];
-                RealImage r_target = target;
-
-                RealImage tmp_stack;
-
-                ResamplingWithPadding<RealPixel> resampling2(1.5, 1.5, 1.5, 0);
-                GenericLinearInterpolateImageFunction<RealImage> interpolator2;
-                resampling2.Interpolator(&interpolator2);
-
-                tmp_stack = r_source;
-                resampling2.Input(&tmp_stack);
-                resampling2.Output(&r_source);
-                resampling2.Run();
-
-                tmp_stack = r_target;
-                resampling2.Input(&tmp_stack);
-                resampling2.Output(&r_target);
-                resampling2.Run();
-
-                Matrix mo = offset.GetMatrix();
-                Matrix m = stack_transformations[i].GetMatrix();
-                m=m*mo;
-                stack_transformations[i].PutMatrix(m);
-
-                ParameterList params;
-                Insert(params, "Transformation model", "Rigid");
-//                if (reconstructor->_nmi_bins>0)
-//                    Insert(params, "No. of bins", reconstructor->_nmi_bins);
-
-//                if(reconstructor->_masked_stacks) {
-//                    Insert(params, "Background value", 0);
-//                }
-//                else {
-//                    Insert(params, "Background value for image 1", 0);
-//                }
-
-                Insert(params, "Background value for image 1", 0);
-
-//                Insert(params, "Image (dis-)similarity measure", "NCC");
-//                string type = "box";
-//                string units = "vox";
-//                double width = 0;
-//                Insert(params, string("Local window size [") + type + string("]"), ToString(width) + units);
-
-
-                GenericRegistrationFilter registration;
-                registration.Parameter(params);
-
-                registration.Input(&r_target, &r_source);
-
-                Transformation *dofout = nullptr;
-                registration.Output(&dofout);
-
-                RigidTransformation dofin = stack_transformations[i];
-                registration.InitialGuess(&dofin);
-
-                registration.GuessParameter();
-                registration.Run();
-
-                unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-                stack_transformations[i] = *rigidTransf;
-
-                mo.Invert();
-                m = stack_transformations[i].GetMatrix();
-                m=m*mo;
-                stack_transformations[i].PutMatrix(m);
-
-                if (reconstructor->_debug) {
-
-                    char buffer[256];
-                    sprintf(buffer, "global-transformation%zu.dof", i);
-                    stack_transformations[i].Write(buffer);
-                    sprintf(buffer, "global-stack%zu.nii.gz", i);
-                    stacks[i].Write(buffer);
-                }
-
-
-            }
-        }
-
-        void operator() () const {
-
-            parallel_for( blocked_range<size_t>(0, stacks.size() ), *this );
-
-        }
-
-    };
-
-
-
     void ReconstructionDWI::StackRegistrations(Array<RealImage>& stacks,
                                                 Array<RigidTransformation>& stack_transformations, int templateNumber)
     {
@@ -725,16 +608,24 @@ namespace svrtk {
             target.Write("target.nii.gz");
             stacks[0].Write("stack0.nii.gz");
         }
-        RigidTransformation offset;
-        ResetOrigin(target,offset);
-
-        ParallelStackRegistrations_DWI registration( this,
-                                                stacks,
-                                                stack_transformations,
-                                                templateNumber,
-                                                target,
-                                                offset );
-        registration();
+        ParameterList params;
+        Insert(params, "Background value for image 1", 0);
+
+        StackRegistration registration(StackRegistration::Rigid, params, 1.5);
+        registration.Template(RealImage(target));
+        registration.Run(stacks, stack_transformations, templateNumber);
+
+        if (_debug) {
+            char buffer[256];
+            for (int i = 0; i < (int)stacks.size(); i++) {
+                if (i == templateNumber)
+                    continue;
+                sprintf(buffer, "global-transformation%i.dof", i);
+                stack_transformations[i].Write(buffer);
+                sprintf(buffer, "global-stack%i.nii.gz", i);
+                stacks[i].Write(buffer);
+            }
+        }
 
         InvertStackTransformations(stack_transformations);
     }
@@ -784,78 +675,17 @@ namespace svrtk {
 
         if(_debug)
             target.Write("target.nii.gz");
-        RigidTransformation offset;
-        ResetOrigin(target,offset);
-
-        for (int i = 0; i < (int)stacks.size(); i++)
-        {
-
-            GreyImage source = stacks[i];
-
-            Matrix mo = offset.GetMatrix();
-            Matrix m = stack_transformations[i].GetMatrix();
-            m=m*mo;
-            stack_transformations[i].PutMatrix(m);
-
 
-            RealImage r_source = stacks[i];
-            RealImage r_target = target;
+        ParameterList params;
+        Insert(params, "Background value for image 1", 0);
 
-            RealImage tmp_stack;
+        StackRegistration registration(StackRegistration::Rigid, params, 1.5);
+        registration.Template(RealImage(target));
+        registration.Run(stacks, stack_transformations);
 
-            ResamplingWithPadding<RealPixel> resampling2(1.5, 1.5, 1.5, 0);
-            GenericLinearInterpolateImageFunction<RealImage> interpolator2;
-            resampling2.Interpolator(&interpolator2);
-
-            tmp_stack = r_source;
-            resampling2.Input(&tmp_stack);
-            resampling2.Output(&r_source);
-            resampling2.Run();
-
-            tmp_stack = r_target;
-            resampling2.Input(&tmp_stack);
-            resampling2.Output(&r_target);
-            resampling2.Run();
-
-
-
-            ParameterList params;
-            Insert(params, "Transformation model", "Rigid");
-            Insert(params, "Background value for image 1", 0);
-
-
-//            Insert(params, "Image (dis-)similarity measure", "NCC");
-//            string type = "box";
-//            string units = "vox";
-//            double width = 0;
-//            Insert(params, string("Local window size [") + type + string("]"), ToString(width) + units);
-
-
-            GenericRegistrationFilter registration;
-            registration.Parameter(params);
-
-            registration.Input(&r_target, &r_source);
-
-            Transformation *dofout = nullptr;
-            registration.Output(&dofout);
-
-            RigidTransformation dofin = stack_transformations[i];
-            registration.InitialGuess(&dofin);
-
-            registration.GuessParameter();
-            registration.Run();
-
-            unique_ptr<RigidTransformation> rigidTransf(dynamic_cast<RigidTransformation*>(dofout));
-            stack_transformations[i] = *rigidTransf;
-
-
-            mo.Invert();
-            m = stack_transformations[i].GetMatrix();
-            m=m*mo;
-            stack_transformations[i].PutMatrix(m);
-
-
-            if (_debug)
+        if (_debug)
+        {
+            for (int i = 0; i < (int)stacks.size(); i++)
             {
                 sprintf(buffer, "stack-transformation%i.dof.gz", i);
                 stack_transformations[i].Write(buffer);
@@ -992,6 +822,7 @@ namespace svrtk {
 
     void ReconstructionDWI::SimulateSlices()
     {
+        RequireResidentCoeffs("SimulateSlices");
         if (_debug)
             cout<<"Simulating slices."<<endl;
 
@@ -1004,6 +835,7 @@ namespace svrtk {
 
     void ReconstructionDWI::SimulateStacks(Array<RealImage>& stacks, bool simulate_excluded)
     {
+        RequireResidentCoeffs("SimulateStacks");
         if (_debug)
             cout<<"Simulating stacks."<<endl;
 
@@ -1345,12 +1177,11 @@ namespace svrtk {
 
             for (int j = 0; j < attr._z; j++) {
 
-                RealImage slice = stacks[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
-
-                slice.PutPixelSize(attr._dx, attr._dy, thickness[i]);
+                // the slice refers to the stack, the working copies are taken from it
+                RealImage slice;
+                svrtk::Utility::StackSliceView(slice, stacks[i], j, 0, thickness[i]);
 
                 _slices.push_back(slice);
-                _original_slices.push_back(slice);
                 _simulated_slices.push_back(slice);
                 _simulated_weights.push_back(slice);
                 _simulated_inside.push_back(slice);
@@ -1396,9 +1227,9 @@ namespace svrtk {
 
             for (int j = 0; j < attr._z; j++) {
 
-                RealImage slice = stacks[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
-                slice.PutPixelSize(attr._dx, attr._dy, thickness[i]);
-                _slices.push_back(slice);
+                RealImage view;
+                svrtk::Utility::StackSliceView(view, stacks[i], j, 0, thickness[i]);
+                _slices.push_back(view);
 
             }
         }
@@ -1410,46 +1241,16 @@ namespace svrtk {
     {
         cout << "Masking slices ... ";
 
-        double x, y, z;
-        int i, j;
-
         if (!_have_mask) {
             cout << "Could not mask slices because no mask has been set." << endl;
             return;
         }
 
-        for (int unsigned inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-
-            RealImage& slice = _slices[inputIndex];
-
-            for (i = 0; i < slice.GetX(); i++)
-                for (j = 0; j < slice.GetY(); j++) {
-
-                    if (slice(i,j,0) < 0.01)
-                        slice(i,j,0) = -1;
-
-                    x = i;
-                    y = j;
-                    z = 0;
+        _slice_geometry.Resize(_slices.size());
+        svrtk::Utility::MaskSlices(_slices, _mask, [&](size_t index) {
+            return _slice_geometry.Get(index, _slices[index].Attributes(), _transformations[index], _mask.Attributes());
+        });
 
-                    slice.ImageToWorld(x, y, z);
-
-                    _transformations[inputIndex].Transform(x, y, z);
-
-                    _mask.WorldToImage(x, y, z);
-                    x = round(x);
-                    y = round(y);
-                    z = round(z);
-
-                    if (_mask.IsInside(x, y, z)) {
-                        if (_mask(x, y, z) == 0)
-                            slice(i, j, 0) = -1;
-                    }
-                    else
-                        slice(i, j, 0) = -1;
-                }
-
-        }
         cout << "done." << endl;
     }
 
@@ -1592,9 +1393,14 @@ namespace svrtk {
     class ParallelCoeffInit_DWI {
     public:
         ReconstructionDWI *reconstructor;
+        size_t begin;
+        size_t end;
 
         ParallelCoeffInit_DWI(ReconstructionDWI *_reconstructor) :
-        reconstructor(_reconstructor) { }
+        reconstructor(_reconstructor), begin(0), end(_reconstructor->_slices.size()) { }
+
+        ParallelCoeffInit_DWI(ReconstructionDWI *_reconstructor, size_t begin, size_t end) :
+        reconstructor(_reconstructor), begin(begin), end(end) { }
 
         void operator() (const blocked_range<size_t> &r) const {
 
@@ -1607,8 +1413,11 @@ namespace svrtk {
 
                 double res = vx;
 
-                cout << inputIndex << " ";
-                cout.flush();
+                // batches are regenerated on every pass of the out-of-core mode
+                if (reconstructor->_memory_cap <= 0) {
+                    cout << inputIndex << " ";
+                    cout.flush();
+                }
 
                 RealImage& slice = reconstructor->_slices[inputIndex];
 
@@ -1715,6 +1524,10 @@ namespace svrtk {
 
                 if (reconstructor->_intensity_weights[inputIndex] > 0) {
 
+                    const SliceGeometry& geometry = reconstructor->_slice_geometry.Get(inputIndex, slice.Attributes(), reconstructor->_transformations[inputIndex], reconstructor->_reconstructed.Attributes());
+                    Array<double> psf_offsets;
+                    geometry.PSFOffsets(PSF, dx, dy, dz, psf_offsets);
+
                     for (i = 0; i < slice.GetX(); i++)
                         for (j = 0; j < slice.GetY(); j++)
                             if (slice(i, j, 0) != -1) {
@@ -1722,9 +1535,8 @@ namespace svrtk {
                                 x = i;
                                 y = j;
                                 z = 0;
-                                slice.ImageToWorld(x, y, z);
-                                reconstructor->_transformations[inputIndex].Transform(x, y, z);
-                                reconstructor->_reconstructed.WorldToImage(x, y, z);
+                                geometry.Transform(x, y, z);
+                                const double centre_x = x, centre_y = y, centre_z = z;
                                 tx = round(x);
                                 ty = round(y);
                                 tz = round(z);
@@ -1738,28 +1550,10 @@ namespace svrtk {
                                     for (jj = 0; jj < yDim; jj++)
                                         for (kk = 0; kk < zDim; kk++) {
 
-                                            x = ii;
-                                            y = jj;
-                                            z = kk;
-
-                                            PSF.ImageToWorld(x, y, z);
-
-                                            x -= cx;
-                                            y -= cy;
-                                            z -= cz;
-
-                                            x /= dx;
-                                            y /= dy;
-                                            z /= dz;
-
-                                            x += i;
-                                            y += j;
-
-                                            slice.ImageToWorld(x, y, z);
-
-                                            reconstructor->_transformations[inputIndex].Transform(x, y, z);
-
-                                            reconstructor->_reconstructed.WorldToImage(x, y, z);
+                                            const double *po = &psf_offsets[3 * ((ii * yDim + jj) * zDim + kk)];
+                                            x = centre_x + po[0];
+                                            y = centre_y + po[1];
+                                            z = centre_z + po[2];
 
                                             nx = (int) floor(x);
                                             ny = (int) floor(y);
@@ -1837,7 +1631,7 @@ namespace svrtk {
         }
 
         void operator() () const {
-            parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ), *this );
+            parallel_for( blocked_range<size_t>(begin, end), *this );
         }
 
     };
@@ -1853,27 +1647,34 @@ namespace svrtk {
         _slice_inside.clear();
         _slice_inside.resize(_slices.size());
 
+        _slice_geometry.Resize(_slices.size());
+
         cout << "Initialising matrix coefficients...";
         cout.flush();
-        ParallelCoeffInit_DWI coeffinit(this);
-        coeffinit();
-        cout << " ... done." << endl;
+        if (_memory_cap <= 0) {
+            ParallelCoeffInit_DWI coeffinit(this);
+            coeffinit();
+        }
 
         _volume_weights.Initialize( _reconstructed.Attributes() );
         _volume_weights = 0;
 
-        int inputIndex, i, j, n, k;
-        POINT3D p;
-        for ( inputIndex = 0; inputIndex < _slices.size(); ++inputIndex) {
-            for ( i = 0; i < _slices[inputIndex].GetX(); i++)
-                for ( j = 0; j < _slices[inputIndex].GetY(); j++) {
-                    n = _volcoeffs[inputIndex][i][j].size();
-                    for (k = 0; k < n; k++) {
-                        p = _volcoeffs[inputIndex][i][j][k];
-                        _volume_weights(p.x, p.y, p.z) += p.value;
+        ForEachCoeffBatch([&](size_t begin, size_t end) {
+            int i, j, n, k;
+            POINT3D p;
+            for ( size_t inputIndex = begin; inputIndex < end; ++inputIndex) {
+                for ( i = 0; i < _slices[inputIndex].GetX(); i++)
+                    for ( j = 0; j < _slices[inputIndex].GetY(); j++) {
+                        n = _volcoeffs[inputIndex][i][j].size();
+                        for (k = 0; k < n; k++) {
+                            p = _volcoeffs[inputIndex][i][j][k];
+                            _volume_weights(p.x, p.y, p.z) += p.value;
+                        }
                     }
-                }
-        }
+            }
+        });
+        cout << " ... done." << endl;
+
         if (_debug)
             _volume_weights.Write("volume_weights.nii.gz");
 
@@ -1898,8 +1699,140 @@ namespace svrtk {
     }
 
 
+    void ReconstructionDWI::ForEachCoeffBatch(const function<void(size_t, size_t)>& kernel)
+    {
+        if (_memory_cap <= 0) {
+            kernel(0, _slices.size());
+            return;
+        }
+
+        _volcoeffs.resize(_slices.size());
+        _slice_inside.resize(_slices.size());
+        _slice_geometry.Resize(_slices.size());
+
+        // half of the cap is left for the SH blocks of the kernels
+        const double budget = 0.5 * _memory_cap * 1024 * 1024;
+        // the first batch only probes the size of the coefficients
+        size_t batch = max(1, omp_get_max_threads());
+        size_t total_bytes = 0, largest = 0, batches = 0;
+
+        for (size_t begin = 0; begin < _slices.size(); batches++) {
+            const size_t end = min(_slices.size(), begin + batch);
+
+            ParallelCoeffInit_DWI coeffinit(this, begin, end);
+            coeffinit();
+
+            kernel(begin, end);
+
+            const size_t bytes = CoeffBytes(begin, end);
+            total_bytes += bytes;
+            largest = max(largest, bytes);
+            for (size_t inputIndex = begin; inputIndex < end; inputIndex++)
+                SLICECOEFFS().swap(_volcoeffs[inputIndex]);
+
+            const double slice_bytes = max(1.0, double(total_bytes) / end);
+            batch = max(size_t(1), size_t(budget / slice_bytes));
+            begin = end;
+        }
+
+        if (_debug)
+            cout << "Out-of-core: " << batches << " coefficient batches, largest " << largest / (1024 * 1024) << " MB" << endl;
+    }
+
+    size_t ReconstructionDWI::CoeffBytes(size_t begin, size_t end) const
+    {
+        size_t bytes = 0;
+        for (size_t inputIndex = begin; inputIndex < end; inputIndex++) {
+            bytes += _volcoeffs[inputIndex].capacity() * sizeof(Array<VOXELCOEFFS>);
+            for (size_t i = 0; i < _volcoeffs[inputIndex].size(); i++) {
+                bytes += _volcoeffs[inputIndex][i].capacity() * sizeof(VOXELCOEFFS);
+                for (size_t j = 0; j < _volcoeffs[inputIndex][i].size(); j++)
+                    bytes += _volcoeffs[inputIndex][i][j].capacity() * sizeof(POINT3D);
+            }
+        }
+        return bytes;
+    }
+
+    int ReconstructionDWI::SHBlockSize(bool keep_original) const
+    {
+        const int coeffs = max(1, _SH_coeffs.GetT());
+        if (_memory_cap <= 0)
+            return coeffs;
+
+        // resident SH state: the coefficients, the copy for the adaptive regularisation and the confidence frame
+        const double frame_bytes = double(sizeof(RealPixel)) * _SH_coeffs.NumberOfSpatialVoxels();
+        const double state_bytes = frame_bytes * (coeffs * (keep_original ? 2 : 1) + 1);
+
+        // the adaptive regularisation holds a further copy of the coefficients once the blocks are released
+        if (keep_original && 3 * coeffs * frame_bytes > _memory_cap * 1024 * 1024)
+            cerr << "Out-of-core: the SH coefficients and their regularisation copies ("
+                << 3 * coeffs * frame_bytes / (1024 * 1024) << " MB) exceed the memory cap" << endl;
+
+        // per-thread update of a block and the confidence map, within the other half of the cap
+        const double budget = 0.5 * _memory_cap * 1024 * 1024 - state_bytes;
+        const int block = int(budget / (frame_bytes * max(1, omp_get_max_threads()))) - 1;
+
+        if (block < 1 && _debug)
+            cout << "Out-of-core: memory cap is too small for the SH updates, using blocks of a single coefficient" << endl;
+
+        return max(1, min(coeffs, block));
+    }
+
+    void ReconstructionDWI::BindSliceStore()
+    {
+        const Array<pair<string, Array<RealImage>*>> candidates = {
+            {"slices", &_slices},
+            {"simulated_slices", &_simulated_slices},
+            {"simulated_weights", &_simulated_weights},
+            {"simulated_inside", &_simulated_inside},
+            {"weights", &_weights},
+            {"bias", &_bias}
+        };
+
+        Array<string> fields;
+        for (const auto& candidate : candidates)
+            if (candidate.second->size() == _slices.size())
+                fields.push_back(candidate.first);
+
+        Array<ImageAttributes> slice_attributes;
+        Array<int> stack_index;
+        for (size_t i = 0; i < _slices.size(); i++) {
+            slice_attributes.push_back(_slices[i].Attributes());
+            stack_index.push_back(i < _stack_index.size() ? _stack_index[i] : 0);
+        }
+
+        // The new slab is filled before the previous one is released, as the images may still refer to it
+        SliceStore store;
+        store.Initialize(slice_attributes, stack_index, fields, _scratch_file);
+        for (const auto& candidate : candidates)
+            store.Bind(*candidate.second, candidate.first);
+        _slice_store = move(store);
+
+        cout << "Slice store : " << fields.size() << " fields, " << _slice_store.Bytes() / (1024 * 1024) << " MB"
+            << (_slice_store.IsMapped() ? " (memory-mapped)" : "") << endl;
+    }
+
+    void ReconstructionDWI::SetOutOfCore(double memory_cap, const string& scratch_file)
+    {
+        const bool released = _memory_cap > 0;
+
+        _memory_cap = max(0.0, memory_cap);
+        _scratch_file = scratch_file;
+
+        if (_memory_cap > 0) {
+            for (size_t inputIndex = 0; inputIndex < _volcoeffs.size(); inputIndex++)
+                SLICECOEFFS().swap(_volcoeffs[inputIndex]);
+            if (!_scratch_file.empty() && !_slices.empty())
+                BindSliceStore();
+        } else if (released && !_slices.empty()) {
+            CoeffInit();
+        }
+    }
+
+
     void ReconstructionDWI::GaussianReconstruction(double small_slices_threshold)
     {
+        RequireResidentCoeffs("GaussianReconstruction");
         cout << "Gaussian reconstruction ... ";
         unsigned int inputIndex;
         int i, j, k, n;
@@ -2151,7 +2084,8 @@ namespace svrtk {
                             else
                                 slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
 
-                            int n = reconstructor->_volcoeffs[inputIndex][i][j].size();
+                            //coefficients are released in the out-of-core mode, where the simulated weights tell the same
+                            int n = reconstructor->_volcoeffs[inputIndex].empty() ? 1 : reconstructor->_volcoeffs[inputIndex][i][j].size();
 
                             if ( (n>0) &&
                                 (reconstructor->_simulated_weights[inputIndex](i,j,0) > 0) ) {
@@ -2449,7 +2383,7 @@ namespace svrtk {
 
                 RealImage& w = reconstructor->_weights[inputIndex];
 
-                RealImage b = reconstructor->_bias[inputIndex];
+                RealImage& b = reconstructor->_bias[inputIndex];
 
                 double scale = reconstructor->_scale[inputIndex];
 
@@ -2520,8 +2454,6 @@ namespace svrtk {
                             }
                 }
 
-                reconstructor->_bias[inputIndex] = b;
-
             }
         }
 
@@ -2676,6 +2608,7 @@ namespace svrtk {
 
     void ReconstructionDWI::Superresolution(int iter)
     {
+        RequireResidentCoeffs("Superresolution");
         if (_debug)
             cout << "Superresolution " << iter << endl;
 
@@ -2849,153 +2782,60 @@ namespace svrtk {
 
     }
 
-    class ParallelAdaptiveRegularization1_DWI {
-        ReconstructionDWI *reconstructor;
-        Array<RealImage> &b;
-        Array<double> &factor;
-        RealImage &original;
-
-    public:
-        ParallelAdaptiveRegularization1_DWI( ReconstructionDWI *_reconstructor,
-                                        Array<RealImage> &_b,
-                                        Array<double> &_factor,
-                                        RealImage &_original) :
-        reconstructor(_reconstructor),
-        b(_b),
-        factor(_factor),
-        original(_original) { }
-
-        void operator() (const blocked_range<size_t> &r) const {
-            int dx = reconstructor->_reconstructed.GetX();
-            int dy = reconstructor->_reconstructed.GetY();
-            int dz = reconstructor->_reconstructed.GetZ();
-            for ( size_t i = r.begin(); i != r.end(); ++i ) {
-
-                int x, y, z, xx, yy, zz;
-                double diff;
-                for (x = 0; x < dx; x++)
-                    for (y = 0; y < dy; y++)
-                        for (z = 0; z < dz; z++) {
-                            xx = x + reconstructor->_directions[i][0];
-                            yy = y + reconstructor->_directions[i][1];
-                            zz = z + reconstructor->_directions[i][2];
-                            if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                && (reconstructor->_mask(x, y, z) > 0) && (reconstructor->_mask(xx, yy, zz) > 0)) {
-                                diff = (original(xx, yy, zz) - original(x, y, z)) * sqrt(factor[i]) / reconstructor->_delta;
-                                b[i](x, y, z) = factor[i] / sqrt(1 + diff * diff);
-
-                            }
-                            else
-                                b[i](x, y, z) = 0;
-                        }
-            }
-        }
-
-        void operator() () const {
-
-            parallel_for( blocked_range<size_t>(0, 13), *this );
-        }
-
-    };
-
-    class ParallelAdaptiveRegularization2_DWI {
-        ReconstructionDWI *reconstructor;
-        Array<RealImage> &b;
-        Array<double> &factor;
-        RealImage &original;
-
-    public:
-        ParallelAdaptiveRegularization2_DWI( ReconstructionDWI *_reconstructor,
-                                        Array<RealImage> &_b,
-                                        Array<double> &_factor,
-                                        RealImage &_original) :
-        reconstructor(_reconstructor),
-        b(_b),
-        factor(_factor),
-        original(_original) { }
-
-        void operator() (const blocked_range<size_t> &r) const {
-            int dx = reconstructor->_reconstructed.GetX();
-            int dy = reconstructor->_reconstructed.GetY();
-            int dz = reconstructor->_reconstructed.GetZ();
-            for ( size_t x = r.begin(); x != r.end(); ++x ) {
-                int xx, yy, zz;
-                for (int y = 0; y < dy; y++)
-                    for (int z = 0; z < dz; z++)
-                        if(reconstructor->_mask(x,y,z)>0)
-                        {
-                            double val = 0;
-                            double sum = 0;
-                            for (int i = 0; i < 13; i++) {
-                                xx = x + reconstructor->_directions[i][0];
-                                yy = y + reconstructor->_directions[i][1];
-                                zz = z + reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz))
-                                    if(reconstructor->_mask(xx,yy,zz)>0)
-                                    {
-                                        val += b[i](x, y, z) * original(xx, yy, zz);
-                                        sum += b[i](x, y, z);
-                                    }
-                            }
-
-                            for (int i = 0; i < 13; i++) {
-                                xx = x - reconstructor->_directions[i][0];
-                                yy = y - reconstructor->_directions[i][1];
-                                zz = z - reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz))
-                                    if(reconstructor->_mask(xx,yy,zz)>0)
-                                    {
-                                        val += b[i](x, y, z) * original(xx, yy, zz);
-                                        sum += b[i](x, y, z);
-                                    }
-
-                            }
-
-                            val -= sum * original(x, y, z);
-                            val = original(x, y, z) + reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
+    void ReconstructionDWI::AdaptiveRegularization(int iter, RealImage& original)
+    {
+        if (_debug)
+            cout << "AdaptiveRegularization: _delta = "<<_delta<<" _lambda = "<<_lambda <<" _alpha = "<<_alpha<< endl;
 
-                            reconstructor->_reconstructed(x, y, z) = val;
-                        }
+        AdaptiveRegularization(_reconstructed, original);
 
-            }
+        if (_alpha * _lambda / (_delta * _delta) > 0.068) {
+            cerr
+            << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068."
+            << endl;
         }
+    }
 
-        void operator() () const {
-
-            parallel_for( blocked_range<size_t>(0, reconstructor->_reconstructed.GetX()), *this );
-
+    void ReconstructionDWI::AdaptiveRegularization(RealImage& reconstructed, const RealImage& original)
+    {
+        Array<double> factor(13,0);
+        for (int i = 0; i < 13; i++) {
+            for (int j = 0; j < 3; j++)
+                factor[i] += fabs(double(_directions[i][j]));
+            factor[i] = 1 / factor[i];
         }
 
-    };
+        StencilRegulariser regulariser(_mask.Attributes(), _directions);
+        regulariser.Adaptive(original, reconstructed, _mask, factor, _delta, _alpha * _lambda / (_delta * _delta));
+    }
 
-    void ReconstructionDWI::AdaptiveRegularization(int iter, RealImage& original)
+    void ReconstructionDWI::LaplacianRegularization(int iter, int t, RealImage& original)
     {
         if (_debug)
-            cout << "AdaptiveRegularization: _delta = "<<_delta<<" _lambda = "<<_lambda <<" _alpha = "<<_alpha<< endl;
+            cout << "LaplacianRegularization:  _lambda = "<<_lambda <<" _alpha = "<<_alpha<< endl;
+        CreateInternalMask();
 
         Array<double> factor(13,0);
+        double sum=0;
         for (int i = 0; i < 13; i++) {
             for (int j = 0; j < 3; j++)
                 factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / factor[i];
+            factor[i] = 1 / sqrt(factor[i]);
+            sum+=factor[i];
+        }
+        for (int i = 0; i < 13; i++) {
+            factor[i]/=2*sum;
         }
 
-        Array<RealImage> b;//(13);
-        for (int i = 0; i < 13; i++)
-            b.push_back( _reconstructed );
+        StencilRegulariser regulariser(_mask.Attributes(), _directions);
 
-        ParallelAdaptiveRegularization1_DWI ParallelAdaptiveRegularization1_DWI( this,
-                                                                        b,
-                                                                        factor,
-                                                                        original );
-        ParallelAdaptiveRegularization1_DWI();
+        RealImage laplacian;
+        regulariser.Laplacian(original, laplacian, _mask, _mask_internal, factor);
+        char buffer[256];
+        sprintf(buffer,"laplacian%i-%i.nii.gz",iter,t);
+        laplacian.Write(buffer);
 
-        RealImage original2 = _reconstructed;
-        ParallelAdaptiveRegularization2_DWI ParallelAdaptiveRegularization2_DWI( this,
-                                                                        b,
-                                                                        factor,
-                                                                        original2 );
-        ParallelAdaptiveRegularization2_DWI();
+        regulariser.LaplacianUpdate(laplacian, _reconstructed, _mask, _mask_internal, factor, _alpha * _lambda / (_delta * _delta));
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068) {
             cerr
@@ -3004,186 +2844,10 @@ namespace svrtk {
         }
     }
 
-    class ParallelLaplacianRegularization1_DWI {
-        ReconstructionDWI *reconstructor;
-        RealImage &laplacian;
-        Array<double> &factor;
-        RealImage &original;
 
-    public:
-        ParallelLaplacianRegularization1_DWI( ReconstructionDWI *_reconstructor,
-                                         RealImage &_laplacian,
-                                         Array<double> &_factor,
-                                         RealImage &_original) :
-        reconstructor(_reconstructor),
-        laplacian(_laplacian),
-        factor(_factor),
-        original(_original) { }
 
-        void operator() (const blocked_range<size_t> &r) const {
-            int dx = reconstructor->_reconstructed.GetX();
-            int dy = reconstructor->_reconstructed.GetY();
-            int dz = reconstructor->_reconstructed.GetZ();
-            for ( size_t i = r.begin(); i != r.end(); ++i ) {
-
-                int x, y, z, xx, yy, zz;
-                double diff;
-                for (x = 0; x < dx; x++)
-                    for (y = 0; y < dy; y++)
-                        for (z = 0; z < dz; z++) {
-                            xx = x + reconstructor->_directions[i][0];
-                            yy = y + reconstructor->_directions[i][1];
-                            zz = z + reconstructor->_directions[i][2];
-                            if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                && (reconstructor->_mask_internal(x, y, z) > 0)
-                                && (reconstructor->_mask(xx, yy, zz) > 0))
-                            {
-                                diff = (original(xx, yy, zz) - original(x, y, z)) * factor[i];
-                                laplacian(x, y, z) += diff;
-
-                            }
-
-                            xx = x - reconstructor->_directions[i][0];
-                            yy = y - reconstructor->_directions[i][1];
-                            zz = z - reconstructor->_directions[i][2];
-                            if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                && (reconstructor->_mask_internal(x, y, z) > 0)
-                                && (reconstructor->_mask(xx, yy, zz) > 0)) {
-                                diff = (original(xx, yy, zz) - original(x, y, z)) * factor[i];
-                                laplacian(x, y, z) += diff;
-
-                            }
-                        }
-            }
-        }
-
-        // execute
-        void operator() () const {
-            parallel_for( blocked_range<size_t>(0, 13),
-                         *this );
-        }
-
-    };
-
-    class ParallelLaplacianRegularization2_DWI {
-        ReconstructionDWI *reconstructor;
-        RealImage &laplacian;
-        Array<double> &factor;
-        RealImage &original;
-
-    public:
-        ParallelLaplacianRegularization2_DWI( ReconstructionDWI *_reconstructor,
-                                         RealImage &_laplacian,
-                                         Array<double> &_factor,
-                                         RealImage &_original) :
-        reconstructor(_reconstructor),
-        laplacian(_laplacian),
-        factor(_factor),
-        original(_original) { }
-
-        void operator() (const blocked_range<size_t> &r) const {
-            int dx = reconstructor->_reconstructed.GetX();
-            int dy = reconstructor->_reconstructed.GetY();
-            int dz = reconstructor->_reconstructed.GetZ();
-            for ( size_t x = r.begin(); x != r.end(); ++x ) {
-                int xx, yy, zz;
-                for (int y = 0; y < dy; y++)
-                    for (int z = 0; z < dz; z++)
-                        if(reconstructor->_mask(x,y,z)>0)
-                        {
-                            double val = 0;
-                            double sum = 0;
-                            for (int i = 0; i < 13; i++) {
-                                xx = x + reconstructor->_directions[i][0];
-                                yy = y + reconstructor->_directions[i][1];
-                                zz = z + reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz))
-                                    if(reconstructor->_mask_internal(xx,yy,zz)>0)
-                                    {
-                                        val += factor[i] * laplacian(xx, yy, zz);
-                                        sum += factor[i];
-                                    }
-                            }
-
-                            for (int i = 0; i < 13; i++) {
-                                xx = x - reconstructor->_directions[i][0];
-                                yy = y - reconstructor->_directions[i][1];
-                                zz = z - reconstructor->_directions[i][2];
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz))
-                                    if(reconstructor->_mask_internal(xx,yy,zz)>0)
-                                    {
-                                        val += factor[i] * laplacian(xx, yy, zz);
-                                        sum += factor[i];
-                                    }
-
-                            }
-
-                            if(reconstructor->_mask_internal(x,y,z)>0)
-                                val -= sum * laplacian(x, y, z);
-
-                            val = original(x, y, z) - reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val/0.068;
-
-                            reconstructor->_reconstructed(x, y, z) = val;
-                        }
-
-            }
-        }
-
-        void operator() () const {
-            parallel_for( blocked_range<size_t>(0, reconstructor->_reconstructed.GetX()),
-                         *this );
-        }
-
-    };
-
-    void ReconstructionDWI::LaplacianRegularization(int iter, int t, RealImage& original)
-    {
-        if (_debug)
-            cout << "LaplacianRegularization:  _lambda = "<<_lambda <<" _alpha = "<<_alpha<< endl;
-        CreateInternalMask();
-
-        Array<double> factor(13,0);
-        double sum=0;
-        for (int i = 0; i < 13; i++) {
-            for (int j = 0; j < 3; j++)
-                factor[i] += fabs(double(_directions[i][j]));
-            factor[i] = 1 / sqrt(factor[i]);
-            sum+=factor[i];
-        }
-        for (int i = 0; i < 13; i++) {
-            factor[i]/=2*sum;
-        }
-
-        RealImage laplacian(_reconstructed);
-        laplacian=0;
-
-        ParallelLaplacianRegularization1_DWI ParallelLaplacianRegularization1_DWI( this,
-                                                                          laplacian,
-                                                                          factor,
-                                                                          original );
-        ParallelLaplacianRegularization1_DWI();
-        char buffer[256];
-        sprintf(buffer,"laplacian%i-%i.nii.gz",iter,t);
-        laplacian.Write(buffer);
-
-        RealImage original2 = _reconstructed;
-        ParallelLaplacianRegularization2_DWI ParallelLaplacianRegularization2_DWI( this,
-                                                                          laplacian,
-                                                                          factor,
-                                                                          original2 );
-        ParallelLaplacianRegularization2_DWI();
-
-        if (_alpha * _lambda / (_delta * _delta) > 0.068) {
-            cerr
-            << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068."
-            << endl;
-        }
-    }
-
-
-
-    void ReconstructionDWI::CreateInternalMask()
-    {
+    void ReconstructionDWI::CreateInternalMask()
+    {
 
         _mask_internal = _mask;
         int directions[13][3] = {
@@ -3261,14 +2925,10 @@ namespace svrtk {
             factor[i]/=2*sum;
         }
 
-        RealImage laplacian(_reconstructed);
-        laplacian=0;
+        StencilRegulariser regulariser(_mask.Attributes(), _directions);
 
-        ParallelLaplacianRegularization1_DWI ParallelLaplacianRegularization1_DWI( this,
-                                                                          laplacian,
-                                                                          factor,
-                                                                          original );
-        ParallelLaplacianRegularization1_DWI();
+        RealImage laplacian;
+        regulariser.Laplacian(original, laplacian, _mask, _mask_internal, factor);
 
         sum=0;
         int num=0;
@@ -3292,84 +2952,6 @@ namespace svrtk {
 
 
 
-    class ParallelL22Regularization_DWI {
-        ReconstructionDWI *reconstructor;
-        Array<double> &factor;
-        RealImage &original;
-
-    public:
-        ParallelL22Regularization_DWI( ReconstructionDWI *_reconstructor,
-                                  Array<double> &_factor,
-                                  RealImage &_original) :
-        reconstructor(_reconstructor),
-        factor(_factor),
-        original(_original) { }
-
-        void operator() (const blocked_range<size_t> &r) const {
-            int dx = reconstructor->_reconstructed.GetX();
-            int dy = reconstructor->_reconstructed.GetY();
-            int dz = reconstructor->_reconstructed.GetZ();
-            for ( size_t x = r.begin(); x != r.end(); ++x ) {
-                int xx, yy, zz, xxx, yyy, zzz;
-                for (int y = 0; y < dy; y++)
-                    for (int z = 0; z < dz; z++)
-                        if(reconstructor->_confidence_map(x,y,z)>0)
-                        {
-                            double val = 0;
-                            double sum = 0;
-                            for (int i = 0; i < 13; i++) {
-                                xx = x + reconstructor->_directions[i][0];
-                                yy = y + reconstructor->_directions[i][1];
-                                zz = z + reconstructor->_directions[i][2];
-                                xxx = x + reconstructor->_directions[i][0]*2;
-                                yyy = y + reconstructor->_directions[i][1]*2;
-                                zzz = z + reconstructor->_directions[i][2]*2;
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    &&(xxx >= 0) && (xxx < dx) && (yyy >= 0) && (yyy < dy) && (zzz >= 0) && (zzz < dz))
-                                    if(reconstructor->_confidence_map(xx,yy,zz)>0)
-                                    {
-                                        val += factor[i] * (original(xxx, yyy, zzz)-4*original(xx, yy, zz))/3;
-                                        sum += factor[i];
-                                    }
-                            }
-
-                            for (int i = 0; i < 13; i++) {
-                                xx = x - reconstructor->_directions[i][0];
-                                yy = y - reconstructor->_directions[i][1];
-                                zz = z - reconstructor->_directions[i][2];
-                                xxx = x - reconstructor->_directions[i][0]*2;
-                                yyy = y - reconstructor->_directions[i][1]*2;
-                                zzz = z - reconstructor->_directions[i][2]*2;
-                                if ((xx >= 0) && (xx < dx) && (yy >= 0) && (yy < dy) && (zz >= 0) && (zz < dz)
-                                    &&(xxx >= 0) && (xxx < dx) && (yyy >= 0) && (yyy < dy) && (zzz >= 0) && (zzz < dz))
-                                    if(reconstructor->_confidence_map(xx,yy,zz)>0)
-                                    {
-                                        val += factor[i] * (original(xxx, yyy, zzz)-4*original(xx, yy, zz))/3;
-                                        sum += factor[i];
-                                    }
-
-                            }
-
-                            val += sum * original(x, y, z);
-                            val = original(x, y, z)
-                            - reconstructor->_alpha * reconstructor->_lambda / (reconstructor->_delta * reconstructor->_delta) * val;
-
-                            reconstructor->_reconstructed(x, y, z) = val;
-                        }
-
-            }
-        }
-
-        // execute
-        void operator() () const {
-
-            parallel_for( blocked_range<size_t>(0, reconstructor->_reconstructed.GetX()),
-                         *this );
-
-        }
-
-    };
-
     void ReconstructionDWI::L22Regularization(int iter, RealImage& original)
     {
         if (_debug)
@@ -3383,11 +2965,8 @@ namespace svrtk {
             factor[i] = 1 / factor[i];
         }
 
-        RealImage original2 = _reconstructed;
-        ParallelL22Regularization_DWI ParallelL22Regularization_DWI( this,
-                                                            factor,
-                                                            original2 );
-        ParallelL22Regularization_DWI();
+        StencilRegulariser regulariser(_mask.Attributes(), _directions);
+        regulariser.L22(_reconstructed, _confidence_map, factor, _alpha * _lambda / (_delta * _delta));
 
         if (_alpha * _lambda / (_delta * _delta) > 0.068) {
             cerr
@@ -3509,6 +3088,8 @@ namespace svrtk {
 
     class ParallelNormaliseBias_DWI{
         ReconstructionDWI* reconstructor;
+        size_t begin;
+        size_t end;
     public:
         RealImage bias;
 
@@ -3553,7 +3134,7 @@ namespace svrtk {
         }
 
         ParallelNormaliseBias_DWI( ParallelNormaliseBias_DWI& x, split ) :
-        reconstructor(x.reconstructor)
+        reconstructor(x.reconstructor), begin(x.begin), end(x.end)
         {
             bias.Initialize( reconstructor->_reconstructed.Attributes() );
             bias = 0;
@@ -3563,8 +3144,8 @@ namespace svrtk {
             bias += y.bias;
         }
 
-        ParallelNormaliseBias_DWI( ReconstructionDWI *reconstructor ) :
-        reconstructor(reconstructor)
+        ParallelNormaliseBias_DWI( ReconstructionDWI *reconstructor, size_t begin, size_t end ) :
+        reconstructor(reconstructor), begin(begin), end(end)
         {
             bias.Initialize( reconstructor->_reconstructed.Attributes() );
             bias = 0;
@@ -3573,7 +3154,7 @@ namespace svrtk {
         // execute
         void operator() () {
 
-            parallel_reduce( blocked_range<size_t>(0,reconstructor->_slices.size()),
+            parallel_reduce( blocked_range<size_t>(begin,end),
                             *this );
 
         }
@@ -3585,9 +3166,13 @@ namespace svrtk {
         if(_debug)
             cout << "Normalise Bias ... ";
 
-        ParallelNormaliseBias_DWI ParallelNormaliseBias_DWI(this);
-        ParallelNormaliseBias_DWI();
-        RealImage bias = ParallelNormaliseBias_DWI.bias;
+        RealImage bias( _reconstructed.Attributes() );
+        bias = 0;
+        ForEachCoeffBatch([&](size_t begin, size_t end) {
+            ParallelNormaliseBias_DWI parallelNormaliseBias(this, begin, end);
+            parallelNormaliseBias();
+            bias += parallelNormaliseBias.bias;
+        });
 
         // normalize the volume by proportion of contributing slice voxels for each volume voxel
         bias /= _volume_weights;
@@ -3631,9 +3216,13 @@ namespace svrtk {
         if(_debug)
             cout << "Normalise Bias ... ";
 
-        ParallelNormaliseBias_DWI ParallelNormaliseBias_DWI(this);
-        ParallelNormaliseBias_DWI();
-        RealImage bias = ParallelNormaliseBias_DWI.bias;
+        RealImage bias( _reconstructed.Attributes() );
+        bias = 0;
+        ForEachCoeffBatch([&](size_t begin, size_t end) {
+            ParallelNormaliseBias_DWI parallelNormaliseBias(this, begin, end);
+            parallelNormaliseBias();
+            bias += parallelNormaliseBias.bias;
+        });
 
         // normalize the volume by proportion of contributing slice voxels for each volume voxel
         bias /= _volume_weights;
@@ -4272,6 +3861,7 @@ namespace svrtk {
 
     void ReconstructionDWI::Init4DGauss(int nStacks, Array<RigidTransformation> &stack_transformations, int order)
     {
+        RequireResidentCoeffs("Init4DGauss");
         unsigned int inputIndex;
         int i, j, k, t, n;
         RealImage slice;
@@ -4348,6 +3938,7 @@ namespace svrtk {
 
     void ReconstructionDWI::Init4DGaussWeighted(int nStacks, Array<RigidTransformation> &stack_transformations, int order)
     {
+        RequireResidentCoeffs("Init4DGaussWeighted");
         unsigned int inputIndex;
         int i, j, k, t, n;
         RealImage slice;
@@ -4658,6 +4249,7 @@ namespace svrtk {
 
     void ReconstructionDWI::GaussianReconstruction4D(int nStacks, Array<RigidTransformation> &stack_transformations, int order)
     {
+        RequireResidentCoeffs("GaussianReconstruction4D");
         cout << "Gaussian reconstruction ... ";
         unsigned int inputIndex;
         int i, j, k, t, n;
@@ -4799,6 +4391,7 @@ namespace svrtk {
 
     void ReconstructionDWI::GaussianReconstruction4D2(int nStacks)
     {
+        RequireResidentCoeffs("GaussianReconstruction4D2");
         cout << "Gaussian reconstruction ... ";
         unsigned int inputIndex;
         int i, j, k, n;
@@ -4894,6 +4487,7 @@ namespace svrtk {
 
     void ReconstructionDWI::GaussianReconstruction4D3()
     {
+        RequireResidentCoeffs("GaussianReconstruction4D3");
         cout << "Gaussian reconstruction SH ... ";
         unsigned int inputIndex;
         int i, j, k, n;
@@ -5001,70 +4595,72 @@ namespace svrtk {
             threshold = -1;
 
         _reconstructed.Write("reconstructed.nii.gz");
-        for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+        ForEachCoeffBatch([&](size_t begin, size_t end) {
+            for (inputIndex = begin; inputIndex < end; inputIndex++) {
 
-            //    cout<<inputIndex<<" ";
-            //    cout.flush();
-            // read the current slice
-            RealImage& slice = _slices[inputIndex];
+                //    cout<<inputIndex<<" ";
+                //    cout.flush();
+                // read the current slice
+                RealImage& slice = _slices[inputIndex];
 
-            //Calculate simulated slice
-            sim.Initialize( slice.Attributes() );
-            sim = 0;
+                //Calculate simulated slice
+                sim.Initialize( slice.Attributes() );
+                sim = 0;
 
-            //direction for current slice
-            int dirIndex = _stack_index[inputIndex]+1;
-            double gx=_directionsDTI[0][dirIndex];
-            double gy=_directionsDTI[1][dirIndex];
-            double gz=_directionsDTI[2][dirIndex];
-            RotateDirections(gx,gy,gz,inputIndex);
-            double bval=_bvalues[dirIndex];
-            SphericalHarmonics sh;
-            Matrix dir(1,3);
-            dir(0,0)=gx;
-            dir(0,1)=gy;
-            dir(0,2)=gz;
-            Matrix basis = sh.SHbasis(dir,_order);
-            double sim_signal;
+                //direction for current slice
+                int dirIndex = _stack_index[inputIndex]+1;
+                double gx=_directionsDTI[0][dirIndex];
+                double gy=_directionsDTI[1][dirIndex];
+                double gz=_directionsDTI[2][dirIndex];
+                RotateDirections(gx,gy,gz,inputIndex);
+                double bval=_bvalues[dirIndex];
+                SphericalHarmonics sh;
+                Matrix dir(1,3);
+                dir(0,0)=gx;
+                dir(0,1)=gy;
+                dir(0,2)=gz;
+                Matrix basis = sh.SHbasis(dir,_order);
+                double sim_signal;
 
-            //do not simulate excluded slice
-            if(_slice_weight[inputIndex]>threshold)
-            {
-                for (i = 0; i < slice.GetX(); i++)
-                    for (j = 0; j < slice.GetY(); j++)
-                        if (slice(i, j, 0) != -1) {
-                            weight=0;
-                            n = _volcoeffs[inputIndex][i][j].size();
-                            for (k = 0; k < n; k++) {
-                                p = _volcoeffs[inputIndex][i][j][k];
-                                //signal simulated from SH
-                                sim_signal = 0;
-                                for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    sim_signal += _SH_coeffs(p.x, p.y, p.z,l)*basis(0,l);
-                                //update slice
-                                sim(i, j, 0) += p.value *sim_signal;
-                                weight += p.value;
+                //do not simulate excluded slice
+                if(_slice_weight[inputIndex]>threshold)
+                {
+                    for (i = 0; i < slice.GetX(); i++)
+                        for (j = 0; j < slice.GetY(); j++)
+                            if (slice(i, j, 0) != -1) {
+                                weight=0;
+                                n = _volcoeffs[inputIndex][i][j].size();
+                                for (k = 0; k < n; k++) {
+                                    p = _volcoeffs[inputIndex][i][j][k];
+                                    //signal simulated from SH
+                                    sim_signal = 0;
+                                    for(unsigned int l = 0; l < basis.Cols(); l++ )
+                                        sim_signal += _SH_coeffs(p.x, p.y, p.z,l)*basis(0,l);
+                                    //update slice
+                                    sim(i, j, 0) += p.value *sim_signal;
+                                    weight += p.value;
+                                }
+                                if(weight>0.98)
+                                    sim(i,j,0)/=weight;
+                                else
+                                    sim(i,j,0)=0;
                             }
-                            if(weight>0.98)
-                                sim(i,j,0)/=weight;
-                            else
-                                sim(i,j,0)=0;
-                        }
-            }
-
-            if (_stack_index[inputIndex]==current_stack)
-                z++;
-            else {
-                current_stack=_stack_index[inputIndex];
-                z=0;
-            }
+                }
 
-            for(i=0;i<sim.GetX();i++)
-                for(j=0;j<sim.GetY();j++) {
-                    stacks[_stack_index[inputIndex]](i,j,z)=sim(i,j,0);
+                if (_stack_index[inputIndex]==current_stack)
+                    z++;
+                else {
+                    current_stack=_stack_index[inputIndex];
+                    z=0;
                 }
-            //end of loop for a slice inputIndex
-        }
+
+                for(i=0;i<sim.GetX();i++)
+                    for(j=0;j<sim.GetY();j++) {
+                        stacks[_stack_index[inputIndex]](i,j,z)=sim(i,j,0);
+                    }
+                //end of loop for a slice inputIndex
+            }
+        });
     }
 
     void ReconstructionDWI::SimulateStacksDTIIntensityMatching(Array<RealImage>& stacks, bool simulate_excluded)
@@ -5088,110 +4684,112 @@ namespace svrtk {
             threshold = -1;
 
         _reconstructed.Write("reconstructed.nii.gz");
-        for (inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
+        ForEachCoeffBatch([&](size_t begin, size_t end) {
+            for (inputIndex = begin; inputIndex < end; inputIndex++) {
 
-            //    cout<<inputIndex<<" ";
-            //    cout.flush();
-            // read the current slice
-            RealImage& slice = _slices[inputIndex];
-            //read the current bias image
-            RealImage& b = _bias[inputIndex];
-            //identify scale factor
-            double scale = _scale[inputIndex];
+                //    cout<<inputIndex<<" ";
+                //    cout.flush();
+                // read the current slice
+                RealImage& slice = _slices[inputIndex];
+                //read the current bias image
+                RealImage& b = _bias[inputIndex];
+                //identify scale factor
+                double scale = _scale[inputIndex];
 
 
-            //Calculate simulated slice
-            sim.Initialize( slice.Attributes() );
-            sim = 0;
-            RealImage simulatedslice(sim), simulatedsliceint(sim), simulatedweights(sim);
+                //Calculate simulated slice
+                sim.Initialize( slice.Attributes() );
+                sim = 0;
+                RealImage simulatedslice(sim), simulatedsliceint(sim), simulatedweights(sim);
 
-            //direction for current slice
-            int dirIndex = _stack_index[inputIndex]+1;
-            double gx=_directionsDTI[0][dirIndex];
-            double gy=_directionsDTI[1][dirIndex];
-            double gz=_directionsDTI[2][dirIndex];
-            RotateDirections(gx,gy,gz,inputIndex);
-            double bval=_bvalues[dirIndex];
-            SphericalHarmonics sh;
-            Matrix dir(1,3);
-            dir(0,0)=gx;
-            dir(0,1)=gy;
-            dir(0,2)=gz;
-            Matrix basis = sh.SHbasis(dir,_order);
-            double sim_signal;
+                //direction for current slice
+                int dirIndex = _stack_index[inputIndex]+1;
+                double gx=_directionsDTI[0][dirIndex];
+                double gy=_directionsDTI[1][dirIndex];
+                double gz=_directionsDTI[2][dirIndex];
+                RotateDirections(gx,gy,gz,inputIndex);
+                double bval=_bvalues[dirIndex];
+                SphericalHarmonics sh;
+                Matrix dir(1,3);
+                dir(0,0)=gx;
+                dir(0,1)=gy;
+                dir(0,2)=gz;
+                Matrix basis = sh.SHbasis(dir,_order);
+                double sim_signal;
 
-            //do not simulate excluded slice
-            if(_slice_weight[inputIndex]>threshold)
-            {
-                for (i = 0; i < slice.GetX(); i++)
-                    for (j = 0; j < slice.GetY(); j++)
-                        if (slice(i, j, 0) != -1) {
-                            weight=0;
-                            n = _volcoeffs[inputIndex][i][j].size();
-                            for (k = 0; k < n; k++) {
-                                p = _volcoeffs[inputIndex][i][j][k];
-                                //signal simulated from SH
-                                sim_signal = 0;
-                                for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    sim_signal += _SH_coeffs(p.x, p.y, p.z,l)*basis(0,l);
-                                //update slice
-                                sim(i, j, 0) += p.value *sim_signal;
-                                weight += p.value;
-                            }
-                            simulatedweights(i,j,0)=weight;
-                            if(weight>0.98)
-                                sim(i,j,0)/=weight;
-                            else
-                                sim(i,j,0)=0;
-                            simulatedslice(i,j,0)=sim(i,j,0);
-                            //intensity parameters
-                            if(_intensity_matching_GD)
-                            {
-                                double a=b(i, j, 0) * scale;
-                                if(a>0)
-                                    sim(i,j,0)/=a;
+                //do not simulate excluded slice
+                if(_slice_weight[inputIndex]>threshold)
+                {
+                    for (i = 0; i < slice.GetX(); i++)
+                        for (j = 0; j < slice.GetY(); j++)
+                            if (slice(i, j, 0) != -1) {
+                                weight=0;
+                                n = _volcoeffs[inputIndex][i][j].size();
+                                for (k = 0; k < n; k++) {
+                                    p = _volcoeffs[inputIndex][i][j][k];
+                                    //signal simulated from SH
+                                    sim_signal = 0;
+                                    for(unsigned int l = 0; l < basis.Cols(); l++ )
+                                        sim_signal += _SH_coeffs(p.x, p.y, p.z,l)*basis(0,l);
+                                    //update slice
+                                    sim(i, j, 0) += p.value *sim_signal;
+                                    weight += p.value;
+                                }
+                                simulatedweights(i,j,0)=weight;
+                                if(weight>0.98)
+                                    sim(i,j,0)/=weight;
                                 else
                                     sim(i,j,0)=0;
+                                simulatedslice(i,j,0)=sim(i,j,0);
+                                //intensity parameters
+                                if(_intensity_matching_GD)
+                                {
+                                    double a=b(i, j, 0) * scale;
+                                    if(a>0)
+                                        sim(i,j,0)/=a;
+                                    else
+                                        sim(i,j,0)=0;
+                                }
+                                else
+                                    sim(i,j,0)/=(exp(-b(i, j, 0)) * scale);
+                                simulatedsliceint(i,j,0)=sim(i,j,0);
                             }
-                            else
-                                sim(i,j,0)/=(exp(-b(i, j, 0)) * scale);
-                            simulatedsliceint(i,j,0)=sim(i,j,0);
-                        }
-            }
+                }
 
-            if (_stack_index[inputIndex]==current_stack)
-                z++;
-            else {
-                current_stack=_stack_index[inputIndex];
-                z=0;
-            }
+                if (_stack_index[inputIndex]==current_stack)
+                    z++;
+                else {
+                    current_stack=_stack_index[inputIndex];
+                    z=0;
+                }
 
-            for(i=0;i<sim.GetX();i++)
-                for(j=0;j<sim.GetY();j++) {
-                    stacks[_stack_index[inputIndex]](i,j,z)=sim(i,j,0);
+                for(i=0;i<sim.GetX();i++)
+                    for(j=0;j<sim.GetY();j++) {
+                        stacks[_stack_index[inputIndex]](i,j,z)=sim(i,j,0);
+                    }
+                if(inputIndex == 528)
+                {
+                    //          cout<<"InputIndex = "<<inputIndex<<endl;
+                    //          cout<<"stack="<<_stack_index[inputIndex]<<endl;
+                    sim.Write("sim.nii.gz");
                 }
-            if(inputIndex == 528)
-            {
-                //          cout<<"InputIndex = "<<inputIndex<<endl;
-                //          cout<<"stack="<<_stack_index[inputIndex]<<endl;
-                sim.Write("sim.nii.gz");
-            }
 
-            //end of loop for a slice inputIndex
+                //end of loop for a slice inputIndex
 
-            if (_debug)
-            {
-                char buffer[256];
-                sprintf(buffer,"simulatedslice%i.nii.gz",inputIndex);
-                simulatedslice.Write(buffer);
-                sprintf(buffer,"simulatedsliceint%i.nii.gz",inputIndex);
-                simulatedsliceint.Write(buffer);
-                sprintf(buffer,"simulatedbias%i.nii.gz",inputIndex);
-                b.Write(buffer);
-                sprintf(buffer,"simulatedweights%i.nii.gz",inputIndex);
-                simulatedweights.Write(buffer);
+                if (_debug)
+                {
+                    char buffer[256];
+                    sprintf(buffer,"simulatedslice%i.nii.gz",inputIndex);
+                    simulatedslice.Write(buffer);
+                    sprintf(buffer,"simulatedsliceint%i.nii.gz",inputIndex);
+                    simulatedsliceint.Write(buffer);
+                    sprintf(buffer,"simulatedbias%i.nii.gz",inputIndex);
+                    b.Write(buffer);
+                    sprintf(buffer,"simulatedweights%i.nii.gz",inputIndex);
+                    simulatedweights.Write(buffer);
+                }
             }
-        }
+        });
     }
 
 
@@ -5222,22 +4820,26 @@ namespace svrtk {
 
     class ParallelSimulateSlicesDTI {
         ReconstructionDWI *reconstructor;
+        size_t begin;
+        size_t end;
+
+        // clear in place, so images paged to the slice store stay bound to it
+        void Reset(RealImage& image, const RealImage& slice) const {
+            if (image.NumberOfVoxels() != slice.NumberOfVoxels())
+                image.Initialize( slice.Attributes() );
+            memset(image.Data(), 0, sizeof(RealPixel) * image.NumberOfVoxels());
+        }
 
     public:
-        ParallelSimulateSlicesDTI( ReconstructionDWI *_reconstructor ) :
-        reconstructor(_reconstructor) { }
+        ParallelSimulateSlicesDTI( ReconstructionDWI *_reconstructor, size_t begin, size_t end ) :
+        reconstructor(_reconstructor), begin(begin), end(end) { }
 
         void operator() (const blocked_range<size_t> &r) const {
             for ( size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex ) {
                 //Calculate simulated slice
-                reconstructor->_simulated_slices[inputIndex].Initialize( reconstructor->_slices[inputIndex].Attributes() );
-                reconstructor->_simulated_slices[inputIndex] = 0;
-
-                reconstructor->_simulated_weights[inputIndex].Initialize( reconstructor->_slices[inputIndex].Attributes() );
-                reconstructor->_simulated_weights[inputIndex] = 0;
-
-                reconstructor->_simulated_inside[inputIndex].Initialize( reconstructor->_slices[inputIndex].Attributes() );
-                reconstructor->_simulated_inside[inputIndex] = 0;
+                Reset( reconstructor->_simulated_slices[inputIndex], reconstructor->_slices[inputIndex] );
+                Reset( reconstructor->_simulated_weights[inputIndex], reconstructor->_slices[inputIndex] );
+                Reset( reconstructor->_simulated_inside[inputIndex], reconstructor->_slices[inputIndex] );
 
                 reconstructor->_slice_inside[inputIndex] = false;
 
@@ -5292,7 +4894,7 @@ namespace svrtk {
         // execute
         void operator() () const {
 
-            parallel_for( blocked_range<size_t>(0, reconstructor->_slices.size() ),
+            parallel_for( blocked_range<size_t>(begin, end),
                          *this );
 
         }
@@ -5304,8 +4906,10 @@ namespace svrtk {
         if (_debug)
             cout<<"Simulating slices DTI."<<endl;
 
-        ParallelSimulateSlicesDTI parallelSimulateSlicesDTI( this );
-        parallelSimulateSlicesDTI();
+        ForEachCoeffBatch([&](size_t begin, size_t end) {
+            ParallelSimulateSlicesDTI parallelSimulateSlicesDTI( this, begin, end );
+            parallelSimulateSlicesDTI();
+        });
 
         if (_debug)
             cout<<"done."<<endl;
@@ -5333,6 +4937,28 @@ namespace svrtk {
 
     class ParallelSuperresolutionDTI {
         ReconstructionDWI* reconstructor;
+        size_t begin;
+        size_t end;
+        //block of SH coefficients [l0, l1) updated by this pass
+        int l0;
+        int l1;
+        bool confidence;
+
+        void Initialize() {
+            //Clear addon of the block
+            ImageAttributes attr = reconstructor->_SH_coeffs.Attributes();
+            attr._t = l1 - l0;
+            addon.Initialize( attr );
+            addon = 0;
+
+            //Clear confidence map (the same for all SH coefficients)
+            if (confidence) {
+                attr._t = 1;
+                confidence_map.Initialize( attr );
+                confidence_map = 0;
+            }
+        }
+
     public:
         RealImage confidence_map;
         RealImage addon;
@@ -5367,6 +4993,8 @@ namespace svrtk {
                 if (basis.Cols() != reconstructor->_SH_coeffs.GetT())
                     throw runtime_error("ParallelSimulateSlicesDTI:basis numbers does not match SH coefficients number.");
 
+                const double slice_weight = reconstructor->_slice_weight[inputIndex];
+
                 //Update reconstructed volume using current slice
 
                 //Distribute error to the volume
@@ -5390,21 +5018,17 @@ namespace svrtk {
                                 p = reconstructor->_volcoeffs[inputIndex][i][j][k];
                                 if(reconstructor->_robust_slices_only)
                                 {
-                                    for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    {
-                                        addon(p.x, p.y, p.z,l) += p.value * basis(0,l) * slice(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                        confidence_map(p.x, p.y, p.z,l) += p.value *reconstructor->_slice_weight[inputIndex];
-                                    }
-
+                                    for(int l = l0; l < l1; l++ )
+                                        addon(p.x, p.y, p.z, l - l0) += p.value * basis(0,l) * slice(i, j, 0) * slice_weight;
+                                    if (confidence)
+                                        confidence_map(p.x, p.y, p.z) += p.value * slice_weight;
                                 }
                                 else
                                 {
-                                    for(unsigned int l = 0; l < basis.Cols(); l++ )
-                                    {
-                                        addon(p.x, p.y, p.z, l) += p.value * basis(0,l) * slice(i, j, 0) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                        confidence_map(p.x, p.y, p.z, l) += p.value * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                        //p.value * basis(0,l) * w(i, j, 0) * reconstructor->_slice_weight[inputIndex];
-                                    }
+                                    for(int l = l0; l < l1; l++ )
+                                        addon(p.x, p.y, p.z, l - l0) += p.value * basis(0,l) * slice(i, j, 0) * w(i, j, 0) * slice_weight;
+                                    if (confidence)
+                                        confidence_map(p.x, p.y, p.z) += p.value * w(i, j, 0) * slice_weight;
                                 }
                             }
                         }
@@ -5412,37 +5036,26 @@ namespace svrtk {
         }
 
         ParallelSuperresolutionDTI( ParallelSuperresolutionDTI& x, split ) :
-        reconstructor(x.reconstructor)
+        reconstructor(x.reconstructor), begin(x.begin), end(x.end), l0(x.l0), l1(x.l1), confidence(x.confidence)
         {
-            //Clear addon
-            addon.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            addon = 0;
-
-            //Clear confidence map
-            confidence_map.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            confidence_map = 0;
+            Initialize();
         }
 
         void join( const ParallelSuperresolutionDTI& y ) {
             addon += y.addon;
-            confidence_map += y.confidence_map;
+            if (confidence)
+                confidence_map += y.confidence_map;
         }
 
-        ParallelSuperresolutionDTI( ReconstructionDWI *reconstructor ) :
-        reconstructor(reconstructor)
+        ParallelSuperresolutionDTI( ReconstructionDWI *reconstructor, size_t begin, size_t end, int l0, int l1, bool confidence ) :
+        reconstructor(reconstructor), begin(begin), end(end), l0(l0), l1(l1), confidence(confidence)
         {
-            //Clear addon
-            addon.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            addon = 0;
-
-            //Clear confidence map
-            confidence_map.Initialize( reconstructor->_SH_coeffs.Attributes() );
-            confidence_map = 0;
+            Initialize();
         }
 
         // execute
         void operator() () {
-            parallel_reduce( blocked_range<size_t>(0,reconstructor->_slices.size()),
+            parallel_reduce( blocked_range<size_t>(begin,end),
                             *this );
         }
     };
@@ -5452,17 +5065,56 @@ namespace svrtk {
         if (_debug)
             cout << "SuperresolutionDTI " << iter << endl;
 
-        int i, j, k, l,t;
         RealImage addon, original;
 
-
         //Remember current reconstruction for edge-preserving smoothing
-        original = _SH_coeffs;
+        const bool keep_original = tv && _regul_steps > 0;
+        if (keep_original)
+            original = _SH_coeffs;
+
+        //the whole addon is only collected for the debug output of the in-core mode
+        const bool keep_addon = _debug && _memory_cap <= 0;
+        if (keep_addon) {
+            addon.Initialize( _SH_coeffs.Attributes() );
+            addon = 0;
+        }
+
+        //confidence map is the same for all SH coefficients
+        ImageAttributes attr = _SH_coeffs.Attributes();
+        attr._t = 1;
+        _confidence_map.Initialize( attr );
+        _confidence_map = 0;
+
+        double alpha;
+        alpha=sh_alpha/_average_volume_weight;
 
-        ParallelSuperresolutionDTI parallelSuperresolutionDTI(this);
-        parallelSuperresolutionDTI();
-        addon = parallelSuperresolutionDTI.addon;
-        _confidence_map = parallelSuperresolutionDTI.confidence_map;
+        //per-thread updates are split into blocks of SH coefficients (all of them unless out-of-core)
+        //and applied to the coefficients straight away
+        const int coeffs = _SH_coeffs.GetT();
+        const int block = SHBlockSize(keep_original);
+        const size_t voxels = _SH_coeffs.NumberOfSpatialVoxels();
+
+        ForEachCoeffBatch([&](size_t begin, size_t end) {
+            for (int l0 = 0; l0 < coeffs; l0 += block) {
+                const int l1 = min(coeffs, l0 + block);
+                ParallelSuperresolutionDTI parallelSuperresolutionDTI(this, begin, end, l0, l1, l0 == 0);
+                parallelSuperresolutionDTI();
+
+                RealPixel *ps = _SH_coeffs.Data() + l0 * voxels;
+                const RealPixel *pb = parallelSuperresolutionDTI.addon.Data();
+                for (size_t v = 0; v < (l1 - l0) * voxels; v++)
+                    ps[v] += pb[v] * alpha;
+
+                if (keep_addon) {
+                    RealPixel *pa = addon.Data() + l0 * voxels;
+                    for (size_t v = 0; v < (l1 - l0) * voxels; v++)
+                        pa[v] += pb[v];
+                }
+
+                if (l0 == 0)
+                    _confidence_map += parallelSuperresolutionDTI.confidence_map;
+            }
+        });
         //_confidence4mask = _confidence_map;
 
         if(_debug) {
@@ -5470,15 +5122,12 @@ namespace svrtk {
             //sprintf(buffer,"confidence-map%i.nii.gz",iter);
             //_confidence_map.Write(buffer);
             _confidence_map.Write("confidence-map-superDTI.nii.gz");
-            sprintf(buffer,"addon%i.nii.gz",iter);
-            addon.Write(buffer);
+            if (keep_addon) {
+                sprintf(buffer,"addon%i.nii.gz",iter);
+                addon.Write(buffer);
+            }
         }
 
-        double alpha;
-        alpha=sh_alpha/_average_volume_weight;
-
-
-        _SH_coeffs += addon * alpha;
         cout<<"alpha = "<<alpha<<endl;
 
         ////regularisation
@@ -5486,60 +5135,71 @@ namespace svrtk {
         if (_lambdaLB > 0)
         {
             cout<<"_lambdaLB = "<<_lambdaLB<<endl;
-            RealImage regul(addon);
-            regul=0;
-            double lb=0;
-            double factor;
-            for (t = 0; t < regul.GetT(); t++)
-                for (i = 0; i < regul.GetX(); i++)
-                    for (j = 0; j < regul.GetY(); j++)
-                        for (k = 0; k < regul.GetZ(); k++)
-                        {
-                            if(t==0) lb=0;
-                            if((t>=1)&&(t<=5)) lb=36.0/400.0;
-                            if((t>=6)&&(t<=15)) lb=400.0/400.0;
-                            factor = _lambdaLB * lb;
-                            if(factor>1) factor=1;//this is to ensure that there cannot be negative effect
-                            regul(i,j,k,t)=factor * _SH_coeffs(i,j,k,t);//alpha *
-                        }
-            regul.Write("regul.nii.gz");
-            _SH_coeffs -= regul;
-
+            if (_memory_cap > 0) {
+                //out-of-core: the damping is applied in place instead of through a 4D image
+                LaplaceBeltramiDamping(_SH_coeffs, _lambdaLB);
+            } else {
+                RealImage regul;
+                LaplaceBeltramiDamping(_SH_coeffs, _lambdaLB, &regul);
+                regul.Write("regul.nii.gz");
+            }
         }
 
         //TV on SH basis
         if(tv)
         {
-            RealImage o,r;
-
-
+            // all SH coefficients are regularised together (partitioned over coefficients and spatial blocks)
             for (int steps = 0; steps < _regul_steps; steps ++)
             {
-                r=_reconstructed;
-                for(t=0;t<_SH_coeffs.GetT();t++)
-                {
-                    o=original.GetRegion(0,0,0,t,original.GetX(),original.GetY(),original.GetZ(),t+1);
+                //L22Regularization(iter, o);
+                AdaptiveRegularization(_SH_coeffs, original);
+                //LaplacianRegularization(iter,t,o);
+            }
 
-                    _reconstructed=_SH_coeffs.GetRegion(0,0,0,t,original.GetX(),original.GetY(),original.GetZ(),t+1);
+            if (_alpha * _lambda / (_delta * _delta) > 0.068) {
+                cerr
+                << "Warning: regularization might not have smoothing effect! Ensure that alpha*lambda/delta^2 is below 0.068."
+                << endl;
+            }
+        }
 
-                    //L22Regularization(iter, o);
-                    AdaptiveRegularization(iter, o);
-                    //LaplacianRegularization(iter,t,o);
 
+    }
 
-                    //put it back to _SH_coeffs
-                    for (i = 0; i < _SH_coeffs.GetX(); i++)
-                        for (j = 0; j < _SH_coeffs.GetY(); j++)
-                            for (k = 0; k < _SH_coeffs.GetZ(); k++)
-                            {
-                                _SH_coeffs(i,j,k,t)=_reconstructed(i,j,k);
-                            }
-                }
-                _reconstructed=r;
+    void ReconstructionDWI::LaplaceBeltramiDamping(RealImage& sh_coeffs, double lambdaLB, RealImage *regul)
+    {
+        //weight of the coefficients of each SH order (orders above 4 keep the weight of order 4)
+        auto weight = [](int t) {
+            double lb = 0;
+            if(t>=1) lb=36.0/400.0;
+            if(t>=6) lb=400.0/400.0;
+            return lb;
+        };
+
+        if (regul == nullptr) {
+            const size_t voxels = sh_coeffs.NumberOfSpatialVoxels();
+            for (int t = 0; t < sh_coeffs.GetT(); t++) {
+                //this is to ensure that there cannot be negative effect
+                const double factor = min(1.0, lambdaLB * weight(t));
+                RealPixel *ps = sh_coeffs.Data() + t * voxels;
+                for (size_t v = 0; v < voxels; v++)
+                    ps[v] -= RealPixel(factor * ps[v]);
             }
+            return;
         }
 
-
+        regul->Initialize(sh_coeffs.Attributes());
+        double factor;
+        for (int t = 0; t < regul->GetT(); t++)
+            for (int i = 0; i < regul->GetX(); i++)
+                for (int j = 0; j < regul->GetY(); j++)
+                    for (int k = 0; k < regul->GetZ(); k++)
+                    {
+                        factor = lambdaLB * weight(t);
+                        if(factor>1) factor=1;//this is to ensure that there cannot be negative effect
+                        (*regul)(i,j,k,t)=factor * sh_coeffs(i,j,k,t);//alpha *
+                    }
+        sh_coeffs -= *regul;
     }
 
     void ReconstructionDWI::NormaliseBiasSH(int iter)
@@ -5753,12 +5413,6 @@ namespace svrtk {
         //standard deviation for gaussian kernel in number of slices
         double sigma = _motion_sigma;
         int j,iter,par;
-        Array<double> kernel;
-        for(i=-3*sigma; i<=3*sigma; i++)
-        {
-            kernel.push_back(exp(-(i/sigma)*(i/sigma)));
-            //cout<<kernel[kernel.size()-1]<<" ";
-        }
 
         Matrix parameters(6,_transformations.size());
         Matrix weights(6,_transformations.size());
@@ -5812,44 +5466,23 @@ namespace svrtk {
         }
 
 
-        Matrix den(6,_transformations.size());
-        Matrix num(6,_transformations.size());
         Matrix kr(6,_transformations.size());
 
         Array<double> error,tmp;
         double median;
         int packages = 2;
         int dim = _transformations.size()/packages;
-        int pack;
+        //gaussian kernel regression within each package
+        MotionSmoothing smoothing(_transformations.size());
+        for(int pack=0;pack<packages;pack++)
+            smoothing.AddSegment(pack*dim,(pack+1)*dim,sigma);
 
         cerr<<endl<<endl<<endl<<endl;
 
         for(iter = 0; iter<50;iter++)
         {
             //kernel regression
-            for(pack=0;pack<packages;pack++)
-            {
-
-                for(par=0;par<6;par++)
-                {
-
-                    for(i=pack*dim;i<(pack+1)*dim;i++)
-                    {
-
-                        for(j=-3*sigma;j<=3*sigma;j++)
-                            if(((i+j)>=pack*dim) && ((i+j)<(pack+1)*dim))
-                            {
-
-                                num(par,i)+=parameters(par,i+j)*kernel[j+3*sigma]*weights(par,i+j);
-                                den(par,i)+=kernel[j+3*sigma]*weights(par,i+j);
-                            }
-                    }
-                }
-            }
-
-            for(par=0;par<6;par++)
-                for(i=0;i<_transformations.size();i++)
-                    kr(par,i)=num(par,i)/den(par,i);
+            smoothing.Regress(parameters,weights,kr);
 
             //recalculate weights
             for(par=0;par<6;par++)
@@ -5940,12 +5573,6 @@ namespace svrtk {
         //standard deviation for gaussian kernel in number of slices
         double sigma = _motion_sigma;
         int j,iter,par;
-        Array<double> kernel;
-        for(i=-3*sigma; i<=3*sigma; i++)
-        {
-            kernel.push_back(exp(-(i/sigma)*(i/sigma)));
-            //cout<<kernel[kernel.size()-1]<<" ";
-        }
 
         Matrix parameters(6,_transformations.size());
         Matrix weights(6,_transformations.size());
@@ -6001,15 +5628,25 @@ namespace svrtk {
         //parameters.Print();
         //weights.Print();
 
-        Matrix den(6,_transformations.size());
-        Matrix num(6,_transformations.size());
         Matrix kr(6,_transformations.size());
         //Matrix error(6,_transformations.size());
         Array<double> error,tmp;
         double median;
         int packages = 2;
         int dim = _transformations.size()/packages;
-        int pack;
+        //gaussian kernel regression within each package
+        MotionSmoothing smoothing(_transformations.size());
+        for(int pack=0;pack<packages;pack++)
+            smoothing.AddSegment(pack*dim,(pack+1)*dim,sigma);
+
+        //slice points and original transformations in the original coordinate system
+        Array<MotionSmoothing::PointMoments> moments(_transformations.size());
+        Array<Matrix> orig(_transformations.size());
+        for(i=0;i<_transformations.size();i++)
+        {
+            moments[i] = MotionSmoothing::Moments(_slices[_slice_order[i]]);
+            orig[i] = mo*_transformations[_slice_order[i]].GetMatrix()*imo;
+        }
 
         cerr<<endl<<endl<<endl<<endl;
 
@@ -6017,30 +5654,7 @@ namespace svrtk {
         {
             //cerr<<"iter="<<iter<<endl;
             //kernel regression
-            for(pack=0;pack<packages;pack++)
-            {
-                //cerr<<"pack="<<pack<<endl;
-
-                for(par=0;par<6;par++)
-                {
-                    //cerr<<"par="<<par<<endl;
-                    for(i=pack*dim;i<(pack+1)*dim;i++)
-                    {
-                        //cerr<<"i="<<i<<" pack*dim = "<<pack*dim<<" dim = "<<dim<<endl;
-                        for(j=-3*sigma;j<=3*sigma;j++)
-                            if(((i+j)>=pack*dim) && ((i+j)<(pack+1)*dim))
-                            {
-                                //cerr<<"j="<<j<<" i+j="<<i+j<<" par="<<par<<" j+3*sigma="<<j+3*sigma<<endl;
-                                num(par,i)+=parameters(par,i+j)*kernel[j+3*sigma]*weights(par,i+j);
-                                den(par,i)+=kernel[j+3*sigma]*weights(par,i+j);
-                            }
-                    }
-                }
-            }
-
-            for(par=0;par<6;par++)
-                for(i=0;i<_transformations.size();i++)
-                    kr(par,i)=num(par,i)/den(par,i);
+            smoothing.Regress(parameters,weights,kr);
 
             cout<<"Iter "<<iter<<": median = ";
 
@@ -6062,45 +5676,11 @@ namespace svrtk {
                 processed.PutRotationY(kr(4,i));
                 processed.PutRotationZ(kr(5,i));
 
-                RigidTransformation orig = _transformations[_slice_order[i]];
-
                 //need to convert the transformations back to the original coordinate system
-                m = orig.GetMatrix();
-                m=mo*m*imo;
-                orig.PutMatrix(m);
-
-                m = processed.GetMatrix();
-                m=mo*m*imo;
-                processed.PutMatrix(m);
-
-                RealImage slice = _slices[_slice_order[i]];
-
-                double tre=0;
-                int n=0;
-                double x, y, z, xx, yy, zz, e = 0;
-                for(int ii=0;ii<slice.GetX();ii++)
-                    for(int jj=0;jj<slice.GetY();jj++)
-                        if(slice(ii,jj,0)>-1)
-                        {
-                            x=ii; y=jj; z=0;
-                            slice.ImageToWorld(x,y,z);
-                            xx=x;yy=y;zz=z;
-                            orig.Transform(x,y,z);
-                            processed.Transform(xx,yy,zz);
-                            x-=xx;
-                            y-=yy;
-                            z-=zz;
-                            e += sqrt(x*x+y*y+z*z);
-                            n++;
-                        }
-                if(n>0)
-                {
-                    e/=n;
-                    error.push_back(e);
+                double e = MotionSmoothing::TRE(orig[i],mo*processed.GetMatrix()*imo,moments[i]);
+                error.push_back(e);
+                if(e>=0)
                     tmp.push_back(e);
-                }
-                else
-                    error.push_back(-1);
 
                 ///original
                 //error.push_back(fabs(parameters(par,i)-kr(par,i)));
@@ -6230,12 +5810,6 @@ namespace svrtk {
         //standard deviation for gaussian kernel in number of slices
         double sigma = _motion_sigma;
         int j,iter,par;
-        Array<double> kernel;
-        for(i=-3*sigma; i<=3*sigma; i++)
-        {
-            kernel.push_back(exp(-(i/sigma)*(i/sigma)));
-            //cout<<kernel[kernel.size()-1]<<" ";
-        }
 
         Matrix parameters(6,_transformations.size());
         Matrix weights(6,_transformations.size());
@@ -6300,51 +5874,48 @@ namespace svrtk {
         offsetrot[5] = parameters(5,0);
 
 
-        Matrix den(6,_transformations.size());
-        Matrix num(6,_transformations.size());
         Matrix kr(6,_transformations.size());
         //Matrix error(6,_transformations.size());
         Array<double> error,tmp;
         double median;
         int packages = 2;
         int dim = _transformations.size()/packages;
-        int pack;
+        //gaussian kernel regression within each package
+        MotionSmoothing smoothing(_transformations.size());
+        for(int pack=0;pack<packages;pack++)
+            smoothing.AddSegment(pack*dim,(pack+1)*dim,sigma);
+
+        //parameters relative to the first rotation, wrapped to [-180,180]
+        Matrix centred(6,_transformations.size());
+        for(par=0;par<6;par++)
+            for(i=0;i<_transformations.size();i++)
+            {
+                double value = parameters(par,i)-offsetrot[par];
+                if(value>180)
+                    value-=360;
+                if(value<-180)
+                    value+=360;
+                centred(par,i)=value;
+            }
+
+        //sampled volume points and original transformations in the original coordinate system
+        const MotionSmoothing::PointMoments moments = MotionSmoothing::Moments(_reconstructed,3);
+        Array<Matrix> orig(_transformations.size());
+        for(i=0;i<_transformations.size();i++)
+            orig[i] = mo*_transformations[_slice_order[i]].GetMatrix()*imo;
 
         cerr<<endl<<endl<<endl<<endl;
 
         for(iter = 0; iter<50;iter++)
         {
 
-            //kernel regression
-            for(pack=0;pack<packages;pack++)
-            {
-
-                for(par=0;par<6;par++)
-                {
-
-                    for(i=pack*dim;i<(pack+1)*dim;i++)
-                    {
-
-                        for(j=-3*sigma;j<=3*sigma;j++)
-                            if(((i+j)>=pack*dim) && ((i+j)<(pack+1)*dim))
-                            {
-
-                                double value = parameters(par,i+j)-offsetrot[par];
-                                if(value>180)
-                                    value-=360;
-                                if(value<-180)
-                                    value+=360;
-                                num(par,i)+=(value)*kernel[j+3*sigma]*weights(par,i+j);
-                                den(par,i)+=kernel[j+3*sigma]*weights(par,i+j);
-                            }
-                    }
-                }
-            }
+            //kernel regression of the parameters relative to the first rotation
+            smoothing.Regress(centred,weights,kr);
 
             for(par=0;par<6;par++)
                 for(i=0;i<_transformations.size();i++)
                 {
-                    double value=num(par,i)/den(par,i)+offsetrot[par];
+                    double value=kr(par,i)+offsetrot[par];
                     if(value<-180)
                         value+=360;
                     if(value>180)
@@ -6371,47 +5942,11 @@ namespace svrtk {
                 processed.PutRotationY(kr(4,i));
                 processed.PutRotationZ(kr(5,i));
 
-                RigidTransformation orig = _transformations[_slice_order[i]];
-
                 //need to convert the transformations back to the original coordinate system
-                m = orig.GetMatrix();
-                m=mo*m*imo;
-                orig.PutMatrix(m);
-
-                m = processed.GetMatrix();
-                m=mo*m*imo;
-                processed.PutMatrix(m);
-
-                RealImage slice = _slices[_slice_order[i]];
-
-                double tre=0;
-                int n=0;
-                double x, y, z, xx, yy, zz, e = 0;
-                for(int ii=0;ii<_reconstructed.GetX();ii=ii+3)
-                    for(int jj=0;jj<_reconstructed.GetY();jj=jj+3)
-                        for(int kk=0;kk<_reconstructed.GetZ();kk=kk+3)
-                            if(_reconstructed(ii,jj,kk)>-1)
-                            {
-
-                                x=ii; y=jj; z=kk;
-                                _reconstructed.ImageToWorld(x,y,z);
-                                xx=x;yy=y;zz=z;
-                                orig.Transform(x,y,z);
-                                processed.Transform(xx,yy,zz);
-                                x-=xx;
-                                y-=yy;
-                                z-=zz;
-                                e += sqrt(x*x+y*y+z*z);
-                                n++;
-                            }
-                if(n>0)
-                {
-                    e/=n;
-                    error.push_back(e);
+                double e = MotionSmoothing::TRE(orig[i],mo*processed.GetMatrix()*imo,moments);
+                error.push_back(e);
+                if(e>=0)
                     tmp.push_back(e);
-                }
-                else
-                    error.push_back(-1);
 
             }
 
@@ -6536,12 +6071,6 @@ namespace svrtk {
         //standard deviation for gaussian kernel in number of slices
         double sigma = _motion_sigma;
         int j,iter,par;
-        Array<double> kernel;
-        for(i=-3*sigma; i<=3*sigma; i++)
-        {
-            kernel.push_back(exp(-(i/sigma)*(i/sigma)));
-            //cout<<kernel[kernel.size()-1]<<" ";
-        }
 
         Matrix parameters(6,_transformations.size());
         Matrix weights(6,_transformations.size());
@@ -6597,15 +6126,22 @@ namespace svrtk {
         //parameters.Print();
         //weights.Print();
 
-        Matrix den(6,_transformations.size());
-        Matrix num(6,_transformations.size());
         Matrix kr(6,_transformations.size());
         //Matrix error(6,_transformations.size());
         Array<double> error,tmp;
         double median;
         int packages = 2;
         int dim = _transformations.size()/packages;
-        int pack;
+        //gaussian kernel regression within each package
+        MotionSmoothing smoothing(_transformations.size());
+        for(int pack=0;pack<packages;pack++)
+            smoothing.AddSegment(pack*dim,(pack+1)*dim,sigma);
+
+        //sampled volume points and original transformations in the original coordinate system
+        const MotionSmoothing::PointMoments moments = MotionSmoothing::Moments(_reconstructed,3);
+        Array<Matrix> orig(_transformations.size());
+        for(i=0;i<_transformations.size();i++)
+            orig[i] = mo*_transformations[_slice_order[i]].GetMatrix()*imo;
 
         cerr<<endl<<endl<<endl<<endl;
 
@@ -6613,30 +6149,7 @@ namespace svrtk {
         {
             //cerr<<"iter="<<iter<<endl;
             //kernel regression
-            for(pack=0;pack<packages;pack++)
-            {
-                //cerr<<"pack="<<pack<<endl;
-
-                for(par=0;par<6;par++)
-                {
-                    //cerr<<"par="<<par<<endl;
-                    for(i=pack*dim;i<(pack+1)*dim;i++)
-                    {
-                        //cerr<<"i="<<i<<" pack*dim = "<<pack*dim<<" dim = "<<dim<<endl;
-                        for(j=-3*sigma;j<=3*sigma;j++)
-                            if(((i+j)>=pack*dim) && ((i+j)<(pack+1)*dim))
-                            {
-                                //cerr<<"j="<<j<<" i+j="<<i+j<<" par="<<par<<" j+3*sigma="<<j+3*sigma<<endl;
-                                num(par,i)+=parameters(par,i+j)*kernel[j+3*sigma]*weights(par,i+j);
-                                den(par,i)+=kernel[j+3*sigma]*weights(par,i+j);
-                            }
-                    }
-                }
-            }
-
-            for(par=0;par<6;par++)
-                for(i=0;i<_transformations.size();i++)
-                    kr(par,i)=num(par,i)/den(par,i);
+            smoothing.Regress(parameters,weights,kr);
 
             cout<<"Iter "<<iter<<": median = ";
             cout.flush();
@@ -6660,48 +6173,11 @@ namespace svrtk {
                 processed.PutRotationY(kr(4,i));
                 processed.PutRotationZ(kr(5,i));
 
-                RigidTransformation orig = _transformations[_slice_order[i]];
-
                 //need to convert the transformations back to the original coordinate system
-                m = orig.GetMatrix();
-                m=mo*m*imo;
-                orig.PutMatrix(m);
-
-                m = processed.GetMatrix();
-                m=mo*m*imo;
-                processed.PutMatrix(m);
-
-                RealImage slice = _slices[_slice_order[i]];
-
-                double tre=0;
-                int n=0;
-                double x, y, z, xx, yy, zz, e = 0;
-                for(int ii=0;ii<_reconstructed.GetX();ii=ii+3)
-                    for(int jj=0;jj<_reconstructed.GetY();jj=jj+3)
-                        for(int kk=0;kk<_reconstructed.GetZ();kk=kk+3)
-                            if(_reconstructed(ii,jj,kk)>-1)
-                            {
-                                //cout<<ii<<" "<<jj<<" "<<kk<<endl;
-                                //cout.flush();
-                                x=ii; y=jj; z=kk;
-                                _reconstructed.ImageToWorld(x,y,z);
-                                xx=x;yy=y;zz=z;
-                                orig.Transform(x,y,z);
-                                processed.Transform(xx,yy,zz);
-                                x-=xx;
-                                y-=yy;
-                                z-=zz;
-                                e += sqrt(x*x+y*y+z*z);
-                                n++;
-                            }
-                if(n>0)
-                {
-                    e/=n;
-                    error.push_back(e);
+                double e = MotionSmoothing::TRE(orig[i],mo*processed.GetMatrix()*imo,moments);
+                error.push_back(e);
+                if(e>=0)
                     tmp.push_back(e);
-                }
-                else
-                    error.push_back(-1);
 
             }
 
@@ -6876,6 +6352,7 @@ namespace svrtk {
 
         void ReconstructionDWI::SliceToVolumeRegistrationSH()
         {
+            RequireResidentCoeffs("SliceToVolumeRegistrationSH");
             if (_debug)
                 cout << "SliceToVolumeRegistration" << endl;
             ParallelSliceToVolumeRegistrationSH registration(this);
@@ -7030,6 +6507,7 @@ namespace svrtk {
 
         void ReconstructionDWI::NormaliseBiasDTI(int iter, Array<RigidTransformation> &stack_transformations, int order)
         {
+            RequireResidentCoeffs("NormaliseBiasDTI");
             if(_debug)
                 cout << "Normalise Bias ... ";
 
@@ -7096,6 +6574,7 @@ namespace svrtk {
 
         void ReconstructionDWI::NormaliseBiasSH2(int iter, Array<RigidTransformation> &stack_transformations, int order)
         {
+            RequireResidentCoeffs("NormaliseBiasSH2");
             if(_debug)
                 cout << "Normalise Bias ... ";
 
@@ -36,43 +36,11 @@ namespace svrtk {
         SVRTK_START_TIMING();
 
         GenericLinearInterpolateImageFunction<RealImage> interpolator;
-        
-        double res=1.8;
-        
-        Array<RealImage> resampled_stacks;
-        if (_ffd_global_only) {
-            // for (int i=0; i<stacks.size(); i++)
-            //     resampled_stacks.push_back(stacks[i]);
-
-            double res = 0.8;
-
-        } 
-        
-        // else {
-        //     double res = 1.8;
-        // } 
 
-            GaussianBlurring<RealPixel> gb(1.2);
-            ResamplingWithPadding<RealPixel> resampling(res, res, res, -1);
-            
-            resampling.Interpolator(&interpolator);
-            resampling.Input(&template_image);
-            resampling.Output(&template_image);
-            resampling.Run();
-            for (int i=0; i<stacks.size(); i++) {
-                RealImage resampled_stack = stacks[i];
-                gb.Input(&resampled_stack);
-                gb.Output(&resampled_stack);
-                gb.Run();
-                RealImage tmp = resampled_stack;
-                resampling.Input(&tmp);
-                resampling.Output(&resampled_stack);
-                resampling.Run();
-                resampled_stacks.push_back(resampled_stack);
-            }
+        // registration resolution (a 0.8 mm variant for _ffd_global_only was never enabled)
+        const double res = 1.8;
 
         ParameterList params;
-        Insert(params, "Transformation model", "FFD");
         Insert(params, "Control point spacing in X", _global_cp_spacing);
         Insert(params, "Control point spacing in Y", _global_cp_spacing);
         Insert(params, "Control point spacing in Z", _global_cp_spacing);
@@ -92,6 +60,11 @@ namespace svrtk {
             Insert(params, string("Local window size [") + type + string("]"), ToString(width) + units);
         }
 
+        // the template is resampled once and all stacks (blurred and resampled) are registered to it concurrently
+        StackRegistration registration(StackRegistration::FFD, params, res, -1, 1.2);
+        registration.Template(template_image);
+        Array<unique_ptr<MultiLevelFreeFormTransformation>> mffd_transformations;
+        registration.Run(stacks, mffd_transformations);
 
         InterpolationMode interpolation_nn = Interpolation_NN;
         UniquePtr<InterpolateImageFunction> interpolator_nn;
@@ -101,21 +74,8 @@ namespace svrtk {
         bool dofin_invert = false;
         bool twod = false;
         
-        for (int i=0; i<resampled_stacks.size(); i++) {
-            
-            GenericRegistrationFilter registration;
-            registration.Parameter(params);
-            registration.Input(&resampled_stacks[i], &template_image);
-            Transformation *dofout = nullptr;
-            registration.Output(&dofout);
-    //            registration.InitialGuess(RigidTransformation());
-            registration.GuessParameter();
-            registration.Run();
-            MultiLevelFreeFormTransformation* mffd_dofout;
-            
-            mffd_dofout = dynamic_cast<MultiLevelFreeFormTransformation*>(dofout);
-            mffd_dofout->Write((boost::format("ms-%1%.dof") % i).str().c_str());
-    //            _global_mffd_transformations.push_back(mffd_dofout);
+        for (int i=0; i<stacks.size(); i++) {
+            MultiLevelFreeFormTransformation *mffd_dofout = mffd_transformations[i].get();
 
             RealImage transformed_main_mask = stacks[i];
             ImageTransformation *imagetransformation = new ImageTransformation;
@@ -147,8 +107,12 @@ namespace svrtk {
                 }
             }
             
-            
+            // the slice registration picks the stack transformation up from memory
+            _mffd_transformations.SetStack(i, move(mffd_transformations[i]));
         }
+
+        if (_debug)
+            _mffd_transformations.WriteStacks("ms-");
         
         SVRTK_END_TIMING("FFDStackRegistrations");
         
@@ -0,0 +1,181 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/SVRScheduler.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    void SVRScheduler::Plan(const Array<double>& tre, const Array<double>& slice_weight, const Array<double>& residual, const Array<int>& zero_slices) {
+        const size_t slices = zero_slices.size();
+        if (_stable.size() != slices) {
+            _stable.assign(slices, 0);
+            _since.assign(slices, 0);
+            _modes.assign(slices, Full);
+        }
+
+        // Median residual of the slices with foreground
+        double median_residual = -1;
+        if (residual.size() == slices) {
+            Array<double> values;
+            for (size_t i = 0; i < slices; i++)
+                if (zero_slices[i] > 0)
+                    values.push_back(residual[i]);
+            if (!values.empty()) {
+                nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+                median_residual = values[values.size() / 2];
+            }
+        }
+
+        _skipped = _reduced = 0;
+        for (size_t i = 0; i < slices; i++) {
+            if (_modes[i] != Skip) {
+                // Update the history with the outcome of the last registration
+                const bool stable = _tre_tolerance > 0 && i < tre.size() && tre[i] >= 0 && tre[i] <= _tre_tolerance
+                    && i < slice_weight.size() && slice_weight[i] >= _weight_threshold
+                    && (median_residual < 0 || residual[i] <= median_residual);
+                _stable[i] = stable ? _stable[i] + 1 : 0;
+            }
+
+            if (_stable[i] == 0)
+                _modes[i] = Full;
+            else if (_stable[i] == 1 || _since[i] + 1 >= _revisit)
+                _modes[i] = Reduced;
+            else
+                _modes[i] = Skip;
+
+            if (_modes[i] == Skip) {
+                _since[i]++;
+                _skipped++;
+            } else {
+                _since[i] = 0;
+                if (_modes[i] == Reduced)
+                    _reduced++;
+            }
+        }
+
+        // Unstable slices first, then by descending cost, ascending slice weight and descending TRE, empty slices last
+        _order.clear();
+        for (size_t i = 0; i < slices; i++)
+            if (_modes[i] != Skip)
+                _order.push_back(i);
+        auto cost = [&](size_t i) { return i < _cost.size() ? _cost[i] : 0.0; };
+        auto weight = [&](size_t i) { return i < slice_weight.size() ? slice_weight[i] : 1.0; };
+        auto change = [&](size_t i) { return i < tre.size() ? tre[i] : -1.0; };
+        stable_sort(_order.begin(), _order.end(), [&](size_t a, size_t b) {
+            if ((zero_slices[a] > 0) != (zero_slices[b] > 0))
+                return zero_slices[a] > 0;
+            if (_modes[a] != _modes[b])
+                return _modes[a] > _modes[b];
+            if (cost(a) != cost(b))
+                return cost(a) > cost(b);
+            if (weight(a) != weight(b))
+                return weight(a) < weight(b);
+            return change(a) > change(b);
+        });
+
+        _total_registrations += slices;
+        _total_skipped += _skipped;
+        _total_reduced += _reduced;
+    }
+
+    //-------------------------------------------------------------------
+
+    void SVRScheduler::PlanAll(size_t slices) {
+        _modes.assign(slices, Full);
+        _order.resize(slices);
+        iota(_order.begin(), _order.end(), 0);
+        if (_cost.size() == slices)
+            stable_sort(_order.begin(), _order.end(), [this](size_t a, size_t b) {
+                return _cost[a] > _cost[b];
+            });
+        _skipped = _reduced = 0;
+        _total_registrations += slices;
+    }
+
+    //-------------------------------------------------------------------
+
+    void SVRScheduler::EstimateCosts(const Array<double>& foreground) {
+        const size_t slices = foreground.size();
+        if (_time.size() != slices) {
+            _time.assign(slices, -1);
+            _thread.assign(slices, thread::id());
+        }
+
+        // Mean registration time per foreground pixel
+        double time = 0, pixels = 0;
+        for (size_t i = 0; i < slices; i++)
+            if (_time[i] >= 0 && foreground[i] > 0) {
+                time += _time[i];
+                pixels += foreground[i];
+            }
+        const double rate = time > 0 ? time / pixels : 1;
+
+        _cost.resize(slices);
+        for (size_t i = 0; i < slices; i++) {
+            if (foreground[i] <= 0)
+                _cost[i] = 0;
+            else if (_time[i] >= 0 && time > 0)
+                _cost[i] = _time[i];
+            else
+                _cost[i] = foreground[i] * rate;
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void SVRScheduler::ReportLoadBalance(ostream& out) const {
+        // Busy time of each thread
+        map<thread::id, double> busy;
+        double longest = 0;
+        for (const size_t slice : _order) {
+            if (slice >= _time.size() || _time[slice] < 0)
+                continue;
+            busy[_thread[slice]] += _time[slice];
+            longest = max(longest, _time[slice]);
+        }
+        if (busy.empty())
+            return;
+
+        double total = 0, busiest = 0;
+        for (const auto& thread_busy : busy) {
+            total += thread_busy.second;
+            busiest = max(busiest, thread_busy.second);
+        }
+        const double mean = total / busy.size();
+
+        out << "SVR load balance: " << (busiest > 0 ? 100 * mean / busiest : 100) << "% over " << busy.size() << " threads, busiest thread "
+            << busiest << " s, mean " << mean << " s, longest slice " << longest << " s, wall time " << _wall_time << " s" << endl;
+    }
+
+    //-------------------------------------------------------------------
+
+    void SVRScheduler::Reset() {
+        Array<int>().swap(_stable);
+        Array<int>().swap(_since);
+        Array<Mode>().swap(_modes);
+        Array<size_t>().swap(_order);
+        Array<double>().swap(_cost);
+        Array<double>().swap(_time);
+        Array<thread::id>().swap(_thread);
+        _skipped = _reduced = 0;
+    }
+
+} // namespace svrtk
@@ -0,0 +1,83 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/SliceDisplacementField.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    void SliceDisplacementField::Exact(const RealImage& slice, const MultiLevelFreeFormTransformation& mffd, const RealImage& volume,
+        double& x, double& y, double& z) {
+        slice.ImageToWorld(x, y, z);
+        mffd.Transform(-1, 1, x, y, z);
+        volume.WorldToImage(x, y, z);
+    }
+
+    //-------------------------------------------------------------------
+
+    bool SliceDisplacementField::Build(const RealImage& slice, const MultiLevelFreeFormTransformation& mffd, const RealImage& volume,
+        const Array<double>& offsets, double tolerance) {
+        // Extent of the PSF samples around a slice pixel (including the pixel centre)
+        double min_x = 0, max_x = 0, min_y = 0, max_y = 0, min_z = 0, max_z = 0;
+        for (size_t n = 0; n + 2 < offsets.size(); n += 3) {
+            min_x = min(min_x, offsets[n]);
+            max_x = max(max_x, offsets[n]);
+            min_y = min(min_y, offsets[n + 1]);
+            max_y = max(max_y, offsets[n + 1]);
+            min_z = min(min_z, offsets[n + 2]);
+            max_z = max(max_z, offsets[n + 2]);
+        }
+
+        // In-plane nodes on the slice pixel grid, through-plane nodes every half slice voxel
+        _x0 = floor(min_x);
+        _y0 = floor(min_y);
+        _z0 = min_z;
+        _nx = max(2, (int)(slice.GetX() - 1 + ceil(max_x) - _x0) + 1);
+        _ny = max(2, (int)(slice.GetY() - 1 + ceil(max_y) - _y0) + 1);
+        _nz = max(2, (int)ceil((max_z - min_z) / 0.5) + 1);
+        _sz = max_z > min_z ? (max_z - min_z) / (_nz - 1) : 1;
+
+        _map.resize(3 * size_t(_nx) * _ny * _nz);
+        for (int c = 0; c < _nz; c++)
+            for (int b = 0; b < _ny; b++)
+                for (int a = 0; a < _nx; a++) {
+                    double *p = &_map[3 * (a + size_t(_nx) * (b + size_t(_ny) * c))];
+                    p[0] = _x0 + a;
+                    p[1] = _y0 + b;
+                    p[2] = _z0 + c * _sz;
+                    Exact(slice, mffd, volume, p[0], p[1], p[2]);
+                }
+
+        // Error at the centre of every cell, where the trilinear interpolation is furthest from the nodes
+        _error = 0;
+        for (int c = 0; c < _nz - 1; c++)
+            for (int b = 0; b < _ny - 1; b++)
+                for (int a = 0; a < _nx - 1; a++) {
+                    double x = _x0 + a + 0.5, y = _y0 + b + 0.5, z = _z0 + (c + 0.5) * _sz;
+                    double ex = x, ey = y, ez = z;
+                    Map(x, y, z);
+                    Exact(slice, mffd, volume, ex, ey, ez);
+                    _error = max(_error, sqrt((x - ex) * (x - ex) + (y - ey) * (y - ey) + (z - ez) * (z - ez)));
+                }
+
+        return _error <= tolerance;
+    }
+
+} // namespace svrtk
@@ -0,0 +1,96 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/SliceGeometry.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    SliceGeometry::SliceGeometry() {
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                _m[r][c] = r == c ? 1 : 0;
+    }
+
+    //-------------------------------------------------------------------
+
+    SliceGeometry::SliceGeometry(const ImageAttributes& slice, const Matrix& transformation, const ImageAttributes& volume) {
+        const Matrix m = volume.GetWorldToImageMatrix() * transformation * slice.GetImageToWorldMatrix();
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                _m[r][c] = m(r, c);
+    }
+
+    //-------------------------------------------------------------------
+
+    void SliceGeometry::PSFOffsets(const RealImage& PSF, double dx, double dy, double dz, Array<double>& offsets) const {
+        //centre of PSF
+        double cx = 0.5 * (PSF.GetX() - 1);
+        double cy = 0.5 * (PSF.GetY() - 1);
+        double cz = 0.5 * (PSF.GetZ() - 1);
+        PSF.ImageToWorld(cx, cy, cz);
+
+        offsets.resize(3 * PSF.GetX() * PSF.GetY() * PSF.GetZ());
+        double *po = offsets.data();
+        for (int ii = 0; ii < PSF.GetX(); ii++)
+            for (int jj = 0; jj < PSF.GetY(); jj++)
+                for (int kk = 0; kk < PSF.GetZ(); kk++, po += 3) {
+                    //PSF point in world coordinates centred around the centre of the PSF
+                    double x = ii, y = jj, z = kk;
+                    PSF.ImageToWorld(x, y, z);
+                    //slice voxel units - in slice image coordinates z is through-plane
+                    x = (x - cx) / dx;
+                    y = (y - cy) / dy;
+                    z = (z - cz) / dz;
+                    TransformVector(x, y, z);
+                    po[0] = x;
+                    po[1] = y;
+                    po[2] = z;
+                }
+    }
+
+    //-------------------------------------------------------------------
+
+    const SliceGeometry& SliceGeometryCache::Get(size_t index, const ImageAttributes& slice, const RigidTransformation& transformation, const ImageAttributes& volume) {
+        if (index >= _entries.size())
+            throw runtime_error("SliceGeometryCache: slice index is out of range");
+
+        Entry& entry = _entries[index];
+        const Matrix m = transformation.GetMatrix();
+
+        bool valid = entry.valid && entry.slice == slice && entry.volume == volume;
+        for (int r = 0; r < 3 && valid; r++)
+            for (int c = 0; c < 4 && valid; c++)
+                valid = entry.transformation[4 * r + c] == m(r, c);
+
+        if (!valid) {
+            entry.geometry = SliceGeometry(slice, m, volume);
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 4; c++)
+                    entry.transformation[4 * r + c] = m(r, c);
+            entry.slice = slice;
+            entry.volume = volume;
+            entry.valid = true;
+        }
+
+        return entry.geometry;
+    }
+
+} // namespace svrtk
@@ -0,0 +1,215 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/SliceStore.h"
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    // Check whether two slices share the lattice and orientation (origin is ignored)
+    static bool SameGeometry(const ImageAttributes& a, const ImageAttributes& b) {
+        if (a._x != b._x || a._y != b._y || a._z != b._z || a._t != b._t)
+            return false;
+        if (a._dx != b._dx || a._dy != b._dy || a._dz != b._dz || a._dt != b._dt)
+            return false;
+        for (int i = 0; i < 3; i++)
+            if (a._xaxis[i] != b._xaxis[i] || a._yaxis[i] != b._yaxis[i] || a._zaxis[i] != b._zaxis[i])
+                return false;
+        return true;
+    }
+
+    //-------------------------------------------------------------------
+
+    SliceStore::SliceStore(SliceStore&& store) noexcept : _field_size(0), _data(nullptr), _bytes(0), _mapped(false) {
+        *this = move(store);
+    }
+
+    //-------------------------------------------------------------------
+
+    SliceStore& SliceStore::operator=(SliceStore&& store) noexcept {
+        if (this != &store) {
+            Release();
+            _stack_attributes = move(store._stack_attributes);
+            _stack_index = move(store._stack_index);
+            _origins = move(store._origins);
+            _offsets = move(store._offsets);
+            _fields = move(store._fields);
+            _field_size = store._field_size;
+            _data = store._data;
+            _bytes = store._bytes;
+            _mapped = store._mapped;
+            store._data = nullptr;
+            store._bytes = 0;
+            store._field_size = 0;
+            store._mapped = false;
+        }
+        return *this;
+    }
+
+    //-------------------------------------------------------------------
+
+    void SliceStore::Release() {
+        if (_data != nullptr) {
+            if (_mapped)
+                munmap(_data, _bytes);
+            else
+                delete[] _data;
+        }
+        _data = nullptr;
+        _bytes = 0;
+        _mapped = false;
+    }
+
+    //-------------------------------------------------------------------
+
+    void SliceStore::Initialize(const Array<ImageAttributes>& slice_attributes, const Array<int>& stack_index,
+        const Array<string>& fields, const string& scratch_file) {
+        if (slice_attributes.size() != stack_index.size())
+            throw runtime_error("SliceStore: number of slice attributes and stack indices differ");
+
+        Release();
+        Utility::ClearAndReserve(_stack_index, slice_attributes.size());
+        Utility::ClearAndReserve(_origins, slice_attributes.size());
+        Utility::ClearAndReserve(_offsets, slice_attributes.size() + 1);
+        _stack_attributes.clear();
+        _fields = fields;
+
+        // Geometry is shared by all slices of a stack - keep only their origins
+        Array<Array<int>> stack_entries;
+        _field_size = 0;
+        for (size_t i = 0; i < slice_attributes.size(); i++) {
+            const ImageAttributes& attr = slice_attributes[i];
+            if (stack_index[i] >= (int)stack_entries.size())
+                stack_entries.resize(stack_index[i] + 1);
+
+            int entry = -1;
+            for (const int e : stack_entries[stack_index[i]]) {
+                if (SameGeometry(_stack_attributes[e], attr)) {
+                    entry = e;
+                    break;
+                }
+            }
+            if (entry < 0) {
+                entry = _stack_attributes.size();
+                _stack_attributes.push_back(attr);
+                stack_entries[stack_index[i]].push_back(entry);
+            }
+
+            _stack_index.push_back(entry);
+            _origins.push_back(Point(attr._xorigin, attr._yorigin, attr._zorigin));
+            _offsets.push_back(_field_size);
+            _field_size += attr.NumberOfPointsIncludingTemporal();
+        }
+        _offsets.push_back(_field_size);
+
+        _bytes = sizeof(RealPixel) * _field_size * _fields.size();
+        if (_bytes == 0)
+            return;
+
+        if (scratch_file.empty()) {
+            _data = new RealPixel[_field_size * _fields.size()]();
+            _mapped = false;
+            return;
+        }
+
+        // The scratch file is unlinked right away, so it disappears with the mapping
+        const int fd = open(scratch_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            throw runtime_error("SliceStore: cannot create scratch file " + scratch_file);
+        if (ftruncate(fd, _bytes) != 0) {
+            close(fd);
+            unlink(scratch_file.c_str());
+            throw runtime_error("SliceStore: cannot resize scratch file " + scratch_file);
+        }
+        void *ptr = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        unlink(scratch_file.c_str());
+        if (ptr == MAP_FAILED) {
+            _bytes = 0;
+            throw runtime_error("SliceStore: cannot map scratch file " + scratch_file);
+        }
+        _data = static_cast<RealPixel *>(ptr);
+        _mapped = true;
+    }
+
+    //-------------------------------------------------------------------
+
+    ImageAttributes SliceStore::Attributes(size_t index) const {
+        ImageAttributes attr = _stack_attributes[_stack_index[index]];
+        attr._xorigin = _origins[index]._x;
+        attr._yorigin = _origins[index]._y;
+        attr._zorigin = _origins[index]._z;
+        return attr;
+    }
+
+    //-------------------------------------------------------------------
+
+    int SliceStore::Field(const string& name) const {
+        for (size_t i = 0; i < _fields.size(); i++)
+            if (_fields[i] == name)
+                return i;
+        throw runtime_error("SliceStore: unknown field " + name);
+    }
+
+    //-------------------------------------------------------------------
+
+    void SliceStore::View(RealImage& view, int field, size_t index) const {
+        view = RealImage();
+        view.Initialize(Attributes(index), 1, Data(field, index));
+    }
+
+    //-------------------------------------------------------------------
+
+    void SliceStore::Bind(RealImage& image, int field, size_t index) {
+        RealPixel *ptr = Data(field, index);
+        if (image.Data() == ptr)
+            return;
+        if ((size_t)image.NumberOfVoxels() != NumberOfVoxels(index))
+            throw runtime_error("SliceStore: slice " + to_string(index) + " does not match the stored geometry");
+
+        const ImageAttributes attr = image.Attributes();
+        memcpy(ptr, image.Data(), sizeof(RealPixel) * NumberOfVoxels(index));
+
+        // Drop the private buffer and wrap the slab instead
+        image = RealImage();
+        image.Initialize(attr, 1, ptr);
+    }
+
+    //-------------------------------------------------------------------
+
+    void SliceStore::Bind(Array<RealImage>& images, const string& name) {
+        if (images.size() != NumberOfSlices())
+            return;
+        const int field = Field(name);
+        for (size_t i = 0; i < images.size(); i++)
+            if ((size_t)images[i].NumberOfVoxels() != NumberOfVoxels(i))
+                throw runtime_error("SliceStore: slice " + to_string(i) + " does not match the stored geometry");
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < images.size(); i++)
+            Bind(images[i], field, i);
+    }
+
+} // namespace svrtk
@@ -0,0 +1,154 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/StackRegistration.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    StackRegistration::StackRegistration(Model model, const ParameterList& params, double resolution, double padding, double blurring) :
+        _model(model), _resolution(resolution), _padding(padding), _blurring(blurring) {
+        Insert(_params, "Transformation model", model == Rigid ? "Rigid" : "FFD");
+        _params.insert(_params.end(), params.begin(), params.end());
+    }
+
+    //-------------------------------------------------------------------
+
+    RealImage StackRegistration::Resample(const RealImage& image, double blurring) const {
+        RealImage input = image;
+        if (blurring > 0) {
+            GaussianBlurring<RealPixel> gb(blurring);
+            gb.Input(&input);
+            gb.Output(&input);
+            gb.Run();
+        }
+
+        GenericLinearInterpolateImageFunction<RealImage> interpolator;
+        ResamplingWithPadding<RealPixel> resampling(_resolution, _resolution, _resolution, _padding);
+        resampling.Interpolator(&interpolator);
+
+        RealImage output(input.Attributes());
+        resampling.Input(&input);
+        resampling.Output(&output);
+        resampling.Run();
+
+        return output;
+    }
+
+    //-------------------------------------------------------------------
+
+    void StackRegistration::Template(const RealImage& image) {
+        RealImage target = image;
+        if (_model == Rigid)
+            Utility::ResetOrigin(target, _offset);
+        _template = Resample(target, 0);
+    }
+
+    //-------------------------------------------------------------------
+
+    Transformation *StackRegistration::Register(const RealImage& stack, const Transformation *guess) const {
+        if (_template.NumberOfVoxels() == 0)
+            throw runtime_error("StackRegistration: template has not been set");
+
+        const RealImage r_stack = Resample(stack, _blurring);
+
+        GenericRegistrationFilter registration;
+        registration.Parameter(_params);
+        if (_model == Rigid)
+            registration.Input(&_template, &r_stack);
+        else
+            registration.Input(&r_stack, &_template);
+
+        Transformation *dofout = nullptr;
+        registration.Output(&dofout);
+        if (guess != nullptr)
+            registration.InitialGuess(guess);
+        registration.GuessParameter();
+        registration.Run();
+
+        return dofout;
+    }
+
+    //-------------------------------------------------------------------
+
+    void StackRegistration::Run(const Array<RealImage>& stacks, Array<RigidTransformation>& transformations, int skip) const {
+        if (_model != Rigid)
+            throw runtime_error("StackRegistration: rigid registration requested from a non-rigid model");
+        if (transformations.size() != stacks.size())
+            throw runtime_error("StackRegistration: number of transformations doesn't match the number of stacks");
+
+        const Matrix& mo = _offset.GetMatrix();
+        const Matrix mo_inv = mo.Inverse();
+        Array<string> errors(stacks.size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)stacks.size(); i++) {
+            if (i == skip)
+                continue;
+            try {
+                //initial guess relative to the template origin
+                RigidTransformation guess = transformations[i];
+                guess.PutMatrix(guess.GetMatrix() * mo);
+
+                unique_ptr<Transformation> dofout(Register(stacks[i], &guess));
+                const RigidTransformation *rigid = dynamic_cast<RigidTransformation*>(dofout.get());
+                if (rigid == nullptr)
+                    throw runtime_error("registration didn't produce a rigid transformation");
+
+                transformations[i] = *rigid;
+                transformations[i].PutMatrix(transformations[i].GetMatrix() * mo_inv);
+            } catch (const exception& e) {
+                errors[i] = e.what();
+            }
+        }
+
+        for (size_t i = 0; i < errors.size(); i++)
+            if (!errors[i].empty())
+                throw runtime_error("StackRegistration: stack " + to_string(i) + ": " + errors[i]);
+    }
+
+    //-------------------------------------------------------------------
+
+    void StackRegistration::Run(const Array<RealImage>& stacks, Array<unique_ptr<MultiLevelFreeFormTransformation>>& transformations) const {
+        if (_model != FFD)
+            throw runtime_error("StackRegistration: FFD registration requested from a non-FFD model");
+
+        transformations.clear();
+        transformations.resize(stacks.size());
+        Array<string> errors(stacks.size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)stacks.size(); i++) {
+            try {
+                unique_ptr<Transformation> dofout(Register(stacks[i]));
+                if (dynamic_cast<MultiLevelFreeFormTransformation*>(dofout.get()) == nullptr)
+                    throw runtime_error("registration didn't produce a multi-level FFD");
+                transformations[i].reset(static_cast<MultiLevelFreeFormTransformation*>(dofout.release()));
+            } catch (const exception& e) {
+                errors[i] = e.what();
+            }
+        }
+
+        for (size_t i = 0; i < errors.size(); i++)
+            if (!errors[i].empty())
+                throw runtime_error("StackRegistration: stack " + to_string(i) + ": " + errors[i]);
+    }
+
+} // namespace svrtk
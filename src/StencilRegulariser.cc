@@ -0,0 +1,241 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/StencilRegulariser.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    StencilRegulariser::StencilRegulariser(const ImageAttributes& attr, const int directions[13][3], int block_size) :
+        _nx(attr._x), _ny(attr._y), _nz(attr._z), _n((size_t)attr._x * attr._y * attr._z), _block_size(max(block_size, 1)) {
+        for (int i = 0; i < 13; i++) {
+            for (int j = 0; j < 3; j++) {
+                _neighbours[i][j] = directions[i][j];
+                _neighbours[i + 13][j] = -directions[i][j];
+            }
+        }
+        for (int k = 0; k < 26; k++)
+            _offsets[k] = _neighbours[k][0] + (ptrdiff_t)_nx * (_neighbours[k][1] + (ptrdiff_t)_ny * _neighbours[k][2]);
+    }
+
+    //-------------------------------------------------------------------
+
+    void StencilRegulariser::CheckGrid(const RealImage& image, const char *name) const {
+        if (image.GetX() != _nx || image.GetY() != _ny || image.GetZ() != _nz)
+            throw runtime_error(string("StencilRegulariser: ") + name + " does not match the regularisation grid");
+    }
+
+    //-------------------------------------------------------------------
+
+    void StencilRegulariser::NeighbourBits(const RealImage *mask, int step, Array<uint32_t>& bits) const {
+        bits.assign(_n, 0);
+        const RealPixel *pm = mask != nullptr ? mask->Data() : nullptr;
+
+        #pragma omp parallel for
+        for (int z = 0; z < _nz; z++) {
+            for (int y = 0; y < _ny; y++) {
+                for (int x = 0; x < _nx; x++) {
+                    const size_t idx = x + (size_t)_nx * (y + (size_t)_ny * z);
+                    uint32_t b = 0;
+                    for (int k = 0; k < 26; k++) {
+                        const int xx = x + step * _neighbours[k][0];
+                        const int yy = y + step * _neighbours[k][1];
+                        const int zz = z + step * _neighbours[k][2];
+                        if (xx < 0 || xx >= _nx || yy < 0 || yy >= _ny || zz < 0 || zz >= _nz)
+                            continue;
+                        if (pm != nullptr && !(pm[idx + step * _offsets[k]] > 0))
+                            continue;
+                        b |= 1u << k;
+                    }
+                    bits[idx] = b;
+                }
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    void StencilRegulariser::Adaptive(const RealImage& original, RealImage& reconstructed, const RealImage& mask,
+        const Array<double>& factor, double delta, double coef) const {
+        CheckGrid(original, "original image");
+        CheckGrid(reconstructed, "reconstructed image");
+        CheckGrid(mask, "mask");
+        if (original.GetT() != reconstructed.GetT())
+            throw runtime_error("StencilRegulariser: original and reconstructed images have different number of volumes");
+
+        Array<uint32_t> bits;
+        NeighbourBits(&mask, 1, bits);
+
+        double sqrt_factor[13];
+        for (int i = 0; i < 13; i++)
+            sqrt_factor[i] = sqrt(factor[i]);
+
+        const RealImage current = reconstructed;
+        const RealPixel *pm = mask.Data();
+
+        ForEachBlock(reconstructed.GetT(), [&](int volume, size_t begin, size_t end) {
+            const RealPixel *po = original.Data() + volume * _n;
+            const RealPixel *pc = current.Data() + volume * _n;
+            RealPixel *pr = reconstructed.Data() + volume * _n;
+
+            for (size_t idx = begin; idx < end; idx++) {
+                if (!(pm[idx] > 0))
+                    continue;
+                const uint32_t nb = bits[idx];
+
+                // edge-stopping weights of the positive directions (used for both signs)
+                RealPixel b[13];
+                for (int i = 0; i < 13; i++) {
+                    if (nb & (1u << i)) {
+                        const double diff = (po[idx + _offsets[i]] - po[idx]) * sqrt_factor[i] / delta;
+                        b[i] = factor[i] / sqrt(1 + diff * diff);
+                    } else {
+                        b[i] = 0;
+                    }
+                }
+
+                double val = 0, sum = 0;
+                for (int k = 0; k < 26; k++) {
+                    if (nb & (1u << k)) {
+                        val += b[k % 13] * pc[idx + _offsets[k]];
+                        sum += b[k % 13];
+                    }
+                }
+
+                val -= sum * pc[idx];
+                pr[idx] = pc[idx] + coef * val;
+            }
+        });
+    }
+
+    //-------------------------------------------------------------------
+
+    void StencilRegulariser::Laplacian(const RealImage& original, RealImage& laplacian, const RealImage& mask,
+        const RealImage& mask_internal, const Array<double>& factor) const {
+        CheckGrid(original, "original image");
+        CheckGrid(mask, "mask");
+        CheckGrid(mask_internal, "internal mask");
+
+        Array<uint32_t> bits;
+        NeighbourBits(&mask, 1, bits);
+
+        laplacian.Initialize(original.Attributes());
+        const RealPixel *pi = mask_internal.Data();
+
+        ForEachBlock(original.GetT(), [&](int volume, size_t begin, size_t end) {
+            const RealPixel *po = original.Data() + volume * _n;
+            RealPixel *pl = laplacian.Data() + volume * _n;
+
+            for (size_t idx = begin; idx < end; idx++) {
+                RealPixel l = 0;
+                if (pi[idx] > 0) {
+                    const uint32_t nb = bits[idx];
+                    for (int i = 0; i < 13; i++) {
+                        if (nb & (1u << i))
+                            l += (po[idx + _offsets[i]] - po[idx]) * factor[i];
+                        if (nb & (1u << (i + 13)))
+                            l += (po[idx + _offsets[i + 13]] - po[idx]) * factor[i];
+                    }
+                }
+                pl[idx] = l;
+            }
+        });
+    }
+
+    //-------------------------------------------------------------------
+
+    void StencilRegulariser::LaplacianUpdate(const RealImage& laplacian, RealImage& reconstructed, const RealImage& mask,
+        const RealImage& mask_internal, const Array<double>& factor, double coef) const {
+        CheckGrid(laplacian, "Laplacian");
+        CheckGrid(reconstructed, "reconstructed image");
+        CheckGrid(mask, "mask");
+        CheckGrid(mask_internal, "internal mask");
+
+        Array<uint32_t> bits;
+        NeighbourBits(&mask_internal, 1, bits);
+
+        const RealImage current = reconstructed;
+        const RealPixel *pm = mask.Data();
+        const RealPixel *pi = mask_internal.Data();
+
+        ForEachBlock(reconstructed.GetT(), [&](int volume, size_t begin, size_t end) {
+            const RealPixel *pl = laplacian.Data() + volume * _n;
+            const RealPixel *pc = current.Data() + volume * _n;
+            RealPixel *pr = reconstructed.Data() + volume * _n;
+
+            for (size_t idx = begin; idx < end; idx++) {
+                if (!(pm[idx] > 0))
+                    continue;
+                const uint32_t nb = bits[idx];
+
+                double val = 0, sum = 0;
+                for (int k = 0; k < 26; k++) {
+                    if (nb & (1u << k)) {
+                        val += factor[k % 13] * pl[idx + _offsets[k]];
+                        sum += factor[k % 13];
+                    }
+                }
+
+                if (pi[idx] > 0)
+                    val -= sum * pl[idx];
+
+                pr[idx] = pc[idx] - coef * val / 0.068;
+            }
+        });
+    }
+
+    //-------------------------------------------------------------------
+
+    void StencilRegulariser::L22(RealImage& reconstructed, const RealImage& confidence, const Array<double>& factor, double coef) const {
+        CheckGrid(reconstructed, "reconstructed image");
+        CheckGrid(confidence, "confidence map");
+
+        // the first neighbour has to be confident, the second one only within the grid
+        Array<uint32_t> bits, bits2;
+        NeighbourBits(&confidence, 1, bits);
+        NeighbourBits(nullptr, 2, bits2);
+
+        const RealImage current = reconstructed;
+        const RealPixel *pw = confidence.Data();
+
+        ForEachBlock(reconstructed.GetT(), [&](int volume, size_t begin, size_t end) {
+            const RealPixel *pc = current.Data() + volume * _n;
+            RealPixel *pr = reconstructed.Data() + volume * _n;
+
+            for (size_t idx = begin; idx < end; idx++) {
+                if (!(pw[idx] > 0))
+                    continue;
+                const uint32_t nb = bits[idx] & bits2[idx];
+
+                double val = 0, sum = 0;
+                for (int k = 0; k < 26; k++) {
+                    if (nb & (1u << k)) {
+                        val += factor[k % 13] * (pc[idx + 2 * _offsets[k]] - 4 * pc[idx + _offsets[k]]) / 3;
+                        sum += factor[k % 13];
+                    }
+                }
+
+                val += sum * pc[idx];
+                pr[idx] = pc[idx] - coef * val;
+            }
+        });
+    }
+
+} // namespace svrtk
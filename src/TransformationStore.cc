@@ -0,0 +1,82 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/TransformationStore.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    void TransformationStore::SetStack(size_t stack, unique_ptr<MultiLevelFreeFormTransformation> transformation) {
+        if (stack >= _stacks.size())
+            _stacks.resize(stack + 1);
+        _stacks[stack] = move(transformation);
+    }
+
+    //-------------------------------------------------------------------
+
+    void TransformationStore::SetSlice(size_t slice, Transformation *transformation) {
+        MultiLevelFreeFormTransformation *mffd = dynamic_cast<MultiLevelFreeFormTransformation*>(transformation);
+        if (mffd == nullptr) {
+            delete transformation;
+            throw runtime_error("TransformationStore: slice transformation is not a multi-level FFD");
+        }
+        // The previous transformation is released here unless it is shared
+        _slices[slice].reset(mffd);
+    }
+
+    //-------------------------------------------------------------------
+
+    void TransformationStore::ShareStack(size_t slice, size_t stack) {
+        if (stack >= _stacks.size() || !_stacks[stack])
+            throw runtime_error("TransformationStore: no transformation for stack " + to_string(stack));
+        _slices[slice] = _stacks[stack];
+    }
+
+    //-------------------------------------------------------------------
+
+    MultiLevelFreeFormTransformation *TransformationStore::Mutable(size_t slice) {
+        if (_slices[slice].use_count() > 1)
+            _slices[slice] = make_shared<MultiLevelFreeFormTransformation>(*_slices[slice]);
+        return _slices[slice].get();
+    }
+
+    //-------------------------------------------------------------------
+
+    void TransformationStore::WriteStacks(const string& prefix) const {
+        for (size_t i = 0; i < _stacks.size(); i++)
+            if (_stacks[i])
+                _stacks[i]->Write((prefix + to_string(i) + ".dof").c_str());
+    }
+
+    //-------------------------------------------------------------------
+
+    void TransformationStore::ClearSlices(size_t reserve_size) {
+        Array<Pointer>().swap(_slices);
+        _slices.reserve(reserve_size);
+    }
+
+    //-------------------------------------------------------------------
+
+    void TransformationStore::Clear() {
+        ClearSlices();
+        Array<Pointer>().swap(_stacks);
+    }
+
+} // namespace svrtk
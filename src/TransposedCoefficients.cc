@@ -0,0 +1,70 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/TransposedCoefficients.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    size_t TransposedCoefficients::Bytes(const Array<SLICECOEFFS>& volcoeffs, size_t voxels) {
+        size_t n = 0;
+        for (size_t inputIndex = 0; inputIndex < volcoeffs.size(); inputIndex++)
+            for (size_t i = 0; i < volcoeffs[inputIndex].size(); i++)
+                for (size_t j = 0; j < volcoeffs[inputIndex][i].size(); j++)
+                    n += volcoeffs[inputIndex][i][j].size();
+        return n * sizeof(Contribution) + (voxels + 1) * sizeof(size_t);
+    }
+
+    //-------------------------------------------------------------------
+
+    void TransposedCoefficients::Build(const Array<SLICECOEFFS>& volcoeffs, const ImageAttributes& attr) {
+        const size_t voxels = attr.NumberOfSpatialPoints();
+        const size_t nx = attr._x, ny = attr._y;
+        auto Index = [&](const POINT3D& p) {
+            return p.x + nx * (p.y + ny * p.z);
+        };
+
+        // Number of contributions of each voxel
+        _offsets.assign(voxels + 1, 0);
+        for (size_t inputIndex = 0; inputIndex < volcoeffs.size(); inputIndex++)
+            for (size_t i = 0; i < volcoeffs[inputIndex].size(); i++)
+                for (size_t j = 0; j < volcoeffs[inputIndex][i].size(); j++)
+                    for (const POINT3D& p : volcoeffs[inputIndex][i][j])
+                        _offsets[Index(p) + 1]++;
+        partial_sum(_offsets.begin(), _offsets.end(), _offsets.begin());
+
+        // Fill in slice and pixel order, so every voxel sums as a serial scatter would
+        _contributions.resize(_offsets[voxels]);
+        Array<size_t> cursor(_offsets.begin(), _offsets.end() - 1);
+        for (size_t inputIndex = 0; inputIndex < volcoeffs.size(); inputIndex++)
+            for (size_t i = 0; i < volcoeffs[inputIndex].size(); i++)
+                for (size_t j = 0; j < volcoeffs[inputIndex][i].size(); j++)
+                    for (const POINT3D& p : volcoeffs[inputIndex][i][j])
+                        _contributions[cursor[Index(p)]++] = {(int)inputIndex, (short)i, (short)j, p.value};
+    }
+
+    //-------------------------------------------------------------------
+
+    void TransposedCoefficients::Clear() {
+        Array<size_t>().swap(_offsets);
+        Array<Contribution>().swap(_contributions);
+    }
+
+} // namespace svrtk
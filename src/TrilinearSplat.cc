@@ -0,0 +1,64 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "svrtk/TrilinearSplat.h"
+
+using namespace std;
+using namespace mirtk;
+
+namespace svrtk {
+
+    TrilinearSplat::TrilinearSplat(const ImageAttributes& attr, const RealImage& mask, bool no_masking) :
+        _x(attr._x), _y(attr._y), _z(attr._z), _mask(mask.Data()), _no_masking(no_masking) {
+        if (!_no_masking && (mask.GetX() != _x || mask.GetY() != _y || mask.GetZ() != _z))
+            throw runtime_error("TrilinearSplat: mask doesn't match the reconstructed volume");
+    }
+
+    //-------------------------------------------------------------------
+
+    size_t TrilinearSplat::Prune(VOXELCOEFFS& coeffs, double threshold) {
+        if (coeffs.empty() || threshold <= 0)
+            return 0;
+
+        double largest = 0, sum = 0;
+        for (const POINT3D& p : coeffs) {
+            largest = max(largest, double(p.value));
+            sum += p.value;
+        }
+
+        const double cutoff = threshold * largest;
+        const size_t size = coeffs.size();
+        coeffs.erase(remove_if(coeffs.begin(), coeffs.end(), [cutoff](const POINT3D& p) {
+            return p.value < cutoff;
+        }), coeffs.end());
+        const size_t pruned = size - coeffs.size();
+
+        // Keep the total weight of the slice voxel
+        if (pruned > 0) {
+            double kept = 0;
+            for (const POINT3D& p : coeffs)
+                kept += p.value;
+            const double scale = sum / kept;
+            for (POINT3D& p : coeffs)
+                p.value *= scale;
+        }
+
+        return pruned;
+    }
+
+} // namespace svrtk
@@ -720,6 +720,28 @@ namespace svrtk::Utility {
 
     // transform mask to the specified stack space
     void TransformMask(const RealImage& image, RealImage& mask, const RigidTransformation& transformation) {
+        if (image.GetT() == 1 && mask.GetT() == 1) {
+            //nearest neighbour resampling along the rows of image mapped to mask voxels
+            const SliceGeometry geometry(image.Attributes(), transformation.GetMatrix(), mask.Attributes());
+            RealImage m(image.Attributes());
+
+            #pragma omp parallel for
+            for (int k = 0; k < image.GetZ(); k++) {
+                Array<double> x(image.GetX()), y(image.GetX()), z(image.GetX());
+                for (int j = 0; j < image.GetY(); j++) {
+                    geometry.TransformRow(j, k, image.GetX(), x.data(), y.data(), z.data());
+                    for (int i = 0; i < image.GetX(); i++) {
+                        const int mx = round(x[i]), my = round(y[i]), mz = round(z[i]);
+                        //no info from source is filled with zeroes
+                        m(i, j, k) = mask.IsInside(mx, my, mz) ? mask(mx, my, mz) : 0;
+                    }
+                }
+            }
+
+            mask = move(m);
+            return;
+        }
+
         //transform mask to the space of image
         unique_ptr<InterpolateImageFunction> interpolator(InterpolateImageFunction::New(Interpolation_NN));
         ImageTransformation imagetransformation;
@@ -739,24 +761,43 @@ namespace svrtk::Utility {
 
 
     void RemoveNanNegative(RealImage& stack) {
- 
-        for (int x = 0; x < stack.GetX(); x++) {
-            for (int y = 0; y < stack.GetY(); y++) {
-                for (int z = 0; z < stack.GetZ(); z++) {
-                    
-                    if (stack(x,y,z) < 0)
-                        stack(x,y,z) = 0;
-                    
-                    if (stack(x,y,z) != stack(x,y,z))
-                        stack(x,y,z) = 0;
-                    
-                }
+        RealPixel *ps = stack.Data();
+        const int n = stack.NumberOfVoxels();
+
+        // NaN fails the comparison as well
+        #pragma omp simd
+        for (int i = 0; i < n; i++)
+            ps[i] = ps[i] >= 0 ? ps[i] : 0;
+    }
+
+    //-------------------------------------------------------------------
+
+    void ReadImages(const Array<string>& file_names, Array<RealImage>& images, function<void(size_t, RealImage&)> Preprocess) {
+        ClearAndResize(images, file_names.size());
+        Array<string> errors(file_names.size());
+
+        // Exceptions must not leave the parallel region - collect them and rethrow afterwards
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < file_names.size(); i++) {
+            try {
+                UniquePtr<ImageReader> image_reader(ImageReader::TryNew(file_names[i].c_str()));
+                if (!image_reader)
+                    throw runtime_error("cannot read image " + file_names[i]);
+                UniquePtr<BaseImage> tmp_image(image_reader->Run());
+                images[i] = *tmp_image;
+                tmp_image.reset();
+
+                if (Preprocess)
+                    Preprocess(i, images[i]);
+            } catch (const exception& e) {
+                errors[i] = e.what();
             }
         }
-               
-        
-    }
 
+        for (size_t i = 0; i < errors.size(); i++)
+            if (!errors[i].empty())
+                throw runtime_error("ReadImages: " + errors[i]);
+    }
 
     //-------------------------------------------------------------------
 
@@ -880,6 +921,66 @@ namespace svrtk::Utility {
 
     //-------------------------------------------------------------------
 
+    // mask slices based on the reconstruction mask using the slice-to-mask voxel maps
+    void MaskSlices(Array<RealImage>& slices, const RealImage& mask, function<SliceGeometry(size_t)> Geometry) {
+        #pragma omp parallel for
+        for (size_t inputIndex = 0; inputIndex < slices.size(); inputIndex++) {
+            RealImage& slice = slices[inputIndex];
+            const SliceGeometry geometry = Geometry(inputIndex);
+            Array<double> x(slice.GetX()), y(slice.GetX()), z(slice.GetX());
+            for (int j = 0; j < slice.GetY(); j++) {
+                //image coordinates in volume space of the whole row
+                geometry.TransformRow(j, 0, slice.GetX(), x.data(), y.data(), z.data());
+                for (int i = 0; i < slice.GetX(); i++) {
+                    //if the value is smaller than 1 assume it is padding
+                    if (slice(i, j, 0) < 0.01)
+                        slice(i, j, 0) = -1;
+                    const int mx = round(x[i]), my = round(y[i]), mz = round(z[i]);
+                    //if the voxel is outside mask ROI set it to -1 (padding value)
+                    if (!mask.IsInside(mx, my, mz) || mask(mx, my, mz) == 0)
+                        slice(i, j, 0) = -1;
+                }
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------
+
+    // wrap a slice of a stack with the geometry GetRegion and PutPixelSize would give it
+    void StackSliceView(RealImage& view, const RealImage& stack, int z, int t, double thickness) {
+        ImageAttributes attr = stack.Attributes();
+        attr._z = 1;
+        attr._t = 1;
+        attr._dz = thickness;
+
+        // The origin is the centre of the slice
+        double x = (attr._x - 1) / 2.0, y = (attr._y - 1) / 2.0, zc = z;
+        stack.ImageToWorld(x, y, zc);
+        attr._xorigin = x;
+        attr._yorigin = y;
+        attr._zorigin = zc;
+        attr._torigin = stack.ImageToTime(t);
+
+        view = RealImage();
+        view.Initialize(attr, 1, const_cast<RealPixel *>(stack.Data(0, 0, z, t)));
+
+        // Carry the voxel size and the timing over explicitly, as GetRegion and PutPixelSize did
+        view.PutPixelSize(attr._dx, attr._dy, thickness, stack.GetTSize());
+        view.PutTOrigin(attr._torigin);
+    }
+
+    //-------------------------------------------------------------------
+
+    void ImageView(RealImage& view, const RealImage& image) {
+        const ImageAttributes& attr = image.Attributes();
+        view = RealImage();
+        view.Initialize(attr, 1, const_cast<RealPixel *>(image.Data()));
+        view.PutPixelSize(attr._dx, attr._dy, attr._dz, attr._dt);
+        view.PutTOrigin(attr._torigin);
+    }
+
+    //-------------------------------------------------------------------
+
     // get slice order parameters
     void GetSliceAcquisitionOrder(const Array<RealImage>& stacks, const Array<int>& pack_num, const Array<int>& order, const int step, const int rewinder, Array<int>& output_z_slice_order, Array<int>& output_t_slice_order) {
         Array<int> realInterleaved, fakeAscending;
@@ -0,0 +1,159 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testCoefficientCache
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/CoefficientCache.h"
+
+// POSIX
+#include <unistd.h>
+
+// C++ Standard
+#include <random>
+
+using namespace svrtk;
+
+path cacheDirectory;
+Array<RealImage> slices;
+Array<SLICECOEFFS> volcoeffs;
+Array<bool> sliceInside;
+
+// Cache with the key of the given number
+static CoefficientCache Cache(int number) {
+    CoefficientCache cache;
+    cache.SetDirectory(cacheDirectory.string());
+    cache.Add(number);
+    return cache;
+}
+
+// Whether the coefficients read back are the ones written
+static bool Identical(const Array<SLICECOEFFS>& a, const Array<bool>& a_inside) {
+    if (a.size() != volcoeffs.size() || a_inside != sliceInside)
+        return false;
+    for (size_t s = 0; s < a.size(); s++) {
+        if (a[s].size() != volcoeffs[s].size())
+            return false;
+        for (size_t i = 0; i < a[s].size(); i++) {
+            if (a[s][i].size() != volcoeffs[s][i].size())
+                return false;
+            for (size_t j = 0; j < a[s][i].size(); j++) {
+                const VOXELCOEFFS& p = a[s][i][j], & q = volcoeffs[s][i][j];
+                if (p.size() != q.size())
+                    return false;
+                for (size_t n = 0; n < p.size(); n++)
+                    if (p[n].x != q[n].x || p[n].y != q[n].y || p[n].z != q[n].z || p[n].value != q[n].value)
+                        return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether a cache file is rejected by the cache of the given number
+static bool Rejected(int number) {
+    Array<SLICECOEFFS> coeffs;
+    Array<bool> inside;
+    return !Cache(number).Read(coeffs, inside, slices);
+}
+
+BOOST_AUTO_TEST_CASE(Initialise) {
+    cacheDirectory = temp_directory_path() / ("svrtk-coeff-cache-" + to_string(getpid()));
+    remove_all(cacheDirectory);
+    create_directories(cacheDirectory);
+
+    // Slices of different sizes, with empty voxels and a slice outside the mask
+    mt19937 generator(42);
+    uniform_int_distribution<int> count(0, 6), index(0, 63);
+    uniform_real_distribution<float> value(0, 1);
+    const int sizes[][2] = {{9, 7}, {5, 11}, {4, 4}};
+    for (size_t s = 0; s < size(sizes); s++) {
+        ImageAttributes attr;
+        attr._x = sizes[s][0]; attr._y = sizes[s][1]; attr._z = 1;
+        slices.emplace_back(attr);
+
+        SLICECOEFFS slicecoeffs(attr._x, Array<VOXELCOEFFS>(attr._y));
+        for (int i = 0; i < attr._x; i++)
+            for (int j = 0; j < attr._y; j++)
+                for (int n = count(generator); n > 0; n--)
+                    slicecoeffs[i][j].push_back({short(index(generator)), short(index(generator)), short(index(generator)), value(generator)});
+        volcoeffs.push_back(move(slicecoeffs));
+        sliceInside.push_back(s != 1);
+    }
+
+    BOOST_REQUIRE(Cache(1).Write(volcoeffs, sliceInside));
+    BOOST_REQUIRE(exists(Cache(1).Path()));
+}
+
+BOOST_AUTO_TEST_CASE(RoundTrip) {
+    Array<SLICECOEFFS> coeffs;
+    Array<bool> inside;
+    BOOST_REQUIRE(Cache(1).Read(coeffs, inside, slices));
+    BOOST_CHECK(Identical(coeffs, inside));
+}
+
+BOOST_AUTO_TEST_CASE(MismatchedSlices) {
+    Array<RealImage> other(slices);
+    other.pop_back();
+    Array<SLICECOEFFS> coeffs;
+    Array<bool> inside;
+    BOOST_CHECK(!Cache(1).Read(coeffs, inside, other));
+
+    ImageAttributes attr = slices.back().Attributes();
+    attr._x++;
+    other.emplace_back(attr);
+    BOOST_CHECK(!Cache(1).Read(coeffs, inside, other));
+}
+
+BOOST_AUTO_TEST_CASE(MismatchedKey) {
+    // A file stored under the path of another key
+    copy_file(Cache(1).Path(), Cache(2).Path(), copy_options::overwrite_existing);
+    BOOST_CHECK(Rejected(2));
+}
+
+BOOST_AUTO_TEST_CASE(WrongVersion) {
+    // The version follows the 8-byte magic
+    BOOST_REQUIRE(Cache(3).Write(volcoeffs, sliceInside));
+    BOOST_REQUIRE(!Rejected(3));
+    fstream file(Cache(3).Path(), ios::in | ios::out | ios::binary);
+    const uint32_t version = 2;
+    file.seekp(8);
+    file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    file.close();
+    BOOST_CHECK(Rejected(3));
+}
+
+BOOST_AUTO_TEST_CASE(TruncatedBody) {
+    BOOST_REQUIRE(Cache(4).Write(volcoeffs, sliceInside));
+    const uintmax_t bytes = file_size(Cache(4).Path());
+    resize_file(Cache(4).Path(), bytes - 1);
+    BOOST_CHECK(Rejected(4));
+    resize_file(Cache(4).Path(), bytes / 2);
+    BOOST_CHECK(Rejected(4));
+    resize_file(Cache(4).Path(), 16);
+    BOOST_CHECK(Rejected(4));
+
+    // The intact file of the same contents is still read
+    BOOST_CHECK(!Rejected(1));
+}
+
+BOOST_AUTO_TEST_CASE(Cleanup) {
+    remove_all(cacheDirectory);
+}
@@ -0,0 +1,69 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testReconstructionDWI
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/ReconstructionDWI.h"
+
+// C++ Standard
+#include <cstring>
+#include <random>
+
+using namespace svrtk;
+
+RealImage shCoeffs;
+
+// Bitwise comparison of the voxel data
+static bool Identical(const RealImage& a, const RealImage& b) {
+    return a.NumberOfVoxels() == b.NumberOfVoxels()
+        && memcmp(a.Data(), b.Data(), sizeof(RealPixel) * a.NumberOfVoxels()) == 0;
+}
+
+BOOST_AUTO_TEST_CASE(Initialise) {
+    // SH order 6 (28 coefficients), so orders above 4 are included
+    ImageAttributes attr;
+    attr._x = 7; attr._y = 6; attr._z = 5; attr._t = 28;
+    shCoeffs.Initialize(attr);
+
+    mt19937 generator(42);
+    uniform_real_distribution<double> coefficient(-100, 100);
+    RealPixel *ps = shCoeffs.Data();
+    for (int i = 0; i < shCoeffs.NumberOfVoxels(); i++)
+        ps[i] = coefficient(generator);
+}
+
+BOOST_AUTO_TEST_CASE(LaplaceBeltramiDampingInPlace) {
+    for (double lambda : {0.5, 2.0}) {
+        RealImage inCore = shCoeffs, outOfCore = shCoeffs, regul;
+        ReconstructionDWI::LaplaceBeltramiDamping(inCore, lambda, &regul);
+        ReconstructionDWI::LaplaceBeltramiDamping(outOfCore, lambda);
+        BOOST_CHECK(Identical(inCore, outOfCore));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(LaplaceBeltramiDampingHighOrders) {
+    // Coefficients above order 4 are damped fully (factor capped at 1)
+    RealImage damped = shCoeffs;
+    ReconstructionDWI::LaplaceBeltramiDamping(damped, 2.0);
+    for (int t = 16; t < damped.GetT(); t++)
+        BOOST_CHECK_EQUAL(damped(3, 2, 1, t), 0);
+    BOOST_CHECK_EQUAL(damped(3, 2, 1, 0), shCoeffs(3, 2, 1, 0));
+}
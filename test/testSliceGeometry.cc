@@ -0,0 +1,196 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testSliceGeometry
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/SliceGeometry.h"
+
+// C++ Standard
+#include <chrono>
+#include <random>
+
+using namespace svrtk;
+
+RealImage slice, volume;
+RigidTransformation transformation;
+
+// Slice voxel -> world -> transformation -> volume voxel
+static void Reference(double& x, double& y, double& z) {
+    slice.ImageToWorld(x, y, z);
+    transformation.Transform(x, y, z);
+    volume.WorldToImage(x, y, z);
+}
+
+BOOST_AUTO_TEST_CASE(Initialise) {
+    mt19937 generator(42);
+    uniform_real_distribution<double> angle(-45, 45), offset(-20, 20);
+
+    ImageAttributes attr;
+    attr._x = 96; attr._y = 80; attr._z = 1;
+    attr._dx = 1.25; attr._dy = 1.25; attr._dz = 3;
+    attr._xorigin = offset(generator); attr._yorigin = offset(generator); attr._zorigin = offset(generator);
+    // Oblique slice orientation
+    RigidTransformation orientation;
+    orientation.PutRotationX(angle(generator));
+    orientation.PutRotationY(angle(generator));
+    orientation.PutRotationZ(angle(generator));
+    const Matrix r = orientation.GetMatrix();
+    for (int i = 0; i < 3; i++) {
+        attr._xaxis[i] = r(i, 0);
+        attr._yaxis[i] = r(i, 1);
+        attr._zaxis[i] = r(i, 2);
+    }
+    slice.Initialize(attr);
+
+    attr = ImageAttributes();
+    attr._x = 64; attr._y = 64; attr._z = 64;
+    attr._dx = 0.8; attr._dy = 0.8; attr._dz = 0.8;
+    volume.Initialize(attr);
+
+    transformation.PutTranslationX(offset(generator));
+    transformation.PutTranslationY(offset(generator));
+    transformation.PutTranslationZ(offset(generator));
+    transformation.PutRotationX(angle(generator));
+    transformation.PutRotationY(angle(generator));
+    transformation.PutRotationZ(angle(generator));
+}
+
+BOOST_AUTO_TEST_CASE(Transform) {
+    const SliceGeometry geometry(slice.Attributes(), transformation.GetMatrix(), volume.Attributes());
+    double error = 0;
+    for (int j = 0; j < slice.GetY(); j++)
+        for (int i = 0; i < slice.GetX(); i++) {
+            double x = i, y = j, z = 0, rx = i, ry = j, rz = 0;
+            geometry.Transform(x, y, z);
+            Reference(rx, ry, rz);
+            error = max(error, max(fabs(x - rx), max(fabs(y - ry), fabs(z - rz))));
+        }
+    BOOST_CHECK_MESSAGE(error < 1e-9, "Composite map differs from the reference by " << error << " voxels!");
+}
+
+BOOST_AUTO_TEST_CASE(TransformRow) {
+    const SliceGeometry geometry(slice.Attributes(), transformation.GetMatrix(), volume.Attributes());
+    Array<double> x(slice.GetX()), y(slice.GetX()), z(slice.GetX());
+    double error = 0;
+    for (int j = 0; j < slice.GetY(); j++) {
+        geometry.TransformRow(j, 0, slice.GetX(), x.data(), y.data(), z.data());
+        for (int i = 0; i < slice.GetX(); i++) {
+            double rx = i, ry = j, rz = 0;
+            Reference(rx, ry, rz);
+            error = max(error, max(fabs(x[i] - rx), max(fabs(y[i] - ry), fabs(z[i] - rz))));
+        }
+    }
+    BOOST_CHECK_MESSAGE(error < 1e-9, "Row stepping differs from the reference by " << error << " voxels!");
+}
+
+BOOST_AUTO_TEST_CASE(PSFOffsets) {
+    ImageAttributes attr;
+    attr._x = 5; attr._y = 5; attr._z = 9;
+    attr._dx = 0.4; attr._dy = 0.4; attr._dz = 0.4;
+    const RealImage PSF(attr);
+
+    double dx, dy, dz;
+    slice.GetPixelSize(&dx, &dy, &dz);
+    double cx = 0.5 * (PSF.GetX() - 1), cy = 0.5 * (PSF.GetY() - 1), cz = 0.5 * (PSF.GetZ() - 1);
+    PSF.ImageToWorld(cx, cy, cz);
+
+    const SliceGeometry geometry(slice.Attributes(), transformation.GetMatrix(), volume.Attributes());
+    Array<double> offsets;
+    geometry.PSFOffsets(PSF, dx, dy, dz, offsets);
+
+    const int i = 17, j = 23;
+    double centre_x = i, centre_y = j, centre_z = 0;
+    geometry.Transform(centre_x, centre_y, centre_z);
+
+    double error = 0;
+    for (int ii = 0; ii < PSF.GetX(); ii++)
+        for (int jj = 0; jj < PSF.GetY(); jj++)
+            for (int kk = 0; kk < PSF.GetZ(); kk++) {
+                // PSF point centred over the slice voxel as computed by the coefficient kernels
+                double x = ii, y = jj, z = kk;
+                PSF.ImageToWorld(x, y, z);
+                x = (x - cx) / dx + i;
+                y = (y - cy) / dy + j;
+                z = (z - cz) / dz;
+                Reference(x, y, z);
+
+                const double *po = &offsets[3 * ((ii * PSF.GetY() + jj) * PSF.GetZ() + kk)];
+                error = max(error, max(fabs(centre_x + po[0] - x), max(fabs(centre_y + po[1] - y), fabs(centre_z + po[2] - z))));
+            }
+    BOOST_CHECK_MESSAGE(error < 1e-9, "PSF offsets differ from the reference by " << error << " voxels!");
+}
+
+BOOST_AUTO_TEST_CASE(Cache) {
+    SliceGeometryCache cache;
+    cache.Resize(2);
+    BOOST_CHECK_THROW(cache.Get(2, slice.Attributes(), transformation, volume.Attributes()), runtime_error);
+
+    double x = 3, y = 5, z = 0, rx = 3, ry = 5, rz = 0;
+    cache.Get(0, slice.Attributes(), transformation, volume.Attributes()).Transform(x, y, z);
+    Reference(rx, ry, rz);
+    BOOST_CHECK_SMALL(x - rx, 1e-9);
+
+    // A new transformation of the slice rebuilds its entry
+    const RigidTransformation previous = transformation;
+    transformation.PutTranslationX(transformation.GetTranslationX() + 2.5);
+    x = 3; y = 5; z = 0; rx = 3; ry = 5; rz = 0;
+    cache.Get(0, slice.Attributes(), transformation, volume.Attributes()).Transform(x, y, z);
+    Reference(rx, ry, rz);
+    BOOST_CHECK_SMALL(x - rx, 1e-9);
+    BOOST_CHECK_SMALL(y - ry, 1e-9);
+    BOOST_CHECK_SMALL(z - rz, 1e-9);
+    transformation = previous;
+}
+
+BOOST_AUTO_TEST_CASE(Throughput) {
+    // Micro-benchmark of the per-pixel mapping of a slice
+    const int repeats = 200;
+    const double pixels = double(repeats) * slice.GetX() * slice.GetY();
+    double checksum[2] = {};
+
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++)
+        for (int j = 0; j < slice.GetY(); j++)
+            for (int i = 0; i < slice.GetX(); i++) {
+                double x = i, y = j, z = 0;
+                Reference(x, y, z);
+                checksum[0] += x + y + z;
+            }
+    const double reference = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    SliceGeometryCache cache;
+    cache.Resize(1);
+    Array<double> x(slice.GetX()), y(slice.GetX()), z(slice.GetX());
+    for (int r = 0; r < repeats; r++) {
+        const SliceGeometry& geometry = cache.Get(0, slice.Attributes(), transformation, volume.Attributes());
+        for (int j = 0; j < slice.GetY(); j++) {
+            geometry.TransformRow(j, 0, slice.GetX(), x.data(), y.data(), z.data());
+            for (int i = 0; i < slice.GetX(); i++)
+                checksum[1] += x[i] + y[i] + z[i];
+        }
+    }
+    const double cached = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    BOOST_CHECK_CLOSE(checksum[0], checksum[1], 1e-6);
+    BOOST_TEST_MESSAGE("Slice pixel mapping: reference " << pixels / reference / 1e6 << " Mpx/s, cached geometry "
+        << pixels / cached / 1e6 << " Mpx/s (" << reference / cached << "x)");
+}
@@ -0,0 +1,154 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testStencilRegulariser
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/StencilRegulariser.h"
+
+// C++ Standard
+#include <cstring>
+#include <random>
+
+using namespace svrtk;
+
+const int directions[13][3] = {
+    { 1, 0, -1 },
+    { 0, 1, -1 },
+    { 1, 1, -1 },
+    { 1, -1, -1 },
+    { 1, 0, 0 },
+    { 0, 1, 0 },
+    { 1, 1, 0 },
+    { 1, -1, 0 },
+    { 1, 0, 1 },
+    { 0, 1, 1 },
+    { 1, 1, 1 },
+    { 1, -1, 1 },
+    { 0, 0, 1 }
+};
+
+RealImage volumes, mask, maskInternal;
+Array<double> factor(13);
+
+// Bitwise comparison of the voxel data
+static bool Identical(const RealImage& a, const RealImage& b) {
+    return a.NumberOfVoxels() == b.NumberOfVoxels()
+        && memcmp(a.Data(), b.Data(), sizeof(RealPixel) * a.NumberOfVoxels()) == 0;
+}
+
+// Run the given regulariser with a fixed number of threads
+template<typename Run>
+static RealImage RunWithThreads(int threads, Run run) {
+    const int defaultThreads = omp_get_max_threads();
+    omp_set_num_threads(threads);
+    RealImage result = run();
+    omp_set_num_threads(defaultThreads);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Initialise) {
+    ImageAttributes attr;
+    attr._x = 23; attr._y = 19; attr._z = 17; attr._t = 4;
+    volumes.Initialize(attr);
+
+    mt19937 generator(42);
+    uniform_real_distribution<double> intensity(0, 1000);
+    RealPixel *pv = volumes.Data();
+    for (int i = 0; i < volumes.NumberOfVoxels(); i++)
+        pv[i] = intensity(generator);
+
+    attr._t = 1;
+    mask.Initialize(attr);
+    maskInternal.Initialize(attr);
+    for (int z = 0; z < attr._z; z++)
+        for (int y = 0; y < attr._y; y++)
+            for (int x = 0; x < attr._x; x++) {
+                const double r2 = pow(x - 11, 2) + pow(y - 9, 2) + pow(z - 8, 2);
+                mask(x, y, z) = r2 < 64 ? 1 : 0;
+                maskInternal(x, y, z) = r2 < 36 ? 1 : 0;
+            }
+
+    for (int i = 0; i < 13; i++) {
+        factor[i] = 0;
+        for (int j = 0; j < 3; j++)
+            factor[i] += fabs(double(directions[i][j]));
+        factor[i] = 1 / factor[i];
+    }
+}
+
+BOOST_AUTO_TEST_CASE(AdaptiveRepeatable) {
+    const StencilRegulariser regulariser(volumes.Attributes(), directions);
+    auto run = [&] {
+        RealImage reconstructed = volumes;
+        regulariser.Adaptive(volumes, reconstructed, mask, factor, 150, 0.05);
+        return reconstructed;
+    };
+
+    const RealImage reference = RunWithThreads(1, run);
+    BOOST_CHECK_MESSAGE(!Identical(reference, volumes), "Adaptive regularisation didn't change the volumes!");
+    for (int threads : {1, 2, 3, omp_get_max_threads()})
+        for (int repeat = 0; repeat < 3; repeat++)
+            BOOST_CHECK_MESSAGE(Identical(RunWithThreads(threads, run), reference), "Adaptive regularisation differs with " << threads << " threads!");
+}
+
+BOOST_AUTO_TEST_CASE(AdaptivePerVolume) {
+    // Regularising all volumes at once is the same as regularising them one by one
+    const StencilRegulariser regulariser(volumes.Attributes(), directions);
+    RealImage all = volumes;
+    regulariser.Adaptive(volumes, all, mask, factor, 150, 0.05);
+
+    for (int t = 0; t < volumes.GetT(); t++) {
+        const RealImage original = volumes.GetRegion(0, 0, 0, t, volumes.GetX(), volumes.GetY(), volumes.GetZ(), t + 1);
+        RealImage single = original;
+        regulariser.Adaptive(original, single, mask, factor, 150, 0.05);
+        const RealImage expected = all.GetRegion(0, 0, 0, t, volumes.GetX(), volumes.GetY(), volumes.GetZ(), t + 1);
+        BOOST_CHECK_MESSAGE(Identical(single, expected), "Volume " << t << " differs from the joint regularisation!");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(LaplacianRepeatable) {
+    const StencilRegulariser regulariser(volumes.Attributes(), directions);
+    auto run = [&] {
+        RealImage laplacian, reconstructed = volumes;
+        regulariser.Laplacian(volumes, laplacian, mask, maskInternal, factor);
+        regulariser.LaplacianUpdate(laplacian, reconstructed, mask, maskInternal, factor, 0.05);
+        return reconstructed;
+    };
+
+    const RealImage reference = RunWithThreads(1, run);
+    for (int threads : {1, 2, 3, omp_get_max_threads()})
+        for (int repeat = 0; repeat < 3; repeat++)
+            BOOST_CHECK_MESSAGE(Identical(RunWithThreads(threads, run), reference), "Laplacian regularisation differs with " << threads << " threads!");
+}
+
+BOOST_AUTO_TEST_CASE(L22Repeatable) {
+    const StencilRegulariser regulariser(volumes.Attributes(), directions);
+    auto run = [&] {
+        RealImage reconstructed = volumes;
+        regulariser.L22(reconstructed, mask, factor, 0.05);
+        return reconstructed;
+    };
+
+    const RealImage reference = RunWithThreads(1, run);
+    for (int threads : {1, 2, 3, omp_get_max_threads()})
+        for (int repeat = 0; repeat < 3; repeat++)
+            BOOST_CHECK_MESSAGE(Identical(RunWithThreads(threads, run), reference), "L22 regularisation differs with " << threads << " threads!");
+}
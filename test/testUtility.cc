@@ -0,0 +1,90 @@
+/*
+ * SVRTK : SVR reconstruction based on MIRTK
+ *
+ * Copyright 2021- King's College London
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Boost
+#define BOOST_TEST_MODULE testUtility
+
+// SVRTK
+#include "TestCommon.h"
+#include "svrtk/Utility.h"
+
+// C++ Standard
+#include <random>
+
+using namespace svrtk;
+using namespace svrtk::Utility;
+
+RealImage stack;
+
+BOOST_AUTO_TEST_CASE(Initialise) {
+    ImageAttributes attr;
+    attr._x = 12; attr._y = 10; attr._z = 6; attr._t = 4;
+    attr._dx = 1.25; attr._dy = 1.25; attr._dz = 2.5; attr._dt = 0.04;
+    attr._xorigin = 3; attr._yorigin = -7; attr._zorigin = 11; attr._torigin = 0.3;
+    stack.Initialize(attr);
+
+    mt19937 generator(42);
+    uniform_real_distribution<RealPixel> intensity(0, 1000);
+    RealPixel *ps = stack.Data();
+    for (int n = 0; n < stack.NumberOfVoxels(); n++)
+        ps[n] = intensity(generator);
+}
+
+// A view must have the geometry and timing the baseline GetRegion + PutPixelSize copy had
+BOOST_AUTO_TEST_CASE(StackSliceViewAttributes) {
+    const double thickness = 3.5;
+    for (int k = 0; k < stack.GetT(); k++) {
+        for (int j = 0; j < stack.GetZ(); j++) {
+            RealImage slice = stack.GetRegion(0, 0, j, k, stack.GetX(), stack.GetY(), j + 1, k + 1);
+            slice.PutPixelSize(stack.GetXSize(), stack.GetYSize(), thickness, stack.GetTSize());
+
+            RealImage view;
+            StackSliceView(view, stack, j, k, thickness);
+
+            const ImageAttributes& a = view.Attributes();
+            const ImageAttributes& b = slice.Attributes();
+            BOOST_CHECK_EQUAL(a._x, b._x);
+            BOOST_CHECK_EQUAL(a._y, b._y);
+            BOOST_CHECK_EQUAL(a._z, 1);
+            BOOST_CHECK_EQUAL(a._t, 1);
+            BOOST_CHECK_CLOSE(a._dx, b._dx, 1e-9);
+            BOOST_CHECK_CLOSE(a._dy, b._dy, 1e-9);
+            BOOST_CHECK_CLOSE(a._dz, thickness, 1e-9);
+            BOOST_CHECK_CLOSE(a._dt, b._dt, 1e-9);
+            BOOST_CHECK_SMALL(a._xorigin - b._xorigin, 1e-9);
+            BOOST_CHECK_SMALL(a._yorigin - b._yorigin, 1e-9);
+            BOOST_CHECK_SMALL(a._zorigin - b._zorigin, 1e-9);
+            BOOST_CHECK_SMALL(a._torigin - b._torigin, 1e-9);
+            BOOST_CHECK_SMALL(a._torigin - (stack.GetTOrigin() + k * stack.GetTSize()), 1e-9);
+
+            // The view refers to the stack instead of copying it
+            BOOST_CHECK(view.Data() == stack.Data(0, 0, j, k));
+            BOOST_CHECK(memcmp(view.Data(), slice.Data(), sizeof(RealPixel) * slice.NumberOfVoxels()) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ImageViewAttributes) {
+    RealImage slice = stack.GetRegion(0, 0, 2, 1, stack.GetX(), stack.GetY(), 3, 2);
+    RealImage view;
+    ImageView(view, slice);
+    BOOST_CHECK(view.Attributes() == slice.Attributes());
+    BOOST_CHECK_CLOSE(view.GetTSize(), slice.GetTSize(), 1e-9);
+    BOOST_CHECK_SMALL(view.GetTOrigin() - slice.GetTOrigin(), 1e-9);
+    BOOST_CHECK(view.Data() == slice.Data());
+}
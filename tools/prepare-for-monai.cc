@@ -202,14 +202,18 @@ int main(int argc, char **argv)
     Array<string> stack_names;
     Array<Array<string>> mask_names;
     
+    // Decode all input files concurrently
+    Array<string> input_names;
+    for (int i=0; i<nStacks; i++)
+        input_names.push_back(argv[1+i]);
+    Array<RealImage> input_stacks;
+    ReadImages(input_names, input_stacks);
+    
     for (int i=0; i<nStacks; i++) {
         
-        RealImage stack;
+        RealImage& stack = input_stacks[i];
         
         tmp_fname = argv[1];
-        image_reader.reset(ImageReader::TryNew(tmp_fname));
-        
-        stack.Read(tmp_fname);
         
         
         for (int t=0; t<stack.GetT(); t++) {
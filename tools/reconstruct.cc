@@ -180,6 +180,37 @@ int main(int argc, char **argv) {
     bool with_background = false;
     
     bool multiple_channels_flag = false;
+
+    // Coarse-to-fine schedule: volume resolution and SR iterations for each outer iteration
+    vector<double> resolutionLevels;
+    vector<int> srIterationsLevels;
+
+    // Flag for keeping per-slice images in a contiguous slice store
+    bool sliceStoreFlag = false;
+    string sliceStoreFile;
+    int asyncOutputQueue = 0;
+    bool packSliceOutputs = false;
+
+    // Stages updating the volume by gathering through the transposed coefficients
+    vector<string> gatherStages;
+    double gatherMemory = 0;
+
+    // Vectorised trilinear coefficient kernel and its pruning threshold
+    bool trilinearSplat = false;
+    double coeffPrune = 0;
+
+    // Directory and size limit of the persistent coefficient cache
+    string coeffCacheDir;
+    double coeffCacheSize = 4096;
+
+    // Early stopping tolerances of the outer (TRE) and SR (volume change) iterations
+    double convergenceTRE = 0;
+    double convergenceMaxTRE = 0;
+    double convergenceVolume = 0;
+
+    // Adaptive SVR: TRE tolerance of stable slices and their revisit period
+    double svrSkipStable = 0;
+    int svrRevisit = 3;
     
     ConnectivityType connectivity = CONNECTIVITY_26;
 
@@ -227,6 +258,8 @@ int main(int argc, char **argv) {
         ("sr_iterations", value<int>(&srIterations), "Number of SR reconstruction iterations [Default: 7,...,7,7*3]")
         ("sigma", value<double>(&sigma), "Stdev for bias field [Default: 20mm]")
         ("resolution", value<double>(&resolution), "Isotropic resolution of the volume [Default: 0.75mm]")
+        ("resolution_levels", value<vector<double>>(&resolutionLevels)->multitoken(), "Coarse-to-fine schedule: isotropic resolution of the volume for each outer iteration, the last iteration always uses -resolution (e.g., 1.5 1.5 1) [Default: -resolution for all iterations]")
+        ("sr_iterations_levels", value<vector<int>>(&srIterationsLevels)->multitoken(), "Number of SR iterations for each level of the -resolution_levels schedule [Default: -sr_iterations]")
         ("multires", value<int>(&levels), "Multiresolution smoothing with given number of levels [Default: 3]")
         ("average", value<double>(&averageValue), "Average intensity value for stacks [Default: 700]")
         ("delta", value<double>(&delta), "Parameter to define what is an edge [Default: 150]")
@@ -245,6 +278,21 @@ int main(int argc, char **argv) {
 //        ("exact_thickness", bool_switch(&flagNoOverlapThickness), "Exact slice thickness without negative gap [Default: false]")
         ("ncc", bool_switch(&nccRegFlag), "Use global NCC similarity for SVR steps [Default: NMI]")
         ("save_slices", bool_switch(&saveSlicesFlag), "Save slices for future exclusion [Default: false]")
+        ("slice_store", bool_switch(&sliceStoreFlag), "Keep intermediate slice data in one contiguous block per field [Default: false]")
+        ("slice_store_file", value<string>(&sliceStoreFile), "Back the slice store by a memory-mapped scratch file at the given path (implies -slice_store)")
+        ("async_output", value<int>(&asyncOutputQueue)->implicit_value(64), "Write intermediate outputs in the background with a queue of the given size [Default: 64 if given]")
+        ("pack_slice_outputs", bool_switch(&packSliceOutputs), "Pack per-slice debug outputs into single multi-volume files [Default: false]")
+        ("gather", value<vector<string>>(&gatherStages)->multitoken(), "Stages updating the volume by per-voxel gathers through a transposed coefficient index instead of scattering: superresolution, bias, gaussian or all [Default: none]")
+        ("gather_memory", value<double>(&gatherMemory), "Memory budget of the transposed coefficient index in MB, all stages scatter above it [Default: unlimited]")
+        ("trilinear_splat", bool_switch(&trilinearSplat), "Generate coefficients with the vectorised trilinear kernel (rigid SVR only) [Default: false]")
+        ("coeff_cache", value<string>(&coeffCacheDir), "Load the slice coefficients from this directory when an earlier run had identical slices, transformations, PSF and volume grid, and save them there otherwise [Default: none]")
+        ("coeff_cache_size", value<double>(&coeffCacheSize), "Size limit of the coefficient cache directory in MB, least recently used files are removed beyond it (0 - unlimited) [Default: 4096]")
+        ("coeff_prune", value<double>(&coeffPrune), "Prune coefficients below this fraction of the largest one of each slice voxel and renormalise, reporting the pruned count and NRMSE in the log (implies -trilinear_splat) [Default: 0]")
+        ("convergence_tre", value<double>(&convergenceTRE), "Make the current iteration the last one once the mean TRE of the slice transformations between registrations is below this value in mm [Default: 0 - disabled]")
+        ("convergence_max_tre", value<double>(&convergenceMaxTRE), "Also require the max TRE of the slice transformations to be below this value in mm [Default: 0 - not checked]")
+        ("convergence_volume", value<double>(&convergenceVolume), "End the SR iterations once the relative RMS change of the volume within the mask is below this value [Default: 0 - disabled]")
+        ("svr_skip_stable", value<double>(&svrSkipStable), "Skip the registration of stable slices whose transformation changed by less than this TRE in mm, with high slice weight and residual, registering unstable and outlier slices first [Default: 0 - disabled]")
+        ("svr_revisit", value<int>(&svrRevisit), "Register skipped stable slices again after this number of iterations [Default: 3]")
         ("structural", bool_switch(&structural), "Use structural exclusion of slices at the last iteration")
         ("exclude_slices_only", bool_switch(&robustSlicesOnly), "Robust statistics for exclusion of slices only")
         ("remove_black_background", bool_switch(&removeBlackBackground), "Create mask from black background")
@@ -278,6 +326,19 @@ int main(int argc, char **argv) {
             throw error("Count of thickness values should equal to stack count!");
         if (!packages.empty() && packages.size() != nStacks)
             throw error("Count of package values should equal to stack count!");
+        if (!srIterationsLevels.empty() && srIterationsLevels.size() != resolutionLevels.size())
+            throw error("Count of SR iterations per level should equal to count of resolution levels!");
+        for (const auto& stage : gatherStages)
+            if (stage != "superresolution" && stage != "bias" && stage != "gaussian" && stage != "all")
+                throw error("Unknown gather stage '" + stage + "'!");
+        if (coeffCacheSize < 0)
+            throw error("Coefficient cache size should not be negative!");
+        if (coeffPrune < 0 || coeffPrune >= 1)
+            throw error("Coefficient pruning threshold should be in [0, 1)!");
+        if (convergenceTRE < 0 || convergenceMaxTRE < 0 || convergenceVolume < 0)
+            throw error("Convergence tolerances should not be negative!");
+        if (svrSkipStable < 0 || svrRevisit < 1)
+            throw error("Adaptive SVR tolerance should not be negative and the revisit period should be positive!");
     } catch (error& e) {
         // Delete -- from the argument name in the error message
         string err = e.what();
@@ -294,23 +355,24 @@ int main(int argc, char **argv) {
 
     UniquePtr<BaseImage> tmp_image;
     
-    // Read input stacks
+    // Read input stacks (decoded concurrently, negative values are removed as soon as a stack is ready)
+    Array<double> stackMin(nStacks), stackMax(nStacks);
+    Array<RealImage> inputStacks;
+    ReadImages(stackFiles, inputStacks, [&](size_t i, RealImage& stack) {
+        stack.GetMinMax(&stackMin[i], &stackMax[i]);
+        if (stackMin[i] < 0 || stackMax[i] < 0)
+            RemoveNanNegative(stack);
+    });
+
     for (int i = 0; i < nStacks; i++) {
         cout << "Stack " << i << " : " << stackFiles[i];
-        
-        RealImage stack;
-        image_reader.reset(ImageReader::TryNew(stackFiles[i].c_str()));
-        tmp_image.reset(image_reader->Run());
-        stack = *tmp_image;
-        
+
+        RealImage& stack = inputStacks[i];
+
         // Check if the intensity is not negative and correct if so
-        double smin, smax;
-        stack.GetMinMax(&smin, &smax);
-        if (smin < 0 || smax < 0) {
+        const double smin = stackMin[i], smax = stackMax[i];
+        if (smin < 0 || smax < 0)
             cout << "Warning: stack " << i << " has negative values and they were removed!" << endl;
-            RemoveNanNegative(stack);
-//            stack.PutMinMaxAsDouble(0, 1000);
-        }
 
         // Print stack info
         double dx = stack.GetXSize(); double dy = stack.GetYSize();
@@ -341,20 +403,20 @@ int main(int argc, char **argv) {
         
         cout << "Number of channels : " << number_of_channels << endl;
 
+        Array<RealImage> mc_input_stacks;
+        ReadImages(mcStackPaths, mc_input_stacks);
+
         int j=0;
         for (int n=0; n<number_of_channels; n++) {
             Array<RealImage> tmp_mc_array;
             for (int i = 0; i < stacks.size(); i++) {
                 cout << "MC stack " << i << " (" << n  << ") : " << mcStackPaths[j] << endl;
-                RealImage tmp_mc_stack;
-                image_reader.reset(ImageReader::TryNew(mcStackPaths[j].c_str()));
-                tmp_image.reset(image_reader->Run());
-                tmp_mc_stack = *tmp_image;
+                RealImage& tmp_mc_stack = mc_input_stacks[j];
                 if (tmp_mc_stack.GetX() != stacks[i].GetX() || tmp_mc_stack.GetY() != stacks[i].GetY() || tmp_mc_stack.GetZ() != stacks[i].GetZ() || tmp_mc_stack.GetT() != stacks[i].GetT()) {
                     cout << "Dimensions of MC stacks should the same as the main channel." << endl;
                     exit(1);
                 }
-                tmp_mc_array.push_back(tmp_mc_stack);
+                tmp_mc_array.push_back(move(tmp_mc_stack));
                 j=j+1;
             }
             multi_channel_stacks.push_back(tmp_mc_array);
@@ -810,6 +872,14 @@ int main(int argc, char **argv) {
     // If resolution==0 it will be determined from in-plane resolution of the image
     resolution = reconstruction.CreateTemplate(maskedTemplate, resolution);
 
+    // Print coarse-to-fine schedule
+    if (!resolutionLevels.empty()) {
+        cout << "Resolution levels : ";
+        for (int iter = 0; iter < iterations; iter++)
+            cout << (iter < (int)resolutionLevels.size() && iter < iterations - 1 ? resolutionLevels[iter] : resolution) << " ";
+        cout << endl;
+    }
+
     // Set mask to reconstruction object
     reconstruction.SetMask(mask.get(), smoothMask);
 
@@ -986,6 +1056,44 @@ int main(int argc, char **argv) {
     if (!folder.empty())
         reconstruction.ReadTransformations((char*)folder.c_str());
 
+    // Keep intermediate slice data in the contiguous slice store
+    if (sliceStoreFlag || !sliceStoreFile.empty())
+        reconstruction.UseSliceStore(sliceStoreFile);
+
+    // Write intermediate outputs off the compute threads
+    if (asyncOutputQueue > 0)
+        reconstruction.UseAsyncOutput(asyncOutputQueue);
+    reconstruction.PackSliceOutputs(packSliceOutputs);
+
+    // Update the volume by gathering in the selected stages
+    if (!gatherStages.empty()) {
+        int stages = 0;
+        for (const auto& stage : gatherStages) {
+            if (stage == "superresolution")
+                stages |= Reconstruction::StageSuperresolution;
+            else if (stage == "bias")
+                stages |= Reconstruction::StageNormaliseBias;
+            else if (stage == "gaussian")
+                stages |= Reconstruction::StageGaussianReconstruction;
+            else
+                stages |= Reconstruction::StageAll;
+        }
+        reconstruction.SetGatherStages(stages, gatherMemory);
+    }
+
+    // Generate coefficients with the vectorised trilinear kernel
+    if (trilinearSplat || coeffPrune > 0)
+        reconstruction.UseTrilinearSplat(coeffPrune);
+
+    // Persistent coefficient cache
+    if (!coeffCacheDir.empty()) {
+        boost::filesystem::create_directories(coeffCacheDir);
+        reconstruction.SetCoefficientCache(coeffCacheDir, coeffCacheSize);
+    }
+
+    reconstruction.SetConvergenceTolerances(convergenceTRE, convergenceMaxTRE, convergenceVolume);
+    reconstruction.SetAdaptiveSVR(svrSkipStable, svrRevisit);
+
     // Initialise data structures for EM
     reconstruction.InitializeEM();
 
@@ -999,6 +1107,10 @@ int main(int argc, char **argv) {
 
     int currentIteration = 0;
 
+    // Iterations saved by early stopping
+    const int scheduledIterations = iterations;
+    int savedSRIterations = 0;
+
     {
         // Interleaved registration-reconstruction iterations
         for (int iter = 0; iter < iterations; iter++) {
@@ -1007,6 +1119,11 @@ int main(int argc, char **argv) {
             
             reconstruction.SetCurrentIteration(iter);
 
+            // Move to the next level of the coarse-to-fine schedule (the last iteration is at full resolution)
+            const bool levelScheduled = iter < (int)resolutionLevels.size() && iter < iterations - 1;
+            if (!resolutionLevels.empty())
+                reconstruction.SetResolutionLevel(levelScheduled ? resolutionLevels[iter] : resolution);
+
             reconstruction.MaskVolume();
 
             // If only SVR option is used - skip 1st SR only averaging
@@ -1015,6 +1132,13 @@ int main(int argc, char **argv) {
                     reconstruction.RemoteSliceToVolumeRegistration(iter, strMirtkPath, strCurrentExchangeFilePath);
                 else
                     reconstruction.SliceToVolumeRegistration();
+
+                // Converged slice transformations - the current iteration becomes the last one
+                // (coarse levels of the schedule are always completed)
+                if (convergenceTRE > 0 && !levelScheduled && iter < iterations - 1 && reconstruction.RegistrationConverged()) {
+                    cout << " - slice transformations converged: skipping " << iterations - 1 - iter << " registration-reconstruction iterations" << endl;
+                    iterations = iter + 1;
+                }
             }
 
             // Run global NNC structure-based outlier rejection of slices
@@ -1072,11 +1196,13 @@ int main(int argc, char **argv) {
             }
 
             // Set number of reconstruction iterations
-            const int recIterations = iter == iterations - 1 ? srIterations * 3 : srIterations;
+            const int levelSRIterations = levelScheduled && !srIterationsLevels.empty() ? srIterationsLevels[iter] : srIterations;
+            const int recIterations = iter == iterations - 1 ? srIterations * 3 : levelSRIterations;
             cout<<'parameter sr_iterations: '<<srIterations;
             cout<<'recIterations: '<<recIterations;
 
             // SR reconstruction loop
+            reconstruction.ResetReconstructionConvergence();
             for (int i = 0; i < recIterations; i++) {
                 if (debug) {
                     cout << "------------------------------------------------------" << endl;
@@ -1115,13 +1241,20 @@ int main(int argc, char **argv) {
                 
                 if (debug) {
                     // Save intermediate reconstructed image
-                    reconstruction.GetReconstructed().Write((boost::format("super%1%.nii.gz") % i).str().c_str());
+                    reconstruction.SaveImage(reconstruction.GetReconstructed(), (boost::format("super%1%.nii.gz") % i).str());
 
                     // Evaluate reconstruction quality
                     double error = reconstruction.EvaluateReconQuality(1);
                     cout << "Total reconstruction error : " << error << endl;
                 }
 
+                // Converged volume - skip the remaining SR iterations
+                if (convergenceVolume > 0 && reconstruction.ReconstructionConverged() && i < recIterations - 1) {
+                    cout << " - reconstruction converged: skipping " << recIterations - 1 - i << " SR iterations" << endl;
+                    savedSRIterations += recIterations - 1 - i;
+                    break;
+                }
+
             } // End of SR reconstruction iterations
 
             // Mask reconstructed image to ROI given by the mask
@@ -1130,7 +1263,7 @@ int main(int argc, char **argv) {
                 reconstruction.MaskVolume();
 
             // Save reconstructed image
-            reconstruction.GetReconstructed().Write((boost::format("image%1%.nii.gz") % iter).str().c_str());
+            reconstruction.SaveImage(reconstruction.GetReconstructed(), (boost::format("image%1%.nii.gz") % iter).str());
 
             // Compute and save quality metrics
             double outNcc = 0;
@@ -1141,6 +1274,12 @@ int main(int argc, char **argv) {
             cout << endl; 
             cout << " - global metrics: ncc = " << outNcc << " ; nrmse = " << outNrmse << " ; average weight = " << averageVolumeWeight << " ; excluded slices = " << ratioExcluded << endl;
 
+            // Per-level quality to compare the coarse-to-fine schedule against the single-resolution run
+            if (!resolutionLevels.empty()) {
+                ofstream ofsLevels("output-metric-levels.txt", iter == 0 ? ofstream::trunc : ofstream::app);
+                ofsLevels << iter << " " << reconstruction.GetLevelResolution() << " " << outNcc << " " << outNrmse << " " << averageVolumeWeight << " " << ratioExcluded << endl;
+            }
+
             ofstream ofsNcc("output-metric-ncc.txt");
             ofstream ofsNrmse("output-metric-nrmse.txt");
             ofstream ofsWeight("output-metric-average-weight.txt");
@@ -1153,6 +1292,15 @@ int main(int argc, char **argv) {
 
         } // End of interleaved registration-reconstruction iterations
 
+        if (convergenceTRE > 0 || convergenceVolume > 0)
+            cout << "Early stopping saved " << scheduledIterations - iterations << " registration-reconstruction and " << savedSRIterations << " SR iterations" << endl;
+
+        if (svrSkipStable > 0) {
+            const SVRScheduler& scheduler = reconstruction.GetSVRScheduler();
+            cout << "Adaptive SVR skipped " << scheduler.TotalSkipped() << " of " << scheduler.TotalRegistrations()
+                << " slice registrations, " << scheduler.TotalReduced() << " registered at the finest level only" << endl;
+        }
+
 
         // -----------------------------------------------------------------------------
         // SAVE RESULTS
@@ -1168,9 +1316,11 @@ int main(int argc, char **argv) {
             reconstruction.SaveSlices();
             reconstruction.SaveWeights();
             reconstruction.SaveBiasFields();
-            reconstruction.SimulateStacks(stacks);
-            for (size_t i = 0; i < stacks.size(); i++)
-                stacks[i].Write((boost::format("simulated%1%.nii.gz") % i).str().c_str());
+            // Simulated into copies, the slices still refer to the stacks
+            Array<RealImage> simulated_stacks(stacks);
+            reconstruction.SimulateStacks(simulated_stacks);
+            for (size_t i = 0; i < simulated_stacks.size(); i++)
+                reconstruction.SaveImage(simulated_stacks[i], (boost::format("simulated%1%.nii.gz") % i).str());
         }
 
         if (intensityMatching)
@@ -1192,6 +1342,14 @@ int main(int argc, char **argv) {
         cout << "------------------------------------------------------" << endl;
     }
 
+    // Wait for the queued outputs
+    try {
+        reconstruction.FlushOutput();
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
     SVRTK_END_TIMING("all");
         
     return 0;
@@ -259,19 +259,10 @@ int main(int argc, char **argv) {
     cout << "Reconstructed volume name : " << outputName << endl;
     cout << "Number of stacks : " << nStacks << endl;
 
-    UniquePtr<BaseImage> tmp_image;
-    
-    // Read stacks
-    for (int i = 0; i < nStacks; i++) {
+    // Read stacks (decoded concurrently)
+    for (int i = 0; i < nStacks; i++)
         cout << "Reading stack " << stackFiles[i] << endl;
-        RealImage stack;
-        
-        image_reader.reset(ImageReader::TryNew(stackFiles[i].c_str()));
-        tmp_image.reset(image_reader->Run());
-        stack = *tmp_image;
-        
-        stacks.push_back(move(stack));
-    }
+    ReadImages(stackFiles, stacks);
 
     // Target stack
     if (vm.count("target_stack"))
@@ -332,10 +323,7 @@ int main(int argc, char **argv) {
     // Binary masks for all stacks
     if (!maskFiles.empty()) {
         cout << "Reading stack masks ... ";
-        for (size_t i = 0; i < stacks.size(); i++) {
-            unique_ptr<RealImage> binaryMask(new RealImage(maskFiles[i].c_str()));
-            masks.push_back(move(*binaryMask));
-        }
+        ReadImages(Array<string>(maskFiles.begin(), maskFiles.begin() + stacks.size()), masks);
         reconstruction.SetMaskedStacks();
         cout << "done." << endl;
     }
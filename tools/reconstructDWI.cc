@@ -79,6 +79,9 @@ void usage()
     cerr << "\t                        one stack. The first stack with \'id\' transformation" << endl;
     cerr << "\t                        will be resampled as template." << endl;
     cerr << "\t-order [order]          SH order for reconstruction. [Default: 4]"<<endl;
+    cerr << "\t-memory_cap [MB]         Out-of-core SH reconstruction: regenerate slice coefficients in batches"<<endl;
+    cerr << "\t                        and update SH coefficients in blocks within the memory cap. [Default: 0 / off]"<<endl;
+    cerr << "\t-scratch_file [file]     Page the slices of the out-of-core mode to a memory-mapped scratch file."<<endl;
     cerr << "\t-motion_model_hs        Option for procesing motion parameters. [Default: false]"<<endl;
     cerr << "\t-intensity_exclusion [low_slice_intensity] Set lowest intensity threshold for exclusion of dark slices. [Default: no intensity-based slice exclusion.]"<<endl;
     cerr << "\t-thickness [th]           Slice thickness for all stacks.[Default: voxel size in z direction]"<<endl;
@@ -206,6 +209,10 @@ int main(int argc, char **argv)
     int order = 4;
     double lambdaLB = 0;//0.05;
 
+    //out-of-core SH reconstruction
+    double memory_cap = 0;
+    string scratch_file;
+
     RealImage average;
 
     string info_filename = "slice_info.tsv";
@@ -247,20 +254,19 @@ int main(int argc, char **argv)
 
     Array<int> nStackDynamics;
     
-    UniquePtr<BaseImage> tmp_image;
+    // Read all 4D stacks concurrently
+    Array<string> stackFiles;
+    for (int j=0; j<global_nStacks; j++)
+        stackFiles.push_back(argv[1+j]);
+    Array<RealImage> images4D;
+    ReadImages(stackFiles, images4D);
 
     // Read stacks
     for (int j=0; j<global_nStacks; j++)
     {
         //read 4D image
-        RealImage image4D;
+        RealImage image4D = move(images4D[j]);
         cout<<"Reading stack " << j <<  " ... "<<argv[1]<<endl;
-        
-        image_reader.reset(ImageReader::TryNew(argv[1]));
-        tmp_image.reset(image_reader->Run());
-        image4D = *tmp_image;
-
-//        image4D.Read(argv[1]);
 
         ImageAttributes attr = image4D.Attributes();
         int local_nStacks = attr._t;
@@ -898,6 +904,26 @@ int main(int argc, char **argv)
             ok = true;
         }
 
+        //Memory cap of the out-of-core SH reconstruction
+        if ((ok == false) && (strcmp(argv[1], "-memory_cap") == 0)){
+            argc--;
+            argv++;
+            memory_cap = atof(argv[1]);
+            argc--;
+            argv++;
+            ok = true;
+        }
+
+        //Scratch file of the out-of-core SH reconstruction
+        if ((ok == false) && (strcmp(argv[1], "-scratch_file") == 0)){
+            argc--;
+            argv++;
+            scratch_file = argv[1];
+            argc--;
+            argv++;
+            ok = true;
+        }
+
 
 
 
@@ -1439,6 +1465,10 @@ int main(int argc, char **argv)
     reconstruction.InitializeRobustStatistics();
     /////////////TESTING this
 
+    //Out-of-core SH reconstruction: release slice coefficients and page slices to the scratch file
+    if (memory_cap > 0)
+        reconstruction.SetOutOfCore(memory_cap, scratch_file);
+
     reconstruction.Init4D(nStacks);
     //directions
     int nDir = nStacks;
@@ -1584,20 +1614,22 @@ int main(int argc, char **argv)
         corrected_stacks.push_back(stacks[i]);
     }
 
-    reconstruction.SimulateStacksDTI(stacks,false);
-    //  reconstruction.SimulateStacksDTIIntensityMatching(stacks,true);
-    for (unsigned int i=0;i<stacks.size();i++)
+    // simulated into copies, the original slices still refer to the stacks
+    Array<RealImage> simulated_stacks(stacks);
+    reconstruction.SimulateStacksDTI(simulated_stacks,false);
+    //  reconstruction.SimulateStacksDTIIntensityMatching(simulated_stacks,true);
+    for (unsigned int i=0;i<simulated_stacks.size();i++)
     {
         sprintf(buffer,"simulated-exc%i.nii.gz",i);
-        stacks[i].Write(buffer);
+        simulated_stacks[i].Write(buffer);
     }
 
     //reconstruction.AddBiasAndScale(old_bias, old_scale);
-    reconstruction.SimulateStacksDTIIntensityMatching(stacks,true);
-    for (unsigned int i=0;i<stacks.size();i++)
+    reconstruction.SimulateStacksDTIIntensityMatching(simulated_stacks,true);
+    for (unsigned int i=0;i<simulated_stacks.size();i++)
     {
         sprintf(buffer,"simulated%i.nii.gz",i);
-        stacks[i].Write(buffer);
+        simulated_stacks[i].Write(buffer);
     }
 
 
@@ -136,6 +136,7 @@ int main(int argc, char **argv) {
     int globalCPSpacing = 15;
     double jacThreshold = 30;
     double localSSIMThreshold = 0.3;
+    double ffdFieldTolerance = 0;
 
 
     // Flags for reconstruction options:
@@ -258,6 +259,7 @@ int main(int argc, char **argv) {
         ("rescale_stacks", bool_switch(&rescaleStacks), "Rescale stacks to avoid nan pixel errors [Default: false]")
         ("no_global_rigid", bool_switch(&noGlobalFlag), "No global rigid stack registration")
         ("global_ffd_only", bool_switch(&ffdGlobalOnly), "No FFD SVR - only global FFD betweens stacks")
+        ("ffd_field_tolerance", value<double>(&ffdFieldTolerance), "Map the PSF samples of the coefficients through cached FFD slice maps. Slices whose largest error at the map cell centres exceeds this tolerance (in voxels, e.g. 0.01) are evaluated exactly [Default: 0 - FFD evaluated exactly for every sample]")
         ("compensate", bool_switch(&compensateFlag), "Compensate for undersampling")
 //        ("exact_thickness", bool_switch(&flagNoOverlapThickness), "Exact slice thickness without negative gap [Default: false]")
         ("ncc", bool_switch(&nccRegFlag), "Use global NCC similarity for SVR steps [Default: NMI]")
@@ -299,6 +301,8 @@ int main(int argc, char **argv) {
             throw error("Count of thickness values should equal to stack count!");
         if (!packages.empty() && packages.size() < nStacks)
             throw error("Count of package values should equal to stack count!");
+        if (ffdFieldTolerance < 0)
+            throw error("FFD field tolerance should not be negative!");
     } catch (error& e) {
         // Delete -- from the argument name in the error message
         string err = e.what();
@@ -313,27 +317,25 @@ int main(int argc, char **argv) {
 
     cout << "Reconstructed volume name : " << outputName << endl;
     cout << "Number of stacks : " << nStacks << endl;
-    
-    UniquePtr<BaseImage> tmp_image;
 
-    // Read input stacks
+    // Read input stacks (decoded concurrently, negative values are removed as soon as a stack is ready)
+    Array<double> stackMin(nStacks), stackMax(nStacks);
+    Array<RealImage> inputStacks;
+    ReadImages(stackFiles, inputStacks, [&](size_t i, RealImage& stack) {
+        stack.GetMinMax(&stackMin[i], &stackMax[i]);
+        if (stackMin[i] < 0 || stackMax[i] < 0)
+            RemoveNanNegative(stack);
+    });
+
     for (int i = 0; i < nStacks; i++) {
         cout << "Stack " << i << " : " << stackFiles[i];
-        
-        RealImage stack;
-        
-        image_reader.reset(ImageReader::TryNew(stackFiles[i].c_str()));
-        tmp_image.reset(image_reader->Run());
-        stack = *tmp_image;
-        
+
+        RealImage& stack = inputStacks[i];
+
         // Check if the intensity is not negative and correct if so
-        double smin, smax;
-        stack.GetMinMax(&smin, &smax);
-        if (smin < 0 || smax < 0) {
-//            stack.PutMinMaxAsDouble(0, 1000);
+        const double smin = stackMin[i], smax = stackMax[i];
+        if (smin < 0 || smax < 0)
             cout << "Warning: stack " << i << " has negative values and they were removed!" << endl;
-            RemoveNanNegative(stack);
-        }
 
         // Print stack info
         double dx = stack.GetXSize(); double dy = stack.GetYSize();
@@ -364,20 +366,20 @@ int main(int argc, char **argv) {
         
         cout << "Number of channels : " << number_of_channels << endl;
 
+        Array<RealImage> mc_input_stacks;
+        ReadImages(mcStackPaths, mc_input_stacks);
+
         int j=0;
         for (int n=0; n<number_of_channels; n++) {
             Array<RealImage> tmp_mc_array;
             for (int i = 0; i < stacks.size(); i++) {
                 cout << "MC stack " << i << " (" << n  << ") : " << mcStackPaths[j] << endl;
-                RealImage tmp_mc_stack;
-                image_reader.reset(ImageReader::TryNew(mcStackPaths[j].c_str()));
-                tmp_image.reset(image_reader->Run());
-                tmp_mc_stack = *tmp_image;
+                RealImage& tmp_mc_stack = mc_input_stacks[j];
                 if (tmp_mc_stack.GetX() != stacks[i].GetX() || tmp_mc_stack.GetY() != stacks[i].GetY() || tmp_mc_stack.GetZ() != stacks[i].GetZ() || tmp_mc_stack.GetT() != stacks[i].GetT()) {
                     cout << "Dimensions of MC stacks should the same as the main channel." << endl;
                     exit(1);
                 }
-                tmp_mc_array.push_back(tmp_mc_stack);
+                tmp_mc_array.push_back(move(tmp_mc_stack));
                 j=j+1;
             }
             multi_channel_stacks.push_back(tmp_mc_array);
@@ -571,6 +573,8 @@ int main(int argc, char **argv) {
         cout << "Running only global FFD and 1 interation" << endl;
     }
 
+    reconstruction.SetFFDFieldTolerance(ffdFieldTolerance);
+
 
 
     // -----------------------------------------------------------------------------
@@ -1127,9 +1131,11 @@ int main(int argc, char **argv) {
 //            reconstruction.SaveSlices();
 //            reconstruction.SaveWeights();
 //            reconstruction.SaveBiasFields();
-            reconstruction.SimulateStacks(stacks);
-            for (size_t i = 0; i < stacks.size(); i++)
-                stacks[i].Write((boost::format("simulated%1%.nii.gz") % i).str().c_str());
+            // Simulated into copies, the slices still refer to the stacks
+            Array<RealImage> simulated_stacks(stacks);
+            reconstruction.SimulateStacks(simulated_stacks);
+            for (size_t i = 0; i < simulated_stacks.size(); i++)
+                simulated_stacks[i].Write((boost::format("simulated%1%.nii.gz") % i).str().c_str());
         }
         if (intensityMatching)
             reconstruction.ScaleVolume();
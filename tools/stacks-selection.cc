@@ -152,61 +152,47 @@ int main(int argc, char **argv)
     cout<<"Number of stacks : "<<nStacks<<endl;
     cout << endl;
 
-    // Read stacks
+    // Read stacks and masks (decoded concurrently)
 
-    const char *tmp_fname;
-    UniquePtr<BaseImage> tmp_image;
+    Array<string> stack_files, mask_files;
+    for (i=0;i<nStacks;i++)
+        stack_files.push_back(argv[1+i]);
+    for (i=0;i<nStacks;i++)
+        mask_files.push_back(argv[1+nStacks+i]);
 
+    template_name = stack_files[0];
 
+    // the callbacks run concurrently, so they only record the ranges and the template is rescaled serially
+    Array<double> stack_min(nStacks), stack_max(nStacks);
+    ReadImages(stack_files, stacks, [&](size_t n, RealImage& stack) {
+        stack.GetMinMax(&stack_min[n], &stack_max[n]);
+    });
 
     for (i=0;i<nStacks;i++) {
-
-
-        if (i == 0) {
-            string tmp_str_name(argv[1]);
-            template_name = tmp_str_name;
-        }
-
-
-        cout<<"Stack " << i << " : "<<argv[1]<<endl;
-
-        tmp_fname = argv[1];
-        image_reader.reset(ImageReader::TryNew(tmp_fname));
-        tmp_image.reset(image_reader->Run());
-
-        stack = *tmp_image;
-
-        double smin, smax;
-        stack.GetMinMax(&smin, &smax);
-
-        if (smin < 0 || smax < 0) {
+        if (stack_min[i] < 0 || stack_max[i] < 0) {
             template_stack.PutMinMaxAsDouble(0, 1000);
         }
+    }
 
+    ReadImages(mask_files, masks, [](size_t, RealImage& mask) {
+        mask = CreateMask(mask);
+    });
 
+    for (i=0;i<nStacks;i++) {
+        cout<<"Stack " << i << " : "<<argv[1]<<endl;
         argc--;
         argv++;
-        stacks.push_back(stack);
     }
 
-
-
     cout << endl;
     cout << "Masks : " << endl;
     for (i=0;i<nStacks;i++) {
 
-        RealImage tmp_mask;
-        tmp_mask.Read(argv[1]);
-
-        tmp_mask = CreateMask(tmp_mask);
-
-        if (tmp_mask.GetX() != stacks[i].GetX() || tmp_mask.GetY() != stacks[i].GetY() || tmp_mask.GetZ() != stacks[i].GetZ() || tmp_mask.GetT() != stacks[i].GetT()) {
+        if (masks[i].GetX() != stacks[i].GetX() || masks[i].GetY() != stacks[i].GetY() || masks[i].GetZ() != stacks[i].GetZ() || masks[i].GetT() != stacks[i].GetT()) {
             cout << "Error: the mask (" << argv[1] << ") dimensions are different from the corresponding stack (" << i << ") !" << endl;
             exit(1);
         }
 
-        masks.push_back(tmp_mask);
-
         cout<< "Mask " << i << " : "<< argv[1] <<endl;
 
         argc--;